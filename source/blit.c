@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __3DS__
+#include <3ds.h>
+#include <citro3d.h>
+#endif
+
+#include "blit.h"
+
+/**
+ * SCREEN COPIES
+ * 
+ * The composite and eye buffers live in linear memory so the GX engine
+ * can DMA them into the framebuffers instead of the CPU copying them.
+ * Each copy rides on its own citro3d frame: the frame's queue starts the
+ * transfer, and the next frame begins only once it has landed.
+ * Elsewhere the same interface copies with memcpy.
+ */
+void* allocScreenBuffer(size_t size) {
+#ifdef __3DS__
+    return linearAlloc(size);
+#else
+    return malloc(size);
+#endif
+}
+
+void freeScreenBuffer(void* buffer) {
+#ifdef __3DS__
+    linearFree(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+void blitToFramebuffer(u8* framebuffer, const void* src, u32 size) {
+#ifdef __3DS__
+    GSPGPU_FlushDataCache(src, size);
+    C3D_FrameBegin(0);  // Waits for the previous copy
+    GX_TextureCopy((u32*)src, 0, (u32*)framebuffer, 0, size, GX_TRANSFER_RAW_COPY(1));
+    C3D_FrameEnd(GX_CMDLIST_FLUSH);  // Sources are flushed above, skip the heap-wide flush
+#else
+    memcpy(framebuffer, src, size);
+#endif
+}
+
+void waitForBlits(void) {
+#ifdef __3DS__
+    C3D_FrameBegin(0);
+    C3D_FrameEnd(GX_CMDLIST_FLUSH);
+#endif
+}
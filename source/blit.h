@@ -0,0 +1,22 @@
+/**
+ * Copies of finished screen buffers into the framebuffers (see blit.c).
+ * Host builds fall back to memcpy, which is built and tested there.
+ */
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <stddef.h>
+
+#include "canvas.h"
+
+// Buffers the copies read from (linear memory on the 3DS)
+void* allocScreenBuffer(size_t size);
+void freeScreenBuffer(void* buffer);
+
+// Start copying size bytes of a finished buffer into a framebuffer
+void blitToFramebuffer(u8* framebuffer, const void* src, u32 size);
+
+// Wait until every started copy has landed (before swapping or reusing a source)
+void waitForBlits(void);
+
+#endif
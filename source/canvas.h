@@ -0,0 +1,92 @@
+/**
+ * Screen and canvas geometry, shared by main.c and the modules that also
+ * build on a desktop without libctru (see tests/Makefile).
+ */
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <string.h>
+
+#ifdef __3DS__
+#include <3ds/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+#endif
+
+// Screen dimensions - 3DS has 320x240 bottom screen, 400x240 top screen
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define FB_WIDTH 240      // Framebuffer width (rotated 90°)
+#define FB_HEIGHT 320     // Framebuffer height (rotated 90°)
+
+// Virtual canvas configuration
+// The drawing surface is much larger than the screen and is stored as sparse
+// square tiles that are only allocated once something is drawn on them.
+#define CANVAS_WIDTH 2048
+#define CANVAS_HEIGHT 2048
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)                 // 64x64 pixels per tile
+#define TILE_MASK (TILE_SIZE - 1)
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+#define CANVAS_TILES_X (CANVAS_WIDTH / TILE_SIZE)
+#define CANVAS_TILES_Y (CANVAS_HEIGHT / TILE_SIZE)
+#define CANVAS_TILE_COUNT (CANVAS_TILES_X * CANVAS_TILES_Y)
+#define SUBPIXEL_SHIFT 4                            // Fractional bits of stroke coordinates
+
+/**
+ * Mask tile layout. Pixel (x, y) of a tile is tile[TILE_COLUMN(x) + TILE_ROW(y)].
+ * By default a tile is TILE_SIZE columns of TILE_SIZE bytes (column-major,
+ * like the framebuffer), so brush spans down a column are contiguous.
+ * Built with MASK_TILE_MORTON it is stored the way the PICA200 stores
+ * textures instead: 8x8 blocks row by row, the bytes of a block in Morton
+ * order (bits x0 y0 x1 y1 x2 y2), so the GPU atlas upload is a plain copy.
+ * From an even (x, y), TILE_NEXT_X and TILE_NEXT_Y step to the pixel to
+ * the right and the one below.
+ */
+#ifdef MASK_TILE_MORTON
+#define TILE_COLUMN(x) ((((x) >> 3) << 6) | ((x) & 1) | (((x) & 2) << 1) | (((x) & 4) << 2))
+#define TILE_ROW(y) ((((y) >> 3) << 9) | (((y) & 1) << 1) | (((y) & 2) << 2) | (((y) & 4) << 3))
+#define TILE_NEXT_X 1
+#define TILE_NEXT_Y 2
+#else
+#define TILE_COLUMN(x) ((x) * TILE_SIZE)
+#define TILE_ROW(y) (y)
+#define TILE_NEXT_X TILE_SIZE
+#define TILE_NEXT_Y 1
+#endif
+
+// Copy count pixels of tile column x, from row top down, to or from a contiguous buffer
+static inline void readTileColumn(const u8* tile, int x, int top, int count, u8* out) {
+#ifdef MASK_TILE_MORTON
+    const u8* column = &tile[TILE_COLUMN(x)];
+    for (int i = 0; i < count; i++) out[i] = column[TILE_ROW(top + i)];
+#else
+    memcpy(out, &tile[TILE_COLUMN(x) + top], count);
+#endif
+}
+
+static inline void writeTileColumn(u8* tile, int x, int top, int count, const u8* in) {
+#ifdef MASK_TILE_MORTON
+    u8* column = &tile[TILE_COLUMN(x)];
+    for (int i = 0; i < count; i++) column[TILE_ROW(top + i)] = in[i];
+#else
+    memcpy(&tile[TILE_COLUMN(x) + top], in, count);
+#endif
+}
+
+// Per-tile change flags (tileDirty), one per consumer of tile contents
+#define TILE_DIRTY_KEYFRAME 1    // Changed since the last journal keyframe
+#define TILE_DIRTY_JOURNAL 2     // Changed by an edit the journal can't replay as strokes
+#define TILE_DIRTY_AUTOSAVE 4    // Changed since the last autosave
+#define TILE_DIRTY_TEXTURE 8     // Changed since the GPU mask atlas copied it
+
+#endif
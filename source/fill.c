@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fill.h"
+
+/**
+ * FLOOD FILL
+ * 
+ * Reveal the connected region of the visible composite around a tap, so
+ * enclosed areas can be scratched out in one go (and one undo record).
+ * 
+ * The fill runs on the on-screen composite in framebuffer (column) layout:
+ * each seed is grown into a vertical span along its contiguous column, then
+ * the two neighbouring columns are scanned across the span for new seeds.
+ * Seeds live on a fixed-size stack. If it ever fills up, extra seeds are
+ * dropped and recovered afterwards by rescanning the region's border, so
+ * memory use is bounded for any pattern. The rescan stops whenever the
+ * stack is full again and resumes from the same pixel once it has drained,
+ * so one pass over the screen recovers any number of dropped seeds.
+ */
+#ifndef FILL_STACK_SIZE
+#define FILL_STACK_SIZE 4096    // The tests also build it with a tiny stack
+#endif
+
+u8 fillRegion[SCREEN_WIDTH * SCREEN_HEIGHT];
+int fillRescans = 0;
+
+static u32 fillStack[FILL_STACK_SIZE];               // Seeds packed as (x << 8) | row
+static int fillTop = 0;
+static int fillDroppedX = SCREEN_WIDTH;             // Leftmost column of a dropped seed
+static int fillRescanPos = -1;                       // Next pixel of the border rescan, -1 when idle
+
+static void fillPush(int x, int row) {
+    if (fillTop == FILL_STACK_SIZE) {
+        if (x < fillDroppedX) fillDroppedX = x;
+        return;
+    }
+    fillStack[fillTop++] = (x << 8) | row;
+}
+
+// Push one seed per run of open pixels in rows [top, bottom] of column x
+static void fillScanColumn(int x, int top, int bottom) {
+    if (x < 0 || x >= SCREEN_WIDTH) return;
+    
+    const u8* column = &fillRegion[x * SCREEN_HEIGHT];
+    bool inRun = false;
+    for (int row = top; row <= bottom; row++) {
+        if (column[row] == FILL_OPEN) {
+            if (!inRun) fillPush(x, row);
+            inRun = true;
+        } else {
+            inRun = false;
+        }
+    }
+}
+
+// Push open pixels that touch the filled region (overflow recovery), from
+// fillRescanPos on until the stack is full or the pass reaches the end
+static void fillRescan() {
+    for (int i = fillRescanPos; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        if (fillRegion[i] != FILL_OPEN) continue;
+        
+        int x = i / SCREEN_HEIGHT;
+        int row = i - x * SCREEN_HEIGHT;
+        if ((row > 0 && fillRegion[i - 1] == FILL_DONE) ||
+            (row < SCREEN_HEIGHT - 1 && fillRegion[i + 1] == FILL_DONE) ||
+            (x > 0 && fillRegion[i - SCREEN_HEIGHT] == FILL_DONE) ||
+            (x < SCREEN_WIDTH - 1 && fillRegion[i + SCREEN_HEIGHT] == FILL_DONE)) {
+            if (fillTop == FILL_STACK_SIZE) {
+                fillRescanPos = i;
+                return;
+            }
+            fillPush(x, row);
+        }
+    }
+    fillRescanPos = -1;
+}
+
+/**
+ * Mark the region of composite connected to screen pixel (screenX, screenY)
+ * as FILL_DONE in fillRegion. Returns the number of pixels filled.
+ */
+int floodFillRegion(const u8* composite, int screenX, int screenY) {
+    // Classify every pixel against the tapped color up front
+    const u8* seed = &composite[(screenX * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - screenY)) * 3];
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        const u8* pixel = &composite[i * 3];
+        int diff = abs(pixel[0] - seed[0]) + abs(pixel[1] - seed[1]) + abs(pixel[2] - seed[2]);
+        fillRegion[i] = (diff <= FILL_TOLERANCE) ? FILL_OPEN : FILL_BLOCKED;
+    }
+    
+    int filled = 0;
+    fillTop = 0;
+    fillPush(screenX, SCREEN_HEIGHT - 1 - screenY);
+    
+    fillDroppedX = SCREEN_WIDTH;
+    fillRescanPos = -1;
+    fillRescans = 0;
+    
+    while (true) {
+        while (fillTop > 0) {
+            u32 packed = fillStack[--fillTop];
+            int x = packed >> 8;
+            int row = packed & 0xFF;
+            u8* column = &fillRegion[x * SCREEN_HEIGHT];
+            if (column[row] != FILL_OPEN) continue;  // Already reached via another span
+            
+            // Grow the seed into the full open span of its column
+            int top = row;
+            int bottom = row;
+            while (top > 0 && column[top - 1] == FILL_OPEN) top--;
+            while (bottom < SCREEN_HEIGHT - 1 && column[bottom + 1] == FILL_OPEN) bottom++;
+            memset(&column[top], FILL_DONE, bottom - top + 1);
+            filled += bottom - top + 1;
+            
+            fillScanColumn(x - 1, top, bottom);
+            fillScanColumn(x + 1, top, bottom);
+        }
+        
+        if (fillRescanPos < 0) {
+            if (fillDroppedX == SCREEN_WIDTH) break;
+            
+            // Some seeds were dropped: find them again from the region border,
+            // starting at the first column that lost one. Seeds dropped while
+            // the pass is running may lie behind it, so they start another
+            // pass once this one is done.
+            fillRescans++;
+            fillRescanPos = fillDroppedX * SCREEN_HEIGHT;
+            fillDroppedX = SCREEN_WIDTH;
+        }
+        fillRescan();
+    }
+    
+    return filled;
+}
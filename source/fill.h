@@ -0,0 +1,23 @@
+/**
+ * Scanline flood fill on the screen composite (see fill.c). No libctru,
+ * so it builds and is tested on the host.
+ */
+#ifndef FILL_H
+#define FILL_H
+
+#include "canvas.h"
+
+#define FILL_TOLERANCE 48       // Max summed BGR difference from the tapped color
+
+enum { FILL_BLOCKED, FILL_OPEN, FILL_DONE };
+
+extern u8 fillRegion[SCREEN_WIDTH * SCREEN_HEIGHT];  // Per pixel state, framebuffer layout
+extern int fillRescans;                              // Stack overflow recoveries in the last fill
+
+/**
+ * Mark the region of composite connected to screen pixel (screenX, screenY)
+ * as FILL_DONE in fillRegion. Returns the number of pixels filled.
+ */
+int floodFillRegion(const u8* composite, int screenX, int screenY);
+
+#endif
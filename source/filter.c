@@ -0,0 +1,170 @@
+#include <string.h>
+
+#include "filter.h"
+#include "packed.h"
+
+/**
+ * MASK FILTERS
+ * 
+ * One-shot soften and sharpen of a layer's whole mask, e.g. to feather
+ * hard brush edges after the fact. Softening is a Gaussian approximated by
+ * FILTER_PASSES box blurs, separable and with running sums, so each pass
+ * costs the same per pixel at any radius, in integer arithmetic.
+ * Sharpening is an unsharp mask with the same blur. Off the canvas the
+ * mask counts as unscratched (255).
+ * 
+ * Only tiles that are scratched, or next to one, can change. Each is
+ * filtered in a window with an apron wide enough for all passes: the
+ * vertical passes run down the window's contiguous columns, then the
+ * center rows are transposed in blocks so the horizontal passes also run
+ * over contiguous memory, and transposed back into tile layout. The apron
+ * makes every tile come out exactly as if the whole canvas had been
+ * filtered in one piece. Tiles whose whole neighbourhood is one value
+ * are left alone.
+ */
+
+// Box blur of one line (edges clamped), running sum over 2 * FILTER_RADIUS + 1 values
+static void boxBlurLine(const u8* src, u8* dst, int length) {
+    const int width = 2 * FILTER_RADIUS + 1;
+    const int reciprocal = (65536 + width / 2) / width;
+    int sum = src[0] * (FILTER_RADIUS + 1);
+    for (int i = 1; i <= FILTER_RADIUS; i++) sum += src[i];
+    
+    // The window only overhangs the ends of the line near them
+    int i = 0;
+    for (; i <= FILTER_RADIUS; i++) {
+        dst[i] = (sum * reciprocal + 32768) >> 16;
+        sum += src[i + FILTER_RADIUS + 1] - src[0];
+    }
+    for (; i < length - FILTER_RADIUS - 1; i++) {
+        dst[i] = (sum * reciprocal + 32768) >> 16;
+        sum += src[i + FILTER_RADIUS + 1] - src[i - FILTER_RADIUS];
+    }
+    for (; i < length; i++) {
+        dst[i] = (sum * reciprocal + 32768) >> 16;
+        sum += src[length - 1] - src[i - FILTER_RADIUS];
+    }
+}
+
+// All FILTER_PASSES box blurs of a line, in place
+static void gaussianLine(u8* line, int length) {
+    u8 scratch[FILTER_WINDOW];
+    for (int pass = 0; pass < FILTER_PASSES; pass += 2) {
+        boxBlurLine(line, scratch, length);
+        if (pass + 1 < FILTER_PASSES) {
+            boxBlurLine(scratch, line, length);
+        } else {
+            memcpy(line, scratch, length);
+        }
+    }
+}
+
+// Mask value of a whole tile if it is uniform (NULL tiles are 255), else -1
+int uniformTileValue(const u8* tile) {
+    if (!tile) return 255;
+    for (int i = 1; i < TILE_PIXELS; i++) {
+        if (tile[i] != tile[0]) return -1;
+    }
+    return tile[0];
+}
+
+int findFilterTiles(u8* const* tiles, u32* const* bits, u16* pending) {
+    static s16 uniform[CANVAS_TILE_COUNT];
+    int count = 0;
+    
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        uniform[i] = bits[i] ? uniformPackedTile(bits[i]) : uniformTileValue(tiles[i]);
+    }
+    
+    // Tiles whose neighbourhood isn't a single value
+    for (int tileY = 0; tileY < CANVAS_TILES_Y; tileY++) {
+        for (int tileX = 0; tileX < CANVAS_TILES_X; tileX++) {
+            int value = uniform[tileY * CANVAS_TILES_X + tileX];
+            bool flat = value >= 0;
+            for (int ny = tileY - 1; ny <= tileY + 1 && flat; ny++) {
+                for (int nx = tileX - 1; nx <= tileX + 1 && flat; nx++) {
+                    bool inside = nx >= 0 && nx < CANVAS_TILES_X && ny >= 0 && ny < CANVAS_TILES_Y;
+                    if ((inside ? uniform[ny * CANVAS_TILES_X + nx] : 255) != value) flat = false;
+                }
+            }
+            if (!flat) pending[count++] = tileY * CANVAS_TILES_X + tileX;
+        }
+    }
+    return count;
+}
+
+void filterMaskTile(u8* const* tiles, u32* const* bits, int tileIndex, MaskFilter filter, u8* out) {
+    static u8 window[FILTER_WINDOW * FILTER_WINDOW];   // Column-major, apron included
+    static u8 rows[TILE_SIZE * FILTER_WINDOW];         // Center rows, row-major
+    static u8 expanded[TILE_PIXELS];                   // A packed center tile, for sharpening
+    int tileX = tileIndex % CANVAS_TILES_X;
+    int tileY = tileIndex / CANVAS_TILES_X;
+    int originY = (tileY << TILE_SHIFT) - FILTER_APRON;
+    
+    // Gather the window: each column is at most three contiguous tile spans
+    for (int wx = 0; wx < FILTER_WINDOW; wx++) {
+        int x = (tileX << TILE_SHIFT) - FILTER_APRON + wx;
+        u8* column = &window[wx * FILTER_WINDOW];
+        int wy = 0;
+        while (wy < FILTER_WINDOW) {
+            int y = originY + wy;
+            int span = TILE_SIZE - (y & TILE_MASK);
+            if (span > FILTER_WINDOW - wy) span = FILTER_WINDOW - wy;
+            bool inside = x >= 0 && x < CANVAS_WIDTH && y >= 0 && y < CANVAS_HEIGHT;
+            int index = inside ? (y >> TILE_SHIFT) * CANVAS_TILES_X + (x >> TILE_SHIFT) : 0;
+            if (inside && tiles[index]) {
+                readTileColumn(tiles[index], x & TILE_MASK, y & TILE_MASK, span, &column[wy]);
+            } else if (inside && bits[index]) {
+                readTileBitColumn(bits[index], x & TILE_MASK, y & TILE_MASK, span, &column[wy]);
+            } else {
+                memset(&column[wy], 255, span);  // Unscratched or off the canvas
+            }
+            wy += span;
+        }
+    }
+    
+    // Vertical passes along the columns
+    for (int wx = 0; wx < FILTER_WINDOW; wx++) {
+        gaussianLine(&window[wx * FILTER_WINDOW], FILTER_WINDOW);
+    }
+    
+    // Transpose the center rows in blocks, then the horizontal passes
+    for (int bx = 0; bx < FILTER_WINDOW; bx += FILTER_BLOCK) {
+        for (int by = 0; by < TILE_SIZE; by += FILTER_BLOCK) {
+            int endX = bx + FILTER_BLOCK < FILTER_WINDOW ? bx + FILTER_BLOCK : FILTER_WINDOW;
+            for (int wx = bx; wx < endX; wx++) {
+                const u8* column = &window[wx * FILTER_WINDOW + FILTER_APRON];
+                for (int row = by; row < by + FILTER_BLOCK; row++) {
+                    rows[row * FILTER_WINDOW + wx] = column[row];
+                }
+            }
+        }
+    }
+    for (int row = 0; row < TILE_SIZE; row++) {
+        gaussianLine(&rows[row * FILTER_WINDOW], FILTER_WINDOW);
+    }
+    
+    // Back to tile layout, combined with the original for sharpening
+    const u8* tile = tiles[tileIndex];
+    if (!tile && bits[tileIndex] && filter == FILTER_SHARPEN) {
+        unpackBinaryTile(bits[tileIndex], expanded);
+        tile = expanded;
+    }
+    for (int bx = 0; bx < TILE_SIZE; bx += FILTER_BLOCK) {
+        for (int by = 0; by < TILE_SIZE; by += FILTER_BLOCK) {
+            for (int col = bx; col < bx + FILTER_BLOCK; col++) {
+                u8* outColumn = &out[TILE_COLUMN(col)];
+                for (int row = by; row < by + FILTER_BLOCK; row++) {
+                    int blurred = rows[row * FILTER_WINDOW + FILTER_APRON + col];
+                    if (filter == FILTER_SOFTEN) {
+                        outColumn[TILE_ROW(row)] = blurred;
+                    } else {
+                        int original = tile ? tile[TILE_COLUMN(col) + TILE_ROW(row)] : 255;
+                        int value = original + (original - blurred) * SHARPEN_AMOUNT / 2;
+                        outColumn[TILE_ROW(row)] = value < 0 ? 0 : value > 255 ? 255 : value;
+                    }
+                }
+            }
+        }
+    }
+}
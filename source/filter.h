@@ -0,0 +1,34 @@
+/**
+ * Soften and sharpen filters for scratch masks (see filter.c). No
+ * libctru, so they build and are tested on the host.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "canvas.h"
+
+#define FILTER_RADIUS 2
+#define FILTER_PASSES 3
+#define FILTER_APRON (FILTER_RADIUS * FILTER_PASSES)
+#define FILTER_WINDOW (TILE_SIZE + 2 * FILTER_APRON)
+#define FILTER_BLOCK 8             // Transpose block size
+#define SHARPEN_AMOUNT 2           // Unsharp mask strength, in halves
+#define FILTER_TILES_PER_FRAME 4   // Tiles filtered per frame while a filter runs
+
+typedef enum {
+    FILTER_SOFTEN,
+    FILTER_SHARPEN
+} MaskFilter;
+
+int uniformTileValue(const u8* tile);
+
+/**
+ * List in pending the tiles of a layer's mask (its maskTiles and maskBits
+ * tables) that a filter can change. Returns how many there are.
+ */
+int findFilterTiles(u8* const* tiles, u32* const* bits, u16* pending);
+
+// Filter one tile of a layer's mask into out (TILE_PIXELS, tile layout)
+void filterMaskTile(u8* const* tiles, u32* const* bits, int tileIndex, MaskFilter filter, u8* out);
+
+#endif
@@ -6,17 +6,28 @@
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
 #include <tex3ds.h>
 #include <dirent.h>
-
-// Screen dimensions - 3DS has 320x240 bottom screen, 400x240 top screen
-#define SCREEN_WIDTH 320
-#define SCREEN_HEIGHT 240
-#define FB_WIDTH 240      // Framebuffer width (rotated 90°)
-#define FB_HEIGHT 320     // Framebuffer height (rotated 90°)
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __ARM_FEATURE_SIMD32
+#include <arm_acle.h>  // ARMv6 SIMD intrinsics for the stamp brushes
+#endif
+#include "composite_shbin.h"  // Built from composite.v.pica
+#include "canvas.h"
+#include "stereo.h"
+#include "fill.h"
+#include "stabilizer.h"
+#include "packed.h"
+#include "swizzle.h"
+#include "filter.h"
+#include "rgb565.h"
+#include "blit.h"
 
 #define MAX_HISTORY 20    // Maximum number of undo/redo steps to store
-#define MAX_INSTRUCTION_LINES 15  // Number of text lines in instructions
+#define MAX_INSTRUCTION_LINES 48  // Number of text lines in instructions
+#define HELP_PAGES 5
 
 // Gallery configuration
 #define MAX_GALLERY_IMAGES 50
@@ -25,19 +36,83 @@
 #define THUMBNAILS_PER_ROW 4
 #define THUMBNAIL_SPACING 10
 
-// Three framebuffers store different visual layers:
-// 1. baseImage: The "top" layer that gets scratched away
-// 2. rotatedImage: The "hidden" layer revealed underneath
-// 3. scratchMask: Alpha mask determining which layer is visible (0-255)
-u8 baseImage[FB_WIDTH * FB_HEIGHT * 3];
-u8 rotatedImage[FB_WIDTH * FB_HEIGHT * 3];
-u8 scratchMask[FB_WIDTH * FB_HEIGHT];
-
-// Undo/Redo system: Circular buffers storing previous scratch mask states
-u8 undoStack[MAX_HISTORY][FB_WIDTH * FB_HEIGHT];
-u8 redoStack[MAX_HISTORY][FB_WIDTH * FB_HEIGHT];
+// Viewport zoom levels: -1 shows the canvas at 1:2 (2x2 box sampled),
+// 0 is 1:1, and 1..2 magnify 2x/4x with nearest-neighbour sampling
+#define ZOOM_MIN -1
+#define ZOOM_MAX 2
+
+#define MAX_LAYERS 4       // Maximum number of layers in the scratch stack
+
+// Generated layer patterns store a level per pixel, from the canvas
+// background to the layer's palette color; the layer's lut gives the
+// blended color, so changing colors doesn't touch the pixels
+#define PATTERN_PAPER 0    // Canvas background (white, black or dark grey)
+#define PATTERN_INK 255    // The layer's palette color
+#define PATTERN_COLORS 256
+
+// The canvas is a stack of layers, top (index 0) to bottom:
+// - image: Screen-sized pattern or bitmap repeated across the virtual canvas
+// - indexed/lut: Patterns keep a PATTERN_* level in the first byte of each
+//   pixel, colored through lut (BGR); bitmaps are plain BGR
+// - maskTiles: Alpha mask; scratching it reveals the next layer down (0-255)
+// - depth: Parallax of the layer as a fraction of depthOffset
+// The bottom layer has nothing underneath, so its mask is never used.
+//
+// Each tile holds TILE_SIZE x TILE_SIZE alpha values, addressed through
+// TILE_COLUMN / TILE_ROW (see canvas.h for the layouts). A NULL tile has
+// never been scratched (all 255). Tiles that only hard brushes and fills
+// have touched hold just 0 and 255 and live packed in maskBits instead
+// (see packed.h); at most one of maskTiles[i] and maskBits[i] is set.
+typedef struct {
+    u8 image[FB_WIDTH * FB_HEIGHT * 3];
+    bool indexed;
+    u8 lut[PATTERN_COLORS][3];
+    u8* maskTiles[CANVAS_TILE_COUNT];
+    u32* maskBits[CANVAS_TILE_COUNT];
+    float depth;
+} Layer;
+
+Layer layers[MAX_LAYERS];
+int layerCount = 2;       // Classic two-layer scratch canvas by default
+int activeLayer = 0;      // Layer the brush scratches into
+bool layerImagesChanged = true;  // Images changed since the GPU textures were made
+bool layerLutsChanged = true;    // Luts changed since then (color edits and cycling)
+
+// Depth map of the current viewport (0 = screen plane, 255 = full depthOffset),
+// produced by the compositor and used by the stereoscopic renderer
+u8 viewDepth[FB_WIDTH * FB_HEIGHT];
+
+// Viewport: canvas position of the top-left screen pixel and zoom level
+int viewX = 0;
+int viewY = 0;
+int viewZoom = 0;
+
+// Undo/Redo system: each history entry stores only the canvas tiles that an
+// action modified, captured the first time the action touches each tile.
+// Tiles holding only 0 and 255 (hard brushes) are kept at 1 bit per pixel.
+typedef struct {
+    u8 layer;       // Layer whose mask the tile belongs to
+    u16 tileIndex;  // Index into the layer's maskTiles
+    bool packed;    // data is a packed tile (PACKED_TILE_BYTES)
+    u8* data;       // Tile contents before the action (NULL = untouched tile)
+} UndoTile;
+
+typedef struct {
+    UndoTile* tiles;
+    int count;
+    int capacity;
+} UndoRecord;
+
+UndoRecord undoStack[MAX_HISTORY];
+UndoRecord redoStack[MAX_HISTORY];
 int undoTop = 0;  // Points to next available undo slot
 int redoTop = 0;  // Points to next available redo slot
+bool undoRecording = false;              // True while an action is being captured
+u32 undoSerial = 0;                      // Identifies the record being captured
+u32 tileUndoSerial[MAX_LAYERS][CANVAS_TILE_COUNT];  // Last record each tile was saved into
+
+// Tiles changed since the stroke journal or the autosave last saw them (TILE_DIRTY_*)
+u8 tileDirty[MAX_LAYERS][CANVAS_TILE_COUNT];
 
 static C2D_SpriteSheet spriteSheet;
 static C2D_Image logoImage;
@@ -46,9 +121,14 @@ static bool logoLoaded = false;
 // Citro2D render targets and text buffers
 static C3D_RenderTarget* topTarget;
 static C3D_RenderTarget* bottomTarget;
+static C3D_RenderTarget* topRightTarget;  // Created with the GPU compositing path
 static C2D_TextBuf staticTextBuf;
 static C2D_Text instructionTexts[MAX_INSTRUCTION_LINES];
 
+// Help pages: header line index and end (exclusive) of each page's lines
+static const int helpPageStart[HELP_PAGES] = {2, 16, 26, 36, 46};
+static const int helpPageEnd[HELP_PAGES] = {14, 26, 36, 46, MAX_INSTRUCTION_LINES};
+
 // Gallery structures
 typedef struct {
     char filename[256];
@@ -60,14 +140,18 @@ GalleryImage galleryImages[MAX_GALLERY_IMAGES];
 int galleryImageCount = 0;
 int selectedGalleryIndex = 0;
 int galleryScrollOffset = 0;
+char loadedImageName[256] = "";  // Drawing shown on the top layer ("" = generated pattern)
 
 // RGB color structure for easy color management
 typedef struct {
     u8 r, g, b;
 } Color;
 
-// Rainbow palette: 6 vibrant colors the user can cycle through
-Color rainbowColors[] = {
+#define MAX_PALETTE_COLORS 12
+#define PALETTE_SLOTS 4      // Palettes saved as sdmc:/sqribble_palette1.txt to 4
+
+// Rainbow palette: 6 vibrant colors, the default for every palette slot
+const Color rainbowColors[] = {
     {65, 105, 225},    // Royal Blue
     {138, 43, 226},    // Blue Violet (Purple)
     {220, 20, 60},     // Crimson (Red)
@@ -75,36 +159,731 @@ Color rainbowColors[] = {
     {255, 215, 0},     // Gold (Yellow)
     {34, 139, 34}      // Forest Green
 };
-int numColors = 6;
+
+// Palette the user cycles through, edited on the bottom screen
+Color paletteColors[MAX_PALETTE_COLORS];
+int numColors = 0;
+int paletteSlot = 0;        // Palette file being used (0-based)
 int currentColorIndex = 0;  // Current selected color (starts with blue)
 
-// Drawing modes determine what patterns are generated
+// Canvas background: the paper color of every layer's pattern
+typedef enum {
+    PAPER_WHITE,
+    PAPER_BLACK,
+    PAPER_DARK,         // Dark grey, easier on the eyes than black
+    PAPER_STYLE_COUNT
+} PaperStyle;
+
+PaperStyle currentPaper = PAPER_WHITE;
+
+// Layer image patterns (see FRAMEBUFFER GENERATION), in ink over paper
 typedef enum {
-    MODE_CHECKERBOARD_BLACK,    // Checkerboard with black squares
-    MODE_CHECKERBOARD_WHITE,    // Checkerboard with white squares
-    MODE_COLOR_ON_WHITE,        // Solid color strokes on white canvas
-    MODE_COLOR_ON_BLACK         // Solid color strokes on black canvas
-} DrawingMode;
+    CANVAS_PLAIN,       // Paper only
+    CANVAS_SOLID,       // Ink only
+    CANVAS_CHECKER,
+    CANVAS_STRIPES,     // Diagonal stripes
+    CANVAS_DOTS,
+    CANVAS_GRADIENT,
+    CANVAS_HEX,         // Hexagon outlines
+    CANVAS_NOISE,       // Smooth value noise
+    CANVAS_PLASMA,
+    CANVAS_PATTERN_COUNT
+} CanvasPattern;
+
+CanvasPattern topPattern = CANVAS_CHECKER;     // Visible (top) layer, cycled with B
+CanvasPattern hiddenPattern = CANVAS_CHECKER;  // Layers revealed by scratching
+
+// Colors of the hidden layers' pattern levels (see updateLayerPalettes)
+typedef enum {
+    HIDDEN_INK_COLOR,       // Paper to the layer's palette color
+    HIDDEN_INK_RAINBOW,     // Full hue circle
+    HIDDEN_INK_PALETTE,     // Through every palette color in turn
+    HIDDEN_INK_COUNT
+} HiddenInk;
+
+HiddenInk hiddenInk = HIDDEN_INK_COLOR;
 
-DrawingMode currentMode = MODE_CHECKERBOARD_WHITE;
+// Color cycling: the rainbow and palette inks rotate through their levels
+#define COLOR_CYCLE_SPEEDS 3
+static const int colorCycleSpeeds[COLOR_CYCLE_SPEEDS] = {0, 1, 4};  // Levels per frame
+int colorCycle = 0;         // Index into colorCycleSpeeds (0 = still)
+u8 colorCyclePhase = 0;     // Current rotation, in levels
 
 // Brush shapes affect how the scratch mask is modified
 typedef enum {
-    BRUSH_CIRCLE,   // Hard circular brush
-    BRUSH_SQUARE,   // Hard square brush
-    BRUSH_SOFT      // Soft circular brush with feathered edges
+    BRUSH_CIRCLE,       // Hard circular brush
+    BRUSH_CIRCLE_AA,    // Circular brush with anti-aliased edges
+    BRUSH_SQUARE,       // Hard square brush
+    BRUSH_SQUARE_AA,    // Square brush with anti-aliased edges
+    BRUSH_SOFT,         // Soft circular brush with feathered edges
+    BRUSH_AIRBRUSH,     // Sprays dots that build up while the stylus lingers
+    BRUSH_CHALK,        // Stamp brushes (see STAMP BRUSHES)
+    BRUSH_SPRAY,
+    BRUSH_STAR,
+    BRUSH_FILL,         // Flood fill: tap to reveal a connected region
+    BRUSH_SHAPE_COUNT
 } BrushShape;
 
 BrushShape currentBrushShape = BRUSH_CIRCLE;
+int brushSize = 5;                // Brush radius (1-50)
+bool restoreBrush = false;        // Brush raises the mask back toward unscratched
+
+// Symmetry modes copy every stroke around the center of the view
+typedef enum {
+    SYMMETRY_OFF,
+    SYMMETRY_HORIZONTAL,    // Mirror left/right
+    SYMMETRY_VERTICAL,      // Mirror top/bottom
+    SYMMETRY_QUAD,          // Mirror both ways (4 copies)
+    SYMMETRY_ROTATE,        // 8-fold rotation
+    SYMMETRY_KALEIDOSCOPE,  // 6 mirrored wedges (12 copies)
+    SYMMETRY_MODE_COUNT
+} SymmetryMode;
+
+SymmetryMode currentSymmetry = SYMMETRY_OFF;
 
 bool allowDrawing = false;
 bool showInstructions = true;     // Show instruction screen on startup
 bool showGallery = false;         // Show gallery screen
+bool showPalette = false;         // Show palette editor on the bottom screen
+int helpPage = 0;                 // Instruction page: 0 = basic, 1 = SELECT combos, 2 = animation and timelapse, 3 = palette
 float depthOffset = 3.0f;         // 3D stereoscopic depth offset
 
-// Previous touch position for line interpolation (smooth drawing)
+// Previous brush position for line interpolation (smooth drawing)
+// Stored in subpixel canvas coordinates so panning mid-stroke cannot cause jumps
 int prevTouchX = -1;
 int prevTouchY = -1;
+int lastTouchX = 0;               // Last touch sample of the stroke, where the brush ends up
+int lastTouchY = 0;
+
+/**
+ * VIRTUAL CANVAS
+ *
+ * The scratch mask covers CANVAS_WIDTH x CANVAS_HEIGHT pixels split into
+ * TILE_SIZE x TILE_SIZE tiles. Tiles are allocated on first write, so memory
+ * use follows the painted area rather than the canvas size.
+ */
+
+/**
+ * Append a tile to the undo record currently being captured.
+ * Ownership of data passes to the record. Returns false if out of memory.
+ */
+bool appendUndoTile(int layer, int tileIndex, u8* data, bool packed) {
+    UndoRecord* record = &undoStack[undoTop - 1];
+
+    if (record->count == record->capacity) {
+        int newCapacity = record->capacity ? record->capacity * 2 : 16;
+        UndoTile* grown = (UndoTile*)realloc(record->tiles, newCapacity * sizeof(UndoTile));
+        if (!grown) return false;
+        record->tiles = grown;
+        record->capacity = newCapacity;
+    }
+
+    record->tiles[record->count].layer = layer;
+    record->tiles[record->count].tileIndex = tileIndex;
+    record->tiles[record->count].packed = packed;
+    record->tiles[record->count].data = data;
+    record->count++;
+    tileUndoSerial[layer][tileIndex] = undoSerial;
+    return true;
+}
+
+/**
+ * Copy-on-write: save a tile's contents the first time the current
+ * action modifies it. Untouched tiles are recorded as NULL.
+ * Returns false if out of memory; the tile must then not be written, or
+ * undo would restore it wrongly.
+ */
+bool saveTileForUndo(int layer, int tileIndex) {
+    if (!undoRecording || tileUndoSerial[layer][tileIndex] == undoSerial) return true;
+
+    const u8* source = layers[layer].maskTiles[tileIndex];
+    const u32* bits = layers[layer].maskBits[tileIndex];
+    u8* copy = NULL;
+    bool packed = bits != NULL;
+    if (bits) {
+        copy = (u8*)malloc(PACKED_TILE_BYTES);
+        if (!copy) return false;
+        memcpy(copy, bits, PACKED_TILE_BYTES);
+    } else if (source) {
+        copy = (u8*)packBinaryTile(source);
+        packed = copy != NULL;
+        if (!packed) {
+            copy = (u8*)malloc(TILE_PIXELS);
+            if (!copy) return false;
+            memcpy(copy, source, TILE_PIXELS);
+        }
+    }
+
+    if (!appendUndoTile(layer, tileIndex, copy, packed)) {
+        free(copy);
+        return false;
+    }
+    return true;
+}
+
+// Whether a mask tile has never been scratched (no 8-bit or packed tile)
+static inline bool maskTileUntouched(int layer, int tileIndex) {
+    return !layers[layer].maskTiles[tileIndex] && !layers[layer].maskBits[tileIndex];
+}
+
+// Free a live mask tile in either form, leaving it unscratched
+void freeMaskTile(int layer, int tileIndex) {
+    free(layers[layer].maskTiles[tileIndex]);
+    free(layers[layer].maskBits[tileIndex]);
+    layers[layer].maskTiles[tileIndex] = NULL;
+    layers[layer].maskBits[tileIndex] = NULL;
+}
+
+// Switch an 8-bit live tile to the packed form if it only holds 0 and 255
+void repackMaskTile(int layer, int tileIndex) {
+    u8* tile = layers[layer].maskTiles[tileIndex];
+    u32* bits = tile ? packBinaryTile(tile) : NULL;
+    if (!bits) return;
+
+    free(tile);
+    layers[layer].maskTiles[tileIndex] = NULL;
+    layers[layer].maskBits[tileIndex] = bits;
+}
+
+/**
+ * Replace a live mask tile with a malloc'd 8-bit tile (NULL = unscratched),
+ * taking ownership. Tiles holding only 0 and 255 are kept packed.
+ */
+void setMaskTile(int layer, int tileIndex, u8* tile) {
+    freeMaskTile(layer, tileIndex);
+    layers[layer].maskTiles[tileIndex] = tile;
+    repackMaskTile(layer, tileIndex);
+}
+
+/**
+ * The 8-bit contents of a mask tile for reading, or NULL if unscratched.
+ * Packed tiles are expanded into a buffer shared by all callers, valid
+ * until the next call.
+ */
+const u8* maskTileBytes(int layer, int tileIndex) {
+    static u8 expanded[TILE_PIXELS];
+    if (layers[layer].maskBits[tileIndex]) {
+        unpackBinaryTile(layers[layer].maskBits[tileIndex], expanded);
+        return expanded;
+    }
+    return layers[layer].maskTiles[tileIndex];
+}
+
+// Mark a tile as written, saving it for undo first; false if it couldn't be saved
+static bool touchTileState(int layer, int tileIndex) {
+    if (!saveTileForUndo(layer, tileIndex)) return false;
+    tileDirty[layer][tileIndex] |= TILE_DIRTY_KEYFRAME | TILE_DIRTY_AUTOSAVE | TILE_DIRTY_TEXTURE;
+    return true;
+}
+
+/**
+ * Get a mask tile of a layer for writing 8-bit alpha, allocating it (fully
+ * opaque) on first touch. A packed tile is expanded for good: once a soft
+ * brush has written partial alpha the tile stays 8-bit.
+ * Returns NULL if the tile is outside the canvas, couldn't be saved for
+ * undo or allocation failed.
+ */
+u8* touchMaskTile(int layer, int tileX, int tileY) {
+    if (tileX < 0 || tileX >= CANVAS_TILES_X || tileY < 0 || tileY >= CANVAS_TILES_Y) return NULL;
+
+    u8** tiles = layers[layer].maskTiles;
+    u32** bits = layers[layer].maskBits;
+    int tileIndex = tileY * CANVAS_TILES_X + tileX;
+    if (!touchTileState(layer, tileIndex)) return NULL;
+
+    if (!tiles[tileIndex]) {
+        tiles[tileIndex] = (u8*)malloc(TILE_PIXELS);
+        if (!tiles[tileIndex]) return NULL;
+        if (bits[tileIndex]) {
+            unpackBinaryTile(bits[tileIndex], tiles[tileIndex]);
+            free(bits[tileIndex]);
+            bits[tileIndex] = NULL;
+        } else {
+            memset(tiles[tileIndex], 255, TILE_PIXELS);
+        }
+    }
+    return tiles[tileIndex];
+}
+
+/**
+ * Get a mask tile for writing only 0 or 255 (hard brushes, fills). Packed
+ * tiles are returned as they are and unscratched ones are allocated packed.
+ * Returns NULL if the tile already holds 8-bit alpha (write it through
+ * touchMaskTile instead), is outside the canvas, couldn't be saved for
+ * undo or allocation failed.
+ */
+u32* touchMaskBits(int layer, int tileX, int tileY) {
+    if (tileX < 0 || tileX >= CANVAS_TILES_X || tileY < 0 || tileY >= CANVAS_TILES_Y) return NULL;
+
+    int tileIndex = tileY * CANVAS_TILES_X + tileX;
+    if (layers[layer].maskTiles[tileIndex]) return NULL;
+    if (!touchTileState(layer, tileIndex)) return NULL;
+
+    u32** bits = layers[layer].maskBits;
+    if (!bits[tileIndex]) bits[tileIndex] = newPackedTile();
+    return bits[tileIndex];
+}
+
+/**
+ * Reset one layer's mask to unscratched.
+ * Tiles are moved into the open undo record instead of being copied.
+ */
+void clearLayerMask(int layer) {
+    u8** tiles = layers[layer].maskTiles;
+    u32** bits = layers[layer].maskBits;
+
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        if (!tiles[i] && !bits[i]) continue;
+        tileDirty[layer][i] |= TILE_DIRTY_KEYFRAME | TILE_DIRTY_JOURNAL | TILE_DIRTY_AUTOSAVE | TILE_DIRTY_TEXTURE;
+
+        // Binary tiles go into history packed, others are handed over as they are
+        if (undoRecording && tileUndoSerial[layer][i] != undoSerial) {
+            if (bits[i]) {
+                if (appendUndoTile(layer, i, (u8*)bits[i], true)) bits[i] = NULL;
+            } else {
+                u8* packed = (u8*)packBinaryTile(tiles[i]);
+                if (!packed) {
+                    if (appendUndoTile(layer, i, tiles[i], false)) tiles[i] = NULL;
+                } else if (!appendUndoTile(layer, i, packed, true)) {
+                    free(packed);
+                }
+            }
+        }
+        freeMaskTile(layer, i);
+    }
+}
+
+/**
+ * Flag every allocated tile as changed; called before and after edits that
+ * replace masks wholesale, so both the old and the new tiles are covered
+ */
+void markLiveTilesDirty() {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (maskTileUntouched(layer, i)) continue;
+            tileDirty[layer][i] |= TILE_DIRTY_KEYFRAME | TILE_DIRTY_JOURNAL | TILE_DIRTY_AUTOSAVE | TILE_DIRTY_TEXTURE;
+        }
+    }
+}
+
+/**
+ * Reset the whole canvas (every layer) to unscratched
+ */
+void clearCanvasMask() {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        clearLayerMask(layer);
+    }
+}
+
+/**
+ * Release the tiles held by an undo/redo record
+ */
+void freeUndoRecord(UndoRecord* record) {
+    for (int i = 0; i < record->count; i++) {
+        free(record->tiles[i].data);
+    }
+    free(record->tiles);
+    record->tiles = NULL;
+    record->count = 0;
+    record->capacity = 0;
+}
+
+/**
+ * Drop all undo and redo history
+ */
+void clearUndoHistory() {
+    for (int i = 0; i < undoTop; i++) freeUndoRecord(&undoStack[i]);
+    for (int i = 0; i < redoTop; i++) freeUndoRecord(&redoStack[i]);
+    undoTop = 0;
+    redoTop = 0;
+    undoRecording = false;
+}
+
+/**
+ * VIEWPORT TRANSFORM
+ *
+ * Maps screen pixels to canvas pixels. The mapping is separable, so the
+ * compositor can build one table per axis each frame.
+ */
+int canvasFromScreenX(int screenX) {
+    return (viewZoom < 0) ? viewX + (screenX << 1) : viewX + (screenX >> viewZoom);
+}
+
+int canvasFromScreenY(int screenY) {
+    return (viewZoom < 0) ? viewY + (screenY << 1) : viewY + (screenY >> viewZoom);
+}
+
+// Same mapping in subpixel units, keeping the fraction lost when zoomed in
+int subpixelFromScreenX(int screenX) {
+    int offset = (viewZoom < 0) ? screenX << (SUBPIXEL_SHIFT + 1) : (screenX << SUBPIXEL_SHIFT) >> viewZoom;
+    return (viewX << SUBPIXEL_SHIFT) + offset;
+}
+
+int subpixelFromScreenY(int screenY) {
+    int offset = (viewZoom < 0) ? screenY << (SUBPIXEL_SHIFT + 1) : (screenY << SUBPIXEL_SHIFT) >> viewZoom;
+    return (viewY << SUBPIXEL_SHIFT) + offset;
+}
+
+/**
+ * Keep the viewport inside the canvas. When zoomed out the origin is kept
+ * even so each 2x2 sample block lies within a single tile.
+ */
+void clampView() {
+    int visibleWidth = (viewZoom < 0) ? SCREEN_WIDTH * 2 : SCREEN_WIDTH >> viewZoom;
+    int visibleHeight = (viewZoom < 0) ? SCREEN_HEIGHT * 2 : SCREEN_HEIGHT >> viewZoom;
+
+    if (viewX > CANVAS_WIDTH - visibleWidth) viewX = CANVAS_WIDTH - visibleWidth;
+    if (viewY > CANVAS_HEIGHT - visibleHeight) viewY = CANVAS_HEIGHT - visibleHeight;
+    if (viewX < 0) viewX = 0;
+    if (viewY < 0) viewY = 0;
+
+    if (viewZoom < 0) {
+        viewX &= ~1;
+        viewY &= ~1;
+    }
+}
+
+/**
+ * Center the viewport at 1:1 on the middle of the canvas.
+ * The origin is a multiple of the screen size so the repeated layer
+ * patterns (and loaded drawings) line up with the screen.
+ */
+void resetView() {
+    viewZoom = 0;
+    viewX = (CANVAS_WIDTH / 2 / SCREEN_WIDTH) * SCREEN_WIDTH;
+    viewY = (CANVAS_HEIGHT / 2 / SCREEN_HEIGHT) * SCREEN_HEIGHT;
+    clampView();
+}
+
+/**
+ * Change zoom level while keeping the canvas point under the
+ * anchor screen position fixed
+ */
+void zoomView(int newZoom, int anchorX, int anchorY) {
+    if (newZoom < ZOOM_MIN) newZoom = ZOOM_MIN;
+    if (newZoom > ZOOM_MAX) newZoom = ZOOM_MAX;
+
+    int canvasX = canvasFromScreenX(anchorX);
+    int canvasY = canvasFromScreenY(anchorY);
+
+    viewZoom = newZoom;
+    viewX = canvasX - ((viewZoom < 0) ? anchorX << 1 : anchorX >> viewZoom);
+    viewY = canvasY - ((viewZoom < 0) ? anchorY << 1 : anchorY >> viewZoom);
+    clampView();
+}
+
+/**
+ * FLIPBOOK
+ * 
+ * An animation is a sequence of frames, each with its own set of layer
+ * masks. The frame being edited lives in the normal layer masks; the
+ * other frames are stored as deltas: the list of tiles that differ from
+ * the previous frame (frame 0 against a blank canvas). A still background
+ * with a small moving part costs only the tiles that move.
+ * 
+ * Decoding never copies tiles. A frame table holds, for every layer and
+ * tile, a pointer to the delta data of the last frame that changed it, so
+ * stepping to the next frame only reassigns that frame's changed tiles.
+ * Playback runs off such a table; the onion skin reads another one (the
+ * previous frame) directly inside the compositor.
+ * 
+ * Frames are written back (re-encoding this frame's delta and the next
+ * one's) whenever the current frame changes. Undo history refers to the
+ * live masks, so it is dropped on every frame change.
+ */
+#define MAX_FRAMES 100
+#define PLAYBACK_INTERVAL 2        // Display frames per animation frame (30 fps)
+
+typedef struct {
+    u8 layer;
+    u16 tileIndex;
+    u8* data;                      // NULL = tile reset to unscratched
+} FrameTile;
+
+typedef struct {
+    FrameTile* tiles;
+    int tileCount;
+} FlipFrame;
+
+typedef u8* FrameTable[MAX_LAYERS][CANVAS_TILE_COUNT];
+
+FlipFrame flipFrames[MAX_FRAMES];
+int frameCount = 1;
+int currentFrame = 0;
+
+bool onionSkin = false;            // Tint the previous frame under the current one
+bool flipbookPlaying = false;
+int playbackFrame = 0;
+int playbackTick = 0;
+
+static FrameTable onionTable;      // Previous frame (valid when currentFrame > 0)
+static FrameTable playbackTable;   // Frame being played back
+static FrameTable scratchTableA;
+static FrameTable scratchTableB;
+static FrameTable liveTable;       // Live masks, 8-bit (see liveMaskRows)
+
+// Apply one frame's delta to a frame table
+static void applyFrameDelta(FrameTable table, const FlipFrame* frame) {
+    for (int i = 0; i < frame->tileCount; i++) {
+        const FrameTile* tile = &frame->tiles[i];
+        table[tile->layer][tile->tileIndex] = tile->data;
+    }
+}
+
+// Build the table of a frame from the deltas up to it (frame -1 = blank)
+static void buildFrameTable(FrameTable table, int frame) {
+    memset(table, 0, sizeof(FrameTable));
+    for (int f = 0; f <= frame; f++) {
+        applyFrameDelta(table, &flipFrames[f]);
+    }
+}
+
+static void freeFrameDelta(FlipFrame* frame) {
+    for (int i = 0; i < frame->tileCount; i++) {
+        free(frame->tiles[i].data);
+    }
+    free(frame->tiles);
+    frame->tiles = NULL;
+    frame->tileCount = 0;
+}
+
+// Compare two tiles; NULL stands for an all-255 tile
+static bool tilesEqual(const u8* a, const u8* b) {
+    if (a == b) return true;
+    if (!a || !b) {
+        const u8* tile = a ? a : b;
+        for (int i = 0; i < TILE_PIXELS; i++) {
+            if (tile[i] != 255) return false;
+        }
+        return true;
+    }
+    return memcmp(a, b, TILE_PIXELS) == 0;
+}
+
+/**
+ * Encode the tiles that differ between two sets of layer masks as a new
+ * delta owning copies of the changed tiles. Returns false if out of memory.
+ */
+static bool encodeFrameDelta(FlipFrame* out, u8** const from[MAX_LAYERS], u8** const to[MAX_LAYERS]) {
+    int changed = 0;
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (!tilesEqual(from[layer][i], to[layer][i])) changed++;
+        }
+    }
+    
+    out->tiles = NULL;
+    out->tileCount = 0;
+    if (changed == 0) return true;
+    
+    out->tiles = (FrameTile*)malloc(changed * sizeof(FrameTile));
+    if (!out->tiles) return false;
+    
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            const u8* source = to[layer][i];
+            if (tilesEqual(from[layer][i], source)) continue;
+            
+            FrameTile* tile = &out->tiles[out->tileCount];
+            tile->layer = layer;
+            tile->tileIndex = i;
+            tile->data = NULL;
+            if (source && !tilesEqual(NULL, source)) {
+                tile->data = (u8*)malloc(TILE_PIXELS);
+                if (!tile->data) {
+                    freeFrameDelta(out);
+                    return false;
+                }
+                memcpy(tile->data, source, TILE_PIXELS);
+            }
+            out->tileCount++;
+        }
+    }
+    return true;
+}
+
+// Per-layer row pointers of a frame table / of the live masks
+static void frameTableRows(FrameTable table, u8** rows[MAX_LAYERS]) {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) rows[layer] = table[layer];
+}
+
+// Frames are stored 8-bit, so packed live tiles are expanded into liveTable
+// for the comparison; releaseLiveMaskRows frees the expanded copies.
+// Returns false if out of memory.
+static bool liveMaskRows(u8** rows[MAX_LAYERS]) {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        rows[layer] = liveTable[layer];
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            liveTable[layer][i] = layers[layer].maskTiles[i];
+            if (!layers[layer].maskBits[i]) continue;
+            liveTable[layer][i] = (u8*)malloc(TILE_PIXELS);
+            if (!liveTable[layer][i]) return false;
+            unpackBinaryTile(layers[layer].maskBits[i], liveTable[layer][i]);
+        }
+    }
+    return true;
+}
+
+static void releaseLiveMaskRows() {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (layers[layer].maskBits[i]) free(liveTable[layer][i]);
+            liveTable[layer][i] = NULL;
+        }
+    }
+}
+
+static void refreshOnionTable() {
+    buildFrameTable(onionTable, currentFrame - 1);
+}
+
+/**
+ * Write the live masks back into the current frame: its delta against the
+ * previous frame, and the next frame's delta against it.
+ */
+bool storeCurrentFrame() {
+    u8** previous[MAX_LAYERS];
+    u8** live[MAX_LAYERS];
+    u8** next[MAX_LAYERS];
+    FlipFrame newCurrent, newNext = {NULL, 0};
+    bool hasNext = currentFrame + 1 < frameCount;
+    
+    buildFrameTable(scratchTableA, currentFrame - 1);
+    frameTableRows(scratchTableA, previous);
+    if (!liveMaskRows(live) || !encodeFrameDelta(&newCurrent, previous, live)) {
+        releaseLiveMaskRows();
+        return false;
+    }
+    
+    if (hasNext) {
+        buildFrameTable(scratchTableB, currentFrame + 1);
+        frameTableRows(scratchTableB, next);
+        if (!encodeFrameDelta(&newNext, live, next)) {
+            releaseLiveMaskRows();
+            freeFrameDelta(&newCurrent);
+            return false;
+        }
+    }
+    releaseLiveMaskRows();
+    
+    // The old deltas are no longer referenced once the new ones exist
+    freeFrameDelta(&flipFrames[currentFrame]);
+    flipFrames[currentFrame] = newCurrent;
+    if (hasNext) {
+        freeFrameDelta(&flipFrames[currentFrame + 1]);
+        flipFrames[currentFrame + 1] = newNext;
+    }
+    refreshOnionTable();
+    return true;
+}
+
+// Replace the live masks with a copy of a stored frame
+static void loadFrame(int frame) {
+    clearUndoHistory();
+    clearCanvasMask();  // Flags the outgoing tiles as changed
+    
+    buildFrameTable(scratchTableA, frame);
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (!scratchTableA[layer][i]) continue;
+            u8* tile = (u8*)malloc(TILE_PIXELS);
+            if (!tile) continue;  // Out of memory: tile stays unscratched
+            memcpy(tile, scratchTableA[layer][i], TILE_PIXELS);
+            setMaskTile(layer, i, tile);
+        }
+    }
+    markLiveTilesDirty();
+    
+    currentFrame = frame;
+    refreshOnionTable();
+}
+
+void gotoFrame(int frame) {
+    if (frame < 0 || frame >= frameCount || frame == currentFrame) return;
+    if (!storeCurrentFrame()) return;
+    loadFrame(frame);
+}
+
+// Insert a copy of the current frame after it and continue on the copy
+void insertFrame() {
+    if (frameCount >= MAX_FRAMES) return;
+    if (!storeCurrentFrame()) return;
+    
+    memmove(&flipFrames[currentFrame + 2], &flipFrames[currentFrame + 1],
+            (frameCount - currentFrame - 1) * sizeof(FlipFrame));
+    flipFrames[currentFrame + 1].tiles = NULL;  // Same as the frame before it
+    flipFrames[currentFrame + 1].tileCount = 0;
+    frameCount++;
+    currentFrame++;
+    
+    clearUndoHistory();
+    refreshOnionTable();
+}
+
+// Delete the current frame and move on to the one that replaces it
+void deleteFrame() {
+    if (frameCount <= 1) return;
+    
+    // The next frame's delta must now lead from the previous frame to it
+    if (currentFrame + 1 < frameCount) {
+        u8** previous[MAX_LAYERS];
+        u8** next[MAX_LAYERS];
+        FlipFrame newNext;
+        
+        buildFrameTable(scratchTableA, currentFrame - 1);
+        buildFrameTable(scratchTableB, currentFrame + 1);
+        frameTableRows(scratchTableA, previous);
+        frameTableRows(scratchTableB, next);
+        if (!encodeFrameDelta(&newNext, previous, next)) return;
+        
+        freeFrameDelta(&flipFrames[currentFrame + 1]);
+        flipFrames[currentFrame + 1] = newNext;
+    }
+    
+    freeFrameDelta(&flipFrames[currentFrame]);
+    memmove(&flipFrames[currentFrame], &flipFrames[currentFrame + 1],
+            (frameCount - currentFrame - 1) * sizeof(FlipFrame));
+    frameCount--;
+    flipFrames[frameCount].tiles = NULL;
+    flipFrames[frameCount].tileCount = 0;
+    
+    loadFrame((currentFrame < frameCount) ? currentFrame : frameCount - 1);
+}
+
+// Drop all frames; the live masks become the only frame
+void resetFlipbook() {
+    for (int f = 0; f < frameCount; f++) {
+        freeFrameDelta(&flipFrames[f]);
+    }
+    frameCount = 1;
+    currentFrame = 0;
+    flipbookPlaying = false;
+    memset(onionTable, 0, sizeof(FrameTable));
+}
+
+void startPlayback() {
+    if (frameCount <= 1 || !storeCurrentFrame()) return;
+    
+    buildFrameTable(playbackTable, 0);
+    playbackFrame = 0;
+    playbackTick = 0;
+    flipbookPlaying = true;
+}
+
+// Advance playback one display frame; only changed tiles are decoded
+void updatePlayback() {
+    if (++playbackTick < PLAYBACK_INTERVAL) return;
+    playbackTick = 0;
+    
+    playbackFrame++;
+    if (playbackFrame == frameCount) {
+        // Loop back to the start
+        playbackFrame = 0;
+        buildFrameTable(playbackTable, 0);
+    } else {
+        applyFrameDelta(playbackTable, &flipFrames[playbackFrame]);
+    }
+}
 
 /**
  * GALLERY FUNCTIONS
@@ -238,9 +1017,9 @@ void freeGalleryImages() {
 }
 
 /**
- * Load a saved drawing into the current canvas
+ * Load a saved drawing into the images of the top and bottom layers
  */
-bool loadDrawing(const char* filename) {
+bool loadDrawingImage(const char* filename) {
     FILE* file = fopen(filename, "rb");
     if (!file) return false;
     
@@ -275,35 +1054,48 @@ bool loadDrawing(const char* filename) {
             int bmpIdx = ((239 - y) * 320 + x) * 3;  // BMP bottom-to-top
             int fbIdx = (x * 240 + (239 - y)) * 3;   // Framebuffer format
             
-            // Copy BGR data to BOTH layers so drawing reveals the same image
-            baseImage[fbIdx + 0] = pixelData[bmpIdx + 0];  // B
-            baseImage[fbIdx + 1] = pixelData[bmpIdx + 1];  // G
-            baseImage[fbIdx + 2] = pixelData[bmpIdx + 2];  // R
+            // Copy BGR data to top AND bottom layers so drawing reveals the same image
+            layers[0].image[fbIdx + 0] = pixelData[bmpIdx + 0];  // B
+            layers[0].image[fbIdx + 1] = pixelData[bmpIdx + 1];  // G
+            layers[0].image[fbIdx + 2] = pixelData[bmpIdx + 2];  // R
             
-            // KEY FIX: Copy to rotatedImage as well
-            rotatedImage[fbIdx + 0] = pixelData[bmpIdx + 0];  // B
-            rotatedImage[fbIdx + 1] = pixelData[bmpIdx + 1];  // G
-            rotatedImage[fbIdx + 2] = pixelData[bmpIdx + 2];  // R
+            // KEY FIX: Copy to the bottom layer as well
+            layers[layerCount - 1].image[fbIdx + 0] = pixelData[bmpIdx + 0];  // B
+            layers[layerCount - 1].image[fbIdx + 1] = pixelData[bmpIdx + 1];  // G
+            layers[layerCount - 1].image[fbIdx + 2] = pixelData[bmpIdx + 2];  // R
         }
     }
     
-    // Clear scratch mask to show loaded image
-    memset(scratchMask, 255, sizeof(scratchMask));
-    
-    // Clear undo/redo stacks when loading new image
-    undoTop = 0;
-    redoTop = 0;
-    
     free(pixelData);
+    layers[0].indexed = false;
+    layers[layerCount - 1].indexed = false;
+    layerImagesChanged = true;
+    snprintf(loadedImageName, sizeof(loadedImageName), "%s", filename);
     return true;
 }
 
 /**
- * Draw gallery thumbnails on top screen using direct framebuffer rendering
+ * Load a saved drawing into the current canvas
  */
-void drawGallery(u8* framebuffer) {
-    // Clear framebuffer to dark background
-    memset(framebuffer, 20, 240 * 400 * 3);
+bool loadDrawing(const char* filename) {
+    if (!loadDrawingImage(filename)) return false;
+    
+    // Clear undo/redo stacks when loading new image
+    clearUndoHistory();
+    
+    // Clear scratch mask to show loaded image
+    clearCanvasMask();
+    resetFlipbook();
+    resetView();
+    return true;
+}
+
+/**
+ * Draw gallery thumbnails on top screen using direct framebuffer rendering
+ */
+void drawGallery(u8* framebuffer) {
+    // Clear framebuffer to dark background
+    memset(framebuffer, 20, 240 * 400 * 3);
     
     if (galleryImageCount == 0) {
         // No images - could draw "No saved images" text here
@@ -403,45 +1195,84 @@ void drawGallery(u8* framebuffer) {
 /**
  * UNDO/REDO SYSTEM
  * 
- * Push current scratch mask state onto undo stack.
+ * Start a new undo record for the action about to happen.
+ * Tiles are saved into it lazily as the action modifies them.
  * When stack is full, oldest entry is discarded (FIFO).
  * Any new action clears the redo stack (standard undo/redo behavior).
  */
 void pushUndo() {
     if (undoTop >= MAX_HISTORY) {
         // Shift all entries left to discard oldest
-        for (int i = 1; i < MAX_HISTORY; i++) {
-            memcpy(undoStack[i - 1], undoStack[i], sizeof(scratchMask));
-        }
+        freeUndoRecord(&undoStack[0]);
+        memmove(&undoStack[0], &undoStack[1], (MAX_HISTORY - 1) * sizeof(UndoRecord));
         undoTop = MAX_HISTORY - 1;
     }
-    memcpy(undoStack[undoTop++], scratchMask, sizeof(scratchMask));
-    redoTop = 0; // New action invalidates redo history
+    
+    // New action invalidates redo history
+    for (int i = 0; i < redoTop; i++) freeUndoRecord(&redoStack[i]);
+    redoTop = 0;
+    
+    memset(&undoStack[undoTop++], 0, sizeof(UndoRecord));
+    undoSerial++;
+    undoRecording = true;
+}
+
+/**
+ * Exchange the tiles stored in a record with the live canvas tiles.
+ * Applying it once reverts an action; applying it again re-does it.
+ */
+void swapRecordTiles(UndoRecord* record) {
+    for (int i = 0; i < record->count; i++) {
+        UndoTile* saved = &record->tiles[i];
+        u8** tiles = layers[saved->layer].maskTiles;
+        u32** bits = layers[saved->layer].maskBits;
+        int tileIndex = saved->tileIndex;
+        
+        // The outgoing tile is packed too when it allows
+        u8* current = (u8*)bits[tileIndex];
+        bool packed = current != NULL;
+        if (tiles[tileIndex]) {
+            current = (u8*)packBinaryTile(tiles[tileIndex]);
+            packed = current != NULL;
+            if (packed) {
+                free(tiles[tileIndex]);
+            } else {
+                current = tiles[tileIndex];
+            }
+        }
+        
+        // Packed records go back live packed
+        tiles[tileIndex] = saved->packed ? NULL : saved->data;
+        bits[tileIndex] = saved->packed ? (u32*)saved->data : NULL;
+        saved->data = current;
+        saved->packed = packed;
+        tileDirty[saved->layer][tileIndex] |= TILE_DIRTY_KEYFRAME | TILE_DIRTY_JOURNAL | TILE_DIRTY_AUTOSAVE | TILE_DIRTY_TEXTURE;
+    }
 }
 
 /**
- * Restore previous scratch mask state from undo stack
- * Current state is saved to redo stack before reverting
+ * Restore previous canvas state from undo stack
+ * The swapped-out tiles become the redo record
  */
 void undo() {
     if (undoTop > 0) {
-        // Save current state to redo stack
-        memcpy(redoStack[redoTop++], scratchMask, sizeof(scratchMask));
-        // Restore previous state
-        memcpy(scratchMask, undoStack[--undoTop], sizeof(scratchMask));
+        undoRecording = false;  // Stop capturing into the record being undone
+        UndoRecord record = undoStack[--undoTop];
+        swapRecordTiles(&record);
+        redoStack[redoTop++] = record;
     }
 }
 
 /**
- * Restore next scratch mask state from redo stack
- * Current state is saved to undo stack before advancing
+ * Restore next canvas state from redo stack
+ * The swapped-out tiles become the undo record again
  */
 void redo() {
     if (redoTop > 0) {
-        // Save current state to undo stack
-        memcpy(undoStack[undoTop++], scratchMask, sizeof(scratchMask));
-        // Restore next state
-        memcpy(scratchMask, redoStack[--redoTop], sizeof(scratchMask));
+        undoRecording = false;
+        UndoRecord record = redoStack[--redoTop];
+        swapRecordTiles(&record);
+        undoStack[undoTop++] = record;
     }
 }
 
@@ -474,449 +1305,5234 @@ bool loadLogo() {
 /**
  * FRAMEBUFFER GENERATION
  * 
- * Generate the base (top) layer with checkerboard or solid pattern.
- * The 3DS framebuffer is rotated 90° clockwise, so coordinates are transformed:
- * Screen(x,y) -> Framebuffer(x, HEIGHT-1-y)
+ * Layer images are procedural patterns of levels from PATTERN_PAPER to
+ * PATTERN_INK; each layer's lut turns a level into a blend of the paper
+ * color and the layer's palette color (see updateLayerPalettes), in BGR
+ * order like the framebuffer. Changing colors never touches the pixels.
  * 
- * Framebuffer uses BGR color format (not RGB).
+ * The framebuffer is rotated 90°, so every screen column is a contiguous
+ * run of pixels: Screen(x,y) -> column x, row SCREEN_HEIGHT-1-y. Generators
+ * work a column at a time with integer arithmetic, using per-row tables
+ * built once per call. Every pattern repeats horizontally every `period`
+ * pixels, so only the first period columns are evaluated and the rest
+ * are copied. All patterns tile seamlessly across the virtual canvas.
  */
-void generateCheckerboard(u8* buffer, int cellSize) {
-    Color primaryColor = rainbowColors[currentColorIndex];
+typedef void (*PatternColumns)(u8* buffer, int shiftX, int shiftY, int size);
+
+typedef struct {
+    PatternColumns generate;  // Fills columns 0..period-1, offset by the shift
+    int period;               // Horizontal repeat in pixels, divides SCREEN_WIDTH
+    int size;                 // Pattern specific: level, cell, width or radius
+} PatternDef;
+
+static inline u8* patternColumn(u8* buffer, int x) {
+    return &buffer[x * SCREEN_HEIGHT * 3];
+}
+
+static inline void putPatternLevel(u8* column, int y, int level) {
+    column[(SCREEN_HEIGHT - 1 - y) * 3] = level;
+}
+
+static inline int clampLevel(int level) {
+    return level < PATTERN_PAPER ? PATTERN_PAPER : level > PATTERN_INK ? PATTERN_INK : level;
+}
+
+// Flat paper (size 0) or ink (size 255)
+static void fillPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    u8* column = patternColumn(buffer, 0);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) putPatternLevel(column, y, size);
+}
+
+// Checkerboard of size x size cells
+static void checkerPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    u8 rowCell[SCREEN_HEIGHT];
+    for (int y = 0; y < SCREEN_HEIGHT; y++) rowCell[y] = ((y + shiftY) / size) & 1;
     
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int x = 0; x < size * 2; x++) {
+        u8* column = patternColumn(buffer, x);
+        int colCell = ((x + shiftX) / size) & 1;
         for (int y = 0; y < SCREEN_HEIGHT; y++) {
-            u8 r, g, b;
-            
-            if (currentMode == MODE_COLOR_ON_WHITE) {
-                // Solid white canvas for color drawing mode
-                r = g = b = 255;
-            } else if (currentMode == MODE_COLOR_ON_BLACK) {
-                // Solid dark grey (draw on dark canvas)
-                r = g = b = 20;
-            } else {
-                // Checkerboard pattern: alternate between color and black/white
-                int cellX = x / cellSize;
-                int cellY = y / cellSize;
-                int isColored = (cellX + cellY) % 2;  // Checkerboard logic
-                
-                if (isColored) {
-                    r = primaryColor.r;
-                    g = primaryColor.g;
-                    b = primaryColor.b;
-                } else {
-                    // Background is either black (0) or white (255)
-                    u8 bgValue = (currentMode == MODE_CHECKERBOARD_BLACK) ? 0 : 255;
-                    r = g = b = bgValue;
-                }
-            }
-            
-            // Transform screen coordinates to framebuffer coordinates
-            int fbX = x;
-            int fbY = y;
-            int offset = (fbX * FB_WIDTH + (FB_HEIGHT - 1 - fbY)) * 3;
-            
-            // Write BGR pixel data (3DS uses BGR, not RGB!)
-            if (offset >= 0 && offset < FB_WIDTH * FB_HEIGHT * 3 - 2) {
-                buffer[offset + 0] = b;
-                buffer[offset + 1] = g;
-                buffer[offset + 2] = r;
-            }
+            putPatternLevel(column, y, (colCell ^ rowCell[y]) ? PATTERN_INK : PATTERN_PAPER);
         }
     }
 }
 
-/**
- * Generate the rotated (bottom) layer - the "hidden" pattern revealed by scratching.
- * For checkerboard modes, pattern is rotated 90° for visual interest.
- * For solid color modes, this layer contains the drawing color.
- */
-void generateRotatedCheckerboard(u8* buffer, int cellSize) {
-    Color primaryColor = rainbowColors[currentColorIndex];
+// Diagonal stripes, size pixels of ink every STRIPE_PERIOD
+#define STRIPE_PERIOD 20
+
+static void stripePattern(u8* buffer, int shiftX, int shiftY, int size) {
+    u8 rowPhase[SCREEN_HEIGHT];
+    u8 stripe[STRIPE_PERIOD * 2];
+    for (int y = 0; y < SCREEN_HEIGHT; y++) rowPhase[y] = (y + shiftY) % STRIPE_PERIOD;
+    for (int i = 0; i < STRIPE_PERIOD * 2; i++) {
+        stripe[i] = (i % STRIPE_PERIOD < size) ? PATTERN_INK : PATTERN_PAPER;
+    }
+    
+    for (int x = 0; x < STRIPE_PERIOD; x++) {
+        u8* column = patternColumn(buffer, x);
+        const u8* phase = &stripe[(x + shiftX) % STRIPE_PERIOD];
+        for (int y = 0; y < SCREEN_HEIGHT; y++) putPatternLevel(column, y, phase[rowPhase[y]]);
+    }
+}
+
+// Anti-aliased dots of radius size, one per DOT_PERIOD cell
+#define DOT_PERIOD 20
+#define DOT_MAX_DISTANCE (2 * (DOT_PERIOD / 2) * (DOT_PERIOD / 2))
+
+static void dotPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    u8 rowDistance[SCREEN_HEIGHT];
+    u8 levelAt[DOT_MAX_DISTANCE + 1];  // By squared distance from the center
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        int dy = (y + shiftY) % DOT_PERIOD - DOT_PERIOD / 2;
+        rowDistance[y] = dy * dy;
+    }
+    for (int d = 0; d <= DOT_MAX_DISTANCE; d++) {
+        levelAt[d] = clampLevel((int)((size + 0.5f - sqrtf(d)) * PATTERN_INK));
+    }
+    
+    for (int x = 0; x < DOT_PERIOD; x++) {
+        u8* column = patternColumn(buffer, x);
+        int dx = (x + shiftX) % DOT_PERIOD - DOT_PERIOD / 2;
+        int colDistance = dx * dx;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            putPatternLevel(column, y, levelAt[colDistance + rowDistance[y]]);
+        }
+    }
+}
+
+// Sum of a horizontal and a vertical triangle wave spanning the screen
+static int triangleLevel(int position, int period) {
+    position %= period;
+    return (position < period - position ? position : period - position) * 256 / period;
+}
+
+static void gradientPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    int rowLevel[SCREEN_HEIGHT];
+    for (int y = 0; y < SCREEN_HEIGHT; y++) rowLevel[y] = triangleLevel(y + shiftY, SCREEN_HEIGHT);
     
     for (int x = 0; x < SCREEN_WIDTH; x++) {
+        u8* column = patternColumn(buffer, x);
+        int colLevel = triangleLevel(x + shiftX, SCREEN_WIDTH);
         for (int y = 0; y < SCREEN_HEIGHT; y++) {
-            u8 r, g, b;
-            
-            if (currentMode == MODE_COLOR_ON_WHITE || currentMode == MODE_COLOR_ON_BLACK) {
-                // Hidden layer is the current color for drawing modes
-                r = primaryColor.r;
-                g = primaryColor.g;
-                b = primaryColor.b;
-            } else {
-                // Apply 90° rotation to checkerboard coordinates
-                int rotX = y;
-                int rotY = SCREEN_WIDTH - x - 1;
-                
-                int cellX = rotX / cellSize;
-                int cellY = rotY / cellSize;
-                int isColored = (cellX + cellY) % 2;
-                
-                if (isColored) {
-                    r = primaryColor.r;
-                    g = primaryColor.g;
-                    b = primaryColor.b;
-                } else {
-                    u8 bgValue = (currentMode == MODE_CHECKERBOARD_BLACK) ? 0 : 255;
-                    r = g = b = bgValue;
-                }
-            }
-            
-            int offset = (x * FB_WIDTH + (FB_HEIGHT - 1 - y)) * 3;
-            
-            if (offset >= 0 && offset < FB_WIDTH * FB_HEIGHT * 3 - 2) {
-                buffer[offset + 0] = b;
-                buffer[offset + 1] = g;
-                buffer[offset + 2] = r;
-            }
+            putPatternLevel(column, y, clampLevel(colLevel + rowLevel[y]));
         }
     }
 }
 
 /**
- * ALPHA COMPOSITING
+ * Hexagon outlines, size pixels wide. The hexagons are the cells around
+ * two interleaved rectangular lattices of centers, A at (HEX_W*i, HEX_H*j)
+ * and B offset by half a cell. Distances are in 1/HEX_SCALE pixels so the
+ * lattice fits the screen height exactly (HEX_H is 240/7 pixels), keeping
+ * the cells within 1% of regular.
  * 
- * Blend two layers using the scratch mask as alpha channel.
- * Formula: dest = bottom * (1 - alpha) + top * alpha
- * 
- * alpha = 0:   Show bottom layer fully (scratched away)
- * alpha = 255: Show top layer fully (unscratched)
+ * A pixel's distance to its cell edge is the smaller of its distance to
+ * the bisector with the nearest center of the other lattice and to the
+ * vertical edge shared with its horizontal neighbours.
  */
-void compositeImage(u8* dest, u8* bottom, u8* top, u8* mask) {
-    for (int i = 0; i < FB_WIDTH * FB_HEIGHT; i++) {
-        int pixelIdx = i * 3;
-        u8 alpha = mask[i];
+#define HEX_SCALE 7
+#define HEX_W 140          // 20 pixels
+#define HEX_H 240          // 240/7 pixels
+#define HEX_PERIOD (HEX_W / HEX_SCALE)
+#define HEX_NEIGHBOUR 280  // Twice the center spacing to the other lattice (~139)
+
+// Signed offset from the nearest lattice position, in [-period/2, period/2)
+static inline int latticeOffset(int position, int period) {
+    return (position + period / 2) % period - period / 2;
+}
+
+static void hexPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    int rowA[SCREEN_HEIGHT], rowB[SCREEN_HEIGHT];  // Squared vertical distances
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        int units = (y + shiftY) * HEX_SCALE;
+        int dyA = latticeOffset(units, HEX_H);
+        int dyB = latticeOffset(units + HEX_H / 2, HEX_H);
+        rowA[y] = dyA * dyA;
+        rowB[y] = dyB * dyB;
+    }
+    int falloff = size * HEX_SCALE;  // Half the line on each side of the edge
+    
+    for (int x = 0; x < HEX_PERIOD; x++) {
+        u8* column = patternColumn(buffer, x);
+        int units = (x + shiftX) * HEX_SCALE;
+        int dxA = latticeOffset(units, HEX_W);
+        int dxB = latticeOffset(units + HEX_W / 2, HEX_W);
+        int colA = dxA * dxA, colB = dxB * dxB;
+        int edgeA = HEX_W / 2 - abs(dxA), edgeB = HEX_W / 2 - abs(dxB);
         
-        // Blend each color channel separately (B, G, R)
-        dest[pixelIdx + 0] = (bottom[pixelIdx + 0] * (255 - alpha) + top[pixelIdx + 0] * alpha) / 255;
-        dest[pixelIdx + 1] = (bottom[pixelIdx + 1] * (255 - alpha) + top[pixelIdx + 1] * alpha) / 255;
-        dest[pixelIdx + 2] = (bottom[pixelIdx + 2] * (255 - alpha) + top[pixelIdx + 2] * alpha) / 255;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int distA = colA + rowA[y];
+            int distB = colB + rowB[y];
+            int edge = (distA < distB) ? (distB - distA) / HEX_NEIGHBOUR : (distA - distB) / HEX_NEIGHBOUR;
+            int vertical = (distA < distB) ? edgeA : edgeB;
+            if (vertical < edge) edge = vertical;
+            putPatternLevel(column, y, clampLevel(PATTERN_INK - edge * PATTERN_INK / falloff));
+        }
     }
 }
 
 /**
- * DRAWING ENGINE
- * 
- * Apply brush to scratch mask at touch coordinates.
- * Modifies alpha values in scratchMask to reveal hidden layer.
- * 
- * Supports three brush shapes:
- * - CIRCLE: Hard-edged circular brush
- * - SQUARE: Hard-edged square brush
- * - SOFT: Feathered circular brush with smooth falloff
+ * Smooth value noise: two octaves of random lattice values on 40 and 20
+ * pixel grids that wrap at the screen edges, blended with smoothstep
+ * weights. Each column first blends the lattice horizontally, leaving one
+ * vertical blend per pixel.
  */
-void scratchAt(int touchX, int touchY, int brushSize) {
-    if (touchX < 0 || touchX >= 320 || touchY < 0 || touchY >= 240) return;
+#define NOISE_OCTAVES 2
+#define NOISE_CELL 40      // Coarse octave; each next one halves it
+#define NOISE_MAX_ROWS (SCREEN_HEIGHT / (NOISE_CELL >> (NOISE_OCTAVES - 1)))
+
+static int noiseLattice(int i, int j, int octave) {
+    u32 hash = (u32)i * 73856093u ^ (u32)j * 19349663u ^ (u32)octave * 83492791u;
+    hash *= 2654435761u;
+    return hash >> 24;
+}
+
+// Smoothstep weight (0-256) for a position inside a cell
+static int noiseWeight(int offset, int cell) {
+    int t = offset * 256 / cell;
+    return t * t * (3 * 256 - 2 * t) >> 16;
+}
+
+static void noisePattern(u8* buffer, int shiftX, int shiftY, int size) {
+    u8 rowCell[NOISE_OCTAVES][SCREEN_HEIGHT];
+    u16 rowWeight[NOISE_OCTAVES][SCREEN_HEIGHT];
+    for (int o = 0; o < NOISE_OCTAVES; o++) {
+        int cell = NOISE_CELL >> o;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int position = (y + shiftY) % SCREEN_HEIGHT;
+            rowCell[o][y] = position / cell;
+            rowWeight[o][y] = noiseWeight(position % cell, cell);
+        }
+    }
     
-    // Iterate over bounding box of brush
-    for (int dx = -brushSize; dx <= brushSize; dx++) {
-        for (int dy = -brushSize; dy <= brushSize; dy++) {
-            int px = touchX + dx;
-            int py = touchY + dy;
-            
-            // Bounds check
-            if (px < 0 || px >= 320 || py >= 240) continue;
-            if (py < 0) py = 0;  // Allow slight negative y to prevent gaps
-            
-            // Convert screen coordinates to mask index
-            int maskIdx = px * 240 + (239 - py);
-            if (maskIdx < 0 || maskIdx >= FB_WIDTH * FB_HEIGHT) continue;
-            
-            bool shouldDraw = false;
-            u8 alphaValue = 0;
-            
-            switch (currentBrushShape) {
-                case BRUSH_CIRCLE:
-                    // Circular brush: check if pixel is within radius
-                    if (dx*dx + dy*dy <= brushSize*brushSize) {
-                        shouldDraw = true;
-                        alphaValue = 0;  // Fully reveal bottom layer
-                    }
-                    break;
-                    
-                case BRUSH_SQUARE:
-                    // Square brush: always draw within bounding box
-                    shouldDraw = true;
-                    alphaValue = 0;
-                    break;
-                    
-                case BRUSH_SOFT:
-                    // Soft brush: feathered edges with improved falloff curve
-                    {
-                        float distance = sqrtf(dx*dx + dy*dy);
-                        if (distance <= brushSize) {
-                            shouldDraw = true;
-                            // Improved falloff: quadratic easing for smoother appearance
-                            float falloff = distance / brushSize;
-                            falloff = falloff * falloff;  // Square for smoother gradient
-                            alphaValue = (u8)(falloff * 255);
-                            
-                            // Blend with existing alpha for accumulation
-                            u8 currentAlpha = scratchMask[maskIdx];
-                            alphaValue = (currentAlpha < alphaValue) ? currentAlpha : alphaValue;
-                        }
-                    }
-                    break;
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        u8* column = patternColumn(buffer, x);
+        int position = (x + shiftX) % SCREEN_WIDTH;
+        int blended[NOISE_OCTAVES][NOISE_MAX_ROWS + 1];  // Lattice rows blended at this column
+        
+        for (int o = 0; o < NOISE_OCTAVES; o++) {
+            int cell = NOISE_CELL >> o;
+            int i = position / cell;
+            int weight = noiseWeight(position % cell, cell);
+            int columns = SCREEN_WIDTH / cell, rows = SCREEN_HEIGHT / cell;
+            for (int j = 0; j <= rows; j++) {
+                int left = noiseLattice(i, j % rows, o);
+                int right = noiseLattice((i + 1) % columns, j % rows, o);
+                blended[o][j] = left * 256 + (right - left) * weight;
             }
-            
-            if (shouldDraw) {
-                scratchMask[maskIdx] = alphaValue;
+        }
+        
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int value = 0;
+            for (int o = 0; o < NOISE_OCTAVES; o++) {
+                int* lattice = &blended[o][rowCell[o][y]];
+                int octave = (lattice[0] * 256 + (lattice[1] - lattice[0]) * rowWeight[o][y]) >> 16;
+                value += octave * (2 - o);  // Coarse octave weighs twice as much
             }
+            // Averaged lattice values bunch up around the middle; stretch them out
+            putPatternLevel(column, y, clampLevel(128 + (value / 3 - 128) * 3 / 2));
         }
     }
 }
 
 /**
- * LINE INTERPOLATION
- * 
- * Draw smooth line between two points using Bresenham-style algorithm.
- * This prevents gaps when touch moves quickly between frames.
- * Called with previous and current touch positions.
+ * Plasma: sum of sines along x, y and both diagonals, folded through
+ * another sine for the banded look. Phases step by 256/320 per pixel
+ * horizontally and 256/240 vertically, so every term wraps seamlessly.
  */
-void drawLine(int x0, int y0, int x1, int y1, int brushSize) {
-    int dx = abs(x1 - x0);
-    int dy = abs(y1 - y0);
-    int sx = (x0 < x1) ? 1 : -1;
-    int sy = (y0 < y1) ? 1 : -1;
-    int err = dx - dy;
+static s8 patternSine[256];
+
+static int plasmaPhaseX(int x, int frequency) {
+    return ((x % SCREEN_WIDTH) * frequency * 256 / SCREEN_WIDTH) & 255;
+}
+
+static int plasmaPhaseY(int y, int frequency) {
+    return ((y % SCREEN_HEIGHT) * frequency * 256 / SCREEN_HEIGHT) & 255;
+}
+
+static void plasmaPattern(u8* buffer, int shiftX, int shiftY, int size) {
+    if (patternSine[64] == 0) {
+        for (int i = 0; i < 256; i++) patternSine[i] = (s8)(sinf(i * (float)M_PI / 128) * 127);
+    }
     
-    while (1) {
-        scratchAt(x0, y0, brushSize);
-        
-        if (x0 == x1 && y0 == y1) break;
-        
-        int e2 = 2 * err;
-        if (e2 > -dy) {
-            err -= dy;
-            x0 += sx;
-        }
-        if (e2 < dx) {
-            err += dx;
-            y0 += sy;
+    int rowWave[SCREEN_HEIGHT];
+    u8 rowDiagonal[SCREEN_HEIGHT], rowAnti[SCREEN_HEIGHT];
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        rowWave[y] = patternSine[plasmaPhaseY(y + shiftY, 3)];
+        rowDiagonal[y] = plasmaPhaseY(y + shiftY, 2);
+        rowAnti[y] = plasmaPhaseY(y + shiftY, 1);
+    }
+    
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        u8* column = patternColumn(buffer, x);
+        int colWave = patternSine[plasmaPhaseX(x + shiftX, 2)];
+        int diagonal = plasmaPhaseX(x + shiftX, 1);
+        int anti = plasmaPhaseX(x + shiftX, 3);
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int value = colWave + rowWave[y] +
+                        patternSine[(diagonal + rowDiagonal[y]) & 255] +
+                        patternSine[(anti - rowAnti[y]) & 255];
+            putPatternLevel(column, y, patternSine[(value >> 1) & 255] + 128);
         }
     }
 }
 
+static const PatternDef canvasPatterns[CANVAS_PATTERN_COUNT] = {
+    [CANVAS_PLAIN]    = {fillPattern, 1, PATTERN_PAPER},
+    [CANVAS_SOLID]    = {fillPattern, 1, PATTERN_INK},
+    [CANVAS_CHECKER]  = {checkerPattern, 40, 20},
+    [CANVAS_STRIPES]  = {stripePattern, STRIPE_PERIOD, STRIPE_PERIOD / 2},
+    [CANVAS_DOTS]     = {dotPattern, DOT_PERIOD, 6},
+    [CANVAS_GRADIENT] = {gradientPattern, SCREEN_WIDTH, 0},
+    [CANVAS_HEX]      = {hexPattern, HEX_PERIOD, 1},
+    [CANVAS_NOISE]    = {noisePattern, SCREEN_WIDTH, 0},
+    [CANVAS_PLASMA]   = {plasmaPattern, SCREEN_WIDTH, 0},
+};
+
+// Fill a layer image with a pattern moved left/up by (shiftX, shiftY) pixels
+void generatePattern(u8* buffer, CanvasPattern pattern, int shiftX, int shiftY) {
+    const PatternDef* def = &canvasPatterns[pattern];
+    def->generate(buffer, shiftX, shiftY, def->size);
+    
+    int columnBytes = SCREEN_HEIGHT * 3;
+    for (int x = def->period; x < SCREEN_WIDTH; x++) {
+        memcpy(patternColumn(buffer, x), patternColumn(buffer, x - def->period), columnBytes);
+    }
+}
+
 /**
- * CITRO2D INSTRUCTION SCREEN INITIALIZATION
- * 
- * Pre-parse all static instruction text once for efficient repeated rendering.
- * Text is optimized after parsing to improve GPU performance.
+ * Copy a pattern image moved left/up by (dx, dy) pixels, wrapping at the
+ * screen edges like the patterns do. Much cheaper than evaluating the
+ * slower patterns again for each layer that shares them.
  */
-void initInstructionText() {
-    // Parse each line of instruction text
-    C2D_TextParse(&instructionTexts[0], staticTextBuf, "SQRIBBLE 3DS");
-    C2D_TextOptimize(&instructionTexts[0]);
-    
-    C2D_TextParse(&instructionTexts[1], staticTextBuf, "v1.0");
-    C2D_TextOptimize(&instructionTexts[1]);
-    
-    C2D_TextParse(&instructionTexts[2], staticTextBuf, "BASIC CONTROLS:");
-    C2D_TextOptimize(&instructionTexts[2]);
-    
-    C2D_TextParse(&instructionTexts[3], staticTextBuf, "Touch: Draw");
-    C2D_TextOptimize(&instructionTexts[3]);
+static void copyShiftedPattern(u8* buffer, const u8* source, int dx, int dy) {
+    int columnBytes = SCREEN_HEIGHT * 3;
+    dx = (dx % SCREEN_WIDTH + SCREEN_WIDTH) % SCREEN_WIDTH;
+    dy = (dy % SCREEN_HEIGHT + SCREEN_HEIGHT) % SCREEN_HEIGHT;
     
-    C2D_TextParse(&instructionTexts[4], staticTextBuf, "L/R: Undo/Redo");
-    C2D_TextOptimize(&instructionTexts[4]);
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        u8* column = patternColumn(buffer, x);
+        const u8* from = &source[((x + dx) % SCREEN_WIDTH) * columnBytes];
+        // Rows are stored bottom-up, so moving the pattern up moves bytes later in the column
+        memcpy(column + dy * 3, from, columnBytes - dy * 3);
+        memcpy(column, from + columnBytes - dy * 3, dy * 3);
+    }
+}
+
+// Integer HSV to RGB (hue 0-359, saturation and value 0-255)
+static Color hsvToColor(int hue, int saturation, int value) {
+    int f = (hue % 60) * 255 / 60;
+    u8 p = value * (255 - saturation) / 255;
+    u8 q = value * (255 - saturation * f / 255) / 255;
+    u8 t = value * (255 - saturation * (255 - f) / 255) / 255;
+    u8 v = value;
     
-    C2D_TextParse(&instructionTexts[5], staticTextBuf, "D-Pad Up/Down: Brush size");
-    C2D_TextOptimize(&instructionTexts[5]);
+    switch (hue / 60) {
+        case 0:  return (Color){v, t, p};
+        case 1:  return (Color){q, v, p};
+        case 2:  return (Color){p, v, t};
+        case 3:  return (Color){p, q, v};
+        case 4:  return (Color){t, p, v};
+        default: return (Color){v, p, q};
+    }
+}
+
+static void setLutColor(u8* entry, Color color) {
+    entry[0] = color.b;
+    entry[1] = color.g;
+    entry[2] = color.r;
+}
+
+/**
+ * Rainbow and palette inks are a ramp that wraps around (level 255 is next
+ * to level 0), so the hidden layers can cycle colors by rotating their
+ * luts: a few hundred bytes per layer and frame, while the compositor
+ * picks up the new colors with the pixels untouched. Layers in between
+ * start a quarter turn further along than the layer above.
+ * 
+ * The pattern levels only span half the ramp: with the ramp wrapping,
+ * level 0 and PATTERN_INK would otherwise get the same color, and
+ * two-level patterns (checkerboard, stripes) would show as one. Spread
+ * out they land on opposite sides of it.
+ */
+static u8 hiddenRamp[PATTERN_COLORS][3];  // BGR, at phase 0
+
+static void buildHiddenRamp() {
+    for (int level = 0; level < PATTERN_COLORS; level++) {
+        Color color;
+        if (hiddenInk == HIDDEN_INK_RAINBOW) {
+            color = hsvToColor(level * 360 / PATTERN_COLORS, 255, 255);
+        } else {
+            // Evenly spaced stops, the last one blending back into the first
+            int position = level * numColors;
+            Color from = paletteColors[position / PATTERN_COLORS];
+            Color to = paletteColors[(position / PATTERN_COLORS + 1) % numColors];
+            int t = position % PATTERN_COLORS;
+            color.r = from.r + (to.r - from.r) * t / PATTERN_COLORS;
+            color.g = from.g + (to.g - from.g) * t / PATTERN_COLORS;
+            color.b = from.b + (to.b - from.b) * t / PATTERN_COLORS;
+        }
+        setLutColor(hiddenRamp[level], color);
+    }
+}
+
+static void rotateHiddenLuts() {
+    for (int i = 1; i < layerCount; i++) {
+        int shift = (colorCyclePhase + (i < layerCount - 1 ? i * PATTERN_COLORS / 4 : 0)) % PATTERN_COLORS;
+        for (int level = 0; level < PATTERN_COLORS; level++) {
+            int position = (shift + level * (PATTERN_COLORS / 2) / PATTERN_INK) % PATTERN_COLORS;
+            memcpy(layers[i].lut[level], hiddenRamp[position], 3);
+        }
+    }
+    layerLutsChanged = true;
+}
+
+// Advance the color cycling of the hidden layers by one frame
+void updateColorCycle() {
+    if (hiddenInk == HIDDEN_INK_COLOR || colorCycleSpeeds[colorCycle] == 0) return;
+    colorCyclePhase += colorCycleSpeeds[colorCycle];
+    rotateHiddenLuts();
+}
+
+/**
+ * Color the generated layers from the palette: the top and bottom layers
+ * use the current color, layers in between the next colors in the
+ * palette so each is distinguishable. Every level between paper and ink
+ * gets its blend. Hidden layers can use a rainbow or palette ramp
+ * instead. Cheap enough to call on every color change.
+ */
+void updateLayerPalettes() {
+    static const u8 paperValues[PAPER_STYLE_COUNT] = {255, 0, 20};
+    u8 paper = paperValues[currentPaper];
     
-    C2D_TextParse(&instructionTexts[6], staticTextBuf, "D-Pad L/R: Cycle primary color");
-    C2D_TextOptimize(&instructionTexts[6]);
+    for (int i = 0; i < layerCount; i++) {
+        if (i > 0 && hiddenInk != HIDDEN_INK_COLOR) continue;
+        bool middle = i > 0 && i < layerCount - 1;
+        Color ink = paletteColors[(currentColorIndex + (middle ? i : 0)) % numColors];
+        for (int level = 0; level < PATTERN_COLORS; level++) {
+            Color blend = {
+                paper + (ink.r - paper) * level / PATTERN_INK,
+                paper + (ink.g - paper) * level / PATTERN_INK,
+                paper + (ink.b - paper) * level / PATTERN_INK
+            };
+            setLutColor(layers[i].lut[level], blend);
+        }
+    }
     
-    C2D_TextParse(&instructionTexts[7], staticTextBuf, "A: Cycle Brush shape");
-    C2D_TextOptimize(&instructionTexts[7]);
+    if (hiddenInk != HIDDEN_INK_COLOR) {
+        buildHiddenRamp();
+        rotateHiddenLuts();
+    }
+    layerLutsChanged = true;
+}
+
+/**
+ * Regenerate the images of the layer stack, starting at firstLayer.
+ * The top layer shows topPattern; the layers below share hiddenPattern,
+ * the bottom one shifted by half a period and the ones in between by a
+ * quarter in each direction, so each scratch reveals something new.
+ */
+void generateLayerImages(int firstLayer) {
+    const u8* hidden = NULL;  // First hidden layer generated, for the others to copy
+    int hiddenShiftX = 0;
+    int hiddenShiftY = 0;
     
-    C2D_TextParse(&instructionTexts[8], staticTextBuf, "B: Cycle canvas style");
-    C2D_TextOptimize(&instructionTexts[8]);
+    if (firstLayer == 0) loadedImageName[0] = '\0';
+    for (int i = firstLayer; i < layerCount; i++) {
+        if (i == 0) {
+            generatePattern(layers[i].image, topPattern, 0, 0);
+        } else {
+            int period = canvasPatterns[hiddenPattern].period;
+            bool bottom = i == layerCount - 1;
+            int shiftX = bottom ? period / 2 : period / 4;
+            int shiftY = bottom ? 0 : period / 4;
+            
+            if (hidden) {
+                copyShiftedPattern(layers[i].image, hidden, shiftX - hiddenShiftX, shiftY - hiddenShiftY);
+            } else {
+                generatePattern(layers[i].image, hiddenPattern, shiftX, shiftY);
+                hidden = layers[i].image;
+                hiddenShiftX = shiftX;
+                hiddenShiftY = shiftY;
+            }
+        }
+        layers[i].indexed = true;
+    }
+    layerImagesChanged = true;
+    updateLayerPalettes();
+}
+
+/**
+ * LAYER STACK
+ * 
+ * Layers are spread evenly in depth: the top layer pops out by the full
+ * depthOffset and the bottom layer sits at the screen plane.
+ * Adding or removing a layer happens just above the bottom layer.
+ * Undo history and flipbook frames refer to layers by index, so history
+ * is dropped on changes and the stack is fixed once there are frames.
+ */
+void resetLayerDepths() {
+    for (int i = 0; i < layerCount; i++) {
+        layers[i].depth = (float)(layerCount - 1 - i) / (layerCount - 1);
+    }
+}
+
+void addLayer() {
+    if (layerCount >= MAX_LAYERS) return;
+    if (frameCount > 1) return;  // Flipbook frames store masks by layer index
     
-    C2D_TextParse(&instructionTexts[9], staticTextBuf, "X: Clear canvas");
-    C2D_TextOptimize(&instructionTexts[9]);
+    clearUndoHistory();
+    markLiveTilesDirty();  // Masks move between layer slots
     
-    C2D_TextParse(&instructionTexts[10], staticTextBuf, "Y: Save screenshot");
-    C2D_TextOptimize(&instructionTexts[10]);
+    // Move the bottom layer down one slot; the new layer takes its place
+    int newLayer = layerCount - 1;
+    memcpy(&layers[layerCount], &layers[newLayer], sizeof(Layer));
+    memset(layers[newLayer].maskTiles, 0, sizeof(layers[newLayer].maskTiles));
+    memset(layers[newLayer].maskBits, 0, sizeof(layers[newLayer].maskBits));
+    layerCount++;
+    markLiveTilesDirty();
     
-    C2D_TextParse(&instructionTexts[11], staticTextBuf, "Circle Pad: 3D depth");
-    C2D_TextOptimize(&instructionTexts[11]);
+    generateLayerImages(newLayer);
+    resetLayerDepths();
+}
+
+void removeLayer() {
+    if (layerCount <= 2) return;
+    if (frameCount > 1) return;  // Flipbook frames store masks by layer index
     
-    C2D_TextParse(&instructionTexts[12], staticTextBuf, "START: Toggle help");
-    C2D_TextOptimize(&instructionTexts[12]);
+    clearUndoHistory();
+    markLiveTilesDirty();
     
-    C2D_TextParse(&instructionTexts[13], staticTextBuf, "SELECT: Open gallery");
-    C2D_TextOptimize(&instructionTexts[13]);
+    // Drop the lowest intermediate layer and move the bottom layer up
+    int removed = layerCount - 2;
+    clearLayerMask(removed);
+    memcpy(&layers[removed], &layers[layerCount - 1], sizeof(Layer));
+    memset(layers[layerCount - 1].maskTiles, 0, sizeof(layers[layerCount - 1].maskTiles));
+    memset(layers[layerCount - 1].maskBits, 0, sizeof(layers[layerCount - 1].maskBits));
+    layerCount--;
+    markLiveTilesDirty();
+    layerImagesChanged = true;
     
-    C2D_TextParse(&instructionTexts[14], staticTextBuf, "Press any button to begin!");
-    C2D_TextOptimize(&instructionTexts[14]);
+    if (activeLayer > layerCount - 2) activeLayer = layerCount - 2;
+    resetLayerDepths();
 }
 
 /**
- * CITRO2D INSTRUCTION SCREEN RENDERER
+ * ALPHA COMPOSITING
  * 
- * GPU-accelerated instruction screen using Citro2D text rendering.
- * Uses pre-parsed text objects with color formatting and scaling.
+ * Blend the layer stack using each layer's scratch mask as alpha channel.
+ * For two layers: dest = bottom * (1 - alpha) + top * alpha
+ * 
+ * alpha = 0:   Show the layer below fully (scratched away)
+ * alpha = 255: Show this layer fully (unscratched)
+ * 
+ * All layers are blended in one fused front-to-back pass: each layer adds
+ * its color weighted by the light left over from the layers above, and the
+ * walk stops at the first opaque layer, so unscratched pixels cost a single
+ * layer read regardless of stack depth.
+ * 
+ * Only the canvas tiles that intersect the viewport are read, so the cost
+ * per frame is the same no matter how large the canvas is. Screen rows are
+ * grouped into runs that share a tile row so each tile is looked up once
+ * per column; unallocated top tiles take a copy-only fast path.
+ * Generated layers are colored through their lut while blending, so
+ * changing colors never touches the layer images.
+ * When zoomed out the masks are box-filtered over each 2x2 block, while
+ * the layers are point-sampled (their pattern edges fall on even pixels).
+ * 
+ * The same weights give each pixel a continuous depth (written to
+ * destDepth): a soft brush edge blends smoothly between layer depths
+ * instead of snapping to one of them.
+ * 
+ * Packed tiles (hard brushes only, see packed.h) are sampled as 0 or 255.
+ * At 1:1, runs where every scratchable layer is packed or unscratched
+ * skip the blend entirely: each pixel shows the first layer whose bit is
+ * set, so the visible layer is picked for 32 rows at a time with a few
+ * word operations, and only the pixels it shows are copied.
+ * 
+ * In the 16-bit display mode pixels are stored straight to dest565,
+ * dithered to RGB565 (rgb565.h), instead of to dest as BGR8; the depth
+ * map is written either way.
+ * 
+ * During flipbook playback the masks come from the playback frame table.
+ * With the onion skin on, the previous frame's mask of the active layer is
+ * sampled in the same pass and tints the result, so no extra pass over
+ * the screen is needed.
  */
-void drawInstructionsGPU() {
-     // Target top screen "SQRIBBLE 3DS" - ver
-    C2D_TargetClear(topTarget, C2D_Color32(0,0,0,0)); // black
-    C2D_SceneBegin(topTarget);
-    
-     if (logoLoaded) {
-        // Top screen is 400x240
-        float logoWidth = logoImage.subtex->width;
-        float logoHeight = logoImage.subtex->height;
+#define ONION_STRENGTH 96   // Tint strength (of 255) where the previous frame is fully scratched
+
+// BGR color of a layer pixel, through the layer's lut for generated patterns
+static inline const u8* layerPixel(int layer, int layerIdx) {
+    const Layer* l = &layers[layer];
+    return l->indexed ? l->lut[l->image[layerIdx]] : &l->image[layerIdx];
+}
+
+// Alpha of a mask sample from an 8-bit tile, a packed tile, or neither (unscratched)
+static inline int sampleMaskAlpha(const u8* tile, const u32* bits, int sampleIdx) {
+    if (tile) {
+        const u8* sample = &tile[sampleIdx];
+        return (viewZoom < 0)
+            ? (sample[0] + sample[TILE_NEXT_Y] + sample[TILE_NEXT_X] + sample[TILE_NEXT_X + TILE_NEXT_Y] + 2) >> 2
+            : sample[0];
+    }
+    if (bits) {
+        if (viewZoom < 0) {
+            int set = tileBit(bits, sampleIdx) + tileBit(bits, sampleIdx + TILE_NEXT_Y) +
+                      tileBit(bits, sampleIdx + TILE_NEXT_X) + tileBit(bits, sampleIdx + TILE_NEXT_X + TILE_NEXT_Y);
+            return (set * 255 + 2) >> 2;
+        }
+        return tileBit(bits, sampleIdx) ? 255 : 0;
+    }
+    return 255;
+}
+
+// Store a composited BGR pixel at screen (x, y): to dest, or dithered to dest565 when set
+static inline void storeCompositePixel(u8* dest, u16* dest565, int x, int y, const u8* bgr) {
+    int maskIdx = x * 240 + (239 - y);
+    if (dest565) {
+        dest565[maskIdx] = ditherTo565(bgr[0], bgr[1], bgr[2], x, y);
+    } else {
+        dest[maskIdx * 3 + 0] = bgr[0];
+        dest[maskIdx * 3 + 1] = bgr[1];
+        dest[maskIdx * 3 + 2] = bgr[2];
+    }
+}
+
+// Copy the pixels of one layer selected by a word of a packed run
+static inline void copyShownPixels(u8* dest, u16* dest565, u8* destDepth, u32 shown, int layer, int depth,
+                                   int x, int y, int layerColumn, const int* layerRow) {
+    while (shown) {
+        int row = y + __builtin_ctz(shown);
+        shown &= shown - 1;
         
-        // Calculate scale to fill screen while maintaining aspect ratio
-        // float scaleX = 400.0f / logoWidth;
-        // float scaleY = 240.0f / logoHeight;
-        float scaleY = 1.0f;
-        float scaleX = 1.0f; // NO SCALE
+        destDepth[x * 240 + (239 - row)] = depth;
+        storeCompositePixel(dest, dest565, x, row, layerPixel(layer, layerColumn + layerRow[row]));
+    }
+}
+
+/**
+ * Composite screen rows [top, bottom) of column x at 1:1 from packed (or
+ * unscratched) tiles. Rows are consecutive bits of the tile column, so
+ * each word covers up to 32 of them: pending holds the rows no layer has
+ * claimed yet, and each layer claims the pending rows whose bit is set.
+ */
+static void compositePackedRun(u8* dest, u16* dest565, u8* destDepth, const u32* const* bits, int bottomLayer,
+                               const int* layerDepth, int x, int top, int bottom, int firstBit,
+                               int layerColumn, const int* layerRow) {
+    int y = top;
+    int bit = firstBit;
+    while (y < bottom) {
+        int shift = bit & 31;
+        int count = 32 - shift < bottom - y ? 32 - shift : bottom - y;
+        u32 pending = (count == 32 ? 0xFFFFFFFF : (1u << count) - 1) << shift;
         
-        // Use the larger scale to ensure entire screen is covered
-        float scale = (scaleX > scaleY) ? scaleX : scaleY;
+        for (int layer = 0; layer < bottomLayer && pending; layer++) {
+            u32 shown = bits[layer] ? pending & bits[layer][bit >> 5] : pending;
+            pending &= ~shown;
+            copyShownPixels(dest, dest565, destDepth, shown >> shift, layer, layerDepth[layer], x, y, layerColumn, layerRow);
+        }
+        copyShownPixels(dest, dest565, destDepth, pending >> shift, bottomLayer, layerDepth[bottomLayer], x, y, layerColumn, layerRow);
         
-        // Calculate scaled dimensions
-        float scaledWidth = logoWidth * scale;
-        float scaledHeight = logoHeight * scale;
+        y += count;
+        bit += count;
+    }
+}
+
+// Tint a composited pixel where the previous frame's mask was scratched
+static inline void blendOnionSkin(u8* pixel, const u8* sample) {
+    int alpha = (viewZoom < 0)
+        ? (sample[0] + sample[TILE_NEXT_Y] + sample[TILE_NEXT_X] + sample[TILE_NEXT_X + TILE_NEXT_Y] + 2) >> 2
+        : sample[0];
+    int weight = (255 - alpha) * ONION_STRENGTH / 255;
+    if (weight == 0) return;
+    
+    // Onion skins are traditionally red (BGR order)
+    pixel[0] -= pixel[0] * weight / 255;
+    pixel[1] -= pixel[1] * weight / 255;
+    pixel[2] += (255 - pixel[2]) * weight / 255;
+}
+
+void compositeViewport(u8* dest, u16* dest565, u8* destDepth) {
+    static int canvasRow[SCREEN_HEIGHT];
+    static int tileRow[SCREEN_HEIGHT];
+    static int layerRow[SCREEN_HEIGHT];
+    static int runStart[SCREEN_HEIGHT + 1];
+    static int runTileY[SCREEN_HEIGHT];
+    int runCount = 0;
+    int bottomLayer = layerCount - 1;
+    
+    // Masks come from the live canvas, or the frame being played back
+    // (frames are stored 8-bit, so only the live canvas has packed tiles)
+    u8** maskTables[MAX_LAYERS];
+    u32** bitTables[MAX_LAYERS];
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        maskTables[i] = flipbookPlaying ? playbackTable[i] : layers[i].maskTiles;
+        bitTables[i] = flipbookPlaying ? NULL : layers[i].maskBits;
+    }
+    
+    // Onion skin: the active layer of the previous frame, tinted over the result
+    u8** onionTiles = (onionSkin && !flipbookPlaying && currentFrame > 0) ? onionTable[activeLayer] : NULL;
+    
+    // Layer depths on the 0-255 depth map scale
+    int layerDepth[MAX_LAYERS];
+    for (int i = 0; i < layerCount; i++) {
+        layerDepth[i] = (int)(layers[i].depth * 255.0f + 0.5f);
+    }
+    
+    // Per-frame row table: canvas row, its offset in a tile, repeated layer row and tile runs
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        canvasRow[y] = canvasFromScreenY(y);
+        tileRow[y] = TILE_ROW(canvasRow[y] & TILE_MASK);
+        layerRow[y] = (239 - canvasRow[y] % SCREEN_HEIGHT) * 3;
         
-        // Center the oversized image (this crops edges)
-        float posX = (400.0f - scaledWidth) / 2.0f;
-        float posY = (240.0f - scaledHeight) / 2.0f;
+        int tileY = canvasRow[y] >> TILE_SHIFT;
+        if (runCount == 0 || runTileY[runCount - 1] != tileY) {
+            runStart[runCount] = y;
+            runTileY[runCount] = tileY;
+            runCount++;
+        }
+    }
+    runStart[runCount] = SCREEN_HEIGHT;
+    
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        int canvasX = canvasFromScreenX(x);
+        int tileX = canvasX >> TILE_SHIFT;
+        int tileColumn = TILE_COLUMN(canvasX & TILE_MASK);
+        int layerColumn = (canvasX % SCREEN_WIDTH) * 240 * 3;
         
-        // Draw the logo - it will fill screen and crop if needed
-        C2D_DrawImageAt(logoImage, posX, posY, 0.5f, NULL, scale, scale);
+        for (int run = 0; run < runCount; run++) {
+            // Mask tile of every scratchable layer at this position
+            const u8* tiles[MAX_LAYERS];
+            const u32* bits[MAX_LAYERS];
+            int tileIndex = runTileY[run] * CANVAS_TILES_X + tileX;
+            for (int i = 0; i < bottomLayer; i++) {
+                tiles[i] = maskTables[i][tileIndex];
+                bits[i] = bitTables[i] ? bitTables[i][tileIndex] : NULL;
+            }
+            const u8* onionTile = onionTiles ? onionTiles[tileIndex] : NULL;
+            
+#ifndef MASK_TILE_MORTON
+            // Hard-brush tiles at 1:1: pick each pixel's layer a word at a time
+            bool packedRun = bits[0] && viewZoom == 0 && !onionTile;
+            for (int i = 1; i < bottomLayer; i++) {
+                if (tiles[i]) packedRun = false;
+            }
+            if (packedRun) {
+                int top = runStart[run];
+                compositePackedRun(dest, dest565, destDepth, bits, bottomLayer, layerDepth, x, top, runStart[run + 1],
+                                   tileColumn + tileRow[top], layerColumn, layerRow);
+                continue;
+            }
+#endif
+            
+            for (int y = runStart[run]; y < runStart[run + 1]; y++) {
+                int maskIdx = x * 240 + (239 - y);
+                int layerIdx = layerColumn + layerRow[y];
+                int sampleIdx = tileColumn + tileRow[y];
+                u8 pixel[3];
+                
+                if (!tiles[0] && !bits[0]) {
+                    // Untouched tile: top layer fully visible
+                    const u8* top = layerPixel(0, layerIdx);
+                    destDepth[maskIdx] = layerDepth[0];
+                    if (onionTile) {
+                        memcpy(pixel, top, 3);
+                        blendOnionSkin(pixel, &onionTile[sampleIdx]);
+                        top = pixel;
+                    }
+                    storeCompositePixel(dest, dest565, x, y, top);
+                    continue;
+                }
+                
+                int remaining = 255;  // Light passing through the layers above
+                int sumB = 0, sumG = 0, sumR = 0, sumDepth = 0;
+                int layer;
+                
+                for (layer = 0; layer < bottomLayer; layer++) {
+                    int alpha = sampleMaskAlpha(tiles[layer], bits[layer], sampleIdx);
+                    if (alpha == 255) break;  // Opaque: nothing below shows through
+                    
+                    if (alpha > 0) {
+                        const u8* src = layerPixel(layer, layerIdx);
+                        int weight = remaining * alpha;
+                        sumB += src[0] * weight;
+                        sumG += src[1] * weight;
+                        sumR += src[2] * weight;
+                        sumDepth += layerDepth[layer] * weight;
+                    }
+                    
+                    remaining = remaining * (255 - alpha) / 255;
+                    if (remaining == 0) break;
+                }
+                
+                // The opaque (or bottom) layer receives the remaining light
+                if (remaining > 0) {
+                    const u8* src = layerPixel(layer, layerIdx);
+                    int weight = remaining * 255;
+                    sumB += src[0] * weight;
+                    sumG += src[1] * weight;
+                    sumR += src[2] * weight;
+                    sumDepth += layerDepth[layer] * weight;
+                }
+                
+                destDepth[maskIdx] = sumDepth / (255 * 255);
+                pixel[0] = sumB / (255 * 255);
+                pixel[1] = sumG / (255 * 255);
+                pixel[2] = sumR / (255 * 255);
+                if (onionTile) blendOnionSkin(pixel, &onionTile[sampleIdx]);
+                storeCompositePixel(dest, dest565, x, y, pixel);
+            }
+        }
+    }
+}
+
+/**
+ * FRAMEBUFFER OUTPUT
+ * 
+ * B in the gallery cycles how the canvas reaches the screens: 24-bit
+ * framebuffers, 16-bit RGB565 framebuffers (a third less memory to fill
+ * and copy every frame), or the GPU path below.
+ * 
+ * In 16-bit mode the compositor dithers its pixels straight to RGB565
+ * (rgb565.c), so there is no extra pass over the screen; the bottom
+ * screen copy and the stereo warp then move 2-byte pixels. The BGR8
+ * composite is rebuilt when screenshots, exports and fills need it.
+ * Screens drawn with citro2d, the gallery and the palette editor expect
+ * 24-bit framebuffers, so the format is only switched for the canvas.
+ */
+typedef enum {
+    DISPLAY_RGB8,
+    DISPLAY_RGB565,
+    DISPLAY_GPU,
+    DISPLAY_MODE_COUNT
+} DisplayMode;
+
+DisplayMode displayMode = DISPLAY_RGB8;
+static bool framebuffers565 = false;   // Format the framebuffers are currently in
+static bool composite565Only = false;  // The last canvas frame skipped the BGR8 composite
+
+// Switch both screens between BGR8 and RGB565 (only when it changes)
+void setFramebufferFormat(bool rgb565) {
+    if (rgb565 == framebuffers565) return;
+    GSPGPU_FramebufferFormat format = rgb565 ? GSP_RGB565_OES : GSP_BGR8_OES;
+    gfxSetScreenFormat(GFX_TOP, format);
+    gfxSetScreenFormat(GFX_BOTTOM, format);
+    framebuffers565 = rgb565;
+}
+
+/**
+ * GPU COMPOSITING
+ * 
+ * Optional path (DISPLAY_GPU) that hands the layer blend and the eye
+ * views to the PICA200 instead of compositeViewport and renderStereoEye:
+ * - Each layer image is an RGB8 texture, expanded through the layer's lut
+ *   and re-uploaded only when an image or lut changes
+ * - Each scratchable mask is an A8 atlas of ATLAS_SLOTS x ATLAS_SLOTS tiles
+ *   (see swizzle.c). The atlas repeats across the canvas, so its texture
+ *   coordinates are plain canvas coordinates.
+ * - Every layer is drawn, bottom to top, as the same few quads (the
+ *   viewport split where the layer images repeat), with the image as
+ *   color and the mask as alpha.
+ * 
+ * Parallax is per layer: the right eye shifts each layer's quads by its
+ * depth times depthOffset, instead of warping pixel by pixel. Modes the
+ * GPU path doesn't cover (onion skin, playback, timelapse, GIF export and
+ * the palette editor) stay on the CPU.
+ * 
+ * Textures are swizzled (swizzle.c). Indexed layers also keep their levels
+ * in that order, so when only the luts change (color edits, cycling every
+ * frame) the upload is a straight lookup pass instead of a re-swizzle.
+ */
+#define LAYER_TEXTURE_WIDTH 512                  // Power-of-two texture around a layer image
+#define LAYER_TEXTURE_HEIGHT 256
+#define GPU_MAX_QUADS 16
+
+typedef struct {
+    float x, y;        // Screen position
+    float u0, v0;      // Layer image
+    float u1, v1;      // Mask atlas
+} GpuVertex;
+
+bool gpuCanvasActive = false;    // The last frame was composited on the GPU
+static bool gpuReady = false;
+static DVLB_s* compositeDvlb;
+static shaderProgram_s compositeProgram;
+static int projectionUniform;
+static int offsetUniform;
+static C3D_Mtx topProjection;
+static C3D_Mtx bottomProjection;
+static GpuVertex* gpuVertices;   // Linear memory, rebuilt every frame
+static C3D_Tex layerTextures[MAX_LAYERS];
+static C3D_Tex maskAtlases[MAX_LAYERS - 1];
+static s16 atlasSlotTile[MAX_LAYERS - 1][ATLAS_SLOTS * ATLAS_SLOTS];  // Tile in each slot (-1 = none)
+static u8* layerLevels[MAX_LAYERS];  // Swizzled levels of indexed layers, SCREEN_WIDTH / 8 blocks a row
+
+// Source of layer pixel block (blockX, blockY) for swizzleBlock: columns run bottom-to-top
+static inline const u8* layerBlockSource(const u8* image, int blockX, int blockY) {
+    return &image[(blockX * 8 * 240 + (239 - blockY * 8)) * 3];
+}
+
+// Swizzle the levels of an indexed layer
+static void swizzleLayerLevels(int layer) {
+    u8* block = layerLevels[layer];
+    for (int blockY = 0; blockY < SCREEN_HEIGHT / 8; blockY++) {
+        for (int blockX = 0; blockX < SCREEN_WIDTH / 8; blockX++) {
+            swizzleBlock(layerBlockSource(layers[layer].image, blockX, blockY), 240 * 3, -3, block);
+            block += 64;
+        }
+    }
+}
+
+/**
+ * Fill a layer's RGB8 texture: texel (x, y) is layer pixel (x, y), B, G, R
+ * in both. Indexed layers look their swizzled levels up in the lut; a
+ * bitmap is swizzled a channel at a time.
+ */
+static void expandLayerTexture(int layer, u8* texels) {
+    const Layer* l = &layers[layer];
+    for (int blockY = 0; blockY < SCREEN_HEIGHT / 8; blockY++) {
+        // A row of blocks is contiguous in the texture as well
+        u8* out = &texels[blockY * (LAYER_TEXTURE_WIDTH / 8) * 64 * 3];
+        if (l->indexed) {
+            const u8* levels = &layerLevels[layer][blockY * (SCREEN_WIDTH / 8) * 64];
+            for (int i = 0; i < SCREEN_WIDTH * 8; i++) {
+                const u8* color = l->lut[levels[i]];
+                out[i * 3 + 0] = color[0];
+                out[i * 3 + 1] = color[1];
+                out[i * 3 + 2] = color[2];
+            }
+            continue;
+        }
+        
+        for (int blockX = 0; blockX < SCREEN_WIDTH / 8; blockX++) {
+            u8 channel[64];
+            for (int c = 0; c < 3; c++) {
+                swizzleBlock(layerBlockSource(l->image, blockX, blockY) + c, 240 * 3, -3, channel);
+                for (int i = 0; i < 64; i++) out[i * 3 + c] = channel[i];
+            }
+            out += 64 * 3;
+        }
+    }
+}
+
+// Forget everything the textures hold; masks and images may have been replaced wholesale
+static void invalidateGpuTextures() {
+    for (int i = 0; i < MAX_LAYERS - 1; i++) clearAtlasSlots(atlasSlotTile[i]);
+    layerImagesChanged = true;
+}
+
+// Copy the visible mask tiles that the atlases don't hold yet
+static void updateMaskAtlases() {
+    int visibleWidth = (viewZoom < 0) ? SCREEN_WIDTH * 2 : SCREEN_WIDTH >> viewZoom;
+    int visibleHeight = (viewZoom < 0) ? SCREEN_HEIGHT * 2 : SCREEN_HEIGHT >> viewZoom;
+    int firstX = viewX >> TILE_SHIFT;
+    int lastX = (viewX + visibleWidth - 1) >> TILE_SHIFT;
+    int firstY = viewY >> TILE_SHIFT;
+    int lastY = (viewY + visibleHeight - 1) >> TILE_SHIFT;
+    
+    u16 written[ATLAS_SLOTS * ATLAS_SLOTS];
+    for (int layer = 0; layer < layerCount - 1; layer++) {
+        u8* atlas = (u8*)maskAtlases[layer].data;
+        int count = updateAtlasSlots(atlasSlotTile[layer], atlas, layers[layer].maskTiles, layers[layer].maskBits,
+                                     tileDirty[layer], firstX, firstY, lastX, lastY, written);
+        
+        // Flush the slots that were written, a run of texture tiles at a time
+        for (int i = 0; i < count; i++) {
+            for (int blockY = 0; blockY < TILE_SIZE / 8; blockY++) {
+                u8* run = atlasSlotRun(atlas, written[i] % ATLAS_SLOTS, written[i] / ATLAS_SLOTS, blockY);
+                GSPGPU_FlushDataCache(run, ATLAS_RUN_BYTES);
+            }
+        }
+    }
+}
+
+/**
+ * Build the quads covering the viewport, split where the layer images
+ * repeat. Zoomed out, a screen pixel covers 2x2 canvas pixels: the images
+ * are sampled at the first one, like on the CPU, and the mask at the
+ * block center, where linear filtering averages all four.
+ * Returns the number of vertices.
+ */
+static int buildCanvasQuads() {
+    static const int corners[6] = {0, 2, 1, 1, 2, 3};  // Two triangles per quad
+    float scale = (viewZoom < 0) ? 0.5f : (float)(1 << viewZoom);
+    float imageBias = (viewZoom < 0) ? -0.5f : 0.0f;
+    int endX = viewX + ((viewZoom < 0) ? SCREEN_WIDTH * 2 : SCREEN_WIDTH >> viewZoom);
+    int endY = viewY + ((viewZoom < 0) ? SCREEN_HEIGHT * 2 : SCREEN_HEIGHT >> viewZoom);
+    int count = 0;
+    
+    for (int y0 = viewY, y1; y0 < endY; y0 = y1) {
+        y1 = (y0 / SCREEN_HEIGHT + 1) * SCREEN_HEIGHT;
+        if (y1 > endY) y1 = endY;
+        float imageY = y0 % SCREEN_HEIGHT + imageBias;
+        
+        for (int x0 = viewX, x1; x0 < endX && count < GPU_MAX_QUADS * 6; x0 = x1) {
+            x1 = (x0 / SCREEN_WIDTH + 1) * SCREEN_WIDTH;
+            if (x1 > endX) x1 = endX;
+            float imageX = x0 % SCREEN_WIDTH + imageBias;
+            
+            GpuVertex quad[4];
+            for (int i = 0; i < 4; i++) {
+                int x = (i & 1) ? x1 : x0;
+                int y = (i & 2) ? y1 : y0;
+                quad[i].x = (x - viewX) * scale;
+                quad[i].y = (y - viewY) * scale;
+                quad[i].u0 = (imageX + (x - x0)) / LAYER_TEXTURE_WIDTH;
+                quad[i].v0 = (imageY + (y - y0)) / LAYER_TEXTURE_HEIGHT;
+                quad[i].u1 = (float)x / ATLAS_SIZE;
+                quad[i].v1 = (float)y / ATLAS_SIZE;
+            }
+            for (int i = 0; i < 6; i++) {
+                gpuVertices[count++] = quad[corners[i]];
+            }
+        }
+    }
+    GSPGPU_FlushDataCache(gpuVertices, count * sizeof(GpuVertex));
+    return count;
+}
+
+// Release whatever initGpuCompositing created, also after a partial failure
+void freeGpuCompositing() {
+    if (!gpuReady) return;
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (layerTextures[i].data) C3D_TexDelete(&layerTextures[i]);
+        free(layerLevels[i]);
+        layerLevels[i] = NULL;
+    }
+    for (int i = 0; i < MAX_LAYERS - 1; i++) {
+        if (maskAtlases[i].data) C3D_TexDelete(&maskAtlases[i]);
+    }
+    memset(layerTextures, 0, sizeof(layerTextures));
+    memset(maskAtlases, 0, sizeof(maskAtlases));
+    if (topRightTarget) C3D_RenderTargetDelete(topRightTarget);
+    topRightTarget = NULL;
+    linearFree(gpuVertices);
+    gpuVertices = NULL;
+    shaderProgramFree(&compositeProgram);
+    DVLB_Free(compositeDvlb);
+    gpuReady = false;
+    if (displayMode == DISPLAY_GPU) displayMode = DISPLAY_RGB8;
+}
+
+/**
+ * Create the shader, textures and the right-eye target on first use.
+ * Returns false (leaving the CPU path in charge) if anything is missing.
+ */
+bool initGpuCompositing() {
+    if (gpuReady) return true;
+    
+    compositeDvlb = DVLB_ParseFile((u32*)composite_shbin, composite_shbin_size);
+    if (!compositeDvlb) return false;
+    shaderProgramInit(&compositeProgram);
+    shaderProgramSetVsh(&compositeProgram, &compositeDvlb->DVLE[0]);
+    projectionUniform = shaderInstanceGetUniformLocation(compositeProgram.vertexShader, "projection");
+    offsetUniform = shaderInstanceGetUniformLocation(compositeProgram.vertexShader, "offset");
+    Mtx_OrthoTilt(&topProjection, 0.0f, 400.0f, 240.0f, 0.0f, 0.0f, 1.0f, true);
+    Mtx_OrthoTilt(&bottomProjection, 0.0f, 320.0f, 240.0f, 0.0f, 0.0f, 1.0f, true);
+    gpuReady = true;  // From here on freeGpuCompositing cleans up
+    
+    gpuVertices = (GpuVertex*)linearAlloc(GPU_MAX_QUADS * 6 * sizeof(GpuVertex));
+    topRightTarget = C2D_CreateScreenTarget(GFX_TOP, GFX_RIGHT);
+    bool created = gpuVertices && topRightTarget;
+    for (int i = 0; created && i < MAX_LAYERS; i++) {
+        layerLevels[i] = (u8*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT);
+        created = layerLevels[i] &&
+                  C3D_TexInit(&layerTextures[i], LAYER_TEXTURE_WIDTH, LAYER_TEXTURE_HEIGHT, GPU_RGB8);
+        if (created) C3D_TexSetFilter(&layerTextures[i], GPU_NEAREST, GPU_NEAREST);
+    }
+    for (int i = 0; created && i < MAX_LAYERS - 1; i++) {
+        created = C3D_TexInit(&maskAtlases[i], ATLAS_SIZE, ATLAS_SIZE, GPU_A8);
+        if (created) C3D_TexSetWrap(&maskAtlases[i], GPU_REPEAT, GPU_REPEAT);
+    }
+    if (!created) {
+        freeGpuCompositing();
+        return false;
+    }
+    
+    invalidateGpuTextures();
+    return true;
+}
+
+// Shader, vertex layout and blending; citro2d sets its own for the help screen
+static void bindCompositeState() {
+    C3D_BindProgram(&compositeProgram);
+    
+    C3D_AttrInfo* attrInfo = C3D_GetAttrInfo();
+    AttrInfo_Init(attrInfo);
+    AttrInfo_AddLoader(attrInfo, 0, GPU_FLOAT, 2);  // v0: screen position
+    AttrInfo_AddLoader(attrInfo, 1, GPU_FLOAT, 4);  // v1: image and atlas coordinates
+    
+    C3D_BufInfo* bufInfo = C3D_GetBufInfo();
+    BufInfo_Init(bufInfo);
+    BufInfo_Add(bufInfo, gpuVertices, sizeof(GpuVertex), 2, 0x10);
+    
+    for (int i = 1; i < 6; i++) {
+        C3D_TexEnvInit(C3D_GetTexEnv(i));  // Later stages pass the color through
+    }
+    C3D_DepthTest(false, GPU_ALWAYS, GPU_WRITE_COLOR);
+    C3D_CullFace(GPU_CULL_NONE);
+    C3D_AlphaTest(false, GPU_ALWAYS, 0);
+    C3D_AlphaBlend(GPU_BLEND_ADD, GPU_BLEND_ADD, GPU_SRC_ALPHA, GPU_ONE_MINUS_SRC_ALPHA, GPU_ONE, GPU_ZERO);
+}
+
+// Draw the layer stack into one screen (or eye), bottom layer first
+static void drawCanvasLayers(C3D_RenderTarget* target, const C3D_Mtx* projection,
+                             float originX, float eyeOffset, int vertexCount) {
+    C3D_RenderTargetClear(target, C3D_CLEAR_ALL, 0x000000FF, 0);
+    C3D_FrameDrawOn(target);
+    C3D_FVUnifMtx4x4(GPU_VERTEX_SHADER, projectionUniform, projection);
+    
+    C3D_TexEnv* env = C3D_GetTexEnv(0);
+    for (int layer = layerCount - 1; layer >= 0; layer--) {
+        float shift = floorf(layers[layer].depth * eyeOffset + 0.5f);
+        C3D_FVUnifSet(GPU_VERTEX_SHADER, offsetUniform, originX + shift, 0.0f, 0.0f, 0.0f);
+        
+        // Color from the layer image, alpha from its mask; the bottom layer is opaque
+        C3D_TexBind(0, &layerTextures[layer]);
+        C3D_TexEnvInit(env);
+        C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR);
+        if (layer == layerCount - 1) {
+            C3D_TexEnvSrc(env, C3D_Alpha, GPU_CONSTANT, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR);
+            C3D_TexEnvColor(env, 0xFFFFFFFF);
+        } else {
+            C3D_TexBind(1, &maskAtlases[layer]);
+            C3D_TexEnvSrc(env, C3D_Alpha, GPU_TEXTURE1, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR);
+        }
+        C3D_TexEnvFunc(env, C3D_Both, GPU_REPLACE);
+        C3D_DrawArrays(GPU_TRIANGLES, 0, vertexCount);
+    }
+}
+
+/**
+ * Composite the canvas on the GPU into the bottom screen and both eyes of
+ * the top screen. Call between C3D_FrameBegin and C3D_FrameEnd: the frame
+ * start waits for the GPU to finish with the textures being updated.
+ */
+void renderCanvasGPU() {
+    // Tiles may have been swapped out wholesale while the CPU path ran
+    if (!gpuCanvasActive) invalidateGpuTextures();
+    gpuCanvasActive = true;
+    
+    if (layerImagesChanged || layerLutsChanged) {
+        for (int i = 0; i < layerCount; i++) {
+            if (!layerImagesChanged && !layers[i].indexed) continue;  // Bitmaps have no lut
+            if (layerImagesChanged && layers[i].indexed) swizzleLayerLevels(i);
+            expandLayerTexture(i, (u8*)layerTextures[i].data);
+            GSPGPU_FlushDataCache(layerTextures[i].data, LAYER_TEXTURE_WIDTH * SCREEN_HEIGHT * 3);
+        }
+        layerImagesChanged = false;
+        layerLutsChanged = false;
+    }
+    updateMaskAtlases();
+    
+    // Point-sampled masks like the CPU path, averaged 2x2 when zoomed out
+    GPU_TEXTURE_FILTER_PARAM filter = (viewZoom < 0) ? GPU_LINEAR : GPU_NEAREST;
+    for (int i = 0; i < layerCount - 1; i++) {
+        C3D_TexSetFilter(&maskAtlases[i], filter, filter);
+    }
+    
+    int vertexCount = buildCanvasQuads();
+    bindCompositeState();
+    drawCanvasLayers(bottomTarget, &bottomProjection, 0.0f, 0.0f, vertexCount);
+    drawCanvasLayers(topTarget, &topProjection, 40.0f, 0.0f, vertexCount);
+    drawCanvasLayers(topRightTarget, &topProjection, 40.0f, depthOffset, vertexCount);
+}
+
+/**
+ * The CPU composite (and depth map) is only rebuilt every frame on the CPU
+ * path. Screenshots, exports and fills read it, so bring it up to date.
+ */
+void syncComposite(u8* composite) {
+    if (gpuCanvasActive || composite565Only) compositeViewport(composite, NULL, viewDepth);
+}
+
+/**
+ * DRAWING ENGINE
+ * 
+ * Strokes are rasterized as segments: the brush swept from one touch
+ * sample to the next. Each segment's brush bounding box is a dirty rect;
+ * overlapping rects (e.g. symmetry copies meeting in the middle) are merged
+ * and every merged rect is visited tile by tile, so each tile is looked up
+ * (and allocated / saved for undo) once and each mask pixel is written
+ * once, taking the strongest coverage of all segments over it.
+ * Segment endpoints are subpixel (SUBPIXEL_SHIFT fractional bits, with
+ * pixel centers on whole values), so smoothed strokes keep their shape.
+ * 
+ * Within a tile each mask column is handled as spans: the rows a segment's
+ * footprint fully covers are filled outright, and per-pixel coverage is
+ * only computed on the edge rows of soft and anti-aliased brushes.
+ * 
+ * With restoreBrush set the same footprint raises the mask back toward
+ * 255 instead, so mistakes can be corrected locally without an undo.
+ * 
+ * Supports five brush shapes (stamp brushes and the airbrush are separate;
+ * see STAMP BRUSHES and AIRBRUSH):
+ * - CIRCLE: Hard-edged circular brush
+ * - CIRCLE_AA: Circular brush with anti-aliased edges
+ * - SQUARE: Hard-edged square brush
+ * - SQUARE_AA: Square brush with anti-aliased edges
+ * - SOFT: Feathered circular brush with smooth falloff
+ * (BRUSH_FILL does not dab; see fillAt)
+ */
+#define MAX_STROKE_SEGMENTS 12
+
+typedef struct {
+    int x0, y0, x1, y1;           // Subpixel canvas coordinates
+    int minX, minY, maxX, maxY;   // Brush bounding box in pixels, clipped to the canvas
+} StrokeSegment;
+
+static bool isSquareBrush() {
+    return currentBrushShape == BRUSH_SQUARE || currentBrushShape == BRUSH_SQUARE_AA;
+}
+
+static bool isAntialiasedBrush() {
+    return currentBrushShape == BRUSH_CIRCLE_AA || currentBrushShape == BRUSH_SQUARE_AA;
+}
+
+// Narrow [lo, hi] to the y where low <= c + k * y <= high
+static void clipLinear(float c, float k, float low, float high, float* lo, float* hi) {
+    if (k == 0.0f) {
+        if (c < low || c > high) *lo = 1e9f;  // Never inside: empty
+        return;
+    }
+    float y0 = (low - c) / k;
+    float y1 = (high - c) / k;
+    if (y0 > y1) {
+        float t = y0;
+        y0 = y1;
+        y1 = t;
+    }
+    if (y0 > *lo) *lo = y0;
+    if (y1 < *hi) *hi = y1;
+}
+
+/**
+ * Rows of column px covered by a segment's footprint grown by inflate
+ * pixels (negative shrinks it). Returns false if the column misses it.
+ * Footprints are convex, so the covered rows are always one span.
+ */
+static bool segmentSpan(const StrokeSegment* seg, int px, int brushSize, float inflate, int* top, int* bottom) {
+    const float scale = 1.0f / (1 << SUBPIXEL_SHIFT);
+    float dx = (seg->x1 - seg->x0) * scale;
+    float dy = (seg->y1 - seg->y0) * scale;
+    float x = px - seg->x0 * scale;  // Column relative to the segment start
+    float radius = brushSize + inflate;
+    float lo = 1e9f;
+    float hi = -1e9f;
+    
+    if (isSquareBrush()) {
+        // Bounding box of the swept square, cut by a strip along the segment
+        if (x < fminf(0.0f, dx) - radius || x > fmaxf(0.0f, dx) + radius) return false;
+        lo = fminf(0.0f, dy) - radius;
+        hi = fmaxf(0.0f, dy) + radius;
+        float halfWidth = brushSize * (fabsf(dx) + fabsf(dy)) + inflate * sqrtf(dx * dx + dy * dy);
+        clipLinear(x * dy, -dx, -halfWidth, halfWidth, &lo, &hi);
     } else {
-        // Fallback to text if logo didn't load
-        C2D_DrawText(&instructionTexts[0], C2D_WithColor, 
-                     65.0f, 100.0f, 0.5f,
-                     1.5f, 1.5f,
-                     C2D_Color32(255, 255, 100, 255));
+        // Capsule: both end caps plus the band between them
+        for (int end = 0; end < 2; end++) {
+            float cx = end ? x - dx : x;
+            float cy = end ? dy : 0.0f;
+            if (fabsf(cx) > radius) continue;
+            float h = sqrtf(radius * radius - cx * cx);
+            if (cy - h < lo) lo = cy - h;
+            if (cy + h > hi) hi = cy + h;
+        }
+        
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length > 0.0f) {
+            float ux = dx / length;
+            float uy = dy / length;
+            float bandLo = -1e9f;
+            float bandHi = 1e9f;
+            clipLinear(x * ux, uy, 0.0f, length, &bandLo, &bandHi);
+            clipLinear(-x * uy, ux, -radius, radius, &bandLo, &bandHi);
+            if (bandLo <= bandHi) {
+                if (bandLo < lo) lo = bandLo;
+                if (bandHi > hi) hi = bandHi;
+            }
+        }
+    }
+    
+    if (lo > hi) return false;
+    float y0 = seg->y0 * scale;
+    *top = (int)ceilf(y0 + lo);
+    *bottom = (int)floorf(y0 + hi);
+    return *top <= *bottom;
+}
+
+// Mask value for a pixel with the given coverage (fraction of it inside)
+static int coverageAlpha(float coverage) {
+    if (coverage <= 0.0f) return 255;
+    if (coverage >= 1.0f) return 0;
+    return (int)(255.5f - coverage * 255.0f);
+}
+
+/**
+ * Mask value the brush leaves on edge pixel (px, py) for one segment; 255
+ * means the pixel is not covered. The caller ensures the pixel is in the
+ * segment's bounding box. Hard brushes have no edge pixels.
+ */
+static int segmentAlpha(const StrokeSegment* seg, int px, int py, int brushSize) {
+    const float scale = 1.0f / (1 << SUBPIXEL_SHIFT);
+    float dx = (seg->x1 - seg->x0) * scale;
+    float dy = (seg->y1 - seg->y0) * scale;
+    float rx = px - seg->x0 * scale;
+    float ry = py - seg->y0 * scale;
+    
+    if (currentBrushShape == BRUSH_SQUARE_AA) {
+        // Distance inside the nearest edge of the swept square
+        float inside = fminf(fminf(rx - (fminf(0.0f, dx) - brushSize), fmaxf(0.0f, dx) + brushSize - rx),
+                             fminf(ry - (fminf(0.0f, dy) - brushSize), fmaxf(0.0f, dy) + brushSize - ry));
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length > 0.0f) {
+            float strip = (brushSize * (fabsf(dx) + fabsf(dy)) - fabsf(rx * dy - ry * dx)) / length;
+            inside = fminf(inside, strip);
+        }
+        return coverageAlpha(inside + 0.5f);
+    }
+    
+    // Squared distance from the pixel to the segment
+    float length2 = dx * dx + dy * dy;
+    float dot = rx * dx + ry * dy;
+    float distance2;
+    if (dot <= 0.0f || length2 == 0.0f) {
+        distance2 = rx * rx + ry * ry;
+    } else if (dot >= length2) {
+        distance2 = (rx - dx) * (rx - dx) + (ry - dy) * (ry - dy);
+    } else {
+        float cross = rx * dy - ry * dx;
+        distance2 = cross * cross / length2;
+    }
+    
+    if (currentBrushShape == BRUSH_CIRCLE_AA) {
+        return coverageAlpha(brushSize + 0.5f - sqrtf(distance2));
+    }
+    
+    // Soft brush: quadratic falloff from the center line
+    float radius2 = (float)(brushSize * brushSize);
+    if (distance2 > radius2) return 255;
+    return (int)(distance2 / radius2 * 255);
+}
+
+/**
+ * Apply a batch of stroke segments to the active layer's mask.
+ */
+void scratchSegments(StrokeSegment* segments, int count, int brushSize) {
+    if (currentBrushShape == BRUSH_FILL) return;
+    
+    // Footprints: hard brushes are all interior, soft brushes all edge,
+    // anti-aliased brushes have a one pixel wide edge around an interior
+    bool antialiased = isAntialiasedBrush();
+    bool hasInterior = (currentBrushShape != BRUSH_SOFT);
+    bool hasEdge = antialiased || currentBrushShape == BRUSH_SOFT;
+    float edgeInflate = antialiased ? 0.5f : 0.0f;
+    float interiorInflate = antialiased ? -0.5f : 0.0f;
+    
+    // Dirty rects, each with the set of segments it covers
+    int rectMinX[MAX_STROKE_SEGMENTS], rectMinY[MAX_STROKE_SEGMENTS];
+    int rectMaxX[MAX_STROKE_SEGMENTS], rectMaxY[MAX_STROKE_SEGMENTS];
+    u32 rectMembers[MAX_STROKE_SEGMENTS];
+    int rectCount = 0;
+    
+    for (int i = 0; i < count; i++) {
+        StrokeSegment* seg = &segments[i];
+        int radius = (brushSize + (antialiased ? 1 : 0)) << SUBPIXEL_SHIFT;
+        int round = (1 << SUBPIXEL_SHIFT) - 1;
+        seg->minX = (((seg->x0 < seg->x1) ? seg->x0 : seg->x1) - radius + round) >> SUBPIXEL_SHIFT;
+        seg->maxX = (((seg->x0 > seg->x1) ? seg->x0 : seg->x1) + radius) >> SUBPIXEL_SHIFT;
+        seg->minY = (((seg->y0 < seg->y1) ? seg->y0 : seg->y1) - radius + round) >> SUBPIXEL_SHIFT;
+        seg->maxY = (((seg->y0 > seg->y1) ? seg->y0 : seg->y1) + radius) >> SUBPIXEL_SHIFT;
+        if (seg->minX < 0) seg->minX = 0;
+        if (seg->minY < 0) seg->minY = 0;
+        if (seg->maxX >= CANVAS_WIDTH) seg->maxX = CANVAS_WIDTH - 1;
+        if (seg->maxY >= CANVAS_HEIGHT) seg->maxY = CANVAS_HEIGHT - 1;
+        if (seg->minX > seg->maxX || seg->minY > seg->maxY) continue;  // Off canvas
+        
+        rectMinX[rectCount] = seg->minX;
+        rectMinY[rectCount] = seg->minY;
+        rectMaxX[rectCount] = seg->maxX;
+        rectMaxY[rectCount] = seg->maxY;
+        rectMembers[rectCount] = 1u << i;
+        rectCount++;
+    }
+    
+    // Merge overlapping rects until none overlap. A grown rect may now reach
+    // rects before it too, so after each merge the scan starts over
+    for (int i = 0; i < rectCount; i++) {
+        for (int j = i + 1; j < rectCount; j++) {
+            if (rectMinX[j] > rectMaxX[i] || rectMaxX[j] < rectMinX[i] ||
+                rectMinY[j] > rectMaxY[i] || rectMaxY[j] < rectMinY[i]) continue;
+            
+            if (rectMinX[j] < rectMinX[i]) rectMinX[i] = rectMinX[j];
+            if (rectMinY[j] < rectMinY[i]) rectMinY[i] = rectMinY[j];
+            if (rectMaxX[j] > rectMaxX[i]) rectMaxX[i] = rectMaxX[j];
+            if (rectMaxY[j] > rectMaxY[i]) rectMaxY[i] = rectMaxY[j];
+            rectMembers[i] |= rectMembers[j];
+            
+            rectCount--;
+            rectMinX[j] = rectMinX[rectCount];
+            rectMinY[j] = rectMinY[rectCount];
+            rectMaxX[j] = rectMaxX[rectCount];
+            rectMaxY[j] = rectMaxY[rectCount];
+            rectMembers[j] = rectMembers[rectCount];
+            i = -1;
+            break;
+        }
+    }
+    
+    for (int r = 0; r < rectCount; r++) {
+        for (int tileY = rectMinY[r] >> TILE_SHIFT; tileY <= rectMaxY[r] >> TILE_SHIFT; tileY++) {
+            for (int tileX = rectMinX[r] >> TILE_SHIFT; tileX <= rectMaxX[r] >> TILE_SHIFT; tileX++) {
+                // Part of the rect inside this tile
+                int startX = (tileX << TILE_SHIFT > rectMinX[r]) ? tileX << TILE_SHIFT : rectMinX[r];
+                int startY = (tileY << TILE_SHIFT > rectMinY[r]) ? tileY << TILE_SHIFT : rectMinY[r];
+                int endX = (((tileX + 1) << TILE_SHIFT) - 1 < rectMaxX[r]) ? ((tileX + 1) << TILE_SHIFT) - 1 : rectMaxX[r];
+                int endY = (((tileY + 1) << TILE_SHIFT) - 1 < rectMaxY[r]) ? ((tileY + 1) << TILE_SHIFT) - 1 : rectMaxY[r];
+                
+                // Segments reaching into this part
+                const StrokeSegment* nearby[MAX_STROKE_SEGMENTS];
+                int nearbyCount = 0;
+                for (int i = 0; i < count; i++) {
+                    const StrokeSegment* seg = &segments[i];
+                    if (!(rectMembers[r] & (1u << i))) continue;
+                    if (seg->minX > endX || seg->maxX < startX || seg->minY > endY || seg->maxY < startY) continue;
+                    nearby[nearbyCount++] = seg;
+                }
+                if (nearbyCount == 0) continue;
+                
+                // Nothing to restore on a tile that was never scratched
+                if (restoreBrush && maskTileUntouched(activeLayer, tileY * CANVAS_TILES_X + tileX)) continue;
+                
+                u8* tile = NULL;  // Looked up once the footprint actually reaches the tile
+                u32* bits = NULL;
+                int tileTop = tileY << TILE_SHIFT;
+                
+                for (int px = startX; px <= endX; px++) {
+                    // Mark the rows of this column: 2 = inside a footprint, 1 = edge
+                    u8 rowState[TILE_SIZE];
+                    int first = TILE_SIZE;
+                    int last = -1;
+                    memset(rowState, 0, sizeof(rowState));
+                    
+                    for (int i = 0; i < nearbyCount; i++) {
+                        const StrokeSegment* seg = nearby[i];
+                        if (px < seg->minX || px > seg->maxX) continue;
+                        
+                        int top, bottom;
+                        if (hasEdge && segmentSpan(seg, px, brushSize, edgeInflate, &top, &bottom)) {
+                            if (top < startY) top = startY;
+                            if (bottom > endY) bottom = endY;
+                            for (int py = top; py <= bottom; py++) {
+                                if (!rowState[py - tileTop]) rowState[py - tileTop] = 1;
+                            }
+                            if (top <= bottom && top - tileTop < first) first = top - tileTop;
+                            if (top <= bottom && bottom - tileTop > last) last = bottom - tileTop;
+                        }
+                        if (hasInterior && segmentSpan(seg, px, brushSize, interiorInflate, &top, &bottom)) {
+                            if (top < startY) top = startY;
+                            if (bottom > endY) bottom = endY;
+                            if (top > bottom) continue;
+                            memset(&rowState[top - tileTop], 2, bottom - top + 1);
+                            if (top - tileTop < first) first = top - tileTop;
+                            if (bottom - tileTop > last) last = bottom - tileTop;
+                        }
+                    }
+                    if (last < 0) continue;  // Column not reached
+                    
+                    // Hard brushes only write 0 or 255, so packed tiles stay packed
+                    if (!tile && !bits && !hasEdge) bits = touchMaskBits(activeLayer, tileX, tileY);
+                    if (bits) {
+                        int row = first;
+                        while (row <= last) {
+                            int runEnd = row;
+                            while (runEnd <= last && rowState[runEnd]) runEnd++;
+                            if (runEnd > row) writeTileBitColumn(bits, px & TILE_MASK, row, runEnd - row, restoreBrush);
+                            row = runEnd + 1;
+                        }
+                        continue;
+                    }
+                    
+                    if (!tile) {
+                        tile = touchMaskTile(activeLayer, tileX, tileY);
+                        if (!tile) break;  // Out of memory
+                    }
+                    u8* column = &tile[TILE_COLUMN(px & TILE_MASK)];
+                    
+                    for (int row = first; row <= last; row++) {
+                        if (!rowState[row]) continue;
+                        
+                        // Strongest coverage of all segments (0 = full brush)
+                        int coverage = 0;
+                        if (rowState[row] == 1) {
+                            int py = tileTop + row;
+                            coverage = 255;
+                            for (int i = 0; i < nearbyCount && coverage > 0; i++) {
+                                const StrokeSegment* seg = nearby[i];
+                                if (px < seg->minX || px > seg->maxX || py < seg->minY || py > seg->maxY) continue;
+                                int segAlpha = segmentAlpha(seg, px, py, brushSize);
+                                if (segAlpha < coverage) coverage = segAlpha;
+                            }
+                        }
+                        
+                        // Scratching only lowers the mask, restoring only raises it,
+                        // so soft edges accumulate across the stroke either way
+                        int alpha = column[TILE_ROW(row)];
+                        if (restoreBrush) {
+                            if (255 - coverage > alpha) alpha = 255 - coverage;
+                        } else {
+                            if (coverage < alpha) alpha = coverage;
+                        }
+                        column[TILE_ROW(row)] = (u8)alpha;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * SYMMETRY
+ * 
+ * Mirror and rotational drawing modes. Each stroke segment is copied
+ * around the center of the view and all copies are rasterized as one
+ * batch, so overlapping copies share the work.
+ */
+void addSymmetryCopy(StrokeSegment* segments, int* count, int centerX, int centerY,
+                     int x0, int y0, int x1, int y1) {
+    StrokeSegment* seg = &segments[(*count)++];
+    seg->x0 = centerX + x0;
+    seg->y0 = centerY + y0;
+    seg->x1 = centerX + x1;
+    seg->y1 = centerY + y1;
+}
+
+/**
+ * Expand a segment into its symmetry copies (the segment itself first).
+ * Returns the number of segments written.
+ */
+int buildSymmetrySegments(StrokeSegment* segments, int x0, int y0, int x1, int y1) {
+    int centerX = canvasFromScreenX(SCREEN_WIDTH / 2) << SUBPIXEL_SHIFT;
+    int centerY = canvasFromScreenY(SCREEN_HEIGHT / 2) << SUBPIXEL_SHIFT;
+    int count = 0;
+    
+    // Work relative to the center
+    x0 -= centerX; y0 -= centerY;
+    x1 -= centerX; y1 -= centerY;
+    addSymmetryCopy(segments, &count, centerX, centerY, x0, y0, x1, y1);
+    
+    switch (currentSymmetry) {
+        case SYMMETRY_HORIZONTAL:
+            addSymmetryCopy(segments, &count, centerX, centerY, -x0, y0, -x1, y1);
+            break;
+            
+        case SYMMETRY_VERTICAL:
+            addSymmetryCopy(segments, &count, centerX, centerY, x0, -y0, x1, -y1);
+            break;
+            
+        case SYMMETRY_QUAD:
+            addSymmetryCopy(segments, &count, centerX, centerY, -x0, y0, -x1, y1);
+            addSymmetryCopy(segments, &count, centerX, centerY, x0, -y0, x1, -y1);
+            addSymmetryCopy(segments, &count, centerX, centerY, -x0, -y0, -x1, -y1);
+            break;
+            
+        case SYMMETRY_ROTATE:
+        case SYMMETRY_KALEIDOSCOPE: {
+            // Rotated copies; the kaleidoscope also mirrors each wedge
+            int folds = (currentSymmetry == SYMMETRY_ROTATE) ? 8 : 6;
+            bool mirrored = (currentSymmetry == SYMMETRY_KALEIDOSCOPE);
+            
+            for (int k = 0; k < folds; k++) {
+                float angle = 2.0f * M_PI * k / folds;
+                float c = cosf(angle);
+                float s = sinf(angle);
+                
+                for (int flip = (k == 0) ? 1 : 0; flip <= (mirrored ? 1 : 0); flip++) {
+                    int sign = flip ? -1 : 1;
+                    addSymmetryCopy(segments, &count, centerX, centerY,
+                                    (int)roundf(sign * x0 * c - y0 * s), (int)roundf(sign * x0 * s + y0 * c),
+                                    (int)roundf(sign * x1 * c - y1 * s), (int)roundf(sign * x1 * s + y1 * c));
+                }
+            }
+            break;
+        }
+            
+        default:
+            break;
+    }
+    return count;
+}
+
+/**
+ * STAMP BRUSHES
+ * 
+ * Image brushes: grayscale stamps (PGM files in romfs:/brushes, white = full
+ * strength) dabbed along the stroke every `spacing` percent of the brush
+ * diameter, optionally turned to a random rotation and jittered off the
+ * stroke line.
+ * 
+ * Each stamp is kept pre-scaled to the current brush size in all
+ * STAMP_ROTATIONS rotations, as mask values (255 - strength, column-major
+ * like the mask tiles), so a dab is a straight min of stamp and mask.
+ * The buffers are allocated once at load time at the largest size;
+ * rescaling on a size change reuses them, so strokes never allocate
+ * stamp memory. Dabs blend a word (four mask pixels) at a time.
+ * 
+ * Rotation and jitter come from brushRandom, seeded with the stroke's
+ * start point, so journal replay puts every dab back in the same place.
+ */
+#define STAMP_SOURCE_SIZE 64
+#define STAMP_ROTATIONS 8
+#define STAMP_MAX_SIZE 50  // Largest brushSize
+#define STAMP_MAX_DIAMETER (STAMP_MAX_SIZE * 2 + 1)
+
+typedef struct {
+    const char* filename;
+    int spacing;            // Distance between dabs, percent of the diameter
+    bool rotate;            // Random rotation per dab
+    int jitter;             // Random offset per dab, percent of the radius
+    u8* source;             // STAMP_SOURCE_SIZE^2 strengths, row-major as in the file
+    u8* scaled;             // STAMP_ROTATIONS stamps at scaledSize
+    int scaledSize;         // brushSize the stamps were scaled for (0 = none yet)
+} StampBrush;
+
+static StampBrush stampBrushes[BRUSH_FILL - BRUSH_CHALK] = {
+    {"romfs:/brushes/chalk.pgm", 30, true, 10, NULL, NULL, 0},
+    {"romfs:/brushes/spray.pgm", 35, true, 40, NULL, NULL, 0},
+    {"romfs:/brushes/star.pgm", 120, false, 0, NULL, NULL, 0},
+};
+
+static u32 brushRandomSeed = 0;
+static u32 brushRandomCounter = 0;
+static int stampTravel = 0;  // Subpixel distance along the stroke since the last dab
+
+static bool isStampBrush(BrushShape shape) {
+    return shape >= BRUSH_CHALK && shape < BRUSH_FILL;
+}
+
+// Whether a shape can be used (stamp brushes need their image)
+bool brushAvailable(BrushShape shape) {
+    return !isStampBrush(shape) || stampBrushes[shape - BRUSH_CHALK].source;
+}
+
+// Read a binary 8-bit PGM of exactly STAMP_SOURCE_SIZE^2 pixels
+static u8* loadStampImage(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    
+    int width = 0, height = 0, maxValue = 0;
+    u8* pixels = NULL;
+    if (fscanf(file, "P5 %d %d %d", &width, &height, &maxValue) == 3 &&
+        width == STAMP_SOURCE_SIZE && height == STAMP_SOURCE_SIZE && maxValue == 255 &&
+        fgetc(file) != EOF) {
+        pixels = (u8*)malloc(STAMP_SOURCE_SIZE * STAMP_SOURCE_SIZE);
+        if (pixels && fread(pixels, 1, STAMP_SOURCE_SIZE * STAMP_SOURCE_SIZE, file) !=
+                      STAMP_SOURCE_SIZE * STAMP_SOURCE_SIZE) {
+            free(pixels);
+            pixels = NULL;
+        }
+    }
+    fclose(file);
+    return pixels;
+}
+
+/**
+ * Load the stamp images from romfs (mounted by loadLogo). Stamps that
+ * fail to load are left out of the brush cycle.
+ */
+void loadStampBrushes() {
+    for (int i = 0; i < BRUSH_FILL - BRUSH_CHALK; i++) {
+        StampBrush* stamp = &stampBrushes[i];
+        stamp->source = loadStampImage(stamp->filename);
+        if (!stamp->source) continue;
+        
+        stamp->scaled = (u8*)malloc(STAMP_ROTATIONS * STAMP_MAX_DIAMETER * STAMP_MAX_DIAMETER);
+        if (!stamp->scaled) {
+            free(stamp->source);
+            stamp->source = NULL;
+        }
+    }
+}
+
+void freeStampBrushes() {
+    for (int i = 0; i < BRUSH_FILL - BRUSH_CHALK; i++) {
+        free(stampBrushes[i].source);
+        free(stampBrushes[i].scaled);
+        stampBrushes[i].source = NULL;
+        stampBrushes[i].scaled = NULL;
+    }
+}
+
+/**
+ * Resample the stamp to a (2 * size + 1) square in every rotation.
+ * Each pixel averages a grid of samples about one source pixel apart,
+ * so small sizes stay smooth; large sizes take one sample per pixel.
+ */
+static void scaleStamp(StampBrush* stamp, int size) {
+    int diameter = size * 2 + 1;
+    int samples = (STAMP_SOURCE_SIZE + diameter - 1) / diameter;
+    if (samples > 4) samples = 4;
+    float scale = (float)STAMP_SOURCE_SIZE / diameter;
+    float center = (STAMP_SOURCE_SIZE - 1) * 0.5f;
+    
+    for (int r = 0; r < STAMP_ROTATIONS; r++) {
+        float c = cosf(2.0f * M_PI * r / STAMP_ROTATIONS);
+        float s = sinf(2.0f * M_PI * r / STAMP_ROTATIONS);
+        u8* out = &stamp->scaled[r * diameter * diameter];
+        
+        for (int x = 0; x < diameter; x++) {
+            for (int y = 0; y < diameter; y++) {
+                int sum = 0;
+                for (int sy = 0; sy < samples; sy++) {
+                    for (int sx = 0; sx < samples; sx++) {
+                        // Sample point relative to the stamp center, rotated back into the source
+                        float u = (x + (sx + 0.5f) / samples - 0.5f - size) * scale;
+                        float v = (y + (sy + 0.5f) / samples - 0.5f - size) * scale;
+                        int srcX = (int)floorf(center + u * c + v * s + 0.5f);
+                        int srcY = (int)floorf(center - u * s + v * c + 0.5f);
+                        if (srcX >= 0 && srcX < STAMP_SOURCE_SIZE && srcY >= 0 && srcY < STAMP_SOURCE_SIZE) {
+                            sum += stamp->source[srcY * STAMP_SOURCE_SIZE + srcX];
+                        }
+                    }
+                }
+                out[x * diameter + y] = 255 - sum / (samples * samples);
+            }
+        }
+    }
+    stamp->scaledSize = size;
+}
+
+/**
+ * Scale the current stamp brush for brushSize if it isn't already. Called
+ * whenever the brush or its size changes, so dabs never wait for it.
+ */
+void updateStampBrush() {
+    if (!isStampBrush(currentBrushShape)) return;
+    StampBrush* stamp = &stampBrushes[currentBrushShape - BRUSH_CHALK];
+    if (stamp->source && stamp->scaledSize != brushSize) scaleStamp(stamp, brushSize);
+}
+
+/**
+ * Counter-based generator for the stamp and airbrush randomness: the n-th
+ * number of a stroke is a hash of the stroke's seed and n, so a replayed
+ * stroke draws the same numbers however it is split into frames.
+ */
+static u32 brushRandom() {
+    u32 x = brushRandomSeed + brushRandomCounter++ * 0x9E3779B9u;
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Start a stroke at a subpixel canvas position: seeds brushRandom, and the first dab goes right there
+void beginBrushStroke(int x, int y) {
+    brushRandomSeed = ((u32)x * 73856093u) ^ ((u32)y * 19349663u);
+    brushRandomCounter = 0;
+    stampTravel = -1;  // Marks the next dab as due
+}
+
+#ifndef __ARM_FEATURE_SIMD32
+// Bytes of a that are less than the same byte of b, as 0xFF
+static inline u32 lessBytes4(u32 a, u32 b) {
+    u32 lowLess = ~((a | 0x80808080u) - (b & 0x7F7F7F7Fu));  // Bit 7: a < b in the low seven bits
+    u32 less = ((~a & b) | (~(a ^ b) & lowLess)) & 0x80808080u;
+    return (less >> 7) * 0xFF;
+}
+#endif
+
+// Per-byte minimum and maximum of four mask pixels
+static inline u32 minBytes4(u32 a, u32 b) {
+#ifdef __ARM_FEATURE_SIMD32
+    return a - __uqsub8(a, b);  // max(a - b, 0) never exceeds a, so no borrows cross bytes
+#else
+    u32 less = lessBytes4(a, b);
+    return (a & less) | (b & ~less);
+#endif
+}
+
+static inline u32 maxBytes4(u32 a, u32 b) {
+#ifdef __ARM_FEATURE_SIMD32
+    return b + __uqsub8(a, b);
+#else
+    u32 less = lessBytes4(a, b);
+    return (b & less) | (a & ~less);
+#endif
+}
+
+// Per-byte saturating subtract and add
+static inline u32 subBytes4(u32 a, u32 b) {
+#ifdef __ARM_FEATURE_SIMD32
+    return __uqsub8(a, b);
+#else
+    return a - minBytes4(a, b);
+#endif
+}
+
+static inline u32 addBytes4(u32 a, u32 b) {
+#ifdef __ARM_FEATURE_SIMD32
+    return __uqadd8(a, b);
+#else
+    return ~subBytes4(~a, b);
+#endif
+}
+
+/**
+ * Blend a stamp column into a mask column: scratching keeps the lower
+ * value, restoring raises the mask to the stamp's strength. Whole words
+ * once the mask pointer is aligned.
+ */
+static void blendStampSpan(u8* mask, const u8* stamp, int length) {
+    while (length > 0 && ((uintptr_t)mask & 3)) {
+        u8 value = restoreBrush ? 255 - *stamp : *stamp;
+        if (restoreBrush ? value > *mask : value < *mask) *mask = value;
+        mask++;
+        stamp++;
+        length--;
+    }
+    for (; length >= 4; length -= 4, mask += 4, stamp += 4) {
+        u32 stampWord, maskWord = *(u32*)mask;
+        memcpy(&stampWord, stamp, 4);
+        *(u32*)mask = restoreBrush ? maxBytes4(maskWord, ~stampWord) : minBytes4(maskWord, stampWord);
+    }
+    for (; length > 0; length--, mask++, stamp++) {
+        u8 value = restoreBrush ? 255 - *stamp : *stamp;
+        if (restoreBrush ? value > *mask : value < *mask) *mask = value;
+    }
+}
+
+/**
+ * Blend a (2 * size + 1) square brush image, column-major, centered on
+ * canvas pixel (centerX, centerY) into the active layer's mask: one pass
+ * over its bounding box clipped to the canvas, a column span per tile.
+ */
+static void blendBrushImage(const u8* stamp, int size, int centerX, int centerY,
+                            void (*blendSpan)(u8* mask, const u8* image, int length)) {
+    int diameter = size * 2 + 1;
+    int left = centerX - size, top = centerY - size;
+    int minX = left < 0 ? 0 : left;
+    int minY = top < 0 ? 0 : top;
+    int maxX = left + diameter - 1 >= CANVAS_WIDTH ? CANVAS_WIDTH - 1 : left + diameter - 1;
+    int maxY = top + diameter - 1 >= CANVAS_HEIGHT ? CANVAS_HEIGHT - 1 : top + diameter - 1;
+    if (minX > maxX || minY > maxY) return;
+    
+    for (int tileX = minX >> TILE_SHIFT; tileX <= maxX >> TILE_SHIFT; tileX++) {
+        for (int tileY = minY >> TILE_SHIFT; tileY <= maxY >> TILE_SHIFT; tileY++) {
+            // Nothing to restore on a tile that was never scratched
+            if (restoreBrush && maskTileUntouched(activeLayer, tileY * CANVAS_TILES_X + tileX)) continue;
+            u8* tile = touchMaskTile(activeLayer, tileX, tileY);
+            if (!tile) continue;
+            
+            int startX = tileX << TILE_SHIFT > minX ? tileX << TILE_SHIFT : minX;
+            int endX = ((tileX + 1) << TILE_SHIFT) - 1 < maxX ? ((tileX + 1) << TILE_SHIFT) - 1 : maxX;
+            int startY = tileY << TILE_SHIFT > minY ? tileY << TILE_SHIFT : minY;
+            int endY = ((tileY + 1) << TILE_SHIFT) - 1 < maxY ? ((tileY + 1) << TILE_SHIFT) - 1 : maxY;
+            
+            for (int px = startX; px <= endX; px++) {
+                const u8* image = &stamp[(px - left) * diameter + (startY - top)];
+#ifdef MASK_TILE_MORTON
+                // Columns aren't contiguous: blend a gathered copy and scatter it back
+                u8 span[TILE_SIZE];
+                readTileColumn(tile, px & TILE_MASK, startY & TILE_MASK, endY - startY + 1, span);
+                blendSpan(span, image, endY - startY + 1);
+                writeTileColumn(tile, px & TILE_MASK, startY & TILE_MASK, endY - startY + 1, span);
+#else
+                blendSpan(&tile[TILE_COLUMN(px & TILE_MASK) + (startY & TILE_MASK)], image, endY - startY + 1);
+#endif
+            }
+        }
+    }
+}
+
+/**
+ * Dab the current stamp along a batch of symmetry segments. The copies
+ * all have the length of the first, so dabs are placed along it and every
+ * copy gets a dab at the same fraction, with the same rotation and jitter.
+ */
+void stampSegments(const StrokeSegment* segments, int count, int brushSize) {
+    StampBrush* stamp = &stampBrushes[currentBrushShape - BRUSH_CHALK];
+    if (!stamp->source) return;
+    
+    const float scale = 1.0f / (1 << SUBPIXEL_SHIFT);
+    int diameter = brushSize * 2 + 1;
+    int spacing = (diameter << SUBPIXEL_SHIFT) * stamp->spacing / 100;
+    if (spacing < 1 << SUBPIXEL_SHIFT) spacing = 1 << SUBPIXEL_SHIFT;
+    
+    float dx = (segments[0].x1 - segments[0].x0) * scale;
+    float dy = (segments[0].y1 - segments[0].y0) * scale;
+    int length = (int)(sqrtf(dx * dx + dy * dy) * (1 << SUBPIXEL_SHIFT));
+    
+    // Distance along this segment to the next dab
+    int next = stampTravel < 0 ? 0 : spacing - stampTravel;
+    if (next < 0) next = 0;
+    
+    for (; next <= length; next += spacing) {
+        float t = length > 0 ? (float)next / length : 0.0f;
+        int rotation = stamp->rotate ? brushRandom() % STAMP_ROTATIONS : 0;
+        int jitterX = 0, jitterY = 0;
+        if (stamp->jitter > 0) {
+            int reach = brushSize * stamp->jitter / 100;
+            jitterX = (int)(brushRandom() % (2 * reach + 1)) - reach;
+            jitterY = (int)(brushRandom() % (2 * reach + 1)) - reach;
+        }
+        
+        const u8* rotated = &stamp->scaled[rotation * diameter * diameter];
+        for (int i = 0; i < count; i++) {
+            const StrokeSegment* seg = &segments[i];
+            float x = (seg->x0 + (seg->x1 - seg->x0) * t) * scale;
+            float y = (seg->y0 + (seg->y1 - seg->y0) * t) * scale;
+            blendBrushImage(rotated, brushSize, (int)floorf(x + 0.5f) + jitterX, (int)floorf(y + 0.5f) + jitterY,
+                            blendStampSpan);
+        }
+    }
+    stampTravel = length - (next - spacing);
+}
+
+/**
+ * AIRBRUSH
+ * 
+ * Sprays single-pixel dots scattered evenly over the brush disc. Every
+ * call of drawLine is one frame of spraying: while the stylus rests the
+ * main loop keeps calling it (and journals a point) each frame, so dots
+ * build up the longer the brush lingers, and a quick stroke leaves a
+ * light trail. Each dot scratches AIRBRUSH_DOT_STRENGTH off the mask.
+ * 
+ * A frame's dots are first accumulated in sprayBuffer, a brush-sized
+ * square, then blended into the mask in one bounding box pass with
+ * saturating word-wide arithmetic, so no dot is checked against the
+ * canvas or its tile. Long segments are sprayed in steps of at most a
+ * brush radius so fast strokes have no gaps. Dot positions come from
+ * brushRandom, so replay gives the same dots.
+ */
+#define AIRBRUSH_DOT_STRENGTH 40
+#define AIRBRUSH_MAX_DIAMETER (50 * 2 + 1)  // Largest brushSize
+
+static u8 sprayBuffer[AIRBRUSH_MAX_DIAMETER * AIRBRUSH_MAX_DIAMETER];
+
+// Dots per frame: about an eighth of the disc, so a resting brush fills in within a second
+static int airbrushDots(int brushSize) {
+    int dots = brushSize * brushSize * 3 / 8;
+    return dots < 1 ? 1 : dots;
+}
+
+static void blendSpraySpan(u8* mask, const u8* spray, int length) {
+    while (length > 0 && ((uintptr_t)mask & 3)) {
+        int value = restoreBrush ? *mask + *spray : *mask - *spray;
+        *mask = value < 0 ? 0 : value > 255 ? 255 : value;
+        mask++;
+        spray++;
+        length--;
+    }
+    for (; length >= 4; length -= 4, mask += 4, spray += 4) {
+        u32 sprayWord, maskWord = *(u32*)mask;
+        memcpy(&sprayWord, spray, 4);
+        *(u32*)mask = restoreBrush ? addBytes4(maskWord, sprayWord) : subBytes4(maskWord, sprayWord);
+    }
+    for (; length > 0; length--, mask++, spray++) {
+        int value = restoreBrush ? *mask + *spray : *mask - *spray;
+        *mask = value < 0 ? 0 : value > 255 ? 255 : value;
+    }
+}
+
+/**
+ * Spray one frame along a batch of symmetry segments. The dots of each
+ * step are generated once and blended at every copy's position.
+ */
+void airbrushSegments(const StrokeSegment* segments, int count, int brushSize) {
+    const float scale = 1.0f / (1 << SUBPIXEL_SHIFT);
+    int diameter = brushSize * 2 + 1;
+    float dx = (segments[0].x1 - segments[0].x0) * scale;
+    float dy = (segments[0].y1 - segments[0].y0) * scale;
+    int steps = (int)ceilf(sqrtf(dx * dx + dy * dy) / brushSize);
+    if (steps < 1) steps = 1;
+    int dots = airbrushDots(brushSize);
+    
+    for (int step = 0; step < steps; step++) {
+        // This step's share of the frame's dots, uniform over the disc
+        memset(sprayBuffer, 0, diameter * diameter);
+        int stepDots = dots * (step + 1) / steps - dots * step / steps;
+        for (int i = 0; i < stepDots; i++) {
+            int x, y;
+            do {
+                u32 bits = brushRandom();
+                x = (int)((bits & 0xFFFF) * diameter >> 16) - brushSize;
+                y = (int)((bits >> 16) * diameter >> 16) - brushSize;
+            } while (x * x + y * y > brushSize * brushSize);
+            
+            u8* pixel = &sprayBuffer[(x + brushSize) * diameter + (y + brushSize)];
+            *pixel = *pixel > 255 - AIRBRUSH_DOT_STRENGTH ? 255 : *pixel + AIRBRUSH_DOT_STRENGTH;
+        }
+        
+        float t = (step + 1.0f) / steps;
+        for (int i = 0; i < count; i++) {
+            const StrokeSegment* seg = &segments[i];
+            float x = (seg->x0 + (seg->x1 - seg->x0) * t) * scale;
+            float y = (seg->y0 + (seg->y1 - seg->y0) * t) * scale;
+            blendBrushImage(sprayBuffer, brushSize, (int)floorf(x + 0.5f), (int)floorf(y + 0.5f), blendSpraySpan);
+        }
+    }
+}
+
+/**
+ * LINE INTERPOLATION
+ * 
+ * Scratch the brush along the line between two touch samples (and its
+ * symmetry copies). This prevents gaps when touch moves quickly between
+ * frames. Called with previous and current stabilized positions, in
+ * subpixel canvas coordinates.
+ */
+void drawLine(int x0, int y0, int x1, int y1, int brushSize) {
+    StrokeSegment segments[MAX_STROKE_SEGMENTS];
+    int count = buildSymmetrySegments(segments, x0, y0, x1, y1);
+    if (isStampBrush(currentBrushShape)) {
+        stampSegments(segments, count, brushSize);
+    } else if (currentBrushShape == BRUSH_AIRBRUSH) {
+        airbrushSegments(segments, count, brushSize);
+    } else {
+        scratchSegments(segments, count, brushSize);
+    }
+}
+
+/**
+ * STROKE STABILIZER
+ * 
+ * The pulled-string filter itself lives in stabilizer.c; this is the
+ * strength picked with SELECT+START (an index into stabilizerStringLength).
+ */
+int stabilizerLevel = 1;
+
+/**
+ * Fill tool: reveal the active layer under the region connected to a tap
+ * (or cover it again with the restore brush).
+ * Every filled screen pixel clears the canvas pixels it shows (a 2x2 block
+ * when zoomed out). Fills only write 0 or 255, so packed tiles stay packed.
+ */
+void fillAt(const u8* composite, int screenX, int screenY) {
+    if (screenX < 0 || screenX >= SCREEN_WIDTH || screenY < 0 || screenY >= SCREEN_HEIGHT) return;
+    if (floodFillRegion(composite, screenX, screenY) == 0) return;
+    
+    int block = (viewZoom < 0) ? 2 : 1;  // Canvas pixels per screen pixel
+    u8 value = restoreBrush ? 255 : 0;
+    int cachedTileIndex = -1;
+    u8* tile = NULL;
+    u32* bits = NULL;
+    
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        const u8* column = &fillRegion[x * SCREEN_HEIGHT];
+        int canvasX = canvasFromScreenX(x);
+        
+        for (int row = 0; row < SCREEN_HEIGHT; row++) {
+            if (column[row] != FILL_DONE) continue;
+            int canvasY = canvasFromScreenY(SCREEN_HEIGHT - 1 - row);
+            
+            // The view origin is even when zoomed out, so a block never straddles tiles
+            int tileIndex = (canvasY >> TILE_SHIFT) * CANVAS_TILES_X + (canvasX >> TILE_SHIFT);
+            if (tileIndex != cachedTileIndex) {
+                // Restoring leaves never-scratched tiles alone
+                bool untouched = maskTileUntouched(activeLayer, tileIndex);
+                tile = NULL;
+                bits = NULL;
+                if (!restoreBrush || !untouched) {
+                    bits = touchMaskBits(activeLayer, canvasX >> TILE_SHIFT, canvasY >> TILE_SHIFT);
+                    if (!bits) tile = touchMaskTile(activeLayer, canvasX >> TILE_SHIFT, canvasY >> TILE_SHIFT);
+                }
+                cachedTileIndex = tileIndex;
+            }
+            if (!tile && !bits) continue;  // Out of memory (or nothing to restore)
+            
+            for (int dx = 0; dx < block; dx++) {
+                if (bits) {
+                    writeTileBitColumn(bits, (canvasX + dx) & TILE_MASK, canvasY & TILE_MASK, block, restoreBrush);
+                    continue;
+                }
+                for (int dy = 0; dy < block; dy++) {
+                    tile[TILE_COLUMN((canvasX + dx) & TILE_MASK) + TILE_ROW((canvasY + dy) & TILE_MASK)] = value;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * CITRO2D INSTRUCTION SCREEN INITIALIZATION
+ * 
+ * Pre-parse all static instruction text once for efficient repeated rendering.
+ * Text is optimized after parsing to improve GPU performance.
+ */
+void initInstructionText() {
+    // Parse each line of instruction text
+    C2D_TextParse(&instructionTexts[0], staticTextBuf, "SQRIBBLE 3DS");
+    C2D_TextOptimize(&instructionTexts[0]);
+    
+    C2D_TextParse(&instructionTexts[1], staticTextBuf, "v1.0");
+    C2D_TextOptimize(&instructionTexts[1]);
+    
+    C2D_TextParse(&instructionTexts[2], staticTextBuf, "BASIC CONTROLS:");
+    C2D_TextOptimize(&instructionTexts[2]);
+    
+    C2D_TextParse(&instructionTexts[3], staticTextBuf, "Touch: Draw");
+    C2D_TextOptimize(&instructionTexts[3]);
+    
+    C2D_TextParse(&instructionTexts[4], staticTextBuf, "L/R: Undo/Redo");
+    C2D_TextOptimize(&instructionTexts[4]);
+    
+    C2D_TextParse(&instructionTexts[5], staticTextBuf, "D-Pad Up/Down: Brush size");
+    C2D_TextOptimize(&instructionTexts[5]);
+    
+    C2D_TextParse(&instructionTexts[6], staticTextBuf, "D-Pad L/R: Cycle primary color");
+    C2D_TextOptimize(&instructionTexts[6]);
+    
+    C2D_TextParse(&instructionTexts[7], staticTextBuf, "A: Cycle brush shape / stamp / fill");
+    C2D_TextOptimize(&instructionTexts[7]);
+    
+    C2D_TextParse(&instructionTexts[8], staticTextBuf, "B: Cycle canvas pattern");
+    C2D_TextOptimize(&instructionTexts[8]);
+    
+    C2D_TextParse(&instructionTexts[9], staticTextBuf, "X: Clear canvas");
+    C2D_TextOptimize(&instructionTexts[9]);
+    
+    C2D_TextParse(&instructionTexts[10], staticTextBuf, "Y: Save screenshot");
+    C2D_TextOptimize(&instructionTexts[10]);
+    
+    C2D_TextParse(&instructionTexts[11], staticTextBuf, "Circle Pad: 3D depth");
+    C2D_TextOptimize(&instructionTexts[11]);
+    
+    C2D_TextParse(&instructionTexts[12], staticTextBuf, "START: Toggle help");
+    C2D_TextOptimize(&instructionTexts[12]);
+    
+    C2D_TextParse(&instructionTexts[13], staticTextBuf, "SELECT: Gallery (L/R soften/sharpen mask)");
+    C2D_TextOptimize(&instructionTexts[13]);
+    
+    C2D_TextParse(&instructionTexts[14], staticTextBuf, "Press any button to begin!");
+    C2D_TextOptimize(&instructionTexts[14]);
+    
+    // Second page: SELECT button combinations
+    C2D_TextParse(&instructionTexts[15], staticTextBuf, "D-Pad L/R: More controls");
+    C2D_TextOptimize(&instructionTexts[15]);
+    
+    C2D_TextParse(&instructionTexts[16], staticTextBuf, "SELECT COMBOS:");
+    C2D_TextOptimize(&instructionTexts[16]);
+    
+    C2D_TextParse(&instructionTexts[17], staticTextBuf, "SELECT+Touch: Pan canvas");
+    C2D_TextOptimize(&instructionTexts[17]);
+    
+    C2D_TextParse(&instructionTexts[18], staticTextBuf, "SELECT+L/R: Zoom out/in");
+    C2D_TextOptimize(&instructionTexts[18]);
+    
+    C2D_TextParse(&instructionTexts[19], staticTextBuf, "SELECT+D-Pad Up/Down: Pick layer");
+    C2D_TextOptimize(&instructionTexts[19]);
+    
+    C2D_TextParse(&instructionTexts[20], staticTextBuf, "SELECT+D-Pad L/R: Remove/add layer");
+    C2D_TextOptimize(&instructionTexts[20]);
+    
+    C2D_TextParse(&instructionTexts[21], staticTextBuf, "SELECT+Y: Export 3D photo (MPO)");
+    C2D_TextOptimize(&instructionTexts[21]);
+    
+    C2D_TextParse(&instructionTexts[22], staticTextBuf, "SELECT+X: Export anaglyph + side-by-side");
+    C2D_TextOptimize(&instructionTexts[22]);
+    
+    C2D_TextParse(&instructionTexts[23], staticTextBuf, "SELECT+A: Cycle symmetry mode");
+    C2D_TextOptimize(&instructionTexts[23]);
+    
+    C2D_TextParse(&instructionTexts[24], staticTextBuf, "SELECT+B: Scratch/restore brush");
+    C2D_TextOptimize(&instructionTexts[24]);
+    
+    C2D_TextParse(&instructionTexts[25], staticTextBuf, "SELECT+START: Stroke stabilizer strength");
+    C2D_TextOptimize(&instructionTexts[25]);
+    
+    C2D_TextParse(&instructionTexts[26], staticTextBuf, "ANIMATION:");
+    C2D_TextOptimize(&instructionTexts[26]);
+    
+    C2D_TextParse(&instructionTexts[27], staticTextBuf, "Circle Pad L/R: Previous/next frame");
+    C2D_TextOptimize(&instructionTexts[27]);
+    
+    C2D_TextParse(&instructionTexts[28], staticTextBuf, "SELECT+Circle Pad R/L: Insert/delete frame");
+    C2D_TextOptimize(&instructionTexts[28]);
+    
+    C2D_TextParse(&instructionTexts[29], staticTextBuf, "SELECT+Circle Pad Up: Play animation");
+    C2D_TextOptimize(&instructionTexts[29]);
+    
+    C2D_TextParse(&instructionTexts[30], staticTextBuf, "SELECT+Circle Pad Down: Onion skin");
+    C2D_TextOptimize(&instructionTexts[30]);
+    
+    C2D_TextParse(&instructionTexts[31], staticTextBuf, "Y while playing: Export GIF");
+    C2D_TextOptimize(&instructionTexts[31]);
+    
+    C2D_TextParse(&instructionTexts[32], staticTextBuf, "TIMELAPSE (Y in gallery):");
+    C2D_TextOptimize(&instructionTexts[32]);
+    
+    C2D_TextParse(&instructionTexts[33], staticTextBuf, "A: Pause  D-Pad Up/Down: Speed");
+    C2D_TextOptimize(&instructionTexts[33]);
+    
+    C2D_TextParse(&instructionTexts[34], staticTextBuf, "D-Pad L/R: Keyframes  L/R: Step");
+    C2D_TextOptimize(&instructionTexts[34]);
+    
+    C2D_TextParse(&instructionTexts[35], staticTextBuf, "Y: Export GIF  B: Back to drawing");
+    C2D_TextOptimize(&instructionTexts[35]);
+    
+    C2D_TextParse(&instructionTexts[36], staticTextBuf, "PALETTE EDITOR (X in gallery):");
+    C2D_TextOptimize(&instructionTexts[36]);
+    
+    C2D_TextParse(&instructionTexts[37], staticTextBuf, "Touch wheel: Hue and saturation");
+    C2D_TextOptimize(&instructionTexts[37]);
+    
+    C2D_TextParse(&instructionTexts[38], staticTextBuf, "Touch bar: Brightness");
+    C2D_TextOptimize(&instructionTexts[38]);
+    
+    C2D_TextParse(&instructionTexts[39], staticTextBuf, "Touch swatch: Pick drawing color");
+    C2D_TextOptimize(&instructionTexts[39]);
+    
+    C2D_TextParse(&instructionTexts[40], staticTextBuf, "X/Y: Add/remove color");
+    C2D_TextOptimize(&instructionTexts[40]);
+    
+    C2D_TextParse(&instructionTexts[41], staticTextBuf, "D-Pad L/R: Palette 1-4  B: Save & close");
+    C2D_TextOptimize(&instructionTexts[41]);
+    
+    C2D_TextParse(&instructionTexts[42], staticTextBuf, "L/R: Hidden layer pattern");
+    C2D_TextOptimize(&instructionTexts[42]);
+    
+    C2D_TextParse(&instructionTexts[43], staticTextBuf, "A: Paper white/black/dark");
+    C2D_TextOptimize(&instructionTexts[43]);
+    
+    C2D_TextParse(&instructionTexts[44], staticTextBuf, "D-Pad Up: Hidden color/rainbow/palette");
+    C2D_TextOptimize(&instructionTexts[44]);
+    
+    C2D_TextParse(&instructionTexts[45], staticTextBuf, "D-Pad Down: Color cycling off/slow/fast");
+    C2D_TextOptimize(&instructionTexts[45]);
+    
+    C2D_TextParse(&instructionTexts[46], staticTextBuf, "DISPLAY:");
+    C2D_TextOptimize(&instructionTexts[46]);
+    
+    C2D_TextParse(&instructionTexts[47], staticTextBuf, "B in gallery: 24-bit/16-bit/GPU display");
+    C2D_TextOptimize(&instructionTexts[47]);
+}
+
+/**
+ * CITRO2D INSTRUCTION SCREEN RENDERER
+ * 
+ * GPU-accelerated instruction screen using Citro2D text rendering.
+ * Uses pre-parsed text objects with color formatting and scaling.
+ */
+void drawInstructionsGPU() {
+     // Target top screen "SQRIBBLE 3DS" - ver
+    C2D_TargetClear(topTarget, C2D_Color32(0,0,0,0)); // black
+    C2D_SceneBegin(topTarget);
+    
+     if (logoLoaded) {
+        // Top screen is 400x240
+        float logoWidth = logoImage.subtex->width;
+        float logoHeight = logoImage.subtex->height;
+        
+        // Calculate scale to fill screen while maintaining aspect ratio
+        // float scaleX = 400.0f / logoWidth;
+        // float scaleY = 240.0f / logoHeight;
+        float scaleY = 1.0f;
+        float scaleX = 1.0f; // NO SCALE
+        
+        // Use the larger scale to ensure entire screen is covered
+        float scale = (scaleX > scaleY) ? scaleX : scaleY;
+        
+        // Calculate scaled dimensions
+        float scaledWidth = logoWidth * scale;
+        float scaledHeight = logoHeight * scale;
+        
+        // Center the oversized image (this crops edges)
+        float posX = (400.0f - scaledWidth) / 2.0f;
+        float posY = (240.0f - scaledHeight) / 2.0f;
+        
+        // Draw the logo - it will fill screen and crop if needed
+        C2D_DrawImageAt(logoImage, posX, posY, 0.5f, NULL, scale, scale);
+    } else {
+        // Fallback to text if logo didn't load
+        C2D_DrawText(&instructionTexts[0], C2D_WithColor, 
+                     65.0f, 100.0f, 0.5f,
+                     1.5f, 1.5f,
+                     C2D_Color32(255, 255, 100, 255));
+    }
+
+    // version - grey
+        C2D_DrawText(&instructionTexts[1], C2D_WithColor,
+                 370.0f, 220.0f, 0.5f,
+                 0.5f, 0.5f,
+                 C2D_Color32(150, 150, 150, 255));  // Gray
+        
+    // Target bottom screen
+    C2D_TargetClear(bottomTarget, C2D_Color32(0,0,0,0));  // Dark gray background
+    C2D_SceneBegin(bottomTarget);
+    
+    // Control lines - white, smaller
+    float yPos = 38.0f;
+    float lineSpacing = 14.0f;
+    float controlScale = 0.5f;
+    
+    // Section header - blue
+    C2D_DrawText(&instructionTexts[helpPageStart[helpPage]], C2D_WithColor,
+                 10.0f, 20.0f, 0.5f,
+                 0.6f, 0.6f, // scale
+                 C2D_Color32(65, 105, 225, 255));
+    
+    for (int i = helpPageStart[helpPage] + 1; i < helpPageEnd[helpPage]; i++) {
+        C2D_DrawText(&instructionTexts[i], C2D_WithColor,
+                     10.0f, yPos, 0.5f,
+                     controlScale, controlScale,
+                     C2D_Color32(255, 255, 255, 255));  // White
+        yPos += lineSpacing;
+    }
+    
+    // Page hint - gray
+    C2D_DrawText(&instructionTexts[15], C2D_WithColor,
+                 10.0f, 198.0f, 0.5f,
+                 0.45f, 0.45f,
+                 C2D_Color32(150, 150, 150, 255));
+    
+    // Prompt at bottom - cyan
+    C2D_DrawText(&instructionTexts[14], C2D_WithColor,
+                 65.0f, 215.0f, 0.5f,
+                 0.6f, 0.6f,
+                 C2D_Color32(100, 255, 255, 255));  // Cyan
+}
+
+/**
+ * Draw gallery instructions on bottom screen
+ */
+void drawGalleryInstructions(u8* framebuffer) {
+    // Fill with dark background
+    for (int i = 0; i < FB_WIDTH * FB_HEIGHT * 3; i += 3) {
+        framebuffer[i + 0] = 20;   // B
+        framebuffer[i + 1] = 20;   // G
+        framebuffer[i + 2] = 20;   // R
+    }
+    
+    // Draw a colored header bar at top
+    for (int x = 0; x < 320; x++) {
+        for (int y = 0; y < 40; y++) {
+            int idx = (x * 240 + (239 - y)) * 3;
+            if (idx >= 0 && idx < FB_WIDTH * FB_HEIGHT * 3 - 2) {
+                framebuffer[idx + 0] = 225;  // B - Royal Blue
+                framebuffer[idx + 1] = 105;  // G
+                framebuffer[idx + 2] = 65;   // R
+            }
+        }
+    }
+}
+
+/**
+ * PALETTE EDITOR
+ * 
+ * X in the gallery opens the drawing palette on the bottom screen: a
+ * hue/saturation wheel, a value bar and the palette's swatches, with the
+ * canvas on the top screen. The selected swatch is the drawing color, and
+ * edits recolor the canvas right away through the layer luts.
+ * Palettes are kept in PALETTE_SLOTS text files of #RRGGBB lines; the one
+ * being edited is saved when the editor closes.
+ * The wheel never changes, so it is drawn once into a cached screen image
+ * that each frame starts from.
+ */
+#define WHEEL_CENTER_X 96
+#define WHEEL_CENTER_Y 120
+#define WHEEL_RADIUS 88
+#define VALUE_BAR_X 200
+#define VALUE_BAR_WIDTH 24
+#define PICKER_TOP (WHEEL_CENTER_Y - WHEEL_RADIUS)
+#define PICKER_HEIGHT (WHEEL_RADIUS * 2)
+#define SWATCH_X 240
+#define SWATCH_Y 24
+#define SWATCH_WIDTH 36
+#define SWATCH_HEIGHT 32
+#define SWATCH_COLUMNS 2
+
+typedef enum {
+    PICK_NONE,
+    PICK_WHEEL,     // Dragging on the hue/saturation wheel
+    PICK_VALUE      // Dragging on the value bar
+} PickTarget;
+
+static u8* wheelImage = NULL;     // Editor background with the wheel (framebuffer format)
+static PickTarget pickTarget = PICK_NONE;
+static int pickHue = 0;           // HSV of the selected color: 0-359, 0-255, 0-255
+static int pickSaturation = 0;
+static int pickValue = 0;
+static bool paletteModified = false;
+
+// Load the selected color into the picker
+static void syncPicker() {
+    Color c = paletteColors[currentColorIndex];
+    int maxValue = c.r > c.g ? (c.r > c.b ? c.r : c.b) : (c.g > c.b ? c.g : c.b);
+    int minValue = c.r < c.g ? (c.r < c.b ? c.r : c.b) : (c.g < c.b ? c.g : c.b);
+    int delta = maxValue - minValue;
+    
+    pickValue = maxValue;
+    pickSaturation = maxValue ? delta * 255 / maxValue : 0;
+    if (delta == 0) {
+        pickHue = 0;
+    } else if (maxValue == c.r) {
+        pickHue = (60 * (c.g - c.b) / delta + 360) % 360;
+    } else if (maxValue == c.g) {
+        pickHue = 120 + 60 * (c.b - c.r) / delta;
+    } else {
+        pickHue = 240 + 60 * (c.r - c.g) / delta;
+    }
+}
+
+static void makePaletteFilename(char* filename, size_t size, int slot) {
+    snprintf(filename, size, "sdmc:/sqribble_palette%d.txt", slot + 1);
+}
+
+/**
+ * Use a palette slot: its file if there is one, the rainbow otherwise.
+ * Colors are read as #RRGGBB, one per line.
+ */
+void loadPalette(int slot) {
+    char filename[64];
+    makePaletteFilename(filename, sizeof(filename), slot);
+    paletteSlot = slot;
+    numColors = 0;
+    
+    FILE* file = fopen(filename, "r");
+    if (file) {
+        unsigned int r, g, b;
+        while (numColors < MAX_PALETTE_COLORS && fscanf(file, " #%2x%2x%2x", &r, &g, &b) == 3) {
+            paletteColors[numColors++] = (Color){r, g, b};
+        }
+        fclose(file);
+    }
+    
+    if (numColors < 2) {
+        numColors = sizeof(rainbowColors) / sizeof(Color);
+        memcpy(paletteColors, rainbowColors, sizeof(rainbowColors));
+    }
+    if (currentColorIndex >= numColors) currentColorIndex = numColors - 1;
+}
+
+bool savePalette() {
+    char filename[64];
+    makePaletteFilename(filename, sizeof(filename), paletteSlot);
+    
+    FILE* file = fopen(filename, "w");
+    if (!file) return false;
+    for (int i = 0; i < numColors; i++) {
+        fprintf(file, "#%02X%02X%02X\n", paletteColors[i].r, paletteColors[i].g, paletteColors[i].b);
+    }
+    return fclose(file) == 0;
+}
+
+void openPaletteEditor() {
+    showPalette = true;
+    pickTarget = PICK_NONE;
+    paletteModified = false;
+    syncPicker();
+}
+
+void closePaletteEditor() {
+    if (paletteModified) savePalette();
+    showPalette = false;
+}
+
+// The drawing color changed: recolor the canvas and follow it in the picker
+static void paletteChanged() {
+    updateLayerPalettes();
+    syncPicker();
+}
+
+static void applyPicker() {
+    paletteColors[currentColorIndex] = hsvToColor(pickHue, pickSaturation, pickValue);
+    paletteModified = true;
+    updateLayerPalettes();
+}
+
+/**
+ * Handle input while the editor is open.
+ * Touch: the wheel sets hue and saturation, the bar sets value and a tap
+ * on a swatch selects it. X/Y add/remove a color, D-Pad Left/Right switch
+ * palette slots and B saves and closes.
+ */
+void updatePaletteEditor(u32 kDown, u32 kHeld) {
+    if (kHeld & KEY_TOUCH) {
+        touchPosition touch;
+        hidTouchRead(&touch);
+        int dx = touch.px - WHEEL_CENTER_X;
+        int dy = touch.py - WHEEL_CENTER_Y;
+        
+        // The touch that lands decides what is being dragged
+        if (kDown & KEY_TOUCH) {
+            pickTarget = PICK_NONE;
+            if (dx * dx + dy * dy <= WHEEL_RADIUS * WHEEL_RADIUS) {
+                pickTarget = PICK_WHEEL;
+            } else if (touch.px >= VALUE_BAR_X && touch.px < VALUE_BAR_X + VALUE_BAR_WIDTH &&
+                       touch.py >= PICKER_TOP && touch.py < PICKER_TOP + PICKER_HEIGHT) {
+                pickTarget = PICK_VALUE;
+            } else if (touch.px >= SWATCH_X && touch.py >= SWATCH_Y) {
+                int swatch = (touch.py - SWATCH_Y) / SWATCH_HEIGHT * SWATCH_COLUMNS +
+                             (touch.px - SWATCH_X) / SWATCH_WIDTH;
+                if ((touch.px - SWATCH_X) / SWATCH_WIDTH < SWATCH_COLUMNS && swatch < numColors) {
+                    currentColorIndex = swatch;
+                    paletteChanged();
+                }
+            }
+        }
+        
+        if (pickTarget == PICK_WHEEL) {
+            // Dragging past the rim keeps full saturation
+            int distance = (int)sqrtf((float)(dx * dx + dy * dy));
+            pickSaturation = distance >= WHEEL_RADIUS ? 255 : distance * 255 / WHEEL_RADIUS;
+            pickHue = ((int)(atan2f((float)-dy, (float)dx) * 180.0f / (float)M_PI) + 360) % 360;
+            applyPicker();
+        } else if (pickTarget == PICK_VALUE) {
+            int y = touch.py - PICKER_TOP;
+            if (y < 0) y = 0;
+            if (y > PICKER_HEIGHT - 1) y = PICKER_HEIGHT - 1;
+            pickValue = 255 - y * 255 / (PICKER_HEIGHT - 1);
+            applyPicker();
+        }
+    } else {
+        pickTarget = PICK_NONE;
+    }
+    
+    // X: Add a copy of the selected color after it
+    if ((kDown & KEY_X) && numColors < MAX_PALETTE_COLORS) {
+        memmove(&paletteColors[currentColorIndex + 1], &paletteColors[currentColorIndex],
+                (numColors - currentColorIndex) * sizeof(Color));
+        numColors++;
+        currentColorIndex++;
+        paletteModified = true;
+        paletteChanged();
+    }
+    
+    // Y: Remove the selected color (at least two stay)
+    if ((kDown & KEY_Y) && numColors > 2) {
+        memmove(&paletteColors[currentColorIndex], &paletteColors[currentColorIndex + 1],
+                (numColors - currentColorIndex - 1) * sizeof(Color));
+        numColors--;
+        if (currentColorIndex >= numColors) currentColorIndex = numColors - 1;
+        paletteModified = true;
+        paletteChanged();
+    }
+    
+    // D-Pad Left/Right: Save this palette and switch to another slot
+    if (kDown & (KEY_DLEFT | KEY_DRIGHT)) {
+        if (paletteModified) savePalette();
+        paletteModified = false;
+        loadPalette((paletteSlot + ((kDown & KEY_DLEFT) ? PALETTE_SLOTS - 1 : 1)) % PALETTE_SLOTS);
+        paletteChanged();
+    }
+    
+    // L/R: Cycle the pattern of the hidden layers
+    if (kDown & (KEY_L | KEY_R)) {
+        hiddenPattern = (CanvasPattern)((hiddenPattern + ((kDown & KEY_L) ? CANVAS_PATTERN_COUNT - 1 : 1)) %
+                                        CANVAS_PATTERN_COUNT);
+        generateLayerImages(1);
+    }
+    
+    // A: Cycle the paper color under every pattern
+    if (kDown & KEY_A) {
+        currentPaper = (PaperStyle)((currentPaper + 1) % PAPER_STYLE_COUNT);
+        updateLayerPalettes();
+    }
+    
+    // D-Pad Up: Cycle the hidden layers' colors (palette color, rainbow, whole palette)
+    if (kDown & KEY_DUP) {
+        hiddenInk = (HiddenInk)((hiddenInk + 1) % HIDDEN_INK_COUNT);
+        updateLayerPalettes();
+    }
+    
+    // D-Pad Down: Color cycling off/slow/fast
+    if (kDown & KEY_DDOWN) {
+        colorCycle = (colorCycle + 1) % COLOR_CYCLE_SPEEDS;
+    }
+    
+    if (kDown & KEY_B) closePaletteEditor();
+}
+
+static void fillScreenRect(u8* framebuffer, int x0, int y0, int width, int height, Color color) {
+    for (int x = x0; x < x0 + width; x++) {
+        for (int y = y0; y < y0 + height; y++) {
+            if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) continue;
+            u8* pixel = &framebuffer[(x * 240 + (239 - y)) * 3];
+            pixel[0] = color.b;
+            pixel[1] = color.g;
+            pixel[2] = color.r;
+        }
+    }
+}
+
+// Two-pixel outline: black inside white, visible on any color
+static void drawScreenOutline(u8* framebuffer, int x0, int y0, int width, int height) {
+    const Color white = {255, 255, 255};
+    const Color black = {0, 0, 0};
+    for (int ring = 0; ring < 2; ring++) {
+        Color color = ring ? black : white;
+        int x = x0 + ring, y = y0 + ring, w = width - 2 * ring, h = height - 2 * ring;
+        fillScreenRect(framebuffer, x, y, w, 1, color);
+        fillScreenRect(framebuffer, x, y + h - 1, w, 1, color);
+        fillScreenRect(framebuffer, x, y, 1, h, color);
+        fillScreenRect(framebuffer, x + w - 1, y, 1, h, color);
+    }
+}
+
+// Background and hue/saturation wheel at full value, drawn once
+static bool renderWheelImage() {
+    wheelImage = (u8*)malloc(FB_WIDTH * FB_HEIGHT * 3);
+    if (!wheelImage) return false;
+    
+    memset(wheelImage, 20, FB_WIDTH * FB_HEIGHT * 3);
+    for (int y = PICKER_TOP; y < PICKER_TOP + PICKER_HEIGHT; y++) {
+        for (int x = WHEEL_CENTER_X - WHEEL_RADIUS; x < WHEEL_CENTER_X + WHEEL_RADIUS; x++) {
+            int dx = x - WHEEL_CENTER_X;
+            int dy = y - WHEEL_CENTER_Y;
+            int distance2 = dx * dx + dy * dy;
+            if (distance2 > WHEEL_RADIUS * WHEEL_RADIUS) continue;
+            
+            int hue = ((int)(atan2f((float)-dy, (float)dx) * 180.0f / (float)M_PI) + 360) % 360;
+            int saturation = (int)sqrtf((float)distance2) * 255 / WHEEL_RADIUS;
+            fillScreenRect(wheelImage, x, y, 1, 1, hsvToColor(hue, saturation, 255));
+        }
+    }
+    return true;
+}
+
+/**
+ * Draw the editor to the bottom screen framebuffer
+ */
+void drawPaletteEditor(u8* framebuffer) {
+    if (!wheelImage && !renderWheelImage()) {
+        memset(framebuffer, 20, FB_WIDTH * FB_HEIGHT * 3);
+        return;
+    }
+    memcpy(framebuffer, wheelImage, FB_WIDTH * FB_HEIGHT * 3);
+    
+    // Header bar in the selected color
+    fillScreenRect(framebuffer, 0, 0, SCREEN_WIDTH, 20, paletteColors[currentColorIndex]);
+    
+    // Marker at the selected hue/saturation
+    float angle = pickHue * (float)M_PI / 180.0f;
+    int radius = pickSaturation * WHEEL_RADIUS / 255;
+    int markerX = WHEEL_CENTER_X + (int)(cosf(angle) * radius);
+    int markerY = WHEEL_CENTER_Y - (int)(sinf(angle) * radius);
+    drawScreenOutline(framebuffer, markerX - 3, markerY - 3, 7, 7);
+    
+    // Value bar: the selected hue/saturation from full value down to black
+    for (int y = 0; y < PICKER_HEIGHT; y++) {
+        Color color = hsvToColor(pickHue, pickSaturation, 255 - y * 255 / (PICKER_HEIGHT - 1));
+        fillScreenRect(framebuffer, VALUE_BAR_X, PICKER_TOP + y, VALUE_BAR_WIDTH, 1, color);
+    }
+    int valueY = PICKER_TOP + (255 - pickValue) * (PICKER_HEIGHT - 1) / 255;
+    drawScreenOutline(framebuffer, VALUE_BAR_X - 3, valueY - 2, VALUE_BAR_WIDTH + 6, 5);
+    
+    // Swatches, the drawing color outlined
+    for (int i = 0; i < numColors; i++) {
+        int x = SWATCH_X + (i % SWATCH_COLUMNS) * SWATCH_WIDTH;
+        int y = SWATCH_Y + (i / SWATCH_COLUMNS) * SWATCH_HEIGHT;
+        fillScreenRect(framebuffer, x + 2, y + 2, SWATCH_WIDTH - 4, SWATCH_HEIGHT - 4, paletteColors[i]);
+        if (i == currentColorIndex) drawScreenOutline(framebuffer, x, y, SWATCH_WIDTH, SWATCH_HEIGHT);
+    }
+    
+    // Palette slot indicator along the bottom
+    for (int slot = 0; slot < PALETTE_SLOTS; slot++) {
+        u8 level = (slot == paletteSlot) ? 255 : 90;
+        fillScreenRect(framebuffer, 8 + slot * 24, 222, 16, 10, (Color){level, level, level});
+    }
+}
+
+/**
+ * SCREENSHOT SYSTEM
+ * 
+ * Save current canvas to SD card as BMP file.
+ * Filename format: sqribble_YYYYMMDD_HHMMSS.bmp
+ * (other exports use the same timestamp with their own suffix)
+ * BMP format is uncompressed 24-bit RGB (actually BGR on 3DS).
+ * Returns true on success, false on failure.
+ */
+void makeTimestampFilename(char* filename, size_t size, const char* suffix) {
+    // Get current time for unique filename
+    time_t rawtime;
+    struct tm* timeinfo;
+    
+    time(&rawtime);
+    timeinfo = localtime(&rawtime);
+    
+    // Format timestamp into filename
+    snprintf(filename, size, "sdmc:/sqribble_%04d%02d%02d_%02d%02d%02d%s",
+             timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
+             timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, suffix);
+}
+
+bool saveScreenshot(u8* framebuffer) {
+    char filename[256];
+    makeTimestampFilename(filename, sizeof(filename), ".bmp");
+    
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+    
+    // BMP file structure: File Header (14 bytes) + Info Header (40 bytes) + Pixel Data
+    u32 fileSize = 54 + (320 * 240 * 3);
+    u32 dataOffset = 54;
+    u32 headerSize = 40;
+    u32 width = 320;
+    u32 height = 240;
+    u16 planes = 1;
+    u16 bitsPerPixel = 24;
+    
+    // Write BMP file header (14 bytes)
+    fwrite("BM", 1, 2, file);              // Magic number
+    fwrite(&fileSize, 4, 1, file);        // File size
+    fwrite("\0\0\0\0", 1, 4, file);        // Reserved
+    fwrite(&dataOffset, 4, 1, file);      // Pixel data offset
+    
+    // Write BMP info header (40 bytes)
+    fwrite(&headerSize, 4, 1, file);      // Header size
+    fwrite(&width, 4, 1, file);           // Image width
+    fwrite(&height, 4, 1, file);          // Image height
+    fwrite(&planes, 2, 1, file);          // Color planes
+    fwrite(&bitsPerPixel, 2, 1, file);    // Bits per pixel
+    fwrite("\0\0\0\0", 1, 4, file);        // Compression (none)
+    fwrite("\0\0\0\0", 1, 4, file);        // Image size (can be 0 for uncompressed)
+    fwrite("\0\0\0\0", 1, 4, file);        // X pixels per meter
+    fwrite("\0\0\0\0", 1, 4, file);        // Y pixels per meter
+    fwrite("\0\0\0\0", 1, 4, file);        // Colors in palette
+    fwrite("\0\0\0\0", 1, 4, file);        // Important colors
+    
+    // Write pixel data (BMP stores bottom-to-top, which matches our coordinate system)
+    for (int y = 239; y >= 0; y--) {
+        for (int x = 0; x < 320; x++) {
+            int idx = (x * 240 + (239 - y)) * 3;
+            // BMP uses BGR format, same as 3DS framebuffer
+            fwrite(&framebuffer[idx], 1, 3, file);
+        }
+    }
+    
+    fclose(file);
+    return true;
+}
+
+/**
+ * BACKGROUND JOBS
+ * 
+ * Slow SD card work (exports) runs on a worker thread with a lower priority
+ * than the main loop, so it only uses the time the main thread spends
+ * waiting for VBlank. One job runs at a time; the job owns its argument
+ * and frees it when done.
+ */
+#define BACKGROUND_STACK_SIZE (32 * 1024)
+
+static Thread backgroundThread = NULL;
+static volatile bool backgroundBusy = false;
+static void (*backgroundJobFunc)(void*) = NULL;
+static void* backgroundJobArg = NULL;
+
+static void backgroundThreadMain(void* arg) {
+    backgroundJobFunc(backgroundJobArg);
+    backgroundBusy = false;
+}
+
+/**
+ * Wait for the running job (if any) and release its thread
+ */
+void waitBackgroundJob() {
+    if (backgroundThread) {
+        threadJoin(backgroundThread, U64_MAX);
+        threadFree(backgroundThread);
+        backgroundThread = NULL;
+    }
+}
+
+/**
+ * Start func(arg) on the worker thread.
+ * Returns false if a job is still running or the thread can't be created;
+ * the caller keeps ownership of arg in that case.
+ */
+bool startBackgroundJob(void (*func)(void*), void* arg) {
+    if (backgroundBusy) return false;
+    waitBackgroundJob();  // Reap the previous (finished) job
+    
+    s32 priority = 0x30;
+    svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+    if (priority < 0x3F) priority++;  // Lower priority than the main loop
+    
+    backgroundJobFunc = func;
+    backgroundJobArg = arg;
+    backgroundBusy = true;
+    backgroundThread = threadCreate(backgroundThreadMain, NULL, BACKGROUND_STACK_SIZE,
+                                    priority, -2, false);
+    if (!backgroundThread) {
+        backgroundBusy = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * JPEG ENCODER
+ * 
+ * Small baseline JPEG encoder (YCbCr 4:4:4, standard Huffman tables) used
+ * by the stereoscopic exports. Pixels are pulled one 8-row strip at a time
+ * from a strip source in framebuffer (column) layout, so no converted copy
+ * of the image is ever built. Color conversion, DCT and quantization are
+ * all fixed-point integer arithmetic.
+ */
+#define JPEG_QUALITY 90
+
+// One 8-row strip in framebuffer layout: columns of 8 BGR pixels stored
+// bottom-to-top, columnStride pixels apart
+typedef struct {
+    const u8* pixels;   // Bottom pixel of the first column
+    int columnStride;
+} JpegStrip;
+
+typedef void (*JpegStripSource)(void* context, int stripY, JpegStrip* strip);
+
+// Zigzag scan order: natural (row-major) index of each coefficient
+static const u8 jpegZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Standard quantization tables (JPEG Annex K), natural order
+static const u8 jpegLumaQuant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const u8 jpegChromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Standard Huffman tables (JPEG Annex K): code counts per length, then symbols
+static const u8 jpegDcLumaBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const u8 jpegDcChromaBits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const u8 jpegDcValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const u8 jpegAcLumaBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const u8 jpegAcLumaValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const u8 jpegAcChromaBits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const u8 jpegAcChromaValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+typedef struct {
+    u16 code[256];
+    u8 size[256];
+} HuffmanTable;
+
+// Buffered big-endian output with an MSB-first bit accumulator
+typedef struct {
+    FILE* file;
+    u8 buffer[2048];
+    int length;
+    u32 bitBuffer;
+    int bitCount;
+} JpegWriter;
+
+// Per-component encoding state
+typedef struct {
+    u8 quant[64];          // Quantizer (zigzag order) as written to DQT
+    u32 reciprocal[64];    // 16.16 reciprocal of 8 * quant (natural order)
+    HuffmanTable dc;
+    HuffmanTable ac;
+    int prevDC;
+} JpegComponent;
+
+static void jpegFlush(JpegWriter* w) {
+    if (w->length > 0) {
+        fwrite(w->buffer, 1, w->length, w->file);
+        w->length = 0;
+    }
+}
+
+static void jpegPutByte(JpegWriter* w, u8 value) {
+    if (w->length == (int)sizeof(w->buffer)) jpegFlush(w);
+    w->buffer[w->length++] = value;
+}
+
+static void jpegPutWord(JpegWriter* w, u16 value) {
+    jpegPutByte(w, value >> 8);
+    jpegPutByte(w, value & 0xFF);
+}
+
+static void jpegPutLong(JpegWriter* w, u32 value) {
+    jpegPutWord(w, value >> 16);
+    jpegPutWord(w, value & 0xFFFF);
+}
+
+static void jpegPutBytes(JpegWriter* w, const void* data, int length) {
+    const u8* bytes = (const u8*)data;
+    for (int i = 0; i < length; i++) jpegPutByte(w, bytes[i]);
+}
+
+// Current output position in the file (includes buffered bytes)
+static long jpegTell(JpegWriter* w) {
+    jpegFlush(w);
+    return ftell(w->file);
+}
+
+static void jpegPutBits(JpegWriter* w, u32 bits, int count) {
+    w->bitBuffer = (w->bitBuffer << count) | bits;
+    w->bitCount += count;
+    while (w->bitCount >= 8) {
+        u8 byte = (w->bitBuffer >> (w->bitCount - 8)) & 0xFF;
+        jpegPutByte(w, byte);
+        if (byte == 0xFF) jpegPutByte(w, 0);  // Byte stuffing
+        w->bitCount -= 8;
+    }
+}
+
+// Pad the last entropy-coded byte with 1 bits
+static void jpegFlushBits(JpegWriter* w) {
+    if (w->bitCount > 0) jpegPutBits(w, 0x7F, 7);
+    w->bitCount = 0;
+    w->bitBuffer = 0;
+}
+
+static void buildHuffmanTable(HuffmanTable* table, const u8* bits, const u8* values) {
+    int code = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < bits[length - 1]; i++) {
+            table->code[values[k]] = code++;
+            table->size[values[k]] = length;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+/**
+ * Scale a standard quantization table to JPEG_QUALITY (libjpeg formula)
+ * and precompute fixed-point reciprocals for the quantizer
+ */
+static void initJpegComponent(JpegComponent* c, const u8* baseQuant,
+                              const u8* dcBits, const u8* acBits, const u8* acValues) {
+    int scale = (JPEG_QUALITY < 50) ? 5000 / JPEG_QUALITY : 200 - JPEG_QUALITY * 2;
+    
+    for (int i = 0; i < 64; i++) {
+        int natural = jpegZigzag[i];
+        int q = (baseQuant[natural] * scale + 50) / 100;
+        if (q < 1) q = 1;
+        if (q > 255) q = 255;
+        c->quant[i] = q;
+        // The DCT output is scaled by 8
+        c->reciprocal[natural] = (65536 + q * 4) / (q * 8);
+    }
+    
+    buildHuffmanTable(&c->dc, dcBits, jpegDcValues);
+    buildHuffmanTable(&c->ac, acBits, acValues);
+    c->prevDC = 0;
+}
+
+/**
+ * Integer forward DCT (Loeffler-Ligtenberg-Moschytz, as in libjpeg's
+ * islow). Output is scaled up by 8 relative to a true DCT.
+ */
+#define DCT_CONST_BITS 13
+#define DCT_PASS1_BITS 2
+#define DCT_DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+static void jpegForwardDCT(int* data) {
+    int* p = data;
+    
+    // Pass 1: rows
+    for (int row = 0; row < 8; row++, p += 8) {
+        int tmp0 = p[0] + p[7], tmp7 = p[0] - p[7];
+        int tmp1 = p[1] + p[6], tmp6 = p[1] - p[6];
+        int tmp2 = p[2] + p[5], tmp5 = p[2] - p[5];
+        int tmp3 = p[3] + p[4], tmp4 = p[3] - p[4];
+        
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        
+        p[0] = (tmp10 + tmp11) << DCT_PASS1_BITS;
+        p[4] = (tmp10 - tmp11) << DCT_PASS1_BITS;
+        
+        int z1 = (tmp12 + tmp13) * 4433;                                              // 0.541196100
+        p[2] = DCT_DESCALE(z1 + tmp13 * 6270, DCT_CONST_BITS - DCT_PASS1_BITS);        // 0.765366865
+        p[6] = DCT_DESCALE(z1 - tmp12 * 15137, DCT_CONST_BITS - DCT_PASS1_BITS);       // 1.847759065
+        
+        z1 = tmp4 + tmp7;
+        int z2 = tmp5 + tmp6;
+        int z3 = tmp4 + tmp6;
+        int z4 = tmp5 + tmp7;
+        int z5 = (z3 + z4) * 9633;   // 1.175875602
+        
+        tmp4 *= 2446;    // 0.298631336
+        tmp5 *= 16819;   // 2.053119869
+        tmp6 *= 25172;   // 3.072711026
+        tmp7 *= 12299;   // 1.501321110
+        z1 *= -7373;     // 0.899976223
+        z2 *= -20995;    // 2.562915447
+        z3 = z3 * -16069 + z5;   // 1.961570560
+        z4 = z4 * -3196 + z5;    // 0.390180644
+        
+        p[7] = DCT_DESCALE(tmp4 + z1 + z3, DCT_CONST_BITS - DCT_PASS1_BITS);
+        p[5] = DCT_DESCALE(tmp5 + z2 + z4, DCT_CONST_BITS - DCT_PASS1_BITS);
+        p[3] = DCT_DESCALE(tmp6 + z2 + z3, DCT_CONST_BITS - DCT_PASS1_BITS);
+        p[1] = DCT_DESCALE(tmp7 + z1 + z4, DCT_CONST_BITS - DCT_PASS1_BITS);
+    }
+    
+    // Pass 2: columns
+    p = data;
+    for (int col = 0; col < 8; col++, p++) {
+        int tmp0 = p[0] + p[56], tmp7 = p[0] - p[56];
+        int tmp1 = p[8] + p[48], tmp6 = p[8] - p[48];
+        int tmp2 = p[16] + p[40], tmp5 = p[16] - p[40];
+        int tmp3 = p[24] + p[32], tmp4 = p[24] - p[32];
+        
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        
+        p[0] = DCT_DESCALE(tmp10 + tmp11, DCT_PASS1_BITS);
+        p[32] = DCT_DESCALE(tmp10 - tmp11, DCT_PASS1_BITS);
+        
+        int z1 = (tmp12 + tmp13) * 4433;
+        p[16] = DCT_DESCALE(z1 + tmp13 * 6270, DCT_CONST_BITS + DCT_PASS1_BITS);
+        p[48] = DCT_DESCALE(z1 - tmp12 * 15137, DCT_CONST_BITS + DCT_PASS1_BITS);
+        
+        z1 = tmp4 + tmp7;
+        int z2 = tmp5 + tmp6;
+        int z3 = tmp4 + tmp6;
+        int z4 = tmp5 + tmp7;
+        int z5 = (z3 + z4) * 9633;
+        
+        tmp4 *= 2446;
+        tmp5 *= 16819;
+        tmp6 *= 25172;
+        tmp7 *= 12299;
+        z1 *= -7373;
+        z2 *= -20995;
+        z3 = z3 * -16069 + z5;
+        z4 = z4 * -3196 + z5;
+        
+        p[56] = DCT_DESCALE(tmp4 + z1 + z3, DCT_CONST_BITS + DCT_PASS1_BITS);
+        p[40] = DCT_DESCALE(tmp5 + z2 + z4, DCT_CONST_BITS + DCT_PASS1_BITS);
+        p[24] = DCT_DESCALE(tmp6 + z2 + z3, DCT_CONST_BITS + DCT_PASS1_BITS);
+        p[8] = DCT_DESCALE(tmp7 + z1 + z4, DCT_CONST_BITS + DCT_PASS1_BITS);
+    }
+}
+
+// Number of bits needed for a coefficient magnitude (JPEG size category)
+static int jpegBitLength(int value) {
+    int bits = 0;
+    if (value < 0) value = -value;
+    while (value) {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+/**
+ * Transform, quantize and entropy-code one 8x8 block of level-shifted samples
+ */
+static void jpegEncodeBlock(JpegWriter* w, int* block, JpegComponent* c) {
+    int quantized[64];
+    
+    jpegForwardDCT(block);
+    for (int i = 0; i < 64; i++) {
+        int natural = jpegZigzag[i];
+        int value = block[natural];
+        int magnitude = (value < 0 ? -value : value);
+        int q = (int)((magnitude * c->reciprocal[natural] + 32768) >> 16);
+        quantized[i] = (value < 0) ? -q : q;
+    }
+    
+    // DC: difference from previous block of this component
+    int diff = quantized[0] - c->prevDC;
+    c->prevDC = quantized[0];
+    int bits = jpegBitLength(diff);
+    jpegPutBits(w, c->dc.code[bits], c->dc.size[bits]);
+    if (bits) jpegPutBits(w, (diff < 0 ? diff - 1 : diff) & ((1 << bits) - 1), bits);
+    
+    // AC: run-length of zeros + size category
+    int run = 0;
+    for (int i = 1; i < 64; i++) {
+        int value = quantized[i];
+        if (value == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            jpegPutBits(w, c->ac.code[0xF0], c->ac.size[0xF0]);  // ZRL: 16 zeros
+            run -= 16;
+        }
+        bits = jpegBitLength(value);
+        int symbol = (run << 4) | bits;
+        jpegPutBits(w, c->ac.code[symbol], c->ac.size[symbol]);
+        jpegPutBits(w, (value < 0 ? value - 1 : value) & ((1 << bits) - 1), bits);
+        run = 0;
+    }
+    if (run > 0) {
+        jpegPutBits(w, c->ac.code[0x00], c->ac.size[0x00]);  // EOB
+    }
+}
+
+static void jpegPutHuffmanTable(JpegWriter* w, u8 tableClassId, const u8* bits, const u8* values) {
+    int count = 0;
+    jpegPutByte(w, tableClassId);
+    for (int i = 0; i < 16; i++) {
+        jpegPutByte(w, bits[i]);
+        count += bits[i];
+    }
+    jpegPutBytes(w, values, count);
+}
+
+/**
+ * Encode a width x height image (both multiples of 8) as a complete
+ * baseline JPEG (SOI..EOI), requesting pixels from source strip by strip.
+ * extraSegment, if given, is written as an APP2 segment right after the
+ * Exif header (used for MPF); the file offset of its payload is returned
+ * through extraOffset.
+ */
+void encodeJpeg(JpegWriter* w, int width, int height, JpegStripSource source, void* context,
+                const u8* extraSegment, int extraLength, long* extraOffset) {
+    JpegComponent components[3];
+    initJpegComponent(&components[0], jpegLumaQuant, jpegDcLumaBits, jpegAcLumaBits, jpegAcLumaValues);
+    initJpegComponent(&components[1], jpegChromaQuant, jpegDcChromaBits, jpegAcChromaBits, jpegAcChromaValues);
+    initJpegComponent(&components[2], jpegChromaQuant, jpegDcChromaBits, jpegAcChromaBits, jpegAcChromaValues);
+    
+    jpegPutWord(w, 0xFFD8);  // SOI
+    
+    // APP1: minimal Exif header naming the software
+    static const char software[] = "SQRIBBLE 3DS";
+    jpegPutWord(w, 0xFFE1);
+    jpegPutWord(w, 2 + 6 + 8 + 18 + sizeof(software));
+    jpegPutBytes(w, "Exif\0\0", 6);
+    jpegPutBytes(w, "MM\0*", 4);  // Big-endian TIFF header
+    jpegPutLong(w, 8);            // Offset of IFD0
+    jpegPutWord(w, 1);            // One entry
+    jpegPutWord(w, 0x0131);       // Software
+    jpegPutWord(w, 2);            // ASCII
+    jpegPutLong(w, sizeof(software));
+    jpegPutLong(w, 8 + 18);       // String follows the IFD
+    jpegPutLong(w, 0);            // No next IFD
+    jpegPutBytes(w, software, sizeof(software));
+    
+    if (extraSegment) {
+        jpegPutWord(w, 0xFFE2);
+        jpegPutWord(w, 2 + extraLength);
+        *extraOffset = jpegTell(w);
+        jpegPutBytes(w, extraSegment, extraLength);
+    }
+    
+    // DQT: luma and chroma tables in zigzag order
+    jpegPutWord(w, 0xFFDB);
+    jpegPutWord(w, 2 + 2 * 65);
+    jpegPutByte(w, 0);
+    jpegPutBytes(w, components[0].quant, 64);
+    jpegPutByte(w, 1);
+    jpegPutBytes(w, components[1].quant, 64);
+    
+    // SOF0: baseline, 8-bit, three components without subsampling
+    jpegPutWord(w, 0xFFC0);
+    jpegPutWord(w, 17);
+    jpegPutByte(w, 8);
+    jpegPutWord(w, height);
+    jpegPutWord(w, width);
+    jpegPutByte(w, 3);
+    for (int i = 0; i < 3; i++) {
+        jpegPutByte(w, i + 1);          // Component id
+        jpegPutByte(w, 0x11);           // 1x1 sampling
+        jpegPutByte(w, i == 0 ? 0 : 1); // Quant table
+    }
+    
+    // DHT: all four standard tables
+    jpegPutWord(w, 0xFFC4);
+    jpegPutWord(w, 2 + 4 * 17 + 12 + 12 + 162 + 162);
+    jpegPutHuffmanTable(w, 0x00, jpegDcLumaBits, jpegDcValues);
+    jpegPutHuffmanTable(w, 0x10, jpegAcLumaBits, jpegAcLumaValues);
+    jpegPutHuffmanTable(w, 0x01, jpegDcChromaBits, jpegDcValues);
+    jpegPutHuffmanTable(w, 0x11, jpegAcChromaBits, jpegAcChromaValues);
+    
+    // SOS
+    jpegPutWord(w, 0xFFDA);
+    jpegPutWord(w, 12);
+    jpegPutByte(w, 3);
+    for (int i = 0; i < 3; i++) {
+        jpegPutByte(w, i + 1);
+        jpegPutByte(w, i == 0 ? 0x00 : 0x11);
+    }
+    jpegPutByte(w, 0);
+    jpegPutByte(w, 63);
+    jpegPutByte(w, 0);
+    
+    // Entropy-coded data: one 8-row strip of interleaved Y/Cb/Cr blocks at a time
+    int blockY[64], blockCb[64], blockCr[64];
+    for (int stripY = 0; stripY < height; stripY += 8) {
+        JpegStrip strip;
+        source(context, stripY, &strip);
+        
+        for (int blockX = 0; blockX < width; blockX += 8) {
+            for (int dx = 0; dx < 8; dx++) {
+                // Framebuffer columns run bottom-to-top
+                const u8* column = &strip.pixels[((blockX + dx) * strip.columnStride + 7) * 3];
+                for (int dy = 0; dy < 8; dy++) {
+                    const u8* pixel = column - dy * 3;
+                    int b = pixel[0], g = pixel[1], r = pixel[2];
+                    int i = dy * 8 + dx;
+                    
+                    // Fixed-point RGB -> YCbCr (16.16), level shifted by -128
+                    blockY[i] = ((19595 * r + 38470 * g + 7471 * b + 32768) >> 16) - 128;
+                    blockCb[i] = (-11056 * r - 21712 * g + 32768 * b + 32768) >> 16;
+                    blockCr[i] = (32768 * r - 27440 * g - 5328 * b + 32768) >> 16;
+                }
+            }
+            jpegEncodeBlock(w, blockY, &components[0]);
+            jpegEncodeBlock(w, blockCb, &components[1]);
+            jpegEncodeBlock(w, blockCr, &components[2]);
+        }
+    }
+    jpegFlushBits(w);
+    
+    jpegPutWord(w, 0xFFD9);  // EOI
+}
+
+/**
+ * STEREOSCOPIC MPO EXPORT
+ * 
+ * Writes the left and right eye views as a Multi-Picture Object file
+ * (CIPA DC-007): two JPEGs back to back, with APP2 "MPF" segments that
+ * index them as a multi-view disparity image. The file goes to the folder
+ * the 3DS Camera app scans, so it can be viewed in 3D there as well as in
+ * desktop stereo viewers.
+ * The MP entries (image sizes and offsets) are patched in once both
+ * images have been written.
+ */
+#define MPF_ENTRY_OFFSET 50        // MP entries within the first image's MPF data
+#define MPF_INDEX_LENGTH (4 + 124) // "MPF\0" + TIFF header + index/attribute IFDs
+#define MPF_ATTR_LENGTH (4 + 50)   // "MPF\0" + TIFF header + attribute IFD
+
+typedef struct {
+    u8* composite;    // Snapshot of the BGR composite and its depth map, one
+    u8* depth;        // allocation; the eye views are warped from it a strip at a time
+    float eyeOffset;  // Right eye offset at the time of the snapshot
+} StereoExportJob;
+
+static void putBE16(u8* p, u16 value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static void putBE32(u8* p, u32 value) {
+    p[0] = value >> 24;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+// Write one 12-byte TIFF IFD entry
+static u8* putIFDEntry(u8* p, u16 tag, u16 type, u32 count, u32 value) {
+    putBE16(p, tag);
+    putBE16(p + 2, type);
+    putBE32(p + 4, count);
+    putBE32(p + 8, value);
+    return p + 12;
+}
+
+// MP Attribute IFD for one individual image (version, number, base viewpoint)
+static u8* putMPAttributeIFD(u8* p, int imageNumber) {
+    putBE16(p, 3);
+    p = putIFDEntry(p + 2, 0xB000, 7, 4, 0x30313030);  // MPFVersion "0100"
+    p = putIFDEntry(p, 0xB101, 4, 1, imageNumber);      // MPIndividualNum
+    p = putIFDEntry(p, 0xB204, 4, 1, 1);                // BaseViewpointNum: left eye
+    putBE32(p, 0);                                      // No next IFD
+    return p + 4;
+}
+
+/**
+ * Build the first image's MPF segment: MP Index IFD (with space for the
+ * two MP entries) followed by its MP Attribute IFD
+ */
+static void buildMPFIndex(u8* data) {
+    memset(data, 0, MPF_INDEX_LENGTH);
+    memcpy(data, "MPF\0", 4);
+    
+    u8* tiff = data + 4;
+    memcpy(tiff, "MM\0*", 4);
+    putBE32(tiff + 4, 8);
+    
+    u8* p = tiff + 8;
+    putBE16(p, 3);
+    p = putIFDEntry(p + 2, 0xB000, 7, 4, 0x30313030);        // MPFVersion "0100"
+    p = putIFDEntry(p, 0xB001, 4, 1, 2);                      // NumberOfImages
+    p = putIFDEntry(p, 0xB002, 7, 32, MPF_ENTRY_OFFSET);      // MPEntry
+    putBE32(p, MPF_ENTRY_OFFSET + 32);                        // Attribute IFD follows the entries
+    
+    putMPAttributeIFD(tiff + MPF_ENTRY_OFFSET + 32, 1);
+}
+
+/**
+ * Pick the next free Camera-app style name: sdmc:/DCIM/100NIN03/HNI_nnnn.MPO
+ */
+static bool findMPOFilename(char* filename, size_t size) {
+    mkdir("sdmc:/DCIM", 0777);
+    mkdir("sdmc:/DCIM/100NIN03", 0777);
+    
+    for (int n = 1; n <= 9999; n++) {
+        struct stat info;
+        snprintf(filename, size, "sdmc:/DCIM/100NIN03/HNI_%04d.MPO", n);
+        if (stat(filename, &info) != 0) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    const StereoExportJob* job;
+    float eyeOffset;
+    u8 strip[400 * 8 * 3];
+} EyeStripContext;
+
+/**
+ * Strip source warping one eye view from the snapshot as it goes
+ */
+static void eyeStripSource(void* context, int stripY, JpegStrip* strip) {
+    EyeStripContext* eye = (EyeStripContext*)context;
+    renderStereoStrip(eye->strip, eye->job->composite, eye->job->depth, eye->eyeOffset, stripY, 8, 3);
+    strip->pixels = eye->strip;
+    strip->columnStride = 8;
+}
+
+static void freeStereoJob(StereoExportJob* job) {
+    free(job->composite);
+    free(job);
+}
+
+static void exportMPOJob(void* arg) {
+    StereoExportJob* job = (StereoExportJob*)arg;
+    static JpegWriter writer;  // Large buffer; only one job runs at a time
+    static EyeStripContext eye;
+    char filename[64];
+    
+    FILE* file = NULL;
+    if (findMPOFilename(filename, sizeof(filename))) {
+        file = fopen(filename, "wb");
+    }
+    
+    if (file) {
+        u8 indexSegment[MPF_INDEX_LENGTH];
+        u8 attributeSegment[MPF_ATTR_LENGTH];
+        long indexOffset = 0, attributeOffset = 0;
+        
+        buildMPFIndex(indexSegment);
+        memset(attributeSegment, 0, sizeof(attributeSegment));
+        memcpy(attributeSegment, "MPF\0", 4);
+        memcpy(attributeSegment + 4, "MM\0*", 4);
+        putBE32(attributeSegment + 8, 8);
+        putMPAttributeIFD(attributeSegment + 12, 2);
+        
+        memset(&writer, 0, sizeof(writer));
+        writer.file = file;
+        
+        eye.job = job;
+        eye.eyeOffset = 0.0f;
+        encodeJpeg(&writer, 400, 240, eyeStripSource, &eye,
+                   indexSegment, sizeof(indexSegment), &indexOffset);
+        long secondStart = jpegTell(&writer);
+        eye.eyeOffset = job->eyeOffset;
+        encodeJpeg(&writer, 400, 240, eyeStripSource, &eye,
+                   attributeSegment, sizeof(attributeSegment), &attributeOffset);
+        long fileEnd = jpegTell(&writer);
+        
+        // MP entries: offsets are relative to the first image's TIFF header
+        u8 entries[32];
+        long tiffStart = indexOffset + 4;
+        putBE32(entries + 0, 0x20020002);                    // Representative, disparity image
+        putBE32(entries + 4, secondStart);                   // Size of first image
+        putBE32(entries + 8, 0);                             // First image starts the file
+        putBE32(entries + 12, 0);
+        putBE32(entries + 16, 0x00020002);                   // Disparity image
+        putBE32(entries + 20, fileEnd - secondStart);
+        putBE32(entries + 24, secondStart - tiffStart);
+        putBE32(entries + 28, 0);
+        
+        fseek(file, tiffStart + MPF_ENTRY_OFFSET, SEEK_SET);
+        fwrite(entries, 1, sizeof(entries), file);
+        fclose(file);
+    }
+    
+    freeStereoJob(job);
+}
+
+/**
+ * Snapshot the current composite and depth map for an export job, which
+ * warps the same eye views the top screen shows from them. That holds
+ * 300 KB instead of two 400x240 eye views. Returns NULL if out of memory.
+ */
+StereoExportJob* captureStereoSnapshot(const u8* composite, const u8* depth) {
+    StereoExportJob* job = (StereoExportJob*)malloc(sizeof(StereoExportJob));
+    if (!job) return NULL;
+    job->composite = (u8*)malloc(FB_WIDTH * FB_HEIGHT * 4);
+    if (!job->composite) {
+        free(job);
+        return NULL;
+    }
+    
+    job->depth = job->composite + FB_WIDTH * FB_HEIGHT * 3;
+    memcpy(job->composite, composite, FB_WIDTH * FB_HEIGHT * 3);
+    memcpy(job->depth, depth, FB_WIDTH * FB_HEIGHT);
+    job->eyeOffset = depthOffset;
+    return job;
+}
+
+/**
+ * Snapshot the composite and hand it to the worker thread for encoding.
+ * Returns false if an export is already running.
+ */
+bool startStereoExport(void (*exportJob)(void*), const u8* composite, const u8* depth) {
+    if (backgroundBusy) return false;
+    
+    StereoExportJob* job = captureStereoSnapshot(composite, depth);
+    if (!job) return false;
+    
+    if (!startBackgroundJob(exportJob, job)) {
+        freeStereoJob(job);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * ANAGLYPH AND SIDE-BY-SIDE EXPORT
+ * 
+ * Shareable 3D images for people without a 3DS, written as JPEGs next to
+ * the screenshots: a red/cyan anaglyph and a side-by-side pair. The strip
+ * sources warp each 8-row strip of both eye views from the snapshot (see
+ * STEREO PAIR EXPORT in stereo.c).
+ */
+#define SHARE_STRIP_COLUMNS 800
+
+typedef struct {
+    const StereoExportJob* job;
+    u32 strip[SHARE_STRIP_COLUMNS * 8 * 3 / 4];  // Word-aligned strip buffers
+    u32 rightStrip[400 * 8 * 3 / 4];
+} ShareStripContext;
+
+static void anaglyphStripSource(void* context, int stripY, JpegStrip* strip) {
+    ShareStripContext* share = (ShareStripContext*)context;
+    const StereoExportJob* job = share->job;
+    buildAnaglyphStrip((u8*)share->strip, (u8*)share->rightStrip, job->composite, job->depth, job->eyeOffset,
+                       stripY, 8);
+    strip->pixels = (const u8*)share->strip;
+    strip->columnStride = 8;
+}
+
+static void sideBySideStripSource(void* context, int stripY, JpegStrip* strip) {
+    ShareStripContext* share = (ShareStripContext*)context;
+    const StereoExportJob* job = share->job;
+    buildSideBySideStrip((u8*)share->strip, job->composite, job->depth, job->eyeOffset, stripY, 8);
+    strip->pixels = (const u8*)share->strip;
+    strip->columnStride = 8;
+}
+
+static void exportShareJob(void* arg) {
+    StereoExportJob* job = (StereoExportJob*)arg;
+    static JpegWriter writer;
+    static ShareStripContext share;
+    char filename[256];
+    
+    share.job = job;
+    
+    makeTimestampFilename(filename, sizeof(filename), "_anaglyph.jpg");
+    FILE* file = fopen(filename, "wb");
+    if (file) {
+        memset(&writer, 0, sizeof(writer));
+        writer.file = file;
+        encodeJpeg(&writer, 400, 240, anaglyphStripSource, &share, NULL, 0, NULL);
+        jpegFlush(&writer);
+        fclose(file);
+    }
+    
+    makeTimestampFilename(filename, sizeof(filename), "_sbs.jpg");
+    file = fopen(filename, "wb");
+    if (file) {
+        memset(&writer, 0, sizeof(writer));
+        writer.file = file;
+        encodeJpeg(&writer, 800, 240, sideBySideStripSource, &share, NULL, 0, NULL);
+        jpegFlush(&writer);
+        fclose(file);
+    }
+    
+    freeStereoJob(job);
+}
+
+/**
+ * ANIMATED GIF EXPORT
+ * 
+ * Writes the flipbook or a timelapse as a looping GIF
+ * (sqribble_<time>_anim.gif). The main thread steps through the animation
+ * once and hands each composited frame to the worker over a two-slot queue; the worker quantizes, crops
+ * and LZW-compresses it straight to the SD card, so no more than two
+ * frames are ever held in memory. Playback waits for a free slot, so the
+ * export runs as fast as the worker can write.
+ * 
+ * The palette holds the app's own colors (black, white, the dark canvas
+ * grey and the drawing palette), the 1/4, 1/2 and 3/4 blends of pairs of
+ * them that soft and anti-aliased edges produce (as many as fit), and a
+ * color cube for anything else. Frames after the first only cover the rectangle that changed,
+ * with pixels that did not change inside it left transparent.
+ */
+#define GIF_QUEUE_SLOTS 2
+#define GIF_FRAME_RATE (60 / PLAYBACK_INTERVAL)
+#define GIF_TRANSPARENT 255        // Palette index of "unchanged since last frame"
+#define GIF_CUBE_COLORS 125        // 5x5x5 color cube after the app colors and their blends
+#define GIF_CLEAR_CODE 256
+#define GIF_END_CODE 257
+#define GIF_MAX_CODE 4096          // 12-bit LZW codes
+#define GIF_HASH_BITS 13           // Dictionary hash table is at most half full
+
+// Buffered output with an LSB-first bit accumulator for image data
+typedef struct {
+    FILE* file;
+    u8 buffer[2048];
+    int length;
+    u8 block[255];                 // Image data sub-block being filled
+    int blockLength;
+    u32 bitBuffer;
+    int bitCount;
+} GifWriter;
+
+// LZW dictionary: strings are (prefix code, pixel) pairs in a hash table
+typedef struct {
+    s32 keys[1 << GIF_HASH_BITS];  // (prefix << 8) | pixel, -1 = empty slot
+    u16 codes[1 << GIF_HASH_BITS];
+    int prefix;                    // Code of the string matched so far, -1 = none
+    int nextCode;
+    int codeSize;
+} GifLzw;
+
+typedef struct {
+    u8* slots[GIF_QUEUE_SLOTS];    // Composites in framebuffer layout
+    volatile int produced;         // Frames handed over by the main thread
+    volatile int consumed;         // Frames written by the worker
+    volatile bool finished;        // No more frames will be produced
+} GifExportJob;
+
+static u8 gifPalette[256][3];
+static u8 gifColorLookup[32768];   // RGB555 -> palette index, GIF_TRANSPARENT = not computed yet
+static u8 gifFrame[SCREEN_WIDTH * SCREEN_HEIGHT];     // Palette indices, row-major
+static u8 gifPrevious[SCREEN_WIDTH * SCREEN_HEIGHT];
+static GifWriter gifWriter;
+static GifLzw gifLzw;
+
+static GifExportJob* gifExport = NULL;  // Export the main thread is feeding
+static bool (*gifExportAdvance)(void) = NULL;  // Steps to the next frame, false after the last
+
+static void gifFlush(GifWriter* w) {
+    if (w->length > 0) {
+        fwrite(w->buffer, 1, w->length, w->file);
+        w->length = 0;
+    }
+}
+
+static void gifPutByte(GifWriter* w, u8 value) {
+    if (w->length == (int)sizeof(w->buffer)) gifFlush(w);
+    w->buffer[w->length++] = value;
+}
+
+static void gifPutWord(GifWriter* w, u16 value) {
+    gifPutByte(w, value & 0xFF);
+    gifPutByte(w, value >> 8);
+}
+
+static void gifPutBytes(GifWriter* w, const void* data, int length) {
+    const u8* bytes = (const u8*)data;
+    for (int i = 0; i < length; i++) gifPutByte(w, bytes[i]);
+}
+
+// Image data is stored as a sequence of sub-blocks of up to 255 bytes
+static void gifPutDataByte(GifWriter* w, u8 value) {
+    w->block[w->blockLength++] = value;
+    if (w->blockLength == (int)sizeof(w->block)) {
+        gifPutByte(w, w->blockLength);
+        gifPutBytes(w, w->block, w->blockLength);
+        w->blockLength = 0;
+    }
+}
+
+static void gifPutCode(GifWriter* w, int code, int size) {
+    w->bitBuffer |= (u32)code << w->bitCount;
+    w->bitCount += size;
+    while (w->bitCount >= 8) {
+        gifPutDataByte(w, w->bitBuffer & 0xFF);
+        w->bitBuffer >>= 8;
+        w->bitCount -= 8;
+    }
+}
+
+// Pad the last byte and terminate the sub-block sequence
+static void gifEndData(GifWriter* w) {
+    if (w->bitCount > 0) gifPutDataByte(w, w->bitBuffer & 0xFF);
+    w->bitBuffer = 0;
+    w->bitCount = 0;
+    if (w->blockLength > 0) {
+        gifPutByte(w, w->blockLength);
+        gifPutBytes(w, w->block, w->blockLength);
+        w->blockLength = 0;
+    }
+    gifPutByte(w, 0);
+}
+
+static void gifLzwReset(GifLzw* lzw) {
+    memset(lzw->keys, 0xFF, sizeof(lzw->keys));
+    lzw->nextCode = GIF_END_CODE + 1;
+    lzw->codeSize = 9;
+}
+
+static void gifLzwBegin(GifWriter* w, GifLzw* lzw) {
+    gifPutByte(w, 8);  // Minimum code size: 8-bit pixels
+    gifLzwReset(lzw);
+    gifPutCode(w, GIF_CLEAR_CODE, lzw->codeSize);
+    lzw->prefix = -1;
+}
+
+static void gifLzwPut(GifWriter* w, GifLzw* lzw, u8 pixel) {
+    if (lzw->prefix < 0) {
+        lzw->prefix = pixel;
+        return;
+    }
+    
+    s32 key = (lzw->prefix << 8) | pixel;
+    u32 slot = ((u32)key * 2654435761u) >> (32 - GIF_HASH_BITS);
+    while (lzw->keys[slot] >= 0) {
+        if (lzw->keys[slot] == key) {
+            lzw->prefix = lzw->codes[slot];
+            return;
+        }
+        slot = (slot + 1) & ((1 << GIF_HASH_BITS) - 1);
+    }
+    
+    // New string: emit its longest known prefix, then learn it
+    gifPutCode(w, lzw->prefix, lzw->codeSize);
+    if (lzw->nextCode == GIF_MAX_CODE) {
+        // Dictionary full: start over
+        gifPutCode(w, GIF_CLEAR_CODE, lzw->codeSize);
+        gifLzwReset(lzw);
+    } else {
+        lzw->keys[slot] = key;
+        lzw->codes[slot] = lzw->nextCode++;
+        if (lzw->nextCode > (1 << lzw->codeSize) && lzw->codeSize < 12) lzw->codeSize++;
+    }
+    lzw->prefix = pixel;
+}
+
+static void gifLzwEnd(GifWriter* w, GifLzw* lzw) {
+    if (lzw->prefix >= 0) {
+        gifPutCode(w, lzw->prefix, lzw->codeSize);
+        // The decoder adds one more entry after this code, which can widen it
+        if (lzw->nextCode == (1 << lzw->codeSize) && lzw->codeSize < 12) lzw->codeSize++;
+    }
+    gifPutCode(w, GIF_END_CODE, lzw->codeSize);
+    gifEndData(w);
+}
+
+static void buildGifPalette() {
+    Color base[MAX_PALETTE_COLORS + 3];
+    int baseCount = 0;
+    int count = 0;
+    
+    // Backgrounds first, so their blends with every color make it in
+    base[baseCount++] = (Color){0, 0, 0};
+    base[baseCount++] = (Color){255, 255, 255};
+    base[baseCount++] = (Color){20, 20, 20};  // Dark canvas background
+    for (int i = 0; i < numColors; i++) base[baseCount++] = paletteColors[i];
+    
+    for (int i = 0; i < baseCount; i++) {
+        gifPalette[count][0] = base[i].r;
+        gifPalette[count][1] = base[i].g;
+        gifPalette[count][2] = base[i].b;
+        count++;
+    }
+    
+    // Edge blends between every pair of app colors
+    for (int i = 0; i < baseCount; i++) {
+        for (int j = i + 1; j < baseCount; j++) {
+            if (count + 3 > GIF_TRANSPARENT - GIF_CUBE_COLORS) break;
+            for (int k = 1; k <= 3; k++) {
+                gifPalette[count][0] = (base[i].r * k + base[j].r * (4 - k)) / 4;
+                gifPalette[count][1] = (base[i].g * k + base[j].g * (4 - k)) / 4;
+                gifPalette[count][2] = (base[i].b * k + base[j].b * (4 - k)) / 4;
+                count++;
+            }
+        }
+    }
+    
+    // 5x5x5 color cube for everything else
+    for (int r = 0; r < 5; r++) {
+        for (int g = 0; g < 5; g++) {
+            for (int b = 0; b < 5; b++) {
+                if (count >= GIF_TRANSPARENT) break;
+                gifPalette[count][0] = r * 255 / 4;
+                gifPalette[count][1] = g * 255 / 4;
+                gifPalette[count][2] = b * 255 / 4;
+                count++;
+            }
+        }
+    }
+    
+    memset(gifColorLookup, GIF_TRANSPARENT, sizeof(gifColorLookup));
+}
+
+// Nearest palette entry to a color, memoized per RGB555 cell
+static u8 gifColorIndex(int r, int g, int b) {
+    int cell = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+    u8 index = gifColorLookup[cell];
+    if (index != GIF_TRANSPARENT) return index;
+    
+    // Match the cell's center so the result doesn't depend on which color came first
+    r = (r & ~7) | 4;
+    g = (g & ~7) | 4;
+    b = (b & ~7) | 4;
+    int bestDistance = 0x7FFFFFFF;
+    for (int i = 0; i < GIF_TRANSPARENT; i++) {
+        int dr = r - gifPalette[i][0];
+        int dg = g - gifPalette[i][1];
+        int db = b - gifPalette[i][2];
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            index = i;
+        }
+    }
+    gifColorLookup[cell] = index;
+    return index;
+}
+
+static void writeGifHeader(GifWriter* w) {
+    // NETSCAPE2.0 application extension: loop forever
+    static const u8 loopForever[] = {
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        0x03, 0x01, 0x00, 0x00, 0x00
+    };
+    
+    gifPutBytes(w, "GIF89a", 6);
+    gifPutWord(w, SCREEN_WIDTH);
+    gifPutWord(w, SCREEN_HEIGHT);
+    gifPutByte(w, 0xF7);  // 256-entry global color table, 8 bits per channel
+    gifPutByte(w, 0);     // Background color index
+    gifPutByte(w, 0);     // Square pixels
+    gifPutBytes(w, gifPalette, sizeof(gifPalette));
+    gifPutBytes(w, loopForever, sizeof(loopForever));
+}
+
+static void writeGifFrame(GifWriter* w, const u8* composite, int frame) {
+    // Quantize into row-major palette indices
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        const u8* column = composite + x * FB_WIDTH * 3;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            const u8* pixel = column + (FB_WIDTH - 1 - y) * 3;
+            gifFrame[y * SCREEN_WIDTH + x] = gifColorIndex(pixel[2], pixel[1], pixel[0]);
+        }
+    }
+    
+    // Crop to the rectangle that changed since the previous frame
+    int minX = 0, minY = 0, maxX = SCREEN_WIDTH - 1, maxY = SCREEN_HEIGHT - 1;
+    if (frame > 0) {
+        minX = SCREEN_WIDTH;
+        minY = SCREEN_HEIGHT;
+        maxX = -1;
+        maxY = -1;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            const u8* row = &gifFrame[y * SCREEN_WIDTH];
+            const u8* previous = &gifPrevious[y * SCREEN_WIDTH];
+            if (memcmp(row, previous, SCREEN_WIDTH) == 0) continue;
+            
+            int left = 0, right = SCREEN_WIDTH - 1;
+            while (row[left] == previous[left]) left++;
+            while (row[right] == previous[right]) right--;
+            if (left < minX) minX = left;
+            if (right > maxX) maxX = right;
+            if (minY == SCREEN_HEIGHT) minY = y;
+            maxY = y;
+        }
+        // Nothing changed: a single transparent pixel still carries the delay
+        if (maxY < 0) minX = maxX = minY = maxY = 0;
+    }
+    
+    // Graphic control extension: delay (3-4 cs, averaging the playback rate),
+    // keep the previous frame underneath, and transparency after frame 0
+    int delay = (frame + 1) * 100 / GIF_FRAME_RATE - frame * 100 / GIF_FRAME_RATE;
+    gifPutByte(w, 0x21);
+    gifPutByte(w, 0xF9);
+    gifPutByte(w, 4);
+    gifPutByte(w, (1 << 2) | (frame > 0 ? 1 : 0));
+    gifPutWord(w, delay);
+    gifPutByte(w, GIF_TRANSPARENT);
+    gifPutByte(w, 0);
+    
+    // Image descriptor (no local color table, not interlaced)
+    gifPutByte(w, 0x2C);
+    gifPutWord(w, minX);
+    gifPutWord(w, minY);
+    gifPutWord(w, maxX - minX + 1);
+    gifPutWord(w, maxY - minY + 1);
+    gifPutByte(w, 0);
+    
+    gifLzwBegin(w, &gifLzw);
+    for (int y = minY; y <= maxY; y++) {
+        const u8* row = &gifFrame[y * SCREEN_WIDTH];
+        const u8* previous = &gifPrevious[y * SCREEN_WIDTH];
+        for (int x = minX; x <= maxX; x++) {
+            u8 index = row[x];
+            if (frame > 0 && index == previous[x]) index = GIF_TRANSPARENT;
+            gifLzwPut(w, &gifLzw, index);
+        }
+    }
+    gifLzwEnd(w, &gifLzw);
+    
+    memcpy(&gifPrevious[minY * SCREEN_WIDTH], &gifFrame[minY * SCREEN_WIDTH],
+           (maxY - minY + 1) * SCREEN_WIDTH);
+}
+
+static void freeGifExportJob(GifExportJob* job) {
+    for (int i = 0; i < GIF_QUEUE_SLOTS; i++) free(job->slots[i]);
+    free(job);
+}
+
+static void exportGifJob(void* arg) {
+    GifExportJob* job = (GifExportJob*)arg;
+    char filename[256];
+    
+    makeTimestampFilename(filename, sizeof(filename), "_anim.gif");
+    FILE* file = fopen(filename, "wb");
+    memset(&gifWriter, 0, sizeof(gifWriter));
+    gifWriter.file = file;
+    if (file) writeGifHeader(&gifWriter);
+    
+    // Frames are drained even if the file couldn't be opened, so the main
+    // thread is never left waiting for a slot
+    int frame = 0;
+    while (true) {
+        bool finished = job->finished;
+        __sync_synchronize();
+        if (job->consumed == job->produced) {
+            if (finished) break;
+            svcSleepThread(2000000);  // Wait 2 ms for the next frame
+            continue;
+        }
+        
+        if (file) writeGifFrame(&gifWriter, job->slots[job->consumed % GIF_QUEUE_SLOTS], frame);
+        frame++;
+        __sync_synchronize();
+        job->consumed++;
+    }
+    
+    if (file) {
+        gifPutByte(&gifWriter, 0x3B);  // Trailer
+        gifFlush(&gifWriter);
+        fclose(file);
+    }
+    freeGifExportJob(job);
+}
+
+/**
+ * Export every frame shown from now on, calling advance after each one
+ * until it returns false. Returns false if another export is running or
+ * memory is short.
+ */
+bool startGifExport(bool (*advance)(void)) {
+    if (gifExport || backgroundBusy) return false;
+    
+    GifExportJob* job = (GifExportJob*)calloc(1, sizeof(GifExportJob));
+    if (!job) return false;
+    for (int i = 0; i < GIF_QUEUE_SLOTS; i++) {
+        job->slots[i] = (u8*)malloc(FB_WIDTH * FB_HEIGHT * 3);
+        if (!job->slots[i]) {
+            freeGifExportJob(job);
+            return false;
+        }
+    }
+    
+    buildGifPalette();  // From the palette in use now
+    if (!startBackgroundJob(exportGifJob, job)) {
+        freeGifExportJob(job);
+        return false;
+    }
+    gifExport = job;
+    gifExportAdvance = advance;
+    return true;
+}
+
+// Next flipbook frame; stops after the last one or if playback was stopped
+// (e.g. a drawing was loaded)
+static bool advanceFlipbookExport() {
+    if (!flipbookPlaying || ++playbackFrame >= frameCount) return false;
+    applyFrameDelta(playbackTable, &flipFrames[playbackFrame]);
+    return true;
+}
+
+// Restart playback from the first frame and export the whole animation
+bool startFlipbookExport() {
+    if (gifExport || backgroundBusy) return false;
+    
+    startPlayback();
+    return flipbookPlaying && startGifExport(advanceFlipbookExport);
+}
+
+// Tell the worker the last frame has been queued; it then finishes the file
+void finishGifExport() {
+    if (!gifExport) return;
+    __sync_synchronize();
+    gifExport->finished = true;
+    gifExport = NULL;  // The worker frees the job
+    flipbookPlaying = false;
+}
+
+/**
+ * Called with each composited display frame during an export. Queues the
+ * frame and steps to the next one if the worker has a free slot;
+ * otherwise the same frame is shown again.
+ */
+void feedGifExport(const u8* composite) {
+    GifExportJob* job = gifExport;
+    if (job->produced - job->consumed >= GIF_QUEUE_SLOTS) return;
+    
+    memcpy(job->slots[job->produced % GIF_QUEUE_SLOTS], composite, FB_WIDTH * FB_HEIGHT * 3);
+    __sync_synchronize();
+    job->produced++;
+    
+    if (!gifExportAdvance()) finishGifExport();
+}
+
+/**
+ * STROKE JOURNAL
+ * 
+ * Every session appends a compact record of its edits to
+ * sdmc:/sqribble_<time>.sqj, created at the first edit:
+ * - brush and canvas state (brush, colors, layers, view), written before
+ *   an edit whenever it changed
+ * - strokes as their first brush position followed by one small delta
+ *   per frame, in canvas coordinates after stabilizing
+ * - edits that aren't strokes (fill, undo, clear, frame and layer changes)
+ *   as the new contents of the tiles they changed
+ * - a keyframe every JOURNAL_KEYFRAME_STROKES strokes with the state and
+ *   all tiles changed since the previous keyframe, used for seeking
+ * Tiles are stored PackBits-compressed. Records are buffered and written
+ * out when the stylus lifts.
+ */
+#define JOURNAL_KEYFRAME_STROKES 16
+#define JOURNAL_STATE_SIZE 17     // Bytes of a JournalState in a file
+
+typedef enum {
+    JOURNAL_STATE = 1,     // JournalState
+    JOURNAL_STROKE,        // Stroke start: s32 x, y (subpixel canvas)
+    JOURNAL_POINT,         // Next brush position: s8 dx, dy
+    JOURNAL_POINT_FAR,     // Next brush position: s32 x, y
+    JOURNAL_FILL,          // Flood fill; its tiles follow as a JOURNAL_TILES record
+    JOURNAL_TILES,         // u16 count, then tiles
+    JOURNAL_KEYFRAME,      // u32 strokes so far, JournalState, u16 count, then tiles
+    JOURNAL_LOAD           // u8 length, then the BMP loaded into the top layer
+} JournalRecord;
+
+// A tile is stored as u8 layer, u16 index, u16 packed size (0 = unscratched), data
+typedef struct {
+    u8 brushShape;
+    u8 brushSize;
+    u8 restoreBrush;
+    u8 symmetry;
+    u8 activeLayer;
+    u8 layerCount;
+    u8 colorIndex;
+    u8 paper;
+    u8 topPattern;
+    u8 hiddenPattern;
+    u8 hiddenInk;
+    u8 colorCycle;
+    s16 viewX;
+    s16 viewY;
+    s8 viewZoom;
+} JournalState;
+
+static FILE* journalFile = NULL;
+static bool journalFailed = false;        // Couldn't create the file: stop trying
+static bool journalSuspended = false;     // The canvas is replaying a timelapse
+static char journalFilename[256];
+static u8 journalBuffer[8192];
+static int journalLength = 0;
+static JournalState journalLastState;
+static int journalStrokes = 0;            // Strokes recorded this session
+static int journalKeyframeStrokes = 0;    // Strokes since the last keyframe
+static int journalX, journalY;            // Last recorded brush position
+static u8 journalPacked[TILE_PIXELS + TILE_PIXELS / 128 + 1];
+
+/**
+ * PackBits: a control byte n < 128 is followed by n + 1 literal bytes,
+ * n >= 128 by one byte repeated n - 125 times (3 to 130).
+ * Files always hold tiles column-major, whatever the layout in memory.
+ */
+static int packTile(const u8* tile, u8* out) {
+#ifdef MASK_TILE_MORTON
+    static u8 columns[TILE_PIXELS];
+    unswizzleTile(tile, columns);
+    tile = columns;
+#endif
+    int length = 0;
+    int i = 0;
+    while (i < TILE_PIXELS) {
+        int run = 1;
+        while (i + run < TILE_PIXELS && run < 130 && tile[i + run] == tile[i]) run++;
+        if (run >= 3) {
+            out[length++] = run + 125;
+            out[length++] = tile[i];
+            i += run;
+            continue;
+        }
+        
+        // Literals up to the next run of three
+        int start = i;
+        while (i < TILE_PIXELS && i - start < 128) {
+            if (i + 2 < TILE_PIXELS && tile[i] == tile[i + 1] && tile[i] == tile[i + 2]) break;
+            i++;
+        }
+        out[length++] = i - start - 1;
+        memcpy(&out[length], &tile[start], i - start);
+        length += i - start;
+    }
+    return length;
+}
+
+static bool unpackTile(const u8* in, int length, u8* out) {
+#ifdef MASK_TILE_MORTON
+    static u8 tile[TILE_PIXELS];
+#else
+    u8* tile = out;
+#endif
+    int i = 0;
+    int pos = 0;
+    while (pos < length) {
+        int control = in[pos++];
+        if (control < 128) {
+            int count = control + 1;
+            if (pos + count > length || i + count > TILE_PIXELS) return false;
+            memcpy(&tile[i], &in[pos], count);
+            pos += count;
+            i += count;
+        } else {
+            int count = control - 125;
+            if (pos >= length || i + count > TILE_PIXELS) return false;
+            memset(&tile[i], in[pos++], count);
+            i += count;
+        }
+    }
+    if (i != TILE_PIXELS) return false;
+#ifdef MASK_TILE_MORTON
+    swizzleTile(tile, out);
+#endif
+    return true;
+}
+
+static void journalFlush() {
+    if (journalLength > 0) {
+        fwrite(journalBuffer, 1, journalLength, journalFile);
+        journalLength = 0;
+    }
+}
+
+static void journalPutBytes(const void* data, int length) {
+    const u8* bytes = (const u8*)data;
+    while (length > 0) {
+        if (journalLength == (int)sizeof(journalBuffer)) journalFlush();
+        int chunk = sizeof(journalBuffer) - journalLength;
+        if (chunk > length) chunk = length;
+        memcpy(&journalBuffer[journalLength], bytes, chunk);
+        journalLength += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+static void journalPutByte(u8 value) {
+    journalPutBytes(&value, 1);
+}
+
+// Little-endian, like the 3DS itself
+static void journalPutU16(u16 value) {
+    journalPutBytes(&value, 2);
+}
+
+static void journalPutU32(u32 value) {
+    journalPutBytes(&value, 4);
+}
+
+static void captureJournalState(JournalState* state) {
+    memset(state, 0, sizeof(JournalState));
+    state->brushShape = currentBrushShape;
+    state->brushSize = brushSize;
+    state->restoreBrush = restoreBrush;
+    state->symmetry = currentSymmetry;
+    state->activeLayer = activeLayer;
+    state->layerCount = layerCount;
+    state->colorIndex = currentColorIndex;
+    state->paper = currentPaper;
+    state->topPattern = topPattern;
+    state->hiddenPattern = hiddenPattern;
+    state->hiddenInk = hiddenInk;
+    state->colorCycle = colorCycle;
+    state->viewX = viewX;
+    state->viewY = viewY;
+    state->viewZoom = viewZoom;
+}
+
+static void restoreJournalState(const JournalState* state) {
+    currentBrushShape = (BrushShape)state->brushShape;
+    brushSize = state->brushSize;
+    updateStampBrush();
+    restoreBrush = state->restoreBrush;
+    currentSymmetry = (SymmetryMode)state->symmetry;
+    activeLayer = state->activeLayer;
+    layerCount = state->layerCount;
+    currentColorIndex = state->colorIndex % numColors;  // The palette may have shrunk since
+    currentPaper = (PaperStyle)state->paper;
+    topPattern = (CanvasPattern)state->topPattern;
+    hiddenPattern = (CanvasPattern)state->hiddenPattern;
+    hiddenInk = (HiddenInk)state->hiddenInk;
+    colorCycle = state->colorCycle;
+    viewX = state->viewX;
+    viewY = state->viewY;
+    viewZoom = state->viewZoom;
+}
+
+// A state read back from a file must not index past the layer stack or the enums
+static bool validJournalState(const JournalState* state) {
+    return state->layerCount >= 2 && state->layerCount <= MAX_LAYERS &&
+           state->activeLayer < state->layerCount &&
+           state->paper < PAPER_STYLE_COUNT &&
+           state->topPattern < CANVAS_PATTERN_COUNT && state->hiddenPattern < CANVAS_PATTERN_COUNT &&
+           state->hiddenInk < HIDDEN_INK_COUNT && state->colorCycle < COLOR_CYCLE_SPEEDS;
+}
+
+// The JOURNAL_STATE_SIZE bytes a state is stored as, in the journal and the autosave
+static void packJournalState(const JournalState* state, u8* out) {
+    const u8 bytes[] = {
+        state->brushShape, state->brushSize, state->restoreBrush, state->symmetry,
+        state->activeLayer, state->layerCount, state->colorIndex, state->paper,
+        state->topPattern, state->hiddenPattern, state->hiddenInk, state->colorCycle,
+        (u16)state->viewX & 0xFF, (u16)state->viewX >> 8,
+        (u16)state->viewY & 0xFF, (u16)state->viewY >> 8,
+        (u8)state->viewZoom
+    };
+    _Static_assert(sizeof(bytes) == JOURNAL_STATE_SIZE, "JournalState file layout");
+    memcpy(out, bytes, JOURNAL_STATE_SIZE);
+}
+
+static void unpackJournalState(const u8* bytes, JournalState* state) {
+    memset(state, 0, sizeof(JournalState));
+    state->brushShape = bytes[0];
+    state->brushSize = bytes[1];
+    state->restoreBrush = bytes[2];
+    state->symmetry = bytes[3];
+    state->activeLayer = bytes[4];
+    state->layerCount = bytes[5];
+    state->colorIndex = bytes[6];
+    state->paper = bytes[7];
+    state->topPattern = bytes[8];
+    state->hiddenPattern = bytes[9];
+    state->hiddenInk = bytes[10];
+    state->colorCycle = bytes[11];
+    state->viewX = (s16)(bytes[12] | bytes[13] << 8);
+    state->viewY = (s16)(bytes[14] | bytes[15] << 8);
+    state->viewZoom = (s8)bytes[16];
+}
+
+static void journalPutState(const JournalState* state) {
+    u8 bytes[JOURNAL_STATE_SIZE];
+    packJournalState(state, bytes);
+    journalPutBytes(bytes, JOURNAL_STATE_SIZE);
+}
+
+// Write the tiles carrying a dirty flag (count first) and clear the flag
+static void journalPutDirtyTiles(u8 flag) {
+    int count = 0;
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (tileDirty[layer][i] & flag) count++;
+        }
+    }
+    
+    journalPutU16(count);
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (!(tileDirty[layer][i] & flag)) continue;
+            tileDirty[layer][i] &= ~flag;
+            
+            const u8* tile = maskTileBytes(layer, i);
+            int packedSize = tile ? packTile(tile, journalPacked) : 0;
+            journalPutByte(layer);
+            journalPutU16(i);
+            journalPutU16(packedSize);
+            journalPutBytes(journalPacked, packedSize);
+        }
+    }
+}
+
+static bool hasDirtyTiles(u8 flag) {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            if (tileDirty[layer][i] & flag) return true;
+        }
+    }
+    return false;
+}
+
+static void clearTileDirty(u8 flags) {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            tileDirty[layer][i] &= ~flags;
+        }
+    }
+}
+
+static void journalWriteKeyframe() {
+    captureJournalState(&journalLastState);
+    journalPutByte(JOURNAL_KEYFRAME);
+    journalPutU32(journalStrokes);
+    journalPutState(&journalLastState);
+    journalPutDirtyTiles(TILE_DIRTY_KEYFRAME);
+    journalKeyframeStrokes = 0;
+}
+
+// Create the journal; its first keyframe holds the whole canvas
+static bool journalOpen() {
+    if (journalFile) return true;
+    if (journalFailed) return false;
+    
+    makeTimestampFilename(journalFilename, sizeof(journalFilename), ".sqj");
+    journalFile = fopen(journalFilename, "wb");
+    if (!journalFile) {
+        journalFailed = true;
+        return false;
+    }
+    
+    journalPutBytes("SQJ2", 4);
+    clearTileDirty(TILE_DIRTY_KEYFRAME | TILE_DIRTY_JOURNAL);
+    markLiveTilesDirty();
+    journalWriteKeyframe();
+    clearTileDirty(TILE_DIRTY_KEYFRAME | TILE_DIRTY_JOURNAL);
+    return true;
+}
+
+/**
+ * Bring the journal up to date before recording an edit: the state if it
+ * changed, then the tiles changed by edits that aren't strokes.
+ * Returns false if nothing should be recorded.
+ */
+static bool journalBegin() {
+    if (journalSuspended || !journalOpen()) return false;
+    
+    JournalState state;
+    captureJournalState(&state);
+    if (memcmp(&state, &journalLastState, sizeof(JournalState)) != 0) {
+        journalPutByte(JOURNAL_STATE);
+        journalPutState(&state);
+        journalLastState = state;
+    }
+    
+    if (hasDirtyTiles(TILE_DIRTY_JOURNAL)) {
+        journalPutByte(JOURNAL_TILES);
+        journalPutDirtyTiles(TILE_DIRTY_JOURNAL);
+    }
+    return true;
+}
+
+void journalStroke(int x, int y) {
+    if (!journalBegin()) return;
+    
+    journalPutByte(JOURNAL_STROKE);
+    journalPutU32(x);
+    journalPutU32(y);
+    journalX = x;
+    journalY = y;
+    journalStrokes++;
+    journalKeyframeStrokes++;
+}
+
+void journalPoint(int x, int y) {
+    if (!journalBegin()) return;
+    
+    int dx = x - journalX;
+    int dy = y - journalY;
+    if (dx >= -128 && dx <= 127 && dy >= -128 && dy <= 127) {
+        journalPutByte(JOURNAL_POINT);
+        journalPutByte((u8)dx);
+        journalPutByte((u8)dy);
+    } else {
+        journalPutByte(JOURNAL_POINT_FAR);
+        journalPutU32(x);
+        journalPutU32(y);
+    }
+    journalX = x;
+    journalY = y;
+}
+
+// Called before a fill or mask filter; journalFillDone() records what it changed
+void journalFill() {
+    if (!journalBegin()) return;
+    
+    journalPutByte(JOURNAL_FILL);
+    journalStrokes++;
+    journalKeyframeStrokes++;
+}
+
+// A fill is recorded by the tiles it changed (those of the open undo record)
+void journalFillDone() {
+    if (!journalFile || journalSuspended || undoTop == 0) return;
+    
+    const UndoRecord* record = &undoStack[undoTop - 1];
+    for (int i = 0; i < record->count; i++) {
+        tileDirty[record->tiles[i].layer][record->tiles[i].tileIndex] |= TILE_DIRTY_JOURNAL;
+    }
+    journalPutByte(JOURNAL_TILES);
+    journalPutDirtyTiles(TILE_DIRTY_JOURNAL);
+}
+
+void journalLoad(const char* filename) {
+    if (!journalBegin()) return;
+    
+    int length = strlen(filename);
+    if (length > 255) length = 255;
+    journalPutByte(JOURNAL_LOAD);
+    journalPutByte(length);
+    journalPutBytes(filename, length);
+}
+
+// Called when the stylus lifts: adds a keyframe when due and writes out
+// the buffered records
+void journalStrokeEnd() {
+    if (!journalFile || journalSuspended) return;
+    
+    if (journalKeyframeStrokes >= JOURNAL_KEYFRAME_STROKES) {
+        journalBegin();
+        journalWriteKeyframe();
+    }
+    journalFlush();
+}
+
+// Write everything recorded so far to the SD card
+void journalCommit() {
+    if (!journalFile || journalSuspended) return;
+    
+    journalBegin();
+    journalFlush();
+    fflush(journalFile);
+}
+
+void journalClose() {
+    if (!journalFile) return;
+    
+    journalCommit();
+    fclose(journalFile);
+    journalFile = NULL;
+}
+
+/**
+ * TIMELAPSE REPLAY
+ * 
+ * Replays this session's stroke journal on the canvas (Y in the gallery).
+ * The live layers, brush and view are set aside and put back on exit.
+ * Strokes are redrawn at 1-256 brush positions per frame; idle time
+ * between strokes is skipped.
+ * 
+ * Seeking rebuilds the last keyframe at or before the target stroke from
+ * the tiles of keyframes 0..k (later ones winning) and replays the few
+ * strokes after it, so scrubbing costs the same anywhere in a session.
+ */
+#define TIMELAPSE_SPEEDS 5
+
+static const int timelapseSpeeds[TIMELAPSE_SPEEDS] = {1, 4, 16, 64, 256};  // Positions per frame
+
+typedef struct {
+    int offset;         // Journal offset of the keyframe record
+    int strokes;        // Strokes before it
+    int imageOffset;    // JOURNAL_LOAD record showing in the top layer, -1 = generated
+} TimelapseKeyframe;
+
+bool timelapseActive = false;
+bool timelapsePaused = false;
+int timelapseSpeed = 1;
+int timelapseStroke = 0;            // Strokes replayed so far
+int timelapseStrokeCount = 0;       // Strokes in the journal
+
+static u8* timelapseData = NULL;
+static int timelapseSize = 0;
+static int timelapseOffset = 0;     // Next record to replay
+static TimelapseKeyframe* timelapseKeyframes = NULL;
+static int timelapseKeyframeCount = 0;
+static int timelapseX, timelapseY;  // Brush position
+
+// The live session while the canvas is replaying
+static Layer* savedLayers = NULL;
+static u8 (*savedTileDirty)[CANVAS_TILE_COUNT] = NULL;
+static JournalState savedState;
+static bool savedOnionSkin;
+static char savedImageName[256];
+
+static bool readJournalBytes(int* offset, void* out, int length) {
+    if (*offset + length > timelapseSize) return false;
+    memcpy(out, &timelapseData[*offset], length);
+    *offset += length;
+    return true;
+}
+
+static bool readJournalState(int* offset, JournalState* state) {
+    u8 bytes[JOURNAL_STATE_SIZE];
+    if (!readJournalBytes(offset, bytes, JOURNAL_STATE_SIZE)) return false;
+    unpackJournalState(bytes, state);
+    return validJournalState(state);
+}
+
+/**
+ * Walk the tiles of a JOURNAL_TILES or keyframe body. With apply, they
+ * replace the canvas tiles; with a table, the table collects where each
+ * tile's data starts (NULL = unscratched).
+ */
+static bool readJournalTiles(int* offset, bool apply, FrameTable table) {
+    u16 count;
+    if (!readJournalBytes(offset, &count, 2)) return false;
+    
+    for (int i = 0; i < count; i++) {
+        u8 layer;
+        u16 tileIndex, packedSize;
+        if (!readJournalBytes(offset, &layer, 1) || !readJournalBytes(offset, &tileIndex, 2) ||
+            !readJournalBytes(offset, &packedSize, 2)) return false;
+        if (layer >= MAX_LAYERS || tileIndex >= CANVAS_TILE_COUNT) return false;
+        if (*offset + packedSize > timelapseSize) return false;
+        
+        const u8* packed = &timelapseData[*offset];
+        if (apply) {
+            u8* tile = NULL;
+            if (packedSize > 0) {
+                tile = (u8*)malloc(TILE_PIXELS);
+                if (tile && !unpackTile(packed, packedSize, tile)) {
+                    free(tile);
+                    tile = NULL;
+                }
+            }
+            setMaskTile(layer, tileIndex, tile);
+        }
+        if (table) {
+            // Keep the header so the size can be read back
+            table[layer][tileIndex] = packedSize ? (u8*)packed - 2 : NULL;
+        }
+        *offset += packedSize;
+    }
+    return true;
+}
+
+static void showLoadedImage(int offset) {
+    char filename[256];
+    u8 length;
+    if (!readJournalBytes(&offset, &length, 1) || !readJournalBytes(&offset, filename, length)) return;
+    filename[length] = '\0';
+    if (loadDrawingImage(filename)) generateLayerImages(1);
+}
+
+// Apply a state record, regenerating the layer images it affects
+static void applyReplayState(const JournalState* state) {
+    bool topChanged = state->topPattern != topPattern;
+    bool hiddenChanged = state->hiddenPattern != hiddenPattern;
+    bool colorChanged = state->colorIndex != currentColorIndex || state->paper != currentPaper ||
+                        state->hiddenInk != hiddenInk;
+    bool layersChanged = state->layerCount != layerCount;
+    
+    restoreJournalState(state);
+    if (layersChanged) resetLayerDepths();
+    if (topChanged) {
+        generateLayerImages(0);
+    } else if (layersChanged || hiddenChanged) {
+        generateLayerImages(1);
+    } else if (colorChanged) {
+        updateLayerPalettes();
+    }
+}
+
+/**
+ * Replay records until budget brush positions have been drawn, the stroke
+ * after lastStroke is next, or the journal ends. Returns false at the end.
+ */
+static bool replayJournal(int budget, int lastStroke) {
+    while (budget > 0) {
+        int offset = timelapseOffset;
+        u8 record;
+        if (!readJournalBytes(&offset, &record, 1)) break;
+        if ((record == JOURNAL_STROKE || record == JOURNAL_FILL) && timelapseStroke >= lastStroke) break;
+        
+        bool valid = true;
+        JournalState state;
+        s32 x, y;
+        s8 delta[2];
+        switch (record) {
+            case JOURNAL_STATE:
+                valid = readJournalState(&offset, &state);
+                if (valid) applyReplayState(&state);
+                break;
+            case JOURNAL_STROKE:
+                valid = readJournalBytes(&offset, &x, 4) && readJournalBytes(&offset, &y, 4);
+                if (valid) {
+                    beginBrushStroke(x, y);
+                    drawLine(x, y, x, y, brushSize);
+                    timelapseX = x;
+                    timelapseY = y;
+                    timelapseStroke++;
+                    budget--;
+                }
+                break;
+            case JOURNAL_POINT:
+            case JOURNAL_POINT_FAR:
+                if (record == JOURNAL_POINT) {
+                    valid = readJournalBytes(&offset, delta, 2);
+                    x = timelapseX + delta[0];
+                    y = timelapseY + delta[1];
+                } else {
+                    valid = readJournalBytes(&offset, &x, 4) && readJournalBytes(&offset, &y, 4);
+                }
+                if (valid) {
+                    drawLine(timelapseX, timelapseY, x, y, brushSize);
+                    timelapseX = x;
+                    timelapseY = y;
+                    budget--;
+                }
+                break;
+            case JOURNAL_FILL:
+                timelapseStroke++;
+                budget--;
+                break;
+            case JOURNAL_TILES:
+                valid = readJournalTiles(&offset, true, NULL);
+                break;
+            case JOURNAL_KEYFRAME:
+                // Already the state we're in
+                offset += 4;
+                valid = readJournalState(&offset, &state) && readJournalTiles(&offset, false, NULL);
+                break;
+            case JOURNAL_LOAD:
+                valid = offset < timelapseSize && offset + 1 + timelapseData[offset] <= timelapseSize;
+                if (valid) {
+                    showLoadedImage(offset);
+                    offset += 1 + timelapseData[offset];
+                }
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        
+        if (!valid) {
+            timelapseOffset = timelapseSize;  // Damaged or cut short: stop here
+            break;
+        }
+        timelapseOffset = offset;
+    }
+    return timelapseOffset < timelapseSize;
+}
+
+// Find the keyframes and count the strokes
+static bool indexJournal() {
+    int offset = 4;
+    int imageOffset = -1;
+    int topPatternShown = -1;
+    int capacity = 0;
+    JournalState state;
+    
+    if (timelapseSize < 4 || memcmp(timelapseData, "SQJ2", 4) != 0) return false;
+    
+    timelapseKeyframeCount = 0;
+    timelapseStrokeCount = 0;
+    while (offset < timelapseSize) {
+        int start = offset;
+        u8 record = timelapseData[offset++];
+        bool valid = true;
+        
+        switch (record) {
+            case JOURNAL_STATE:
+                valid = readJournalState(&offset, &state);
+                // A new top pattern replaces a loaded drawing
+                if (valid && state.topPattern != topPatternShown) {
+                    imageOffset = -1;
+                    topPatternShown = state.topPattern;
+                }
+                break;
+            case JOURNAL_STROKE:
+            case JOURNAL_POINT_FAR:
+                offset += 8;
+                if (record == JOURNAL_STROKE) timelapseStrokeCount++;
+                break;
+            case JOURNAL_POINT:
+                offset += 2;
+                break;
+            case JOURNAL_FILL:
+                timelapseStrokeCount++;
+                break;
+            case JOURNAL_TILES:
+                valid = readJournalTiles(&offset, false, NULL);
+                break;
+            case JOURNAL_KEYFRAME:
+                if (timelapseKeyframeCount == capacity) {
+                    capacity = capacity ? capacity * 2 : 16;
+                    TimelapseKeyframe* grown = (TimelapseKeyframe*)realloc(timelapseKeyframes,
+                                                                           capacity * sizeof(TimelapseKeyframe));
+                    if (!grown) return false;
+                    timelapseKeyframes = grown;
+                }
+                timelapseKeyframes[timelapseKeyframeCount].offset = start;
+                timelapseKeyframes[timelapseKeyframeCount].strokes = timelapseStrokeCount;
+                timelapseKeyframes[timelapseKeyframeCount].imageOffset = imageOffset;
+                offset += 4;
+                valid = readJournalState(&offset, &state) && readJournalTiles(&offset, false, NULL);
+                if (valid) {
+                    timelapseKeyframeCount++;
+                    topPatternShown = state.topPattern;
+                }
+                break;
+            case JOURNAL_LOAD:
+                imageOffset = offset;
+                valid = offset < timelapseSize;
+                if (valid) offset += 1 + timelapseData[offset];
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        
+        if (!valid || offset > timelapseSize) {
+            timelapseSize = start;  // Ignore a damaged or unfinished tail
+            break;
+        }
+    }
+    return timelapseKeyframeCount > 0;
+}
+
+/**
+ * Show the canvas as it was after the given number of strokes
+ */
+void timelapseSeek(int stroke) {
+    if (stroke < 0) stroke = 0;
+    if (stroke > timelapseStrokeCount) stroke = timelapseStrokeCount;
+    
+    int k = 0;
+    while (k + 1 < timelapseKeyframeCount && timelapseKeyframes[k + 1].strokes <= stroke) k++;
+    
+    // Already past keyframe k and going forward: just keep replaying
+    if (stroke >= timelapseStroke && timelapseOffset > timelapseKeyframes[k].offset) {
+        replayJournal(INT_MAX, stroke);
+        return;
+    }
+    
+    // Collect the newest version of every tile up to keyframe k
+    int offset = 0;
+    JournalState state;
+    memset(scratchTableA, 0, sizeof(FrameTable));
+    for (int i = 0; i <= k; i++) {
+        offset = timelapseKeyframes[i].offset + 5;
+        readJournalState(&offset, &state);
+        readJournalTiles(&offset, false, scratchTableA);
+    }
+    
+    clearCanvasMask();
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            const u8* header = scratchTableA[layer][i];
+            if (!header) continue;
+            
+            u16 packedSize;
+            memcpy(&packedSize, header, 2);
+            u8* tile = (u8*)malloc(TILE_PIXELS);
+            if (tile && !unpackTile(header + 2, packedSize, tile)) {
+                free(tile);
+                tile = NULL;
+            }
+            setMaskTile(layer, i, tile);
+        }
+    }
+    
+    // State and layer images of keyframe k
+    int stateOffset = timelapseKeyframes[k].offset + 5;
+    readJournalState(&stateOffset, &state);
+    restoreJournalState(&state);
+    resetLayerDepths();
+    generateLayerImages(0);
+    if (timelapseKeyframes[k].imageOffset >= 0) showLoadedImage(timelapseKeyframes[k].imageOffset);
+    
+    timelapseOffset = offset;
+    timelapseStroke = timelapseKeyframes[k].strokes;
+    replayJournal(INT_MAX, stroke);
+}
+
+// Jump to the previous or next keyframe; nothing needs replaying there
+void timelapseSkip(int direction) {
+    int target = (direction < 0) ? 0 : timelapseStrokeCount;
+    for (int k = 0; k < timelapseKeyframeCount; k++) {
+        int strokes = timelapseKeyframes[k].strokes;
+        if (direction < 0 && strokes < timelapseStroke) target = strokes;
+        if (direction > 0 && strokes > timelapseStroke) {
+            target = strokes;
+            break;
+        }
+    }
+    timelapseSeek(target);
+}
+
+/**
+ * Start replaying this session's journal from the beginning.
+ * Returns false if nothing has been recorded or memory is short.
+ */
+bool startTimelapse() {
+    if (timelapseActive || gifExport || flipbookPlaying) return false;
+    
+    journalCommit();
+    if (!journalFile) return false;
+    
+    FILE* file = fopen(journalFilename, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    timelapseSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    timelapseData = (u8*)malloc(timelapseSize > 0 ? timelapseSize : 1);
+    bool loaded = timelapseData && fread(timelapseData, 1, timelapseSize, file) == (size_t)timelapseSize;
+    fclose(file);
+    
+    savedLayers = (Layer*)malloc(sizeof(layers));
+    savedTileDirty = (u8 (*)[CANVAS_TILE_COUNT])malloc(sizeof(tileDirty));
+    if (!loaded || !savedLayers || !savedTileDirty || !indexJournal()) {
+        free(timelapseData);
+        free(timelapseKeyframes);
+        free(savedLayers);
+        free(savedTileDirty);
+        timelapseData = NULL;
+        timelapseKeyframes = NULL;
+        savedLayers = NULL;
+        savedTileDirty = NULL;
+        return false;
+    }
+    
+    // Set the live session aside; the replay starts from empty masks
+    memcpy(savedLayers, layers, sizeof(layers));
+    memcpy(savedTileDirty, tileDirty, sizeof(tileDirty));
+    captureJournalState(&savedState);
+    savedOnionSkin = onionSkin;
+    strcpy(savedImageName, loadedImageName);
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        memset(layers[layer].maskTiles, 0, sizeof(layers[layer].maskTiles));
+        memset(layers[layer].maskBits, 0, sizeof(layers[layer].maskBits));
+    }
+    onionSkin = false;
+    undoRecording = false;  // Replayed strokes stay out of the undo history
+    journalSuspended = true;
+    
+    timelapseActive = true;
+    timelapsePaused = false;
+    timelapseStroke = 0;
+    timelapseOffset = 0;  // Before keyframe 0, so the seek rebuilds everything
+    timelapseSeek(0);
+    return true;
+}
+
+void stopTimelapse() {
+    if (!timelapseActive) return;
+    
+    clearCanvasMask();
+    memcpy(layers, savedLayers, sizeof(layers));
+    memcpy(tileDirty, savedTileDirty, sizeof(tileDirty));
+    restoreJournalState(&savedState);
+    onionSkin = savedOnionSkin;
+    strcpy(loadedImageName, savedImageName);
+    journalSuspended = false;
+    
+    free(timelapseData);
+    free(timelapseKeyframes);
+    free(savedLayers);
+    free(savedTileDirty);
+    timelapseData = NULL;
+    timelapseKeyframes = NULL;
+    savedLayers = NULL;
+    savedTileDirty = NULL;
+    timelapseActive = false;
+}
+
+// Advance the replay by one display frame; pauses at the end
+void updateTimelapse() {
+    if (!timelapsePaused && !replayJournal(timelapseSpeeds[timelapseSpeed], INT_MAX)) {
+        timelapsePaused = true;
+    }
+}
+
+// GIF frames are shown for two display frames, so each covers twice as much
+static bool advanceTimelapseExport() {
+    return replayJournal(timelapseSpeeds[timelapseSpeed] * PLAYBACK_INTERVAL, INT_MAX);
+}
+
+bool startTimelapseExport() {
+    return startGifExport(advanceTimelapseExport);
+}
+
+/**
+ * AUTOSAVE
+ * 
+ * The canvas is autosaved to sdmc:/sqribble_autosave.sqa and recovered
+ * from it at startup, so a crash or a closed app loses at most the last
+ * second of work. The file is append-only: after the stylus has been idle
+ * for AUTOSAVE_IDLE_FRAMES, a record with the brush/canvas state and the
+ * tiles changed since the previous record is written on the worker thread.
+ * Once AUTOSAVE_COMPACT_BYTES of changes have piled up, the next record is
+ * a full checkpoint written to a new file that then replaces the old one.
+ * Each record ends with a checksum; recovery stops at the first record
+ * that is incomplete or damaged. Only the current flipbook frame is saved.
+ */
+#define AUTOSAVE_FILENAME "sdmc:/sqribble_autosave.sqa"
+#define AUTOSAVE_TEMP_FILENAME "sdmc:/sqribble_autosave.tmp"
+#define AUTOSAVE_IDLE_FRAMES 30
+#define AUTOSAVE_COMPACT_BYTES (256 * 1024)
+
+typedef enum {
+    AUTOSAVE_CHECKPOINT = 1,  // The whole canvas: masks start out unscratched
+    AUTOSAVE_CHANGES          // Only the tiles changed since the previous record
+} AutosaveRecord;
+
+// Record layout: u8 type, JournalState, u8 length + image name, u16 count,
+// tiles as in the stroke journal, u32 FNV-1a checksum of all of the above
+typedef struct {
+    u8 layer;
+    u16 index;
+    bool packed;              // data is a packed tile (PACKED_TILE_BYTES)
+    u8* data;                 // Tile contents in the job's data area (NULL = unscratched)
+} AutosaveTile;
+
+typedef struct {
+    u8 type;
+    JournalState state;
+    char imageName[256];
+    int tileCount;
+    AutosaveTile tiles[];
+} AutosaveJob;
+
+static FILE* autosaveFile = NULL;
+static volatile bool autosaveCheckpointDue = true;  // Next record must be a checkpoint
+static volatile int autosaveAppended = 0;           // Bytes written since the last checkpoint
+static JournalState autosavedState;
+static char autosavedImageName[256];
+static int autosaveIdleFrames = 0;
+
+// Used by the worker thread only (or the main thread once it has finished)
+static FILE* autosaveOut = NULL;
+static u8 autosaveBuffer[8192];
+static int autosaveLength = 0;
+static int autosaveWritten = 0;
+static u32 autosaveHash = 0;
+static bool autosaveError = false;
+static u8 autosavePacked[TILE_PIXELS + TILE_PIXELS / 128 + 1];
+static u8 autosaveExpanded[TILE_PIXELS];
+
+static u32 fnv1a(u32 hash, const u8* data, int length) {
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void autosaveFlush() {
+    if (autosaveLength > 0 && fwrite(autosaveBuffer, 1, autosaveLength, autosaveOut) != (size_t)autosaveLength) {
+        autosaveError = true;
+    }
+    autosaveLength = 0;
+}
+
+static void autosavePutBytes(const void* data, int length) {
+    const u8* bytes = (const u8*)data;
+    autosaveHash = fnv1a(autosaveHash, bytes, length);
+    autosaveWritten += length;
+    while (length > 0) {
+        if (autosaveLength == (int)sizeof(autosaveBuffer)) autosaveFlush();
+        int chunk = sizeof(autosaveBuffer) - autosaveLength;
+        if (chunk > length) chunk = length;
+        memcpy(&autosaveBuffer[autosaveLength], bytes, chunk);
+        autosaveLength += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+static void autosavePutU16(u16 value) {
+    autosavePutBytes(&value, 2);
+}
+
+// Append one record and make sure it reached the card
+static void writeAutosaveRecord(const AutosaveJob* job) {
+    autosaveHash = 2166136261u;
+    autosavePutBytes(&job->type, 1);
+    u8 state[JOURNAL_STATE_SIZE];
+    packJournalState(&job->state, state);
+    autosavePutBytes(state, JOURNAL_STATE_SIZE);
+    
+    u8 length = strlen(job->imageName);
+    autosavePutBytes(&length, 1);
+    autosavePutBytes(job->imageName, length);
+    
+    autosavePutU16(job->tileCount);
+    for (int i = 0; i < job->tileCount; i++) {
+        const AutosaveTile* tile = &job->tiles[i];
+        const u8* data = tile->data;
+        if (data && tile->packed) {
+            unpackBinaryTile((const u32*)data, autosaveExpanded);
+            data = autosaveExpanded;
+        }
+        u16 packedSize = data ? packTile(data, autosavePacked) : 0;
+        autosavePutBytes(&tile->layer, 1);
+        autosavePutU16(tile->index);
+        autosavePutU16(packedSize);
+        autosavePutBytes(autosavePacked, packedSize);
     }
+    
+    u32 hash = autosaveHash;
+    autosavePutBytes(&hash, 4);
+    autosaveFlush();
+    if (fflush(autosaveOut) != 0 || fsync(fileno(autosaveOut)) != 0) autosaveError = true;
+}
 
-    // version - grey
-        C2D_DrawText(&instructionTexts[1], C2D_WithColor,
-                 370.0f, 220.0f, 0.5f,
-                 0.5f, 0.5f,
-                 C2D_Color32(150, 150, 150, 255));  // Gray
+static void writeAutosave(AutosaveJob* job) {
+    autosaveError = false;
+    autosaveWritten = 0;
+    
+    if (job->type == AUTOSAVE_CHECKPOINT) {
+        // Build the checkpoint next to the old file and swap it in when complete
+        autosaveOut = fopen(AUTOSAVE_TEMP_FILENAME, "wb");
+        if (!autosaveOut) {
+            autosaveCheckpointDue = true;
+            return;
+        }
+        autosavePutBytes("SQA2", 4);
+        writeAutosaveRecord(job);
+        if (fclose(autosaveOut) != 0) autosaveError = true;
         
-    // Target bottom screen
-    C2D_TargetClear(bottomTarget, C2D_Color32(0,0,0,0));  // Dark gray background
-    C2D_SceneBegin(bottomTarget);
+        if (!autosaveError) {
+            if (autosaveFile) fclose(autosaveFile);
+            remove(AUTOSAVE_FILENAME);
+            autosaveFile = NULL;
+            if (rename(AUTOSAVE_TEMP_FILENAME, AUTOSAVE_FILENAME) == 0) {
+                autosaveFile = fopen(AUTOSAVE_FILENAME, "ab");
+            }
+        }
+        autosaveCheckpointDue = autosaveError || !autosaveFile;
+        autosaveAppended = 0;
+        return;
+    }
     
-    // Section header - "basic controls"
-    C2D_DrawText(&instructionTexts[2], C2D_WithColor,
-                 10.0f, 20.0f, 0.5f,
-                 0.6f, 0.6f, // scale
-                 C2D_Color32(65, 105, 225, 255));
+    if (!autosaveFile) {
+        autosaveCheckpointDue = true;
+        return;
+    }
+    autosaveOut = autosaveFile;
+    writeAutosaveRecord(job);
+    autosaveAppended += autosaveWritten;
     
-    // Control lines - white, smaller
-    float yPos = 38.0f;
-    float lineSpacing = 14.0f;
-    float controlScale = 0.5f;
+    // A record that didn't make it may have left a damaged tail
+    if (autosaveError) autosaveCheckpointDue = true;
+}
+
+static void autosaveJob(void* arg) {
+    writeAutosave((AutosaveJob*)arg);
+    free(arg);
+}
+
+/**
+ * Gather the state and the tiles for the next record; clears their
+ * autosave flags. Tiles are copied in their live form, packed ones at
+ * PACKED_TILE_BYTES, and only encoded for the file on the worker thread.
+ * Returns NULL if there's nothing to write or memory is short.
+ */
+static AutosaveJob* collectAutosave() {
+    bool checkpoint = autosaveCheckpointDue || autosaveAppended > AUTOSAVE_COMPACT_BYTES;
     
-    for (int i = 3; i < 14; i++) {  // Lines 3-13 are controls
-        C2D_DrawText(&instructionTexts[i], C2D_WithColor,
-                     10.0f, yPos, 0.5f,
-                     controlScale, controlScale,
-                     C2D_Color32(255, 255, 255, 255));  // White
-        yPos += lineSpacing;
+    JournalState state;
+    captureJournalState(&state);
+    bool stateChanged = memcmp(&state, &autosavedState, sizeof(JournalState)) != 0 ||
+                        strcmp(loadedImageName, autosavedImageName) != 0;
+    
+    int count = 0;
+    int dataBytes = 0;
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            bool wanted = checkpoint ? !maskTileUntouched(layer, i) : (tileDirty[layer][i] & TILE_DIRTY_AUTOSAVE);
+            if (!wanted) continue;
+            count++;
+            if (layers[layer].maskBits[i]) dataBytes += PACKED_TILE_BYTES;
+            if (layers[layer].maskTiles[i]) dataBytes += TILE_PIXELS;
+        }
     }
+    if (!checkpoint && !stateChanged && count == 0) return NULL;
     
-    // Prompt at bottom - cyan
-    C2D_DrawText(&instructionTexts[14], C2D_WithColor,
-                 65.0f, 215.0f, 0.5f,
-                 0.6f, 0.6f,
-                 C2D_Color32(100, 255, 255, 255));  // Cyan
+    AutosaveJob* job = (AutosaveJob*)malloc(sizeof(AutosaveJob) + count * sizeof(AutosaveTile) + dataBytes);
+    if (!job) return NULL;
+    
+    job->type = checkpoint ? AUTOSAVE_CHECKPOINT : AUTOSAVE_CHANGES;
+    job->state = state;
+    strcpy(job->imageName, loadedImageName);
+    job->tileCount = 0;
+    u8* data = (u8*)&job->tiles[count];
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+            bool wanted = checkpoint ? !maskTileUntouched(layer, i) : (tileDirty[layer][i] & TILE_DIRTY_AUTOSAVE);
+            tileDirty[layer][i] &= ~TILE_DIRTY_AUTOSAVE;
+            if (!wanted) continue;
+            
+            AutosaveTile* tile = &job->tiles[job->tileCount++];
+            tile->layer = layer;
+            tile->index = i;
+            tile->packed = layers[layer].maskBits[i] != NULL;
+            tile->data = NULL;
+            const void* source = tile->packed ? (const void*)layers[layer].maskBits[i] : layers[layer].maskTiles[i];
+            if (source) {
+                int size = tile->packed ? PACKED_TILE_BYTES : TILE_PIXELS;
+                memcpy(data, source, size);
+                tile->data = data;
+                data += size;
+            }
+        }
+    }
+    
+    autosavedState = state;
+    strcpy(autosavedImageName, loadedImageName);
+    return job;
 }
 
 /**
- * Draw gallery instructions on bottom screen
+ * Called every frame; starts writing a record once the stylus has been
+ * idle for a while and the worker thread is free
  */
-void drawGalleryInstructions(u8* framebuffer) {
-    // Fill with dark background
-    for (int i = 0; i < FB_WIDTH * FB_HEIGHT * 3; i += 3) {
-        framebuffer[i + 0] = 20;   // B
-        framebuffer[i + 1] = 20;   // G
-        framebuffer[i + 2] = 20;   // R
+void updateAutosave(bool touching) {
+    if (touching) {
+        autosaveIdleFrames = 0;
+        return;
     }
+    if (++autosaveIdleFrames < AUTOSAVE_IDLE_FRAMES) return;
+    autosaveIdleFrames = 0;
+    if (backgroundBusy || timelapseActive) return;
     
-    // Draw a colored header bar at top
-    for (int x = 0; x < 320; x++) {
-        for (int y = 0; y < 40; y++) {
-            int idx = (x * 240 + (239 - y)) * 3;
-            if (idx >= 0 && idx < FB_WIDTH * FB_HEIGHT * 3 - 2) {
-                framebuffer[idx + 0] = 225;  // B - Royal Blue
-                framebuffer[idx + 1] = 105;  // G
-                framebuffer[idx + 2] = 65;   // R
+    AutosaveJob* job = collectAutosave();
+    if (job && !startBackgroundJob(autosaveJob, job)) {
+        // Try again later with everything still flagged
+        autosaveCheckpointDue = true;
+        free(job);
+    }
+}
+
+// Write what's left before exiting; the worker thread must be idle
+void closeAutosave() {
+    if (timelapseActive) return;  // stopTimelapse() must run first
+    
+    AutosaveJob* job = collectAutosave();
+    if (job) {
+        writeAutosave(job);
+        free(job);
+    }
+    if (autosaveFile) {
+        fclose(autosaveFile);
+        autosaveFile = NULL;
+    }
+}
+
+static bool readAutosaveBytes(const u8* data, int size, int* offset, void* out, int length) {
+    if (*offset + length > size) return false;
+    memcpy(out, &data[*offset], length);
+    *offset += length;
+    return true;
+}
+
+/**
+ * Read the record at offset; its tiles are put on the canvas if apply is
+ * set. Returns false if the record is incomplete or damaged.
+ */
+static bool readAutosaveRecord(const u8* data, int size, int* offset, bool apply,
+                               JournalState* state, char* imageName) {
+    int start = *offset;
+    u8 type, length;
+    u8 stateBytes[JOURNAL_STATE_SIZE];
+    u16 count;
+    if (!readAutosaveBytes(data, size, offset, &type, 1) ||
+        (type != AUTOSAVE_CHECKPOINT && type != AUTOSAVE_CHANGES) ||
+        !readAutosaveBytes(data, size, offset, stateBytes, JOURNAL_STATE_SIZE) ||
+        !readAutosaveBytes(data, size, offset, &length, 1) ||
+        !readAutosaveBytes(data, size, offset, imageName, length) ||
+        !readAutosaveBytes(data, size, offset, &count, 2)) {
+        return false;
+    }
+    imageName[length] = '\0';
+    unpackJournalState(stateBytes, state);
+    
+    if (apply && type == AUTOSAVE_CHECKPOINT) clearCanvasMask();
+    
+    for (int i = 0; i < count; i++) {
+        u8 layer;
+        u16 index, packedSize;
+        if (!readAutosaveBytes(data, size, offset, &layer, 1) ||
+            !readAutosaveBytes(data, size, offset, &index, 2) ||
+            !readAutosaveBytes(data, size, offset, &packedSize, 2) ||
+            layer >= MAX_LAYERS || index >= CANVAS_TILE_COUNT || *offset + packedSize > size) {
+            return false;
+        }
+        
+        if (apply) {
+            u8* tile = packedSize > 0 ? (u8*)malloc(TILE_PIXELS) : NULL;
+            if (tile && !unpackTile(&data[*offset], packedSize, tile)) {
+                free(tile);
+                tile = NULL;
             }
+            setMaskTile(layer, index, tile);
         }
+        *offset += packedSize;
     }
+    
+    u32 hash;
+    if (!readAutosaveBytes(data, size, offset, &hash, 4)) return false;
+    return hash == fnv1a(2166136261u, &data[start], *offset - 4 - start);
 }
 
 /**
- * SCREENSHOT SYSTEM
- * 
- * Save current canvas to SD card as BMP file.
- * Filename format: sqribble_YYYYMMDD_HHMMSS.bmp
- * BMP format is uncompressed 24-bit RGB (actually BGR on 3DS).
- * Returns true on success, false on failure.
+ * Put back the canvas from the last autosave, if there is one.
+ * Called at startup, before anything is drawn.
  */
-bool saveScreenshot(u8* framebuffer) {
-    // Get current time for unique filename
-    time_t rawtime;
-    struct tm* timeinfo;
-    char filename[256];
+void recoverAutosave() {
+    // A checkpoint may have been cut off between removing and renaming
+    FILE* file = fopen(AUTOSAVE_FILENAME, "rb");
+    if (!file) file = fopen(AUTOSAVE_TEMP_FILENAME, "rb");
+    if (!file) return;
     
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    fseek(file, 0, SEEK_END);
+    int size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8* data = (u8*)malloc(size > 0 ? size : 1);
+    bool loaded = data && fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!loaded || size < 4 || memcmp(data, "SQA2", 4) != 0) {
+        free(data);
+        return;
+    }
     
-    // Format timestamp into filename
-    snprintf(filename, sizeof(filename), "sdmc:/sqribble_%04d%02d%02d_%02d%02d%02d.bmp",
-             timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-             timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    JournalState state, recovered;
+    char imageName[256], recoveredImageName[256];
+    bool found = false;
+    int offset = 4;
+    while (offset < size) {
+        // Check the whole record before touching the canvas
+        int start = offset;
+        if (!readAutosaveRecord(data, size, &offset, false, &state, imageName)) break;
+        if (!validJournalState(&state)) break;
+        
+        offset = start;
+        readAutosaveRecord(data, size, &offset, true, &recovered, recoveredImageName);
+        found = true;
+    }
+    free(data);
+    if (!found) return;
     
-    FILE* file = fopen(filename, "wb");
-    if (!file) return false;
+    restoreJournalState(&recovered);
+    resetLayerDepths();
+    generateLayerImages(0);
+    if (recoveredImageName[0] && loadDrawingImage(recoveredImageName)) {
+        generateLayerImages(1);
+    }
     
-    // BMP file structure: File Header (14 bytes) + Info Header (40 bytes) + Pixel Data
-    u32 fileSize = 54 + (320 * 240 * 3);
-    u32 dataOffset = 54;
-    u32 headerSize = 40;
-    u32 width = 320;
-    u32 height = 240;
-    u16 planes = 1;
-    u16 bitsPerPixel = 24;
+    // The file may end in a damaged record, so start over with a checkpoint
+    autosaveCheckpointDue = true;
+    if (loadedImageName[0]) journalLoad(loadedImageName);
+}
+
+/**
+ * MASK FILTERS
+ * 
+ * L/R in the gallery softens or sharpens the active layer's mask (see
+ * filter.c). A canvas full of scratched tiles is far more than a frame of
+ * work, so a filter runs FILTER_TILES_PER_FRAME tiles a frame into a
+ * results buffer, with input held off and the canvas showing the mask as
+ * it was. After the last tile the results are written in one go, as one
+ * undo record and journal fill, so every tile is filtered from the
+ * original.
+ */
+bool maskFilterActive = false;
+static MaskFilter maskFilter;
+static u16 maskFilterTiles[CANVAS_TILE_COUNT];
+static u8* maskFilterResults = NULL;     // TILE_PIXELS per tile in maskFilterTiles
+static int maskFilterCount = 0;
+static int maskFilterDone = 0;            // Tiles filtered so far
+
+// Start filtering the active layer's mask. Returns false if it can't change or memory is short.
+bool startMaskFilter(MaskFilter filter) {
+    if (maskFilterActive) return false;
     
-    // Write BMP file header (14 bytes)
-    fwrite("BM", 1, 2, file);              // Magic number
-    fwrite(&fileSize, 4, 1, file);        // File size
-    fwrite("\0\0\0\0", 1, 4, file);        // Reserved
-    fwrite(&dataOffset, 4, 1, file);      // Pixel data offset
+    Layer* layer = &layers[activeLayer];
+    maskFilterCount = findFilterTiles(layer->maskTiles, layer->maskBits, maskFilterTiles);
+    if (maskFilterCount == 0) return false;
+    maskFilterResults = (u8*)malloc(maskFilterCount * TILE_PIXELS);
+    if (!maskFilterResults) return false;
     
-    // Write BMP info header (40 bytes)
-    fwrite(&headerSize, 4, 1, file);      // Header size
-    fwrite(&width, 4, 1, file);           // Image width
-    fwrite(&height, 4, 1, file);          // Image height
-    fwrite(&planes, 2, 1, file);          // Color planes
-    fwrite(&bitsPerPixel, 2, 1, file);    // Bits per pixel
-    fwrite("\0\0\0\0", 1, 4, file);        // Compression (none)
-    fwrite("\0\0\0\0", 1, 4, file);        // Image size (can be 0 for uncompressed)
-    fwrite("\0\0\0\0", 1, 4, file);        // X pixels per meter
-    fwrite("\0\0\0\0", 1, 4, file);        // Y pixels per meter
-    fwrite("\0\0\0\0", 1, 4, file);        // Colors in palette
-    fwrite("\0\0\0\0", 1, 4, file);        // Important colors
+    maskFilter = filter;
+    maskFilterDone = 0;
+    maskFilterActive = true;
+    return true;
+}
+
+// Called every frame: filter the next tiles, and write them all after the last
+void updateMaskFilter() {
+    if (!maskFilterActive) return;
     
-    // Write pixel data (BMP stores bottom-to-top, which matches our coordinate system)
-    for (int y = 239; y >= 0; y--) {
-        for (int x = 0; x < 320; x++) {
-            int idx = (x * 240 + (239 - y)) * 3;
-            // BMP uses BGR format, same as 3DS framebuffer
-            fwrite(&framebuffer[idx], 1, 3, file);
-        }
+    Layer* layer = &layers[activeLayer];
+    int end = maskFilterDone + FILTER_TILES_PER_FRAME;
+    if (end > maskFilterCount) end = maskFilterCount;
+    for (; maskFilterDone < end; maskFilterDone++) {
+        filterMaskTile(layer->maskTiles, layer->maskBits, maskFilterTiles[maskFilterDone], maskFilter,
+                       &maskFilterResults[maskFilterDone * TILE_PIXELS]);
     }
+    if (maskFilterDone < maskFilterCount) return;
     
-    fclose(file);
-    return true;
+    pushUndo();
+    journalFill();
+    for (int i = 0; i < maskFilterCount; i++) {
+        int tileIndex = maskFilterTiles[i];
+        const u8* result = &maskFilterResults[i * TILE_PIXELS];
+        // Don't allocate unscratched tiles the filter left unscratched
+        if (maskTileUntouched(activeLayer, tileIndex) && uniformTileValue(result) == 255) continue;
+        u8* tile = touchMaskTile(activeLayer, tileIndex % CANVAS_TILES_X, tileIndex / CANVAS_TILES_X);
+        if (!tile) continue;
+        memcpy(tile, result, TILE_PIXELS);
+        repackMaskTile(activeLayer, tileIndex);  // Sharpening keeps hard edges hard
+    }
+    journalFillDone();
+    
+    free(maskFilterResults);
+    maskFilterResults = NULL;
+    maskFilterActive = false;
 }
 
 /**
@@ -946,27 +6562,53 @@ int main(int argc, char **argv) {
     initInstructionText();
 
     loadLogo();
+    loadStampBrushes();
     
     // Scan for saved images on startup
     scanGalleryImages();
 
-    // Generate initial checkerboard patterns (20px cells)
-    generateCheckerboard(baseImage, 20);
-    generateRotatedCheckerboard(rotatedImage, 20);
-    memset(scratchMask, 255, sizeof(scratchMask));  // Start fully opaque (top layer visible)
+    // Generate initial checkerboard patterns (20px cells) in the saved colors
+    loadPalette(0);
+    generateLayerImages(0);
+    resetLayerDepths();
+    resetView();  // Canvas starts fully opaque (no tiles allocated)
+    recoverAutosave();  // Unless the last session left work behind
     
-    // Allocate working buffers for rendering
-    u8* compositeBuffer = (u8*)malloc(FB_WIDTH * FB_HEIGHT * 3);
-    u8* topScreenBuffer = (u8*)malloc(240 * 400 * 3);
+    // Allocate working buffers for rendering, in linear memory so the GX
+    // engine can copy them to the screens
+    u8* compositeBuffer = (u8*)allocScreenBuffer(FB_WIDTH * FB_HEIGHT * 3);
+    u8* topLeftBuffer = (u8*)allocScreenBuffer(240 * 400 * 3);
+    u8* topRightBuffer = (u8*)allocScreenBuffer(240 * 400 * 3);  // Separate, the left eye may still be copying
+    u16* composite565 = (u16*)allocScreenBuffer(FB_WIDTH * FB_HEIGHT * 2);  // 16-bit display mode
     
-    int brushSize = 5;
     bool wasTouching = false;
+    
+    // SELECT doubles as a modifier: a plain tap opens the gallery on release,
+    // while SELECT + another input performs a view action instead
+    bool selectComboUsed = false;
+    bool isPanning = false;
+    int panStartTouchX = 0, panStartTouchY = 0;
+    int panStartViewX = 0, panStartViewY = 0;
 
     // Main game loop - runs until user exits
     while (aptMainLoop()) {
         hidScanInput();
         u32 kDown = hidKeysDown();   // Buttons pressed this frame
         u32 kHeld = hidKeysHeld();   // Buttons held down
+        u32 kUp = hidKeysUp();       // Buttons released this frame
+        
+        // A mask filter takes a few frames; input waits until it is done
+        if (maskFilterActive) {
+            kDown = kUp = 0;
+            allowDrawing = false;
+        }
+
+        // SELECT + START: Cycle stroke stabilizer strength
+        if ((kDown & KEY_START) && (kHeld & KEY_SELECT)) {
+            stabilizerLevel = (stabilizerLevel + 1) % STABILIZER_LEVELS;
+            selectComboUsed = true;
+            kDown &= ~KEY_START;
+        }
 
         // START button toggles instructions screen on/off
         if (kDown & KEY_START) {
@@ -978,12 +6620,19 @@ int main(int argc, char **argv) {
             allowDrawing = !showInstructions && !showGallery;
         }
 
-        // SELECT button toggles gallery screen on/off
+        // SELECT button (tapped on its own) toggles gallery screen on/off
         if (kDown & KEY_SELECT) {
+            selectComboUsed = false;
+        }
+        if ((kUp & KEY_SELECT) && !selectComboUsed) {
             if (showInstructions) {
                 // If instructions are open, close them first
                 showInstructions = false;
             }
+            if (showPalette) {
+                // The palette editor goes back to the gallery
+                closePaletteEditor();
+            }
             
             // Toggle gallery state
             showGallery = !showGallery;
@@ -1001,13 +6650,19 @@ int main(int argc, char **argv) {
         }
 
         // Any button press (except START/SELECT) dismisses instruction screen
+        // D-Pad Left/Right flips between help pages instead
+        if (showInstructions && (kDown & (KEY_DLEFT | KEY_DRIGHT))) {
+            helpPage = (helpPage + ((kDown & KEY_DLEFT) ? HELP_PAGES - 1 : 1)) % HELP_PAGES;
+            kDown &= ~(KEY_DLEFT | KEY_DRIGHT);
+        }
+        
         if (showInstructions && kDown && !(kDown & KEY_START) && !(kDown & KEY_SELECT)) {
             showInstructions = false;
             allowDrawing = false;  // Don't allow drawing on the dismissal tap
         }
 
         // Auto-enable drawing after dismissing instructions (but not during gallery)
-        if (!showInstructions && !showGallery && !allowDrawing && !(kHeld & KEY_TOUCH)) {
+        if (!showInstructions && !showGallery && !showPalette && !allowDrawing && !(kHeld & KEY_TOUCH)) {
             allowDrawing = true;
         }
 
@@ -1117,68 +6772,211 @@ int main(int argc, char **argv) {
                 if (loadDrawing(galleryImages[selectedGalleryIndex].filename)) {
                     showGallery = false;
                     allowDrawing = true;
-                    // Regenerate the rotated layer to match current mode
-                    generateRotatedCheckerboard(rotatedImage, 20);
+                    // Regenerate the layers below the drawing to match current mode
+                    generateLayerImages(1);
+                    journalLoad(galleryImages[selectedGalleryIndex].filename);
+                }
+            }
+        }
+        
+        // Y in the gallery: Watch a timelapse of this session
+        if (showGallery && (kDown & KEY_Y) && startTimelapse()) {
+            showGallery = false;
+            kDown = 0;
+        }
+        
+        // L/R in the gallery: Soften/sharpen the active layer's mask
+        if (showGallery && (kDown & (KEY_L | KEY_R))) {
+            showGallery = false;
+            startMaskFilter((kDown & KEY_L) ? FILTER_SOFTEN : FILTER_SHARPEN);
+            kDown = 0;
+        }
+        
+        // B in the gallery: Cycle the display mode (24-bit, 16-bit, GPU)
+        if (showGallery && (kDown & KEY_B)) {
+            showGallery = false;
+            displayMode = (DisplayMode)((displayMode + 1) % DISPLAY_MODE_COUNT);
+            if (displayMode == DISPLAY_GPU && !initGpuCompositing()) displayMode = DISPLAY_RGB8;
+            kDown = 0;
+        }
+        
+        // X in the gallery: Edit the palette
+        if (showGallery && (kDown & KEY_X)) {
+            showGallery = false;
+            openPaletteEditor();
+            kDown = 0;
+        }
+        
+        // Palette editor: takes all input until B (or a SELECT tap) closes it
+        if (showPalette && !showInstructions) {
+            updatePaletteEditor(kDown, kHeld);
+            kDown = 0;
+        }
+
+        // Flipbook playback: Y exports the animation as a GIF, any other
+        // button or touch stops it. Input is ignored while exporting.
+        if (flipbookPlaying && !showInstructions && !showGallery) {
+            if (kDown && !gifExport) {
+                if (kDown & KEY_Y) {
+                    startFlipbookExport();
+                } else {
+                    flipbookPlaying = false;
+                }
+                selectComboUsed = true;  // A SELECT press here must not open the gallery
+                allowDrawing = false;    // The stopping tap does not draw
+            }
+            kDown = 0;
+        }
+
+        // Timelapse replay: A pauses, D-Pad Up/Down changes speed, D-Pad
+        // Left/Right jumps between keyframes, L/R step one stroke, Y exports
+        // a GIF and B returns to the drawing
+        if (timelapseActive && !showInstructions && !showGallery) {
+            if (!gifExport) {
+                if (kDown & KEY_A) {
+                    if (timelapseStroke >= timelapseStrokeCount && timelapsePaused) timelapseSeek(0);
+                    timelapsePaused = !timelapsePaused;
+                }
+                if ((kDown & KEY_DUP) && timelapseSpeed < TIMELAPSE_SPEEDS - 1) timelapseSpeed++;
+                if ((kDown & KEY_DDOWN) && timelapseSpeed > 0) timelapseSpeed--;
+                if (kDown & KEY_DLEFT) timelapseSkip(-1);
+                if (kDown & KEY_DRIGHT) timelapseSkip(1);
+                if (kDown & (KEY_L | KEY_R)) {
+                    timelapseSeek(timelapseStroke + ((kDown & KEY_L) ? -1 : 1));
+                    timelapsePaused = true;
                 }
+                if (kDown & KEY_Y) startTimelapseExport();
+                if (kDown & KEY_B) stopTimelapse();
             }
+            if (kDown) {
+                selectComboUsed = true;  // SELECT here must not open the gallery
+                allowDrawing = false;
+            }
+            kDown = 0;
         }
 
         // Only process game controls when not showing instructions or gallery
-        if (!showInstructions && !showGallery) {
+        if (!showInstructions && !showGallery && !showPalette && !flipbookPlaying && !timelapseActive &&
+            !maskFilterActive) {
             // X button: Clear canvas (reset to fully unscratched)
+            // SELECT + X: Export anaglyph and side-by-side 3D JPEGs
             if (kDown & KEY_X) {
-                pushUndo();  // Save current state before clearing
-                memset(scratchMask, 255, sizeof(scratchMask));
-                depthOffset = 3.0f;  // Reset 3D depth to default
+                if (kHeld & KEY_SELECT) {
+                    syncComposite(compositeBuffer);
+                    startStereoExport(exportShareJob, compositeBuffer, viewDepth);
+                    selectComboUsed = true;
+                } else {
+                    pushUndo();  // Save current state before clearing
+                    clearCanvasMask();
+                    depthOffset = 3.0f;  // Reset 3D depth to default
+                }
             }
 
-            // B button: Cycle through drawing modes
+            // B button: Cycle the visible layer's pattern
+            // SELECT + B: Toggle between scratch and restore brush
             if (kDown & KEY_B) {
-                currentMode = (DrawingMode)((currentMode + 1) % 4);
-                // Regenerate both layers with new mode
-                generateCheckerboard(baseImage, 20);
-                generateRotatedCheckerboard(rotatedImage, 20);
+                if (kHeld & KEY_SELECT) {
+                    restoreBrush = !restoreBrush;
+                    selectComboUsed = true;
+                } else {
+                    topPattern = (CanvasPattern)((topPattern + 1) % CANVAS_PATTERN_COUNT);
+                    generateLayerImages(0);
+                }
             }
 
             // A button: Cycle through brush shapes
+            // SELECT + A: Cycle through symmetry modes
             if (kDown & KEY_A) {
-                currentBrushShape = (BrushShape)((currentBrushShape + 1) % 3);
+                if (kHeld & KEY_SELECT) {
+                    currentSymmetry = (SymmetryMode)((currentSymmetry + 1) % SYMMETRY_MODE_COUNT);
+                    selectComboUsed = true;
+                } else {
+                    do {
+                        currentBrushShape = (BrushShape)((currentBrushShape + 1) % BRUSH_SHAPE_COUNT);
+                    } while (!brushAvailable(currentBrushShape));
+                    updateStampBrush();
+                }
             }
 
             // Y button: Save screenshot to SD card
+            // SELECT + Y: Export the 3D view as an MPO stereo photo
             if (kDown & KEY_Y) {
-                saveScreenshot(compositeBuffer);
+                syncComposite(compositeBuffer);
+                if (kHeld & KEY_SELECT) {
+                    startStereoExport(exportMPOJob, compositeBuffer, viewDepth);
+                    selectComboUsed = true;
+                } else {
+                    saveScreenshot(compositeBuffer);
+                }
             }
 
-            // D-Pad Right: Next color in rainbow palette
-            if (kDown & KEY_DRIGHT) {
-                currentColorIndex = (currentColorIndex + 1) % numColors;
-                generateCheckerboard(baseImage, 20);
-                generateRotatedCheckerboard(rotatedImage, 20);
-            }
-            
-            // D-Pad Left: Previous color in rainbow palette
-            if (kDown & KEY_DLEFT) {
-                currentColorIndex = (currentColorIndex - 1 + numColors) % numColors;
-                generateCheckerboard(baseImage, 20);
-                generateRotatedCheckerboard(rotatedImage, 20);
-            }
+            if (kHeld & KEY_SELECT) {
+                // SELECT + D-Pad Up/Down: Choose the layer to scratch
+                if (kDown & KEY_DUP) {
+                    if (activeLayer > 0) activeLayer--;
+                    selectComboUsed = true;
+                }
+                if (kDown & KEY_DDOWN) {
+                    if (activeLayer < layerCount - 2) activeLayer++;
+                    selectComboUsed = true;
+                }
+                
+                // SELECT + D-Pad Right/Left: Add/remove a layer
+                if (kDown & KEY_DRIGHT) {
+                    addLayer();
+                    selectComboUsed = true;
+                }
+                if (kDown & KEY_DLEFT) {
+                    removeLayer();
+                    selectComboUsed = true;
+                }
+            } else {
+                // D-Pad Right: Next color in the palette
+                if (kDown & KEY_DRIGHT) {
+                    currentColorIndex = (currentColorIndex + 1) % numColors;
+                    updateLayerPalettes();
+                }
+                
+                // D-Pad Left: Previous color in the palette
+                if (kDown & KEY_DLEFT) {
+                    currentColorIndex = (currentColorIndex - 1 + numColors) % numColors;
+                    updateLayerPalettes();
+                }
 
-            // D-Pad Up/Down: Adjust brush size (1-50 pixels)
-            if (kDown & KEY_DUP) { 
-                brushSize++; 
-                if (brushSize > 50) brushSize = 50; 
+                // D-Pad Up/Down: Adjust brush size (1-50 pixels)
+                if (kDown & KEY_DUP) { 
+                    brushSize++; 
+                    if (brushSize > 50) brushSize = 50; 
+                    updateStampBrush();
+                }
+                if (kDown & KEY_DDOWN) { 
+                    brushSize--; 
+                    if (brushSize < 1) brushSize = 1; 
+                    updateStampBrush();
+                }
             }
-            if (kDown & KEY_DDOWN) { 
-                brushSize--; 
-                if (brushSize < 1) brushSize = 1; 
+
+            // Circle Pad left/right: Previous/next flipbook frame
+            // SELECT + Circle Pad right/left: Insert/delete frame
+            // SELECT + Circle Pad up/down: Play animation / toggle onion skin
+            if (kHeld & KEY_SELECT) {
+                if (kDown & KEY_CPAD_RIGHT) insertFrame();
+                if (kDown & KEY_CPAD_LEFT) deleteFrame();
+                if (kDown & KEY_CPAD_UP) startPlayback();
+                if (kDown & KEY_CPAD_DOWN) onionSkin = !onionSkin;
+                if (kDown & (KEY_CPAD_LEFT | KEY_CPAD_RIGHT | KEY_CPAD_UP | KEY_CPAD_DOWN)) {
+                    selectComboUsed = true;
+                }
+            } else {
+                if (kDown & KEY_CPAD_LEFT) gotoFrame(currentFrame - 1);
+                if (kDown & KEY_CPAD_RIGHT) gotoFrame(currentFrame + 1);
             }
 
             // Circle Pad: Adjust 3D stereoscopic depth
             circlePosition pos;
             hidCircleRead(&pos);
             
-            if (abs(pos.dy) > 20) {  // Deadzone to prevent drift
+            if (abs(pos.dy) > 20 && !(kHeld & KEY_SELECT)) {  // Deadzone to prevent drift
                 // Convert stick input to depth adjustment (negative y = increase depth)
                 float adjustment = -(float)pos.dy / 1000.0f;
                 depthOffset += adjustment;
@@ -1188,48 +6986,143 @@ int main(int argc, char **argv) {
                 if (depthOffset > 15.0f) depthOffset = 15.0f;
             }
 
-            // L button: Undo last action
-            if (kDown & KEY_L) undo();
-            
-            // R button: Redo last undone action
-            if (kDown & KEY_R) redo();
+            if (kHeld & KEY_SELECT) {
+                // SELECT + L/R: Zoom out/in around the screen center
+                if (kDown & KEY_L) {
+                    zoomView(viewZoom - 1, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
+                    selectComboUsed = true;
+                }
+                if (kDown & KEY_R) {
+                    zoomView(viewZoom + 1, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
+                    selectComboUsed = true;
+                }
+            } else {
+                // L button: Undo last action
+                if (kDown & KEY_L) undo();
+                
+                // R button: Redo last undone action
+                if (kDown & KEY_R) redo();
+            }
 
-            // Touch input: Drawing system with interpolation for smooth lines
-            if (allowDrawing && (kHeld & KEY_TOUCH)) {
+            bool panTouch = allowDrawing && (kHeld & KEY_TOUCH) && (kHeld & KEY_SELECT);
+            
+            // SELECT + Touch drag: Pan the viewport across the canvas
+            if (panTouch) {
                 touchPosition touch;
                 hidTouchRead(&touch);
-
-                // Save undo state when starting new stroke
-                if (!wasTouching) {
-                    pushUndo();
-                    prevTouchX = touch.px;
-                    prevTouchY = touch.py;
-                }
                 
-                // Draw line from previous position to current (prevents gaps)
-                if (prevTouchX >= 0 && prevTouchY >= 0) {
-                    drawLine(prevTouchX, prevTouchY, touch.px, touch.py, brushSize);
+                if (!isPanning) {
+                    isPanning = true;
+                    panStartTouchX = touch.px;
+                    panStartTouchY = touch.py;
+                    panStartViewX = viewX;
+                    panStartViewY = viewY;
                 }
                 
-                // Update previous position for next frame
-                prevTouchX = touch.px;
-                prevTouchY = touch.py;
-                wasTouching = true;
+                // Convert the total drag distance to canvas pixels
+                int dragX = touch.px - panStartTouchX;
+                int dragY = touch.py - panStartTouchY;
+                viewX = panStartViewX - ((viewZoom < 0) ? dragX << 1 : dragX >> viewZoom);
+                viewY = panStartViewY - ((viewZoom < 0) ? dragY << 1 : dragY >> viewZoom);
+                clampView();
+                
+                selectComboUsed = true;
+                wasTouching = false;  // Drawing resumes as a new stroke
+                prevTouchX = -1;
+                prevTouchY = -1;
+            } else if (allowDrawing && (kHeld & KEY_TOUCH)) {
+                // Touch input: Drawing system with interpolation for smooth lines
+                touchPosition touch;
+                hidTouchRead(&touch);
+                
+                // Map the touch through the viewport onto the canvas
+                int touchX = subpixelFromScreenX(touch.px);
+                int touchY = subpixelFromScreenY(touch.py);
+
+                // Fill tool: one fill per tap, nothing while dragging
+                if (currentBrushShape == BRUSH_FILL) {
+                    if (!wasTouching) {
+                        pushUndo();
+                        journalFill();
+                        syncComposite(compositeBuffer);
+                        fillAt(compositeBuffer, touch.px, touch.py);
+                        journalFillDone();
+                    }
+                    wasTouching = true;
+                } else {
+                    // Save undo state when starting new stroke and dab under the stylus
+                    if (!wasTouching) {
+                        pushUndo();
+                        stabilizerStart(touchX, touchY);
+                        prevTouchX = touchX;
+                        prevTouchY = touchY;
+                        journalStroke(touchX, touchY);
+                        beginBrushStroke(touchX, touchY);
+                        drawLine(touchX, touchY, touchX, touchY, brushSize);
+                    }
+                    
+                    // Draw line from previous brush position to the new one (prevents gaps).
+                    // The airbrush keeps spraying where it rests, one journaled point per frame
+                    lastTouchX = touchX;
+                    lastTouchY = touchY;
+                    int brushX, brushY;
+                    int stringLength = stabilizerLength(stabilizerLevel, viewZoom);
+                    bool brushMoved = stabilizerUpdate(touchX, touchY, stringLength, &brushX, &brushY);
+                    if (!brushMoved && wasTouching && currentBrushShape == BRUSH_AIRBRUSH) {
+                        brushX = prevTouchX;
+                        brushY = prevTouchY;
+                        brushMoved = true;
+                    }
+                    if (brushMoved) {
+                        journalPoint(brushX, brushY);
+                        drawLine(prevTouchX, prevTouchY, brushX, brushY, brushSize);
+                        
+                        // Update previous position for next frame
+                        prevTouchX = brushX;
+                        prevTouchY = brushY;
+                    }
+                    wasTouching = true;
+                }
             } else {
-                // Reset touch tracking when stylus lifted
+                // Reset touch tracking when stylus lifted. The stabilized brush
+                // first catches up, so the stroke ends at the last touch
                 if (wasTouching) {
+                    int brushX, brushY;
+                    if (prevTouchX >= 0 && currentBrushShape != BRUSH_FILL &&
+                        stabilizerFinish(lastTouchX, lastTouchY, &brushX, &brushY)) {
+                        journalPoint(brushX, brushY);
+                        drawLine(prevTouchX, prevTouchY, brushX, brushY, brushSize);
+                    }
                     prevTouchX = -1;
                     prevTouchY = -1;
+                    journalStrokeEnd();
                 }
                 wasTouching = false;
             }
+            
+            if (!panTouch) {
+                isPanning = false;
+            }
         }
 
         // RENDERING PIPELINE
         
+        if (flipbookPlaying && !gifExport) updatePlayback();
+        if (timelapseActive && !gifExport && !showInstructions) updateTimelapse();
+        updateMaskFilter();
+        updateAutosave(kHeld & KEY_TOUCH);
+        updateColorCycle();
+        
+        // GPU compositing covers the plain canvas view only
+        bool gpuFrame = displayMode == DISPLAY_GPU && !showInstructions && !showGallery && !showPalette &&
+                        !flipbookPlaying && !timelapseActive && !gifExport && !(onionSkin && currentFrame > 0);
+        if (!gpuFrame) gpuCanvasActive = false;
+        setFramebufferFormat(displayMode == DISPLAY_RGB565 && !showInstructions && !showGallery && !showPalette);
+        
         if (showInstructions) {
             // Begin Citro3D frame for GPU rendering
             C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            if (gpuReady) C2D_Prepare();  // The GPU canvas binds its own shader
             
             // Render GPU-accelerated instruction screen
             drawInstructionsGPU();
@@ -1251,52 +7144,55 @@ int main(int argc, char **argv) {
             
             gfxFlushBuffers();
             gfxSwapBuffers();
+        } else if (gpuFrame) {
+            // Layers blended by the GPU on both screens and both eyes
+            C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            renderCanvasGPU();
+            C3D_FrameEnd(0);
         } else {
             // Use traditional framebuffer rendering for game canvas
-            // Step 1: Composite the two layers based on scratch mask
-            compositeImage(compositeBuffer, rotatedImage, baseImage, scratchMask);
+            // Step 1: Composite the visible part of the canvas based on scratch mask
+            // 16-bit output goes straight to 2-byte pixels, unless a GIF export
+            // needs the BGR8 frame as well
+            const u8* frame = compositeBuffer;
+            int pixelSize = 3;
+            composite565Only = framebuffers565 && !gifExport;
+            if (composite565Only) {
+                compositeViewport(NULL, composite565, viewDepth);
+            } else {
+                compositeViewport(compositeBuffer, NULL, viewDepth);
+                if (gifExport) feedGifExport(compositeBuffer);
+                if (framebuffers565) convertTo565(composite565, compositeBuffer);
+            }
+            if (framebuffers565) {
+                frame = (const u8*)composite565;
+                pixelSize = 2;
+            }
 
-            // Step 2: Render to bottom screen (touch screen) using framebuffer
+            // Step 2: Render to bottom screen (touch screen) using framebuffer,
+            // unless the palette editor is using it
             u8* fbBottom = gfxGetFramebuffer(GFX_BOTTOM, GFX_LEFT, NULL, NULL);
-            memcpy(fbBottom, compositeBuffer, FB_WIDTH * FB_HEIGHT * 3);
+            if (showPalette) {
+                drawPaletteEditor(fbBottom);
+                GSPGPU_FlushDataCache(fbBottom, FB_WIDTH * FB_HEIGHT * 3);
+            } else {
+                blitToFramebuffer(fbBottom, frame, FB_WIDTH * FB_HEIGHT * pixelSize);
+            }
 
             // Step 3: Render to top screen left eye (center 320px in 400px screen)
             u8* fbTopLeft = gfxGetFramebuffer(GFX_TOP, GFX_LEFT, NULL, NULL);
-            memset(topScreenBuffer, 0, 240 * 400 * 3);  // Black bars on sides
-            for (int x = 0; x < 320; x++) {
-                for (int y = 0; y < 240; y++) {
-                    int srcIdx = (x * 240 + (239 - y)) * 3;
-                    int dstX = x + 40;  // Center horizontally (40px black border each side)
-                    int dstIdx = (dstX * 240 + (239 - y)) * 3;
-                    memcpy(&topScreenBuffer[dstIdx], &compositeBuffer[srcIdx], 3);
-                }
-            }
-            memcpy(fbTopLeft, topScreenBuffer, 240 * 400 * 3);
+            renderStereoEye(topLeftBuffer, frame, viewDepth, 0.0f, pixelSize);
+            blitToFramebuffer(fbTopLeft, topLeftBuffer, 240 * 400 * pixelSize);
 
             // Step 4: Render to top screen right eye with parallax for 3D effect
+            // Each pixel is shifted by its depth: unscratched top layer pops
+            // out by depthOffset, layers below sit progressively deeper
             u8* fbTopRight = gfxGetFramebuffer(GFX_TOP, GFX_RIGHT, NULL, NULL);
-            memset(topScreenBuffer, 0, 240 * 400 * 3);
-            for (int x = 0; x < 320; x++) {
-                for (int y = 0; y < 240; y++) {
-                    int srcIdx = (x * 240 + (239 - y)) * 3;
-                    int maskIdx = x * 240 + (239 - y);
-                    u8 alpha = scratchMask[maskIdx];
-                    
-                    // Apply horizontal shift based on scratch state
-                    // Scratched areas (low alpha): base depth
-                    // Unscratched areas (high alpha): shifted by depthOffset for 3D pop
-                    int dstX = (alpha > 128 ? x + 40 + (int)depthOffset : x + 40);
-                    
-                    if (dstX >= 0 && dstX < 400) {
-                        int dstIdx = (dstX * 240 + (239 - y)) * 3;
-                        memcpy(&topScreenBuffer[dstIdx], &compositeBuffer[srcIdx], 3);
-                    }
-                }
-            }
-            memcpy(fbTopRight, topScreenBuffer, 240 * 400 * 3);
+            renderStereoEye(topRightBuffer, frame, viewDepth, depthOffset, pixelSize);
+            blitToFramebuffer(fbTopRight, topRightBuffer, 240 * 400 * pixelSize);
             
-            // Flush framebuffers for non-Citro rendering
-            gfxFlushBuffers();
+            // The framebuffers must be complete before they are shown
+            waitForBlits();
             gfxSwapBuffers();
         }
         
@@ -1304,8 +7200,25 @@ int main(int argc, char **argv) {
         gspWaitForVBlank();  // Sync to 60fps
     }
 
-    // Cleanup gallery resources
+    // Let a running export finish writing its file
+    finishGifExport();
+    waitBackgroundJob();
+    
+    // Put the live drawing back, close the session's journal and autosave
+    if (showPalette) closePaletteEditor();
+    stopTimelapse();
+    journalClose();
+    closeAutosave();
+    
+    // Cleanup gallery and palette editor resources
     freeGalleryImages();
+    free(wheelImage);
+    freeStampBrushes();
+    
+    // Cleanup canvas tiles, history and animation frames
+    clearUndoHistory();
+    resetFlipbook();
+    clearCanvasMask();
     
     // Cleanup logo resources
     if (logoLoaded) {
@@ -1314,10 +7227,13 @@ int main(int argc, char **argv) {
     }
 
     // Cleanup: Free allocated memory and exit
-    free(compositeBuffer);
-    free(topScreenBuffer);
+    freeScreenBuffer(compositeBuffer);
+    freeScreenBuffer(topLeftBuffer);
+    freeScreenBuffer(topRightBuffer);
+    freeScreenBuffer(composite565);
     
     // Cleanup Citro2D/3D
+    freeGpuCompositing();
     C2D_TextBufDelete(staticTextBuf);
     C2D_Fini();
     C3D_Fini();
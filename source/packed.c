@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "packed.h"
+
+/**
+ * PACKED TILES
+ * 
+ * A tile scratched only by hard brushes holds nothing but 0 and 255, so it
+ * is kept as a bit plane: bit i of the packed tile is set where byte i of
+ * the tile would be 255, 32 pixels per word. That is 512 bytes instead of
+ * 4 KB, both live and in undo history, and the compositor can pick the
+ * visible layer for a whole word at a time.
+ */
+
+// A word is binary when every byte repeats its own top bit
+static inline bool binaryWord(u32 word) {
+    return ((word >> 7) & 0x01010101) * 255 == word;
+}
+
+bool isBinaryTile(const u8* tile) {
+    const u32* words = (const u32*)tile;
+    for (int i = 0; i < TILE_PIXELS / 4; i++) {
+        if (!binaryWord(words[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * Pack a tile into a new bit plane.
+ * Returns NULL if the tile holds partial alpha or out of memory.
+ */
+u32* packBinaryTile(const u8* tile) {
+    if (!isBinaryTile(tile)) return NULL;
+    
+    const u32* words = (const u32*)tile;
+    u32* packed = (u32*)malloc(PACKED_TILE_BYTES);
+    if (!packed) return NULL;
+    for (int i = 0; i < PACKED_TILE_WORDS; i++) {
+        u32 bits = 0;
+        for (int j = 0; j < 8; j++) {
+            // Gather the top bits of the four bytes into a nibble
+            u32 top = (words[i * 8 + j] >> 7) & 0x01010101;
+            bits |= ((top | top >> 7 | top >> 14 | top >> 21) & 0xF) << (j * 4);
+        }
+        packed[i] = bits;
+    }
+    return packed;
+}
+
+// Expand a bit plane back into a tile
+void unpackBinaryTile(const u32* bits, u8* tile) {
+    static u32 expand[16];
+    if (!expand[15]) {
+        for (int n = 0; n < 16; n++) {
+            for (int k = 0; k < 4; k++) {
+                if (n & (1 << k)) expand[n] |= 0xFFu << (k * 8);
+            }
+        }
+    }
+    
+    u32* words = (u32*)tile;
+    for (int i = 0; i < PACKED_TILE_WORDS; i++) {
+        u32 word = bits[i];
+        if (word == 0 || word == 0xFFFFFFFF) {
+            // Fully scratched or untouched run of 32 pixels
+            memset(&words[i * 8], word ? 255 : 0, 32);
+            continue;
+        }
+        for (int j = 0; j < 8; j++) {
+            words[i * 8 + j] = expand[(word >> (j * 4)) & 0xF];
+        }
+    }
+}
+
+// A new packed tile, unscratched (all set). NULL if out of memory
+u32* newPackedTile(void) {
+    u32* bits = (u32*)malloc(PACKED_TILE_BYTES);
+    if (bits) memset(bits, 0xFF, PACKED_TILE_BYTES);
+    return bits;
+}
+
+// Mask value of a packed tile if it is uniform (0 or 255), else -1
+int uniformPackedTile(const u32* bits) {
+    u32 first = bits[0];
+    if (first != 0 && first != 0xFFFFFFFF) return -1;
+    for (int i = 1; i < PACKED_TILE_WORDS; i++) {
+        if (bits[i] != first) return -1;
+    }
+    return first ? 255 : 0;
+}
+
+/**
+ * Set (255) or clear (0) count pixels of column x from row top down. In
+ * the column-major layout a column is 64 consecutive bits, so a span is
+ * at most three masked word writes.
+ */
+void writeTileBitColumn(u32* bits, int x, int top, int count, bool set) {
+#ifdef MASK_TILE_MORTON
+    for (int i = 0; i < count; i++) {
+        int index = TILE_COLUMN(x) + TILE_ROW(top + i);
+        if (set) {
+            bits[index >> 5] |= 1u << (index & 31);
+        } else {
+            bits[index >> 5] &= ~(1u << (index & 31));
+        }
+    }
+#else
+    int index = TILE_COLUMN(x) + top;
+    while (count > 0) {
+        int shift = index & 31;
+        int length = 32 - shift < count ? 32 - shift : count;
+        u32 span = (length == 32 ? 0xFFFFFFFF : (1u << length) - 1) << shift;
+        if (set) {
+            bits[index >> 5] |= span;
+        } else {
+            bits[index >> 5] &= ~span;
+        }
+        index += length;
+        count -= length;
+    }
+#endif
+}
+
+// Expand count pixels of column x from row top down into bytes, like readTileColumn
+void readTileBitColumn(const u32* bits, int x, int top, int count, u8* out) {
+    const int column = TILE_COLUMN(x);
+    for (int i = 0; i < count; i++) {
+        out[i] = tileBit(bits, column + TILE_ROW(top + i)) ? 255 : 0;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "canvas.h"
+
+#define PACKED_TILE_BYTES (TILE_PIXELS / 8)
+#define PACKED_TILE_WORDS (TILE_PIXELS / 32)
+
+// Bit of a packed tile for tile byte index i (TILE_COLUMN(x) + TILE_ROW(y)): set = 255
+static inline bool tileBit(const u32* bits, int i) {
+    return (bits[i >> 5] >> (i & 31)) & 1;
+}
+
+bool isBinaryTile(const u8* tile);
+u32* packBinaryTile(const u8* tile);
+void unpackBinaryTile(const u32* bits, u8* tile);
+u32* newPackedTile(void);
+int uniformPackedTile(const u32* bits);
+void writeTileBitColumn(u32* bits, int x, int top, int count, bool set);
+void readTileBitColumn(const u32* bits, int x, int top, int count, u8* out);
+
+#endif
@@ -0,0 +1,28 @@
+#include "rgb565.h"
+
+/**
+ * 16-BIT OUTPUT
+ * 
+ * The 16-bit display mode dithers with a 4x4 ordered (Bayer) pattern, so
+ * gradients and soft brush edges don't band. Over a 4x4 block a flat
+ * input averages out to its own value, and 0 and 255 stay exact. The
+ * compositor stores its pixels through ditherTo565 directly;
+ * convertTo565 is for frames that also need the BGR8 composite (GIF
+ * export).
+ */
+const u8 bayer4x4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+void convertTo565(u16* dest, const u8* src) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int i = x * 240 + (239 - y);
+            const u8* pixel = &src[i * 3];
+            dest[i] = ditherTo565(pixel[0], pixel[1], pixel[2], x, y);
+        }
+    }
+}
@@ -0,0 +1,28 @@
+/**
+ * Dithered RGB565 output for the 16-bit display mode (see rgb565.c). No
+ * libctru, so it builds and is tested on the host.
+ */
+#ifndef RGB565_H
+#define RGB565_H
+
+#include "canvas.h"
+
+extern const u8 bayer4x4[4][4];
+
+/**
+ * One BGR pixel at screen (x, y) to RGB565. Each channel is scaled so 255
+ * stays full, then a Bayer threshold below one output step is added
+ * before truncating.
+ */
+static inline u16 ditherTo565(int b, int g, int r, int x, int y) {
+    int d = bayer4x4[y & 3][x & 3];
+    b = b - (b >> 5) + (d >> 1);
+    g = g - (g >> 6) + (d >> 2);
+    r = r - (r >> 5) + (d >> 1);
+    return (u16)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+// Convert a BGR8 composite to RGB565, both in framebuffer layout
+void convertTo565(u16* dest, const u8* src);
+
+#endif
@@ -0,0 +1,81 @@
+#include "stabilizer.h"
+
+/**
+ * STROKE STABILIZER
+ * 
+ * Pulled-string ("lazy mouse") filter on touch samples. The brush trails
+ * the stylus on a string: it stays put until the stylus pulls the string
+ * tight, then moves straight toward the stylus by the slack. Touch jitter
+ * smaller than the string never reaches the canvas, and wobbles along a
+ * stroke are cut into smooth curves. String lengths are in screen pixels
+ * so the feel is the same at every zoom level; positions are subpixel
+ * fixed point throughout. When the stylus lifts, the brush catches up
+ * with the last touch so the stroke ends where the stylus left.
+ */
+const int stabilizerStringLength[STABILIZER_LEVELS] = {0, 3, 6, 12};  // Screen pixels
+
+static int stabilizedX = 0;
+static int stabilizedY = 0;
+
+// Integer square root (floor) of a 64-bit value
+static u32 isqrt64(u64 value) {
+    u64 root = 0;
+    u64 bit = (u64)1 << 62;
+    while (bit > value) bit >>= 2;
+    
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (u32)root;
+}
+
+// String length of a stabilizer level in subpixel canvas units at a zoom level
+int stabilizerLength(int level, int zoom) {
+    int length = stabilizerStringLength[level] << SUBPIXEL_SHIFT;
+    return (zoom < 0) ? length << 1 : length >> zoom;
+}
+
+// Start a stroke with the brush right under the stylus
+void stabilizerStart(int x, int y) {
+    stabilizedX = x;
+    stabilizedY = y;
+}
+
+/**
+ * Feed one touch sample (subpixel canvas coordinates) with the string
+ * length from stabilizerLength(). Returns true and the new brush position
+ * if the brush moved.
+ */
+bool stabilizerUpdate(int touchX, int touchY, int length, int* outX, int* outY) {
+    s64 dx = touchX - stabilizedX;
+    s64 dy = touchY - stabilizedY;
+    if (dx == 0 && dy == 0) return false;
+    
+    s64 distance2 = dx * dx + dy * dy;
+    if (distance2 <= (s64)length * length) return false;  // String still slack
+    
+    // Move toward the stylus until the string is exactly tight
+    s64 distance = isqrt64((u64)distance2);
+    if (distance <= length) return false;
+    s64 slack = distance - length;
+    stabilizedX += (int)((dx * slack) / distance);
+    stabilizedY += (int)((dy * slack) / distance);
+    
+    *outX = stabilizedX;
+    *outY = stabilizedY;
+    return true;
+}
+
+/**
+ * End a stroke at the last touch sample: the string goes slack to zero
+ * length. Returns true and the final brush position if the brush moved.
+ */
+bool stabilizerFinish(int touchX, int touchY, int* outX, int* outY) {
+    return stabilizerUpdate(touchX, touchY, 0, outX, outY);
+}
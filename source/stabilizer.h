@@ -0,0 +1,15 @@
+#ifndef STABILIZER_H
+#define STABILIZER_H
+
+#include "canvas.h"
+
+#define STABILIZER_LEVELS 4
+
+extern const int stabilizerStringLength[STABILIZER_LEVELS];
+
+int stabilizerLength(int level, int zoom);
+void stabilizerStart(int x, int y);
+bool stabilizerUpdate(int touchX, int touchY, int length, int* outX, int* outY);
+bool stabilizerFinish(int touchX, int touchY, int* outX, int* outY);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "stereo.h"
+
+/**
+ * STEREOSCOPIC RENDERING
+ * 
+ * Warp the 320x240 composite into a 400x240 top screen eye view, shifting
+ * every pixel horizontally by its own disparity from the depth map:
+ * disparity = depth / 255 * eyeOffset (rounded to whole pixels).
+ * 
+ * Occlusion is resolved without a z-buffer by visiting source pixels in
+ * painter's order: when two pixels land on the same target, the one that
+ * moved further is nearer, so pixels are written in the order that lets
+ * the nearer one overwrite (right to left for positive offsets).
+ * Targets that nothing landed on (disoccluded holes) are filled from the
+ * farther of their two neighbours, i.e. the background being revealed.
+ * 
+ * Rows are processed in strips of STEREO_STRIP so each framebuffer
+ * column is read and written as a short contiguous run. Exports warp one
+ * strip at a time into a strip buffer (renderStereoStrip), so they never
+ * hold whole eye views.
+ * 
+ * Pixels are pixelSize bytes: 3 for BGR8, 2 for RGB565 output.
+ */
+static inline void copyPixel(u8* dest, const u8* src, int pixelSize) {
+    dest[0] = src[0];
+    dest[1] = src[1];
+    if (pixelSize == 3) dest[2] = src[2];
+}
+
+// Fixed-point disparity table (1/16 pixel) rounded to whole pixels; true
+// when pixels move right, so the warp runs right to left
+static bool disparityTable(int* shift, float eyeOffset) {
+    int offset16 = (int)(eyeOffset * 16.0f);
+    for (int d = 0; d < 256; d++) {
+        shift[d] = ((d * offset16) / 255 + 8) >> 4;
+    }
+    return offset16 >= 0;
+}
+
+/**
+ * Warp rows [y0, y0 + rows) into dest, where eye pixel (x, y) is at
+ * x * columnStride + (y0 + rows - 1 - y). Targets nothing lands on are
+ * left as they are.
+ */
+static inline void warpStrip(u8* dest, int columnStride, const u8* src, const u8* depth, const int* shift,
+                             bool rightToLeft, int y0, int rows, int pixelSize) {
+    static s16 targetDepth[STEREO_STRIP][400];  // Depth written at each target (-1 = hole)
+    int startX = rightToLeft ? 319 : 0;
+    int stepX = rightToLeft ? -1 : 1;
+    int bottom = y0 + rows - 1;
+    
+    for (int row = 0; row < rows; row++) {
+        for (int t = 0; t < 400; t++) targetDepth[row][t] = -1;
+    }
+    
+    // Forward warp in painter's order
+    for (int i = 0, x = startX; i < 320; i++, x += stepX) {
+        for (int row = 0; row < rows; row++) {
+            int y = y0 + row;
+            int srcIdx = x * 240 + (239 - y);
+            int d = depth[srcIdx];
+            int dstX = x + 40 + shift[d];  // Center horizontally (40px border each side)
+            
+            if (dstX >= 0 && dstX < 400) {
+                copyPixel(&dest[(dstX * columnStride + (bottom - y)) * pixelSize], &src[srcIdx * pixelSize], pixelSize);
+                targetDepth[row][dstX] = d;
+            }
+        }
+    }
+    
+    // Fill holes inside the warped span of each row
+    for (int row = 0; row < rows; row++) {
+        int y = y0 + row;
+        s16* written = targetDepth[row];
+        int first = 0;
+        int last = 399;
+        while (first < 400 && written[first] < 0) first++;
+        while (last > first && written[last] < 0) last--;
+        
+        for (int t = first + 1; t < last; t++) {
+            if (written[t] >= 0) continue;
+            
+            int holeEnd = t;
+            while (written[holeEnd + 1] < 0) holeEnd++;
+            
+            // Reveal the background: take the farther neighbour
+            int fromX = (written[t - 1] <= written[holeEnd + 1]) ? t - 1 : holeEnd + 1;
+            const u8* fill = &dest[(fromX * columnStride + (bottom - y)) * pixelSize];
+            for (int h = t; h <= holeEnd; h++) {
+                copyPixel(&dest[(h * columnStride + (bottom - y)) * pixelSize], fill, pixelSize);
+            }
+            t = holeEnd;
+        }
+    }
+}
+
+void renderStereoEye(u8* dest, const u8* src, const u8* depth, float eyeOffset, int pixelSize) {
+    int shift[256];
+    bool rightToLeft = disparityTable(shift, eyeOffset);
+    
+    memset(dest, 0, 240 * 400 * pixelSize);  // Black bars on sides
+    for (int y0 = 0; y0 < 240; y0 += STEREO_STRIP) {
+        warpStrip(&dest[(240 - y0 - STEREO_STRIP) * pixelSize], 240, src, depth, shift, rightToLeft,
+                  y0, STEREO_STRIP, pixelSize);
+    }
+}
+
+void renderStereoStrip(u8* strip, const u8* src, const u8* depth, float eyeOffset, int y0, int rows, int pixelSize) {
+    int shift[256];
+    bool rightToLeft = disparityTable(shift, eyeOffset);
+    
+    memset(strip, 0, 400 * rows * pixelSize);
+    warpStrip(strip, rows, src, depth, shift, rightToLeft, y0, rows, pixelSize);
+}
+
+/**
+ * STEREO PAIR EXPORT
+ * 
+ * Strips of the shareable images, warped straight from the composite:
+ * a red/cyan anaglyph (red from the left eye, green and blue from the
+ * right) and a side-by-side pair (left eye on the left). A strip is rows
+ * [y0, y0 + rows) of every column, bottom row first, stored column after
+ * column, as renderStereoStrip writes them.
+ * 
+ * The anaglyph mix is done a word at a time: four BGR pixels span three
+ * words, and the red bytes sit at fixed positions within them. Pixels
+ * before the first whole word and after the last one are mixed singly.
+ */
+
+// Red byte positions of four BGR pixels packed into three little-endian words
+static const u32 anaglyphRedMask[3] = {0x00FF0000, 0x0000FF00, 0xFF0000FF};
+
+static inline void mixAnaglyphPixel(u8* out, const u8* left, const u8* right) {
+    out[0] = right[0];
+    out[1] = right[1];
+    out[2] = left[2];
+}
+
+void mixAnaglyph(u8* out, const u8* left, const u8* right, int count) {
+    // Word-wide only when all three are at the same offset within a word;
+    // a pixel is 3 bytes, so after at most 3 single pixels they line up
+    bool inStep = (((uintptr_t)out ^ (uintptr_t)left) & 3) == 0 &&
+                  (((uintptr_t)out ^ (uintptr_t)right) & 3) == 0;
+    int head = 0;
+    while (inStep && head < count && (((uintptr_t)out + head * 3) & 3)) head++;
+    int words = inStep ? (count - head) / 4 : 0;
+    if (!inStep) head = count;
+    
+    for (int i = 0; i < head; i++) {
+        mixAnaglyphPixel(&out[i * 3], &left[i * 3], &right[i * 3]);
+    }
+    
+    u32* outWords = (u32*)&out[head * 3];
+    const u32* leftWords = (const u32*)&left[head * 3];
+    const u32* rightWords = (const u32*)&right[head * 3];
+    for (int i = 0; i < words * 3; i++) {
+        u32 mask = anaglyphRedMask[i % 3];
+        outWords[i] = (leftWords[i] & mask) | (rightWords[i] & ~mask);
+    }
+    
+    for (int i = head + words * 4; i < count; i++) {
+        mixAnaglyphPixel(&out[i * 3], &left[i * 3], &right[i * 3]);
+    }
+}
+
+void buildAnaglyphStrip(u8* out, u8* rightStrip, const u8* composite, const u8* depth, float eyeOffset,
+                        int y0, int rows) {
+    renderStereoStrip(out, composite, depth, 0.0f, y0, rows, 3);
+    renderStereoStrip(rightStrip, composite, depth, eyeOffset, y0, rows, 3);
+    mixAnaglyph(out, out, rightStrip, 400 * rows);
+}
+
+void buildSideBySideStrip(u8* out, const u8* composite, const u8* depth, float eyeOffset, int y0, int rows) {
+    renderStereoStrip(out, composite, depth, 0.0f, y0, rows, 3);
+    renderStereoStrip(&out[400 * rows * 3], composite, depth, eyeOffset, y0, rows, 3);
+}
@@ -0,0 +1,29 @@
+/**
+ * Top screen eye views warped from the composite and its depth map
+ * (see stereo.c). No libctru, so it builds and is tested on the host.
+ */
+#ifndef STEREO_H
+#define STEREO_H
+
+#include "canvas.h"
+
+#define STEREO_STRIP 8   // Rows warped together
+
+// Warp a 320x240 composite into a 400x240 eye view (framebuffer layout)
+void renderStereoEye(u8* dest, const u8* src, const u8* depth, float eyeOffset, int pixelSize);
+
+// The same for rows [y0, y0 + rows) only (rows <= STEREO_STRIP): each of
+// the 400 columns of the strip holds its rows bottom first
+void renderStereoStrip(u8* strip, const u8* src, const u8* depth, float eyeOffset, int y0, int rows, int pixelSize);
+
+// Red/cyan mix of count BGR pixels: red from left, green and blue from right
+void mixAnaglyph(u8* out, const u8* left, const u8* right, int count);
+
+// Export strips of the left (offset 0) and right eye views of a BGR8
+// composite, in renderStereoStrip's layout (the side-by-side strip is 800
+// wide); the anaglyph warps the right eye into rightStrip on the way
+void buildAnaglyphStrip(u8* out, u8* rightStrip, const u8* composite, const u8* depth, float eyeOffset,
+                        int y0, int rows);
+void buildSideBySideStrip(u8* out, const u8* composite, const u8* depth, float eyeOffset, int y0, int rows);
+
+#endif
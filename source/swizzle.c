@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include "swizzle.h"
+#include "packed.h"
+
+/**
+ * TEXTURE SWIZZLING
+ * 
+ * PICA200 textures are stored as 8x8 texel tiles, row by row, with the
+ * texels of a tile in Morton (Z) order: bits x0 y0 x1 y1 x2 y2 of the
+ * index. The GPU compositing path keeps each scratchable mask in an A8
+ * atlas of ATLAS_SLOTS x ATLAS_SLOTS canvas tiles: canvas tile (x, y)
+ * lives in slot (x % ATLAS_SLOTS, y % ATLAS_SLOTS), and a slot is copied
+ * again only when another tile scrolls into it or its tile is flagged
+ * TILE_DIRTY_TEXTURE.
+ * 
+ * Nothing here touches the GPU: flushing the written slots from the data
+ * cache is up to the caller.
+ */
+
+/**
+ * Swizzle one 8x8 block of bytes, where byte (x, y) of the block is
+ * source[x * columnStride + y * rowStride]. Morton order visits 2x2
+ * quads in turn, so the block is written as 16 quads of 4 bytes.
+ */
+void swizzleBlock(const u8* source, int columnStride, int rowStride, u8* block) {
+    for (int quad = 0; quad < 16; quad++) {
+        int x = ((quad & 1) | ((quad >> 1) & 2)) << 1;
+        int y = (((quad >> 1) & 1) | ((quad >> 2) & 2)) << 1;
+        const u8* corner = source + x * columnStride + y * rowStride;
+        block[0] = corner[0];
+        block[1] = corner[columnStride];
+        block[2] = corner[rowStride];
+        block[3] = corner[columnStride + rowStride];
+        block += 4;
+    }
+}
+
+// Inverse of swizzleBlock: scatter a Morton-ordered block back to strided bytes
+void unswizzleBlock(const u8* block, u8* dest, int columnStride, int rowStride) {
+    for (int quad = 0; quad < 16; quad++) {
+        int x = ((quad & 1) | ((quad >> 1) & 2)) << 1;
+        int y = (((quad >> 1) & 1) | ((quad >> 2) & 2)) << 1;
+        u8* corner = dest + x * columnStride + y * rowStride;
+        corner[0] = block[0];
+        corner[columnStride] = block[1];
+        corner[rowStride] = block[2];
+        corner[columnStride + rowStride] = block[3];
+        block += 4;
+    }
+}
+
+/**
+ * Convert a tile between column-major bytes and the MASK_TILE_MORTON
+ * layout (8x8 blocks row by row, each block swizzled).
+ */
+void swizzleTile(const u8* columns, u8* tile) {
+    for (int blockY = 0; blockY < TILE_SIZE / 8; blockY++) {
+        for (int blockX = 0; blockX < TILE_SIZE / 8; blockX++) {
+            swizzleBlock(&columns[blockX * 8 * TILE_SIZE + blockY * 8], TILE_SIZE, 1,
+                         &tile[(blockY * (TILE_SIZE / 8) + blockX) * 64]);
+        }
+    }
+}
+
+void unswizzleTile(const u8* tile, u8* columns) {
+    for (int blockY = 0; blockY < TILE_SIZE / 8; blockY++) {
+        for (int blockX = 0; blockX < TILE_SIZE / 8; blockX++) {
+            unswizzleBlock(&tile[(blockY * (TILE_SIZE / 8) + blockX) * 64],
+                           &columns[blockX * 8 * TILE_SIZE + blockY * 8], TILE_SIZE, 1);
+        }
+    }
+}
+
+// Row blockY of texture tiles in an atlas slot (ATLAS_RUN_BYTES contiguous bytes)
+u8* atlasSlotRun(u8* atlas, int slotX, int slotY, int blockY) {
+    int rowBlock = (slotY * TILE_SIZE / 8 + blockY) * (ATLAS_SIZE / 8) + slotX * TILE_SIZE / 8;
+    return &atlas[rowBlock * 64];
+}
+
+/**
+ * Swizzle a mask tile (NULL = unscratched) into its slot of an A8 atlas.
+ * The slot's texture tiles in each row of them are contiguous, so the
+ * slot is written as TILE_SIZE / 8 runs. Morton tiles already hold each
+ * run in order and are copied.
+ */
+void swizzleMaskTile(const u8* tile, u8* atlas, int slotX, int slotY) {
+    for (int blockY = 0; blockY < TILE_SIZE / 8; blockY++) {
+        u8* run = atlasSlotRun(atlas, slotX, slotY, blockY);
+        if (!tile) {
+            memset(run, 255, ATLAS_RUN_BYTES);
+            continue;
+        }
+#ifdef MASK_TILE_MORTON
+        memcpy(run, &tile[blockY * ATLAS_RUN_BYTES], ATLAS_RUN_BYTES);
+#else
+        for (int blockX = 0; blockX < TILE_SIZE / 8; blockX++) {
+            swizzleBlock(&tile[blockX * 8 * TILE_SIZE + blockY * 8], TILE_SIZE, 1, &run[blockX * 64]);
+        }
+#endif
+    }
+}
+
+// Forget which tiles an atlas holds (-1 in every slot)
+void clearAtlasSlots(s16* slotTile) {
+    memset(slotTile, 0xFF, ATLAS_SLOTS * ATLAS_SLOTS * sizeof(s16));
+}
+
+/**
+ * Bring the atlas up to date for canvas tiles [firstX, lastX] x
+ * [firstY, lastY] of a layer (its mask tiles, packed tiles if any, and
+ * tileDirty row): swizzle each tile its slot doesn't hold yet or that
+ * changed since, and clear its TILE_DIRTY_TEXTURE flag. The indices
+ * (slotY * ATLAS_SLOTS + slotX) of the slots written go to written, which
+ * needs room for every tile of the range. Returns how many there are.
+ */
+int updateAtlasSlots(s16* slotTile, u8* atlas, u8* const* tiles, u32* const* bits, u8* dirty,
+                     int firstX, int firstY, int lastX, int lastY, u16* written) {
+    static u8 expanded[TILE_PIXELS];
+    int count = 0;
+    for (int tileY = firstY; tileY <= lastY; tileY++) {
+        for (int tileX = firstX; tileX <= lastX; tileX++) {
+            int tileIndex = tileY * CANVAS_TILES_X + tileX;
+            int slot = (tileY % ATLAS_SLOTS) * ATLAS_SLOTS + tileX % ATLAS_SLOTS;
+            if (slotTile[slot] == tileIndex && !(dirty[tileIndex] & TILE_DIRTY_TEXTURE)) continue;
+            
+            const u8* tile = tiles[tileIndex];
+            if (bits && bits[tileIndex]) {
+                unpackBinaryTile(bits[tileIndex], expanded);
+                tile = expanded;
+            }
+            swizzleMaskTile(tile, atlas, slot % ATLAS_SLOTS, slot / ATLAS_SLOTS);
+            dirty[tileIndex] &= ~TILE_DIRTY_TEXTURE;
+            slotTile[slot] = tileIndex;
+            written[count++] = slot;
+        }
+    }
+    return count;
+}
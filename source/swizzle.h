@@ -0,0 +1,21 @@
+#ifndef SWIZZLE_H
+#define SWIZZLE_H
+
+#include "canvas.h"
+
+#define ATLAS_SLOTS 16                           // Mask atlas of 16x16 tiles (1024x1024)
+#define ATLAS_SIZE (ATLAS_SLOTS * TILE_SIZE)
+#define ATLAS_RUN_BYTES (TILE_SIZE * 8)          // A row of texture tiles across one slot
+
+void swizzleBlock(const u8* source, int columnStride, int rowStride, u8* block);
+void unswizzleBlock(const u8* block, u8* dest, int columnStride, int rowStride);
+void swizzleTile(const u8* columns, u8* tile);
+void unswizzleTile(const u8* tile, u8* columns);
+void swizzleMaskTile(const u8* tile, u8* atlas, int slotX, int slotY);
+u8* atlasSlotRun(u8* atlas, int slotX, int slotY, int blockY);
+
+void clearAtlasSlots(s16* slotTile);
+int updateAtlasSlots(s16* slotTile, u8* atlas, u8* const* tiles, u32* const* bits, u8* dirty,
+                     int firstX, int firstY, int lastX, int lastY, u16* written);
+
+#endif
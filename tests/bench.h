@@ -0,0 +1,21 @@
+/**
+ * Timing for the host benchmarks. Host numbers only compare variants
+ * with each other; the 3DS's ARM11 is many times slower.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <time.h>
+
+#define FRAME_BUDGET_MS (1000.0 / 60.0)
+
+static inline double benchNow(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Keeps the optimizer from dropping work whose result is never read
+static volatile unsigned benchSink;
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * Flood fill timing on full-screen regions, including the patterns with
+ * the most spans per column, with the normal seed stack and (as
+ * bench_fill_stack8) with an 8-entry stack that keeps overflowing.
+ */
+#include <stdio.h>
+
+#include "fill.h"
+#include "fill_patterns.h"
+#include "bench.h"
+
+#define RUNS 200
+
+static u8 composite[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+
+int main(void) {
+#ifdef FILL_STACK_SIZE
+    int stackSize = FILL_STACK_SIZE;
+#else
+    int stackSize = 4096;
+#endif
+    for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+        makePatternComposite(composite, pattern);
+        int filled = 0;
+        double start = benchNow();
+        for (int i = 0; i < RUNS; i++) {
+            filled = floodFillRegion(composite, 0, 0);
+        }
+        double fill = (benchNow() - start) / RUNS;
+        printf("fill, %4d-entry stack, %-13s: %6d pixels, %2d rescans, %.3f ms (%.1f%% of a 60 fps frame)\n",
+               stackSize, patternNames[pattern], filled, fillRescans, fill, fill * 100.0 / FRAME_BUDGET_MS);
+    }
+    return 0;
+}
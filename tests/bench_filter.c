@@ -0,0 +1,71 @@
+/**
+ * Mask filter timing in the worst case, where every tile of the canvas is
+ * scratched and has to be filtered: all 8-bit (soft brushes) and all
+ * packed (hard brushes). Reports the whole canvas, one tile, and the
+ * FILTER_TILES_PER_FRAME slice main.c runs each frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "filter.h"
+#include "packed.h"
+#include "test.h"
+#include "bench.h"
+
+#define RUNS 3
+
+static u8* tiles[CANVAS_TILE_COUNT];
+static u32* bits[CANVAS_TILE_COUNT];
+static u16 pending[CANVAS_TILE_COUNT];
+static u8 out[TILE_PIXELS];
+
+static void clearTiles(void) {
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        free(tiles[i]);
+        free(bits[i]);
+        tiles[i] = NULL;
+        bits[i] = NULL;
+    }
+}
+
+static void run(const char* name, MaskFilter filter) {
+    int count = 0;
+    double start = benchNow();
+    for (int r = 0; r < RUNS; r++) {
+        count = findFilterTiles(tiles, bits, pending);
+        for (int i = 0; i < count; i++) {
+            filterMaskTile(tiles, bits, pending[i], filter, out);
+            benchSink += out[i & TILE_MASK];
+        }
+    }
+    double total = (benchNow() - start) / RUNS;
+    double tile = total / count;
+    printf("%-16s %4d tiles: %.1f ms, %.1f us a tile, %d a frame %.2f ms (%.1f%% of a 60 fps frame), %d frames\n",
+           name, count, total, tile * 1e3, FILTER_TILES_PER_FRAME, tile * FILTER_TILES_PER_FRAME,
+           tile * FILTER_TILES_PER_FRAME * 100.0 / FRAME_BUDGET_MS,
+           (count + FILTER_TILES_PER_FRAME - 1) / FILTER_TILES_PER_FRAME);
+}
+
+int main(void) {
+    unsigned seed = 70;
+
+    // Soft strokes everywhere: no tile is uniform
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        tiles[i] = malloc(TILE_PIXELS);
+        for (int p = 0; p < TILE_PIXELS; p++) tiles[i][p] = testRandom(&seed);
+    }
+    run("soften, 8-bit", FILTER_SOFTEN);
+    run("sharpen, 8-bit", FILTER_SHARPEN);
+
+    // Hard strokes everywhere
+    clearTiles();
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        u8 tile[TILE_PIXELS];
+        for (int p = 0; p < TILE_PIXELS; p++) tile[p] = (testRandom(&seed) & 64) ? 255 : 0;
+        bits[i] = packBinaryTile(tile);
+    }
+    run("soften, packed", FILTER_SOFTEN);
+    run("sharpen, packed", FILTER_SHARPEN);
+    clearTiles();
+    return 0;
+}
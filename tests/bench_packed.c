@@ -0,0 +1,170 @@
+/**
+ * Packed mask tiles: the compositor's per-pixel front-to-back blend over
+ * 8-bit hard-brush masks against picking the visible layer a word of 32
+ * rows at a time from the same masks packed, at 1:1 over a full screen
+ * with three layers. Both produce the same pixels (checked). Also times
+ * packing and expanding a tile (undo saves, the soft-brush fallback).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packed.h"
+#include "test.h"
+#include "bench.h"
+
+#define RUNS 50
+#define LAYERS 3
+#define VIEW_TILES_X (SCREEN_WIDTH / TILE_SIZE)
+#define VIEW_TILES_Y ((SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+#define VIEW_TILES (VIEW_TILES_X * VIEW_TILES_Y)
+
+static u8 images[LAYERS][SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u8 depths[LAYERS] = {0, 128, 255};
+static u8 tiles[LAYERS - 1][VIEW_TILES][TILE_PIXELS];
+static u32* bits[LAYERS - 1][VIEW_TILES];
+static u8 dest[SCREEN_WIDTH * SCREEN_HEIGHT * 3], destDepth[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u8 expected[SCREEN_WIDTH * SCREEN_HEIGHT * 3], expectedDepth[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+// Hard round dabs scratched to 0 over an unscratched mask
+static void scratchDabs(u8 (*mask)[TILE_PIXELS], int dabs, unsigned* seed) {
+    for (int i = 0; i < VIEW_TILES; i++) memset(mask[i], 255, TILE_PIXELS);
+    for (int d = 0; d < dabs; d++) {
+        int cx = testRandom(seed) % SCREEN_WIDTH, cy = testRandom(seed) % SCREEN_HEIGHT;
+        int r = 4 + testRandom(seed) % 20;
+        for (int x = cx - r; x <= cx + r; x++) {
+            for (int y = cy - r; y <= cy + r; y++) {
+                if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) continue;
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) > r * r) continue;
+                mask[(y >> TILE_SHIFT) * VIEW_TILES_X + (x >> TILE_SHIFT)][TILE_COLUMN(x & TILE_MASK) + TILE_ROW(y & TILE_MASK)] = 0;
+            }
+        }
+    }
+}
+
+static inline void putPixel(int x, int y, int layer) {
+    int maskIdx = x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y);
+    const u8* src = &images[layer][maskIdx * 3];
+    destDepth[maskIdx] = depths[layer];
+    dest[maskIdx * 3 + 0] = src[0];
+    dest[maskIdx * 3 + 1] = src[1];
+    dest[maskIdx * 3 + 2] = src[2];
+}
+
+// The compositor's general path: weights, stopping at the first opaque layer
+static void composite8bit(void) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int tileIndex = (y >> TILE_SHIFT) * VIEW_TILES_X + (x >> TILE_SHIFT);
+            int sampleIdx = TILE_COLUMN(x & TILE_MASK) + TILE_ROW(y & TILE_MASK);
+            int maskIdx = x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y);
+            int remaining = 255;
+            int sumB = 0, sumG = 0, sumR = 0, sumDepth = 0;
+            int layer;
+            for (layer = 0; layer < LAYERS - 1; layer++) {
+                int alpha = tiles[layer][tileIndex][sampleIdx];
+                if (alpha == 255) break;
+                if (alpha > 0) {
+                    const u8* src = &images[layer][maskIdx * 3];
+                    int weight = remaining * alpha;
+                    sumB += src[0] * weight;
+                    sumG += src[1] * weight;
+                    sumR += src[2] * weight;
+                    sumDepth += depths[layer] * weight;
+                }
+                remaining = remaining * (255 - alpha) / 255;
+                if (remaining == 0) break;
+            }
+            if (remaining > 0) {
+                const u8* src = &images[layer][maskIdx * 3];
+                int weight = remaining * 255;
+                sumB += src[0] * weight;
+                sumG += src[1] * weight;
+                sumR += src[2] * weight;
+                sumDepth += depths[layer] * weight;
+            }
+            destDepth[maskIdx] = sumDepth / (255 * 255);
+            dest[maskIdx * 3 + 0] = sumB / (255 * 255);
+            dest[maskIdx * 3 + 1] = sumG / (255 * 255);
+            dest[maskIdx * 3 + 2] = sumR / (255 * 255);
+        }
+    }
+}
+
+// The packed path: each layer claims the still pending rows whose bit is set
+static void compositePacked(void) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int tileY = 0; tileY < VIEW_TILES_Y; tileY++) {
+            int tileIndex = tileY * VIEW_TILES_X + (x >> TILE_SHIFT);
+            int top = tileY << TILE_SHIFT;
+            int bottom = top + TILE_SIZE < SCREEN_HEIGHT ? top + TILE_SIZE : SCREEN_HEIGHT;
+            for (int y = top; y < bottom; y += 32) {
+                int count = bottom - y < 32 ? bottom - y : 32;
+                int word = (TILE_COLUMN(x & TILE_MASK) + (y & TILE_MASK)) >> 5;
+                u32 pending = count == 32 ? 0xFFFFFFFF : (1u << count) - 1;
+                for (int layer = 0; layer < LAYERS; layer++) {
+                    u32 shown = layer < LAYERS - 1 ? pending & bits[layer][tileIndex][word] : pending;
+                    pending &= ~shown;
+                    while (shown) {
+                        putPixel(x, y + __builtin_ctz(shown), layer);
+                        shown &= shown - 1;
+                    }
+                    if (!pending) break;
+                }
+            }
+        }
+    }
+}
+
+static double timeKernel(void (*kernel)(void)) {
+    kernel();
+    double start = benchNow();
+    for (int i = 0; i < RUNS; i++) kernel();
+    return (benchNow() - start) / RUNS;
+}
+
+static void packAll(void) {
+    for (int i = 0; i < VIEW_TILES; i++) {
+        u32* packed = packBinaryTile(tiles[0][i]);
+        benchSink += packed[0];
+        free(packed);
+    }
+}
+
+static void unpackAll(void) {
+    for (int i = 0; i < VIEW_TILES; i++) unpackBinaryTile(bits[0][i], tiles[0][i]);
+}
+
+int main(void) {
+    unsigned seed = 71;
+    for (int layer = 0; layer < LAYERS; layer++) {
+        for (int i = 0; i < (int)sizeof(images[layer]); i++) images[layer][i] = testRandom(&seed);
+    }
+
+    static const int dabCounts[] = {0, 40, 400};
+    for (int d = 0; d < (int)(sizeof(dabCounts) / sizeof(dabCounts[0])); d++) {
+        for (int layer = 0; layer < LAYERS - 1; layer++) {
+            scratchDabs(tiles[layer], dabCounts[d] / (layer + 1), &seed);
+            for (int i = 0; i < VIEW_TILES; i++) {
+                free(bits[layer][i]);
+                bits[layer][i] = packBinaryTile(tiles[layer][i]);
+            }
+        }
+
+        double time8 = timeKernel(composite8bit);
+        memcpy(expected, dest, sizeof(dest));
+        memcpy(expectedDepth, destDepth, sizeof(destDepth));
+        double timePacked = timeKernel(compositePacked);
+        bool same = memcmp(expected, dest, sizeof(dest)) == 0 && memcmp(expectedDepth, destDepth, sizeof(destDepth)) == 0;
+
+        printf("composite, %3d dabs: 8-bit %.3f ms, packed %.3f ms (%.1fx)%s\n", dabCounts[d],
+               time8, timePacked, time8 / timePacked, same ? "" : "  OUTPUT DIFFERS");
+        if (!same) return 1;
+    }
+
+    double pack = timeKernel(packAll) / VIEW_TILES;
+    double unpack = timeKernel(unpackAll) / VIEW_TILES;
+    printf("per tile: pack %.2f us, expand %.2f us; %d bytes packed vs %d\n",
+           pack * 1e3, unpack * 1e3, PACKED_TILE_BYTES, TILE_PIXELS);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * The CPU side of a canvas frame in the 24-bit and the dithered 16-bit
+ * display modes: the compositor's stores (modelled as a copy of one
+ * layer, the cheapest composite, so the stores weigh the most), both
+ * eye warps, and the copies of the bottom screen and both eyes into the
+ * framebuffers. In 16-bit mode the compositor dithers as it stores, like
+ * main.c; the separate convertTo565 pass (GIF export) is timed too.
+ * The copies are GX DMA on the 3DS and memcpy here, and the host caches
+ * hide most of the bandwidth, so the bytes each frame writes are printed
+ * alongside the times.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "stereo.h"
+#include "rgb565.h"
+#include "bench.h"
+#include "test.h"
+
+#define FRAMES 300
+
+static u8 layer[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u8 composite[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u16 composite565[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u8 depth[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u8 left[400 * SCREEN_HEIGHT * 3], right[400 * SCREEN_HEIGHT * 3];
+static u8 fbBottom[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u8 fbLeft[400 * SCREEN_HEIGHT * 3], fbRight[400 * SCREEN_HEIGHT * 3];
+
+// The compositor's visiting order and stores, as in compositeViewport
+static void compositeLayer(bool rgb565) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int i = x * 240 + (239 - y);
+            const u8* pixel = &layer[i * 3];
+            if (rgb565) {
+                composite565[i] = ditherTo565(pixel[0], pixel[1], pixel[2], x, y);
+            } else {
+                composite[i * 3 + 0] = pixel[0];
+                composite[i * 3 + 1] = pixel[1];
+                composite[i * 3 + 2] = pixel[2];
+            }
+        }
+    }
+}
+
+static void frame(bool rgb565) {
+    compositeLayer(rgb565);
+    const u8* src = rgb565 ? (const u8*)composite565 : composite;
+    int pixelSize = rgb565 ? 2 : 3;
+    memcpy(fbBottom, src, SCREEN_WIDTH * SCREEN_HEIGHT * pixelSize);
+    renderStereoEye(left, src, depth, 0.0f, pixelSize);
+    memcpy(fbLeft, left, 400 * SCREEN_HEIGHT * pixelSize);
+    renderStereoEye(right, src, depth, 3.0f, pixelSize);
+    memcpy(fbRight, right, 400 * SCREEN_HEIGHT * pixelSize);
+}
+
+static double timeFrames(bool rgb565) {
+    frame(rgb565);
+    double start = benchNow();
+    for (int f = 0; f < FRAMES; f++) {
+        frame(rgb565);
+        benchSink += fbLeft[f] + fbRight[f];
+    }
+    return (benchNow() - start) / FRAMES;
+}
+
+int main(void) {
+    unsigned seed = 74;
+    for (int i = 0; i < (int)sizeof(layer); i++) layer[i] = testRandom(&seed);
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) depth[x * SCREEN_HEIGHT + y] = ((x / 40 + y / 40) % 3) * 127;
+    }
+    
+    double time8 = timeFrames(false);
+    double time565 = timeFrames(true);
+    int pixels = 2 * SCREEN_WIDTH * SCREEN_HEIGHT + 4 * 400 * SCREEN_HEIGHT;  // Composite, bottom, eyes and their copies
+    printf("frame: 24-bit %.3f ms, %d KB written; 16-bit dithered in the compositor %.3f ms, %d KB written (%.2fx)\n",
+           time8, pixels * 3 / 1024, time565, pixels * 2 / 1024, time8 / time565);
+    
+    double start = benchNow();
+    for (int f = 0; f < FRAMES; f++) {
+        convertTo565(composite565, layer);
+        benchSink += composite565[f];
+    }
+    printf("convertTo565 on its own (GIF export frames): %.3f ms\n", (benchNow() - start) / FRAMES);
+    return 0;
+}
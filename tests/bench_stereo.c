@@ -0,0 +1,49 @@
+/**
+ * Both eye views per frame (what the top screen needs at 60 fps), on a
+ * composite with a mix of layer depths and soft edges between them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stereo.h"
+#include "bench.h"
+#include "test.h"
+
+#define FRAMES 500
+
+static u8 composite[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u8 depth[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u8 left[400 * SCREEN_HEIGHT * 3];
+static u8 right[400 * SCREEN_HEIGHT * 3];
+
+int main(void) {
+    unsigned seed = 3;
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT * 3; i++) composite[i] = testRandom(&seed);
+    
+    // Blobs of the three layer depths with feathered edges
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int cell = ((x / 40) + (y / 40) * 3) % 3;
+            int edge = abs(x % 40 - 20) + abs(y % 40 - 20);
+            int d = cell * 127;
+            if (edge > 30) d = d * (40 - edge) / 10;
+            depth[x * SCREEN_HEIGHT + y] = d;
+        }
+    }
+    
+    static const float offsets[] = {3.0f, 15.0f};
+    for (int pixelSize = 3; pixelSize >= 2; pixelSize--) {
+        for (int i = 0; i < 2; i++) {
+            double start = benchNow();
+            for (int f = 0; f < FRAMES; f++) {
+                renderStereoEye(left, composite, depth, 0.0f, pixelSize);
+                renderStereoEye(right, composite, depth, offsets[i], pixelSize);
+                benchSink += left[f] + right[f];
+            }
+            double frame = (benchNow() - start) / FRAMES;
+            printf("stereo, %d-byte pixels, offset %4.1f: both eyes %.3f ms/frame (%.1f%% of a 60 fps frame)\n",
+                   pixelSize, offsets[i], frame, frame * 100.0 / FRAME_BUDGET_MS);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * Mask tile layout: the app's mask access patterns on column-major tiles
+ * and (as bench_tiles_morton) on Morton tiles in GPU texture order.
+ * Each kernel is timed on the host and replayed through a model of the
+ * 3DS's L1 data cache (16 KB, 4-way, 32-byte lines; LRU replacement
+ * stands in for the ARM11's round-robin), counting mask and atlas
+ * accesses only.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "swizzle.h"
+#include "test.h"
+#include "bench.h"
+
+#define RUNS 50
+#define VIEW_TILES_X 12          // Enough tiles for the zoomed-out view (640x480)
+#define VIEW_TILES_Y 10
+#define LAYERS 2                 // Scratchable layers sampled per pixel
+
+#define CACHE_LINE 32
+#define CACHE_WAYS 4
+#define CACHE_SETS (16384 / CACHE_LINE / CACHE_WAYS)
+
+static u8 tileArena[LAYERS][VIEW_TILES_Y * VIEW_TILES_X][TILE_PIXELS] __attribute__((aligned(CACHE_LINE)));
+static u8 atlas[ATLAS_SIZE * ATLAS_SIZE] __attribute__((aligned(CACHE_LINE)));
+
+static uintptr_t cacheTag[CACHE_SETS][CACHE_WAYS];
+static unsigned cacheAge[CACHE_SETS][CACHE_WAYS];
+static unsigned cacheClock;
+static unsigned long cacheAccesses, cacheMisses;
+
+static void cacheReset(void) {
+    memset(cacheTag, 0, sizeof(cacheTag));
+    memset(cacheAge, 0, sizeof(cacheAge));
+    cacheAccesses = cacheMisses = 0;
+}
+
+static void cacheTouch(const void* address) {
+    uintptr_t line = (uintptr_t)address / CACHE_LINE + 1;  // 0 marks an empty way
+    int set = line % CACHE_SETS;
+    int victim = 0;
+    cacheAccesses++;
+    cacheClock++;
+    for (int way = 0; way < CACHE_WAYS; way++) {
+        if (cacheTag[set][way] == line) {
+            cacheAge[set][way] = cacheClock;
+            return;
+        }
+        if (cacheAge[set][way] < cacheAge[set][victim]) victim = way;
+    }
+    cacheMisses++;
+    cacheTag[set][victim] = line;
+    cacheAge[set][victim] = cacheClock;
+}
+
+#define TOUCH(p) do { if (simulate) cacheTouch(p); } while (0)
+
+static inline u8* viewTile(int layer, int tileX, int tileY) {
+    return tileArena[layer][tileY * VIEW_TILES_X + tileX];
+}
+
+/**
+ * The compositor's mask reads: screen columns outer, rows inner, every
+ * layer's sample per pixel; zoomed out, each sample is a 2x2 box.
+ */
+static inline unsigned composite(bool zoomedOut, bool simulate) {
+    int step = zoomedOut ? 2 : 1;
+    int originX = 32, originY = 16;   // Not tile aligned, like most views
+    unsigned sum = 0;
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        int canvasX = originX + x * step;
+        int tileColumn = TILE_COLUMN(canvasX & TILE_MASK);
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int canvasY = originY + y * step;
+            int sampleIdx = tileColumn + TILE_ROW(canvasY & TILE_MASK);
+            for (int layer = 0; layer < LAYERS; layer++) {
+                const u8* sample = &viewTile(layer, canvasX >> TILE_SHIFT, canvasY >> TILE_SHIFT)[sampleIdx];
+                TOUCH(sample);
+                if (zoomedOut) {
+                    TOUCH(&sample[TILE_NEXT_X + TILE_NEXT_Y]);
+                    sum += (sample[0] + sample[TILE_NEXT_Y] + sample[TILE_NEXT_X] + sample[TILE_NEXT_X + TILE_NEXT_Y] + 2) >> 2;
+                } else {
+                    sum += sample[0];
+                }
+            }
+        }
+    }
+    return sum;
+}
+
+/**
+ * The segment rasterizer's writes: a round brush of radius 12 dragged
+ * diagonally across the view, each column of its footprint lowered a row
+ * at a time.
+ */
+static inline void scratchStroke(bool simulate) {
+    const int radius = 12;
+    for (int dab = 0; dab < 200; dab++) {
+        int centerX = 40 + dab * 2, centerY = 30 + dab;
+        for (int px = centerX - radius; px <= centerX + radius; px++) {
+            int dx = px - centerX;
+            int half = 0;
+            while ((half + 1) * (half + 1) + dx * dx <= radius * radius) half++;
+            u8* tile = NULL;
+            for (int py = centerY - half; py <= centerY + half; py++) {
+                if (!tile || (py & TILE_MASK) == 0) tile = viewTile(0, px >> TILE_SHIFT, py >> TILE_SHIFT);
+                u8* pixel = &tile[TILE_COLUMN(px & TILE_MASK) + TILE_ROW(py & TILE_MASK)];
+                TOUCH(pixel);
+                int coverage = (dx * dx + (py - centerY) * (py - centerY)) * 255 / (radius * radius);
+                if (coverage < *pixel) *pixel = coverage;
+            }
+        }
+    }
+}
+
+/**
+ * The stamp brushes: a 33x33 image blended one column span per tile,
+ * gathered and scattered around the span blend in the Morton layout.
+ */
+static inline void stampStroke(bool simulate) {
+    static u8 stamp[33 * 33];
+    for (int i = 0; i < 33 * 33; i++) stamp[i] = (i * 37) & 0xFF;
+    for (int dab = 0; dab < 200; dab++) {
+        int left = 40 + dab * 2, top = 30 + dab;
+        for (int px = left; px < left + 33; px++) {
+            int py = top;
+            while (py < top + 33) {
+                int count = TILE_SIZE - (py & TILE_MASK);
+                if (count > top + 33 - py) count = top + 33 - py;
+                u8* tile = viewTile(0, px >> TILE_SHIFT, py >> TILE_SHIFT);
+                const u8* image = &stamp[(px - left) * 33 + (py - top)];
+                u8 span[TILE_SIZE];
+                readTileColumn(tile, px & TILE_MASK, py & TILE_MASK, count, span);
+                for (int i = 0; i < count; i++) {
+                    TOUCH(&tile[TILE_COLUMN(px & TILE_MASK) + TILE_ROW((py + i) & TILE_MASK)]);
+                    if (image[i] < span[i]) span[i] = image[i];
+                }
+                writeTileColumn(tile, px & TILE_MASK, py & TILE_MASK, count, span);
+                py += count;
+            }
+        }
+    }
+}
+
+// The GPU atlas upload of every tile of a 1:1 view (a re-swizzle, or a copy of Morton tiles)
+static inline void uploadView(bool simulate) {
+    for (int tileY = 0; tileY < 5; tileY++) {
+        for (int tileX = 0; tileX < 6; tileX++) {
+            const u8* tile = viewTile(0, tileX, tileY);
+            swizzleMaskTile(tile, atlas, tileX, tileY);
+            if (!simulate) continue;
+            for (int i = 0; i < TILE_PIXELS; i += CACHE_LINE) cacheTouch(&tile[i]);
+            for (int blockY = 0; blockY < TILE_SIZE / 8; blockY++) {
+                const u8* run = atlasSlotRun(atlas, tileX, tileY, blockY);
+                for (int i = 0; i < ATLAS_RUN_BYTES; i += CACHE_LINE) cacheTouch(&run[i]);
+            }
+        }
+    }
+}
+
+typedef enum {
+    KERNEL_COMPOSITE,
+    KERNEL_COMPOSITE_ZOOMED_OUT,
+    KERNEL_SCRATCH,
+    KERNEL_STAMP,
+    KERNEL_UPLOAD,
+    KERNEL_COUNT
+} Kernel;
+
+static const char* kernelNames[KERNEL_COUNT] = {
+    "composite 1:1", "composite 1:2", "scratch stroke", "stamp stroke", "atlas upload"
+};
+
+static void runKernel(Kernel kernel, bool simulate) {
+    switch (kernel) {
+        case KERNEL_COMPOSITE: benchSink += composite(false, simulate); break;
+        case KERNEL_COMPOSITE_ZOOMED_OUT: benchSink += composite(true, simulate); break;
+        case KERNEL_SCRATCH: scratchStroke(simulate); break;
+        case KERNEL_STAMP: stampStroke(simulate); break;
+        case KERNEL_UPLOAD: uploadView(simulate); break;
+        default: break;
+    }
+}
+
+int main(void) {
+#ifdef MASK_TILE_MORTON
+    const char* layout = "Morton";
+#else
+    const char* layout = "linear";
+#endif
+    unsigned seed = 73;
+    for (int layer = 0; layer < LAYERS; layer++) {
+        for (int i = 0; i < VIEW_TILES_X * VIEW_TILES_Y; i++) {
+            for (int p = 0; p < TILE_PIXELS; p++) tileArena[layer][i][p] = 128 + (testRandom(&seed) & 127);
+        }
+    }
+
+    for (int kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+        // Misses from a cold cache, then the timing with the simulation compiled out
+        cacheReset();
+        runKernel(kernel, true);
+
+        runKernel(kernel, false);
+        double start = benchNow();
+        for (int i = 0; i < RUNS; i++) runKernel(kernel, false);
+        double time = (benchNow() - start) / RUNS;
+
+        printf("tiles, %-6s, %-14s: %.3f ms, %8lu accesses, %6lu L1 misses (%.2f%%)\n", layout,
+               kernelNames[kernel], time, cacheAccesses, cacheMisses, cacheMisses * 100.0 / cacheAccesses);
+    }
+    return 0;
+}
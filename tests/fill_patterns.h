@@ -0,0 +1,56 @@
+/**
+ * Two-color composites for the flood fill test and benchmark, including
+ * the worst cases for a column-span fill: many short spans per column.
+ */
+#ifndef FILL_PATTERNS_H
+#define FILL_PATTERNS_H
+
+#include <string.h>
+
+#include "canvas.h"
+
+enum {
+    PATTERN_OPEN,           // One region covering the screen
+    PATTERN_CHECKER,        // 1px checkerboard: every open pixel is on its own
+    PATTERN_CHECKER_ROWS,   // Checkerboard with every other row open: all connected
+    PATTERN_CHECKER_CELLS,  // 4px checkerboard: cells only meet at corners
+    PATTERN_COMB,           // Vertical teeth hanging from the top row
+    PATTERN_RUNGS,          // Horizontal rungs joined by the left column
+    PATTERN_NOISE,          // 60% open noise: irregular, mostly connected
+    PATTERN_COUNT
+};
+
+static const char* patternNames[PATTERN_COUNT] = {
+    "open", "checker", "checker rows", "checker cells", "comb", "rungs", "noise"
+};
+
+static inline bool patternOpen(int pattern, int x, int y) {
+    switch (pattern) {
+        case PATTERN_OPEN: return true;
+        case PATTERN_CHECKER: return ((x + y) & 1) == 0;
+        case PATTERN_CHECKER_ROWS: return (y & 1) == 0 || ((x + y) & 1) == 0;
+        case PATTERN_CHECKER_CELLS: return ((x / 4 + y / 4) & 1) == 0;
+        case PATTERN_COMB: return (x & 1) == 0 || y == 0;
+        case PATTERN_RUNGS: return (y & 1) == 0 || x == 0;
+        case PATTERN_NOISE: {
+            unsigned h = (unsigned)(x * 73856093) ^ (unsigned)(y * 19349663);
+            h ^= h >> 13;
+            h *= 0x5bd1e995;
+            h ^= h >> 15;
+            return h % 100 < 60;
+        }
+    }
+    return false;
+}
+
+// Open pixels light grey, blocked ones black (screen (x, y) in framebuffer layout)
+static inline void makePatternComposite(u8* composite, int pattern) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            u8* pixel = &composite[(x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y)) * 3];
+            memset(pixel, patternOpen(pattern, x, y) ? 200 : 0, 3);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * Minimal test helpers for the host tests: CHECK records a failure and
+ * keeps going, testResult() reports and gives the exit status.
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        testFailures++; \
+    } \
+} while (0)
+
+// Like CHECK, with a printf-style note (e.g. the case being run)
+#define CHECK_MSG(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        testFailures++; \
+    } \
+} while (0)
+
+static inline int testResult(const char* name) {
+    if (testFailures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+// Deterministic pseudo-random numbers for test inputs
+static inline unsigned testRandom(unsigned* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+#endif
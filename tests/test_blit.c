@@ -0,0 +1,45 @@
+/**
+ * The host fallback of the screen copies: every frame size the main loop
+ * copies (bottom screen and eye views, 24-bit and 16-bit) lands whole in
+ * its framebuffer, without touching the bytes around it, and one source
+ * can be copied to several framebuffers before waiting.
+ */
+#include <stdlib.h>
+
+#include "blit.h"
+#include "test.h"
+
+#define GUARD 64
+
+static u8 framebuffer[GUARD + 400 * SCREEN_HEIGHT * 3 + GUARD];
+static u8 second[400 * SCREEN_HEIGHT * 3];
+
+static void checkCopy(u32 size, unsigned* seed) {
+    u8* src = allocScreenBuffer(size);
+    CHECK(src != NULL);
+    if (!src) return;
+    for (u32 i = 0; i < size; i++) src[i] = testRandom(seed);
+    memset(framebuffer, 0xAA, sizeof(framebuffer));
+    
+    blitToFramebuffer(&framebuffer[GUARD], src, size);
+    blitToFramebuffer(second, src, size);
+    waitForBlits();
+    
+    CHECK_MSG(memcmp(&framebuffer[GUARD], src, size) == 0, "%u bytes: copy differs", (unsigned)size);
+    CHECK_MSG(memcmp(second, src, size) == 0, "%u bytes: second copy differs", (unsigned)size);
+    int spilled = 0;
+    for (int i = 0; i < GUARD; i++) {
+        if (framebuffer[i] != 0xAA || framebuffer[GUARD + size + i] != 0xAA) spilled++;
+    }
+    CHECK_MSG(spilled == 0, "%u bytes: %d bytes around the copy changed", (unsigned)size, spilled);
+    freeScreenBuffer(src);
+}
+
+int main(void) {
+    unsigned seed = 75;
+    for (int pixelSize = 3; pixelSize >= 2; pixelSize--) {
+        checkCopy(FB_WIDTH * FB_HEIGHT * pixelSize, &seed);
+        checkCopy(240 * 400 * pixelSize, &seed);
+    }
+    return testResult("test_blit");
+}
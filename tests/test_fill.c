@@ -0,0 +1,113 @@
+/**
+ * Flood fill against a breadth-first reference on the same classified
+ * pixels, on patterns with many short spans. Also built with an 8-entry
+ * seed stack (test_fill_stack8) so the overflow rescan does the work.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fill.h"
+#include "fill_patterns.h"
+#include "test.h"
+
+#define PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static u8 composite[PIXELS * 3];
+static bool reached[PIXELS];
+static int queue[PIXELS];
+
+static inline int fbIndex(int x, int y) {
+    return x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y);
+}
+
+static bool referenceOpen(const u8* seed, int x, int y) {
+    const u8* pixel = &composite[fbIndex(x, y) * 3];
+    int diff = abs(pixel[0] - seed[0]) + abs(pixel[1] - seed[1]) + abs(pixel[2] - seed[2]);
+    return diff <= FILL_TOLERANCE;
+}
+
+// 4-connected breadth-first fill in screen coordinates
+static int referenceFill(int startX, int startY) {
+    static const int stepX[4] = {1, -1, 0, 0};
+    static const int stepY[4] = {0, 0, 1, -1};
+    u8 seed[3];
+    memcpy(seed, &composite[fbIndex(startX, startY) * 3], 3);
+    memset(reached, 0, sizeof(reached));
+    
+    int head = 0, tail = 0;
+    reached[fbIndex(startX, startY)] = true;
+    queue[tail++] = startY * SCREEN_WIDTH + startX;
+    while (head < tail) {
+        int x = queue[head] % SCREEN_WIDTH;
+        int y = queue[head] / SCREEN_WIDTH;
+        head++;
+        for (int i = 0; i < 4; i++) {
+            int nx = x + stepX[i], ny = y + stepY[i];
+            if (nx < 0 || nx >= SCREEN_WIDTH || ny < 0 || ny >= SCREEN_HEIGHT) continue;
+            if (reached[fbIndex(nx, ny)] || !referenceOpen(seed, nx, ny)) continue;
+            reached[fbIndex(nx, ny)] = true;
+            queue[tail++] = ny * SCREEN_WIDTH + nx;
+        }
+    }
+    return tail;
+}
+
+static void checkFill(const char* name, int x, int y) {
+    int filled = floodFillRegion(composite, x, y);
+    int expected = referenceFill(x, y);
+    int wrong = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        if ((fillRegion[i] == FILL_DONE) != reached[i]) wrong++;
+    }
+    CHECK_MSG(filled == expected && wrong == 0, "%s, tap (%d, %d): filled %d, expected %d, %d pixels differ",
+              name, x, y, filled, expected, wrong);
+}
+
+static void testPatterns(void) {
+    static const int taps[][2] = {{0, 0}, {160, 120}, {319, 239}, {0, 239}, {318, 1}, {37, 200}};
+    for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+        makePatternComposite(composite, pattern);
+        for (unsigned i = 0; i < sizeof(taps) / sizeof(taps[0]); i++) {
+            checkFill(patternNames[pattern], taps[i][0], taps[i][1]);
+        }
+    }
+}
+
+// Regions end where the color drifts too far from the tapped one
+static void testTolerance(void) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            u8* pixel = &composite[fbIndex(x, y) * 3];
+            pixel[0] = x * 255 / SCREEN_WIDTH;
+            pixel[1] = y;
+            pixel[2] = (x + y) & 0x1F;
+        }
+    }
+    checkFill("gradient", 10, 10);
+    checkFill("gradient", 200, 100);
+    checkFill("gradient", 319, 239);
+}
+
+// Rungs and checker rows put a seed on the stack for every other row of
+// a column: a tiny stack has to rescan, and still reaches everything
+static void testStackOverflow(void) {
+    static const int patterns[] = {PATTERN_RUNGS, PATTERN_CHECKER_ROWS};
+    for (int i = 0; i < 2; i++) {
+        makePatternComposite(composite, patterns[i]);
+        checkFill(patternNames[patterns[i]], 0, 0);
+#ifdef FILL_STACK_SIZE
+        CHECK_MSG(fillRescans > 0, "%s: the small stack never overflowed", patternNames[patterns[i]]);
+#endif
+    }
+}
+
+int main(void) {
+    testPatterns();
+    testTolerance();
+    testStackOverflow();
+#ifdef FILL_STACK_SIZE
+    return testResult("test_fill (8-entry stack)");
+#else
+    return testResult("test_fill");
+#endif
+}
@@ -0,0 +1,174 @@
+/**
+ * Mask filters tile by tile against the same filters run over the whole
+ * canvas in one piece, so any seam between tiles or at the canvas edge
+ * shows up. The canvas mixes soft (8-bit) and packed tiles. Also built
+ * with MASK_TILE_MORTON (test_filter_morton) for the other tile layout.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "packed.h"
+#include "test.h"
+
+// The canvas padded with FILTER_APRON unscratched pixels a side, row-major
+#define PADDED (CANVAS_WIDTH + 2 * FILTER_APRON)
+
+static u8 canvas[CANVAS_HEIGHT][CANVAS_WIDTH];
+static u8 padded[PADDED * PADDED], scratch[PADDED * PADDED];
+static u8 expected[CANVAS_HEIGHT][CANVAS_WIDTH];
+static u8* tiles[CANVAS_TILE_COUNT];
+static u32* bits[CANVAS_TILE_COUNT];
+static u16 pending[CANVAS_TILE_COUNT];
+static u8 out[TILE_PIXELS];
+
+// Round dabs: hard ones scratch to 0, soft ones fade to the edge
+static void dab(int cx, int cy, int r, bool soft) {
+    for (int y = cy - r; y <= cy + r; y++) {
+        for (int x = cx - r; x <= cx + r; x++) {
+            if (x < 0 || x >= CANVAS_WIDTH || y < 0 || y >= CANVAS_HEIGHT) continue;
+            int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            if (d2 > r * r) continue;
+            int alpha = soft ? 255 * d2 / (r * r) : 0;
+            if (alpha < canvas[y][x]) canvas[y][x] = alpha;
+        }
+    }
+}
+
+// Split the canvas into tiles the way main.c keeps them
+static void makeTiles(void) {
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        free(tiles[i]);
+        free(bits[i]);
+        tiles[i] = NULL;
+        bits[i] = NULL;
+
+        u8 tile[TILE_PIXELS];
+        bool unscratched = true;
+        for (int x = 0; x < TILE_SIZE; x++) {
+            for (int y = 0; y < TILE_SIZE; y++) {
+                u8 value = canvas[(i / CANVAS_TILES_X) * TILE_SIZE + y][(i % CANVAS_TILES_X) * TILE_SIZE + x];
+                tile[TILE_COLUMN(x) + TILE_ROW(y)] = value;
+                if (value != 255) unscratched = false;
+            }
+        }
+        if (unscratched) continue;
+        bits[i] = packBinaryTile(tile);
+        if (!bits[i]) {
+            tiles[i] = malloc(TILE_PIXELS);
+            memcpy(tiles[i], tile, TILE_PIXELS);
+        }
+    }
+}
+
+// One box blur pass of the padded canvas along x or y, edges clamped
+static void referenceBoxBlur(const u8* src, u8* dst, bool vertical) {
+    for (int row = 0; row < PADDED; row++) {
+        for (int i = 0; i < PADDED; i++) {
+            int sum = 0;
+            for (int k = -FILTER_RADIUS; k <= FILTER_RADIUS; k++) {
+                int j = i + k < 0 ? 0 : i + k >= PADDED ? PADDED - 1 : i + k;
+                sum += vertical ? src[j * PADDED + row] : src[row * PADDED + j];
+            }
+            int value = (sum + FILTER_RADIUS) / (2 * FILTER_RADIUS + 1);
+            if (vertical) {
+                dst[i * PADDED + row] = value;
+            } else {
+                dst[row * PADDED + i] = value;
+            }
+        }
+    }
+}
+
+// The whole canvas filtered in one piece
+static void referenceFilter(MaskFilter filter) {
+    memset(padded, 255, sizeof(padded));
+    for (int y = 0; y < CANVAS_HEIGHT; y++) {
+        memcpy(&padded[(y + FILTER_APRON) * PADDED + FILTER_APRON], canvas[y], CANVAS_WIDTH);
+    }
+    for (int pass = 0; pass < FILTER_PASSES; pass++) {
+        referenceBoxBlur(padded, scratch, true);
+        memcpy(padded, scratch, sizeof(padded));
+    }
+    for (int pass = 0; pass < FILTER_PASSES; pass++) {
+        referenceBoxBlur(padded, scratch, false);
+        memcpy(padded, scratch, sizeof(padded));
+    }
+    for (int y = 0; y < CANVAS_HEIGHT; y++) {
+        for (int x = 0; x < CANVAS_WIDTH; x++) {
+            int blurred = padded[(y + FILTER_APRON) * PADDED + x + FILTER_APRON];
+            int original = canvas[y][x];
+            int value = filter == FILTER_SOFTEN ? blurred : original + (original - blurred) * SHARPEN_AMOUNT / 2;
+            expected[y][x] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+    }
+}
+
+// Every tile, filtered or skipped, matches the reference
+static void checkFilter(const char* name, MaskFilter filter) {
+    referenceFilter(filter);
+    int count = findFilterTiles(tiles, bits, pending);
+    int next = 0, wrongTiles = 0;
+    for (int i = 0; i < CANVAS_TILE_COUNT; i++) {
+        bool filtered = next < count && pending[next] == i;
+        if (filtered) {
+            filterMaskTile(tiles, bits, i, filter, out);
+            next++;
+        } else if (bits[i]) {
+            unpackBinaryTile(bits[i], out);    // Skipped tiles must stay as they are
+        } else if (tiles[i]) {
+            memcpy(out, tiles[i], TILE_PIXELS);
+        } else {
+            memset(out, 255, TILE_PIXELS);
+        }
+
+        int wrong = 0;
+        for (int x = 0; x < TILE_SIZE; x++) {
+            for (int y = 0; y < TILE_SIZE; y++) {
+                int want = expected[(i / CANVAS_TILES_X) * TILE_SIZE + y][(i % CANVAS_TILES_X) * TILE_SIZE + x];
+                if (out[TILE_COLUMN(x) + TILE_ROW(y)] != want) wrong++;
+            }
+        }
+        CHECK_MSG(wrong == 0, "%s: tile %d (%s): %d pixels differ", name, i, filtered ? "filtered" : "skipped", wrong);
+        if (wrong) wrongTiles++;
+        if (wrongTiles > 8) break;
+    }
+    CHECK_MSG(next == count, "%s: pending list out of order", name);
+}
+
+int main(void) {
+    unsigned seed = 70;
+    memset(canvas, 255, sizeof(canvas));
+
+    // Across tile seams and corners, on the canvas edges and in the corners
+    static const int spots[][2] = {
+        {64, 64}, {127, 64}, {0, 0}, {2047, 2047}, {0, 1000}, {1000, 0},
+        {2047, 700}, {700, 2047}, {320, 448}, {1024, 1024}
+    };
+    for (int s = 0; s < (int)(sizeof(spots) / sizeof(spots[0])); s++) {
+        for (int d = 0; d < 12; d++) {
+            int x = spots[s][0] + (int)(testRandom(&seed) % 48) - 24;
+            int y = spots[s][1] + (int)(testRandom(&seed) % 48) - 24;
+            dab(x, y, 2 + testRandom(&seed) % 14, s % 2 == 1 && d % 3 == 0);
+        }
+    }
+
+    // A fully scratched tile next to an unscratched one, and a mid-gray tile
+    for (int y = 1536; y < 1600; y++) memset(&canvas[y][1536], 0, TILE_SIZE);
+    for (int y = 1536; y < 1600; y++) memset(&canvas[y][1664], 128, TILE_SIZE);
+
+    makeTiles();
+    checkFilter("soften", FILTER_SOFTEN);
+    checkFilter("sharpen", FILTER_SHARPEN);
+
+    // An unscratched canvas has nothing to filter
+    memset(canvas, 255, sizeof(canvas));
+    makeTiles();
+    CHECK(findFilterTiles(tiles, bits, pending) == 0);
+
+#ifdef MASK_TILE_MORTON
+    return testResult("test_filter (Morton tiles)");
+#else
+    return testResult("test_filter");
+#endif
+}
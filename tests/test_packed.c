@@ -0,0 +1,123 @@
+/**
+ * Packed (1 bit per pixel) mask tiles against byte tiles: packing and
+ * expanding, rejection of partial alpha, and the column span writes of
+ * the hard brushes and fills. Also built with MASK_TILE_MORTON
+ * (test_packed_morton) for the other tile layout.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "packed.h"
+#include "test.h"
+
+// A binary tile with roughly density/256 of its pixels at 255, in runs like brush strokes
+static void fillBinary(u8* tile, int density, unsigned* seed) {
+    int i = 0;
+    while (i < TILE_PIXELS) {
+        int run = 1 + testRandom(seed) % 40;
+        u8 value = (int)(testRandom(seed) & 255) < density ? 255 : 0;
+        for (; run > 0 && i < TILE_PIXELS; run--) tile[i++] = value;
+    }
+}
+
+// Bit i is set exactly where byte i is 255, and expanding gives the tile back
+static void testPackRoundTrip() {
+    static const int densities[] = {0, 16, 128, 240, 256};
+    unsigned seed = 71;
+    u8 tile[TILE_PIXELS], back[TILE_PIXELS];
+
+    for (int d = 0; d < (int)(sizeof(densities) / sizeof(densities[0])); d++) {
+        fillBinary(tile, densities[d], &seed);
+        CHECK(isBinaryTile(tile));
+        u32* bits = packBinaryTile(tile);
+        CHECK_MSG(bits != NULL, "density %d", densities[d]);
+        if (!bits) continue;
+
+        int wrong = 0;
+        for (int i = 0; i < TILE_PIXELS; i++) {
+            if (tileBit(bits, i) != (tile[i] == 255)) wrong++;
+        }
+        CHECK_MSG(wrong == 0, "density %d: %d bits wrong", densities[d], wrong);
+
+        memset(back, 0x5A, sizeof(back));
+        unpackBinaryTile(bits, back);
+        CHECK_MSG(memcmp(back, tile, TILE_PIXELS) == 0, "density %d round trip", densities[d]);
+        free(bits);
+    }
+}
+
+// A single byte of partial alpha anywhere keeps a tile 8-bit
+static void testRejectsPartialAlpha() {
+    static const u8 partial[] = {1, 127, 128, 254};
+    unsigned seed = 255;
+    u8 tile[TILE_PIXELS];
+
+    for (int k = 0; k < 64; k++) {
+        fillBinary(tile, 128, &seed);
+        int i = (k == 0) ? 0 : (k == 1) ? TILE_PIXELS - 1 : (int)(testRandom(&seed) % TILE_PIXELS);
+        tile[i] = partial[k % 4];
+        CHECK_MSG(!isBinaryTile(tile), "value %d at %d", tile[i], i);
+        CHECK_MSG(packBinaryTile(tile) == NULL, "value %d at %d", tile[i], i);
+    }
+}
+
+// Span writes and reads match the same spans on a byte tile, in every alignment
+static void testColumnSpans() {
+    static const int columns[] = {0, 1, 6, 31, 32, 63};
+    unsigned seed = 32;
+    u8 reference[TILE_PIXELS], expanded[TILE_PIXELS];
+    u8 span[TILE_SIZE], expected[TILE_SIZE];
+
+    fillBinary(reference, 128, &seed);
+    u32* bits = packBinaryTile(reference);
+    CHECK(bits != NULL);
+    if (!bits) return;
+
+    for (int c = 0; c < (int)(sizeof(columns) / sizeof(columns[0])); c++) {
+        int x = columns[c];
+        for (int top = 0; top < TILE_SIZE; top++) {
+            for (int count = 1; top + count <= TILE_SIZE; count++) {
+                bool set = (top + count + c) & 1;
+                writeTileBitColumn(bits, x, top, count, set);
+                memset(span, set ? 255 : 0, count);
+                writeTileColumn(reference, x, top, count, span);
+
+                readTileBitColumn(bits, x, top, count, span);
+                readTileColumn(reference, x, top, count, expected);
+                CHECK_MSG(memcmp(span, expected, count) == 0, "read x %d, rows %d+%d", x, top, count);
+            }
+
+            // The whole tile, so writes outside the span show up too
+            unpackBinaryTile(bits, expanded);
+            CHECK_MSG(memcmp(expanded, reference, TILE_PIXELS) == 0, "write x %d, from row %d", x, top);
+        }
+    }
+    free(bits);
+}
+
+static void testUniform() {
+    u32* bits = newPackedTile();
+    CHECK(bits != NULL);
+    if (!bits) return;
+
+    CHECK(uniformPackedTile(bits) == 255);
+    writeTileBitColumn(bits, 17, 40, 1, false);
+    CHECK(uniformPackedTile(bits) == -1);
+    for (int x = 0; x < TILE_SIZE; x++) writeTileBitColumn(bits, x, 0, TILE_SIZE, false);
+    CHECK(uniformPackedTile(bits) == 0);
+    writeTileBitColumn(bits, TILE_SIZE - 1, TILE_SIZE - 1, 1, true);
+    CHECK(uniformPackedTile(bits) == -1);
+    free(bits);
+}
+
+int main(void) {
+    testPackRoundTrip();
+    testRejectsPartialAlpha();
+    testColumnSpans();
+    testUniform();
+#ifdef MASK_TILE_MORTON
+    return testResult("test_packed (Morton tiles)");
+#else
+    return testResult("test_packed");
+#endif
+}
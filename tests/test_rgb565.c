@@ -0,0 +1,97 @@
+/**
+ * Dithered RGB565 output against what the dither has to guarantee: 0 and
+ * 255 map to the end levels, outputs never go down as the input goes up,
+ * and over each 4x4 block of a flat input the levels are the two nearest
+ * to it, averaging back to the input. Each channel gets a different
+ * input so a swapped channel shows up too.
+ */
+#include <stdlib.h>
+
+#include "rgb565.h"
+#include "test.h"
+
+static u8 composite[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u16 out[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u16 previous[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+// Level of a channel (0 = blue, 1 = green, 2 = red) and its maximum
+static int level(u16 pixel, int channel) {
+    return channel == 0 ? pixel & 31 : channel == 1 ? (pixel >> 5) & 63 : pixel >> 11;
+}
+
+static int maxLevel(int channel) {
+    return channel == 1 ? 63 : 31;
+}
+
+// Input of a channel for step v of the sweep
+static int channelInput(int v, int channel) {
+    return channel == 0 ? v : channel == 1 ? 255 - v : (v * 7) & 255;
+}
+
+static void fill(int v) {
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        for (int c = 0; c < 3; c++) composite[i * 3 + c] = channelInput(v, c);
+    }
+}
+
+// Every aligned 4x4 block of the screen for one flat input
+static void checkBlocks(int v) {
+    for (int c = 0; c < 3; c++) {
+        int input = channelInput(v, c);
+        int bad = 0;
+        for (int bx = 0; bx < SCREEN_WIDTH && !bad; bx += 4) {
+            for (int by = 0; by < SCREEN_HEIGHT && !bad; by += 4) {
+                int low = 255, high = 0, sum = 0;
+                for (int x = bx; x < bx + 4; x++) {
+                    for (int y = by; y < by + 4; y++) {
+                        int l = level(out[x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y)], c);
+                        if (l < low) low = l;
+                        if (l > high) high = l;
+                        sum += l;
+                    }
+                }
+                double mean = sum / 16.0 * 255.0 / maxLevel(c);
+                if (high - low > 1 || mean < input - 1.0 || mean > input + 1.0) {
+                    CHECK_MSG(false, "channel %d, input %d: block (%d, %d) levels %d-%d, mean %.2f",
+                              c, input, bx, by, low, high, mean);
+                    bad = 1;
+                }
+            }
+        }
+    }
+}
+
+int main(void) {
+    for (int v = 0; v < 256; v++) {
+        fill(v);
+        convertTo565(out, composite);
+        checkBlocks(v);
+        
+        // Blue rises with v and green falls, everywhere
+        if (v > 0) {
+            int wrong = 0;
+            for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+                if (level(out[i], 0) < level(previous[i], 0) || level(out[i], 1) > level(previous[i], 1)) wrong++;
+            }
+            CHECK_MSG(wrong == 0, "input %d: %d pixels not monotonic", v, wrong);
+        }
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) previous[i] = out[i];
+    }
+    
+    // The ends stay exact at every dither position
+    static const int ends[][3] = {{0, 0, 0}, {255, 255, 255}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255}};
+    for (int e = 0; e < 5; e++) {
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+            for (int c = 0; c < 3; c++) composite[i * 3 + c] = ends[e][c];
+        }
+        convertTo565(out, composite);
+        int wrong = 0;
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+            for (int c = 0; c < 3; c++) {
+                if (level(out[i], c) != (ends[e][c] ? maxLevel(c) : 0)) wrong++;
+            }
+        }
+        CHECK_MSG(wrong == 0, "BGR %d,%d,%d: %d channels off", ends[e][0], ends[e][1], ends[e][2], wrong);
+    }
+    return testResult("test_rgb565");
+}
@@ -0,0 +1,132 @@
+/**
+ * Anaglyph and side-by-side export strips against per-pixel references
+ * built from the whole eye views, at every strip position and
+ * alignment, including strips cut short by the top of the image.
+ */
+#include <string.h>
+
+#include "stereo.h"
+#include "test.h"
+
+#define EYE_WIDTH 400
+#define EYE_HEIGHT 240
+
+#define EYE_OFFSET 7.5f
+
+static u8 composite[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+static u8 depth[SCREEN_WIDTH * SCREEN_HEIGHT];
+static u8 leftEye[EYE_WIDTH * EYE_HEIGHT * 3];
+static u8 rightEye[EYE_WIDTH * EYE_HEIGHT * 3];
+static u32 stripWords[EYE_WIDTH * 2 * 8 * 3 / 4 + 4];
+static u8 rightStrip[EYE_WIDTH * 8 * 3];
+static u8 expected[EYE_WIDTH * 2 * 8 * 3];
+
+// Red/cyan reference: BGR pixel from the right eye with the left eye's red
+static void referenceAnaglyphPixel(u8* out, int x, int row) {
+    const u8* l = &leftEye[(x * EYE_HEIGHT + row) * 3];
+    const u8* r = &rightEye[(x * EYE_HEIGHT + row) * 3];
+    out[0] = r[0];
+    out[1] = r[1];
+    out[2] = l[2];
+}
+
+static void referenceAnaglyphStrip(u8* out, int row, int rows) {
+    for (int x = 0; x < EYE_WIDTH; x++) {
+        for (int i = 0; i < rows; i++) {
+            referenceAnaglyphPixel(&out[(x * rows + i) * 3], x, row + i);
+        }
+    }
+}
+
+static void referenceSideBySideStrip(u8* out, int row, int rows) {
+    for (int x = 0; x < EYE_WIDTH * 2; x++) {
+        const u8* eye = (x < EYE_WIDTH) ? leftEye : rightEye;
+        int eyeX = x % EYE_WIDTH;
+        for (int i = 0; i < rows; i++) {
+            memcpy(&out[(x * rows + i) * 3], &eye[(eyeX * EYE_HEIGHT + row + i) * 3], 3);
+        }
+    }
+}
+
+// Every pairing of byte offsets and lengths, with guard bytes around the output
+static void testMixAlignments(void) {
+    static u8 out[64 + 8];
+    u8 want[64];
+    for (int outOffset = 0; outOffset < 4; outOffset++) {
+        for (int leftOffset = 0; leftOffset < 4; leftOffset++) {
+            for (int rightOffset = 0; rightOffset < 4; rightOffset++) {
+                for (int count = 0; count <= 17; count++) {
+                    const u8* left = &leftEye[leftOffset + 300];
+                    const u8* right = &rightEye[rightOffset + 600];
+                    memset(out, 0xA5, sizeof(out));
+                    mixAnaglyph(&out[4 + outOffset], left, right, count);
+                    
+                    for (int i = 0; i < count; i++) {
+                        want[i * 3 + 0] = right[i * 3 + 0];
+                        want[i * 3 + 1] = right[i * 3 + 1];
+                        want[i * 3 + 2] = left[i * 3 + 2];
+                    }
+                    bool same = memcmp(&out[4 + outOffset], want, count * 3) == 0;
+                    bool guarded = true;
+                    for (int i = 0; i < (int)sizeof(out); i++) {
+                        if ((i < 4 + outOffset || i >= 4 + outOffset + count * 3) && out[i] != 0xA5) guarded = false;
+                    }
+                    CHECK_MSG(same && guarded, "offsets %d/%d/%d, %d pixels%s",
+                              outOffset, leftOffset, rightOffset, count, guarded ? "" : " (wrote outside)");
+                }
+            }
+        }
+    }
+}
+
+// Strips starting at every row, as long as fit above the bottom of the image
+static void testStripsAtEveryRow(void) {
+    u8* strip = (u8*)stripWords;
+    for (int y0 = 0; y0 < EYE_HEIGHT; y0++) {
+        for (int rows = 1; rows <= 8 && y0 + rows <= EYE_HEIGHT; rows++) {
+            int row = EYE_HEIGHT - y0 - rows;
+            buildAnaglyphStrip(strip, rightStrip, composite, depth, EYE_OFFSET, y0, rows);
+            referenceAnaglyphStrip(expected, row, rows);
+            CHECK_MSG(memcmp(strip, expected, EYE_WIDTH * rows * 3) == 0, "anaglyph rows %d + %d", y0, rows);
+            
+            buildSideBySideStrip(strip, composite, depth, EYE_OFFSET, y0, rows);
+            referenceSideBySideStrip(expected, row, rows);
+            CHECK_MSG(memcmp(strip, expected, EYE_WIDTH * 2 * rows * 3) == 0, "side-by-side rows %d + %d", y0, rows);
+        }
+    }
+}
+
+// Strips as the JPEG encoder requests them add up to the reference image
+static void testWholeImage(void) {
+    static u8 image[EYE_WIDTH * EYE_HEIGHT * 3];
+    u8* strip = (u8*)stripWords;
+    for (int stripY = 0; stripY < EYE_HEIGHT; stripY += 8) {
+        int row = EYE_HEIGHT - 8 - stripY;
+        buildAnaglyphStrip(strip, rightStrip, composite, depth, EYE_OFFSET, stripY, 8);
+        for (int x = 0; x < EYE_WIDTH; x++) {
+            memcpy(&image[(x * EYE_HEIGHT + row) * 3], &strip[x * 8 * 3], 8 * 3);
+        }
+    }
+    
+    int wrong = 0;
+    for (int x = 0; x < EYE_WIDTH; x++) {
+        for (int row = 0; row < EYE_HEIGHT; row++) {
+            u8 want[3];
+            referenceAnaglyphPixel(want, x, row);
+            if (memcmp(&image[(x * EYE_HEIGHT + row) * 3], want, 3) != 0) wrong++;
+        }
+    }
+    CHECK_MSG(wrong == 0, "%d pixels differ", wrong);
+}
+
+int main(void) {
+    unsigned seed = 11;
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT * 3; i++) composite[i] = testRandom(&seed);
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) depth[i] = (i / 1000) % 2 ? testRandom(&seed) : 200;
+    renderStereoEye(leftEye, composite, depth, 0.0f, 3);
+    renderStereoEye(rightEye, composite, depth, EYE_OFFSET, 3);
+    testMixAlignments();
+    testStripsAtEveryRow();
+    testWholeImage();
+    return testResult("test_share");
+}
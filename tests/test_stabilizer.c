@@ -0,0 +1,184 @@
+/**
+ * Stroke stabilizer on the touch traces in traces/: for every string
+ * length, the brush has to stay within a lag limit of the ideal stylus
+ * path, the drawn path has to turn no more sharply than the limit, and
+ * the stroke has to end at the last touch sample once the stylus lifts.
+ * Run from tests/ (make check does).
+ */
+#include <math.h>
+#include <stdio.h>
+
+#include "stabilizer.h"
+#include "test.h"
+
+#define MAX_SAMPLES 256
+#define SUBPIXEL (1 << SUBPIXEL_SHIFT)
+
+typedef struct {
+    int count;
+    int touchX[MAX_SAMPLES], touchY[MAX_SAMPLES];      // Whole screen pixels
+    float idealX[MAX_SAMPLES], idealY[MAX_SAMPLES];
+} Trace;
+
+typedef struct {
+    float maxLag;       // Brush to ideal stylus position, screen pixels
+    float rmsTurn;      // RMS turning angle between drawn segments, degrees
+    float deviation;    // Mean distance of drawn points from the ideal path
+    int moves;          // Samples that moved the brush
+    int endX, endY;     // Brush after the stylus lifted, subpixels
+} StrokeStats;
+
+static bool loadTrace(const char* name, Trace* trace) {
+    char path[64];
+    snprintf(path, sizeof(path), "traces/%s.txt", name);
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    
+    char line[128];
+    trace->count = 0;
+    while (fgets(line, sizeof(line), file) && trace->count < MAX_SAMPLES) {
+        if (line[0] == '#') continue;
+        int i = trace->count;
+        if (sscanf(line, "%d %d %f %f", &trace->touchX[i], &trace->touchY[i],
+                   &trace->idealX[i], &trace->idealY[i]) == 4) {
+            trace->count++;
+        }
+    }
+    fclose(file);
+    return trace->count > 1;
+}
+
+// Distance from a point to the ideal path (as a polyline)
+static float pathDistance(const Trace* trace, float x, float y) {
+    float best = INFINITY;
+    for (int i = 0; i + 1 < trace->count; i++) {
+        float ax = trace->idealX[i], ay = trace->idealY[i];
+        float bx = trace->idealX[i + 1] - ax, by = trace->idealY[i + 1] - ay;
+        float length2 = bx * bx + by * by;
+        float t = (length2 > 0) ? ((x - ax) * bx + (y - ay) * by) / length2 : 0;
+        t = fminf(fmaxf(t, 0), 1);
+        float d = hypotf(x - ax - t * bx, y - ay - t * by);
+        if (d < best) best = d;
+    }
+    return best;
+}
+
+// Run a trace through the stabilizer at zoom 0 (one canvas pixel per screen pixel)
+static StrokeStats runTrace(const Trace* trace, int level) {
+    StrokeStats stats = {0};
+    int length = stabilizerLength(level, 0);
+    
+    int brushX = trace->touchX[0] * SUBPIXEL;
+    int brushY = trace->touchY[0] * SUBPIXEL;
+    stabilizerStart(brushX, brushY);
+    
+    double turn2 = 0, deviation = 0;
+    int turns = 0;
+    float lastDX = 0, lastDY = 0;
+    for (int i = 0; i < trace->count; i++) {
+        int x, y;
+        if (stabilizerUpdate(trace->touchX[i] * SUBPIXEL, trace->touchY[i] * SUBPIXEL, length, &x, &y)) {
+            float dx = (float)(x - brushX) / SUBPIXEL;
+            float dy = (float)(y - brushY) / SUBPIXEL;
+            if (stats.moves > 0) {
+                float angle = atan2f(lastDX * dy - lastDY * dx, lastDX * dx + lastDY * dy) * 180 / (float)M_PI;
+                turn2 += angle * angle;
+                turns++;
+            }
+            lastDX = dx;
+            lastDY = dy;
+            brushX = x;
+            brushY = y;
+            deviation += pathDistance(trace, (float)x / SUBPIXEL, (float)y / SUBPIXEL);
+            stats.moves++;
+        }
+        
+        float lag = hypotf((float)brushX / SUBPIXEL - trace->idealX[i], (float)brushY / SUBPIXEL - trace->idealY[i]);
+        if (lag > stats.maxLag) stats.maxLag = lag;
+    }
+    
+    // Lift: the brush catches up with the last sample
+    int x, y;
+    int last = trace->count - 1;
+    if (stabilizerFinish(trace->touchX[last] * SUBPIXEL, trace->touchY[last] * SUBPIXEL, &x, &y)) {
+        brushX = x;
+        brushY = y;
+    }
+    stats.endX = brushX;
+    stats.endY = brushY;
+    
+    stats.rmsTurn = turns ? (float)sqrt(turn2 / turns) : 0;
+    stats.deviation = stats.moves ? (float)(deviation / stats.moves) : 0;
+    return stats;
+}
+
+// Worst touch error in the traces: +/-1.5 px jitter rounded to whole pixels
+#define TRACE_JITTER 2.83f
+
+/**
+ * Smoothness limits per trace and level, a little above what the current
+ * filter measures. Lag needs no table: the brush is never more than the
+ * string away from the touch, and the touch never more than TRACE_JITTER
+ * from the stylus.
+ */
+typedef struct {
+    const char* name;
+    float maxTurn[STABILIZER_LEVELS];
+    float maxDeviation[STABILIZER_LEVELS];
+} TraceLimits;
+
+static const TraceLimits limits[] = {
+    {"line",   {70, 20, 12, 7},   {0.90f, 0.55f, 0.45f, 0.35f}},
+    {"circle", {35, 15, 10, 7},   {0.85f, 0.55f, 0.50f, 1.25f}},
+    {"wave",   {25, 20, 18, 16},  {0.80f, 0.60f, 1.00f, 2.30f}},
+    {"hold",   {180, 0, 0, 0},    {1.50f, 0, 0, 0}},
+};
+
+int main(void) {
+    // String lengths follow the zoom so they stay the same on screen
+    for (int level = 0; level < STABILIZER_LEVELS; level++) {
+        int length = stabilizerStringLength[level] * SUBPIXEL;
+        CHECK(stabilizerLength(level, 0) == length);
+        CHECK(stabilizerLength(level, -1) == length * 2);
+        CHECK(stabilizerLength(level, 2) == length / 4);
+    }
+    
+    for (int t = 0; t < (int)(sizeof(limits) / sizeof(limits[0])); t++) {
+        const TraceLimits* limit = &limits[t];
+        Trace trace;
+        if (!loadTrace(limit->name, &trace)) {
+            CHECK_MSG(false, "can't read traces/%s.txt", limit->name);
+            continue;
+        }
+        
+        StrokeStats raw = runTrace(&trace, 0);
+        for (int level = 0; level < STABILIZER_LEVELS; level++) {
+            StrokeStats stats = runTrace(&trace, level);
+            float maxLag = stabilizerStringLength[level] + TRACE_JITTER;
+            CHECK_MSG(stats.maxLag <= maxLag, "%s level %d: lag %.2f px > %.2f",
+                      limit->name, level, stats.maxLag, maxLag);
+            CHECK_MSG(stats.rmsTurn <= limit->maxTurn[level], "%s level %d: turning %.1f deg > %.1f",
+                      limit->name, level, stats.rmsTurn, limit->maxTurn[level]);
+            CHECK_MSG(stats.deviation <= limit->maxDeviation[level], "%s level %d: deviation %.2f px > %.2f",
+                      limit->name, level, stats.deviation, limit->maxDeviation[level]);
+            int liftX = trace.touchX[trace.count - 1] * SUBPIXEL;
+            int liftY = trace.touchY[trace.count - 1] * SUBPIXEL;
+            CHECK_MSG(stats.endX == liftX && stats.endY == liftY, "%s level %d: ends at (%d, %d), lifted at (%d, %d)",
+                      limit->name, level, stats.endX, stats.endY, liftX, liftY);
+            if (level > 0) {
+                CHECK_MSG(stats.rmsTurn < raw.rmsTurn, "%s level %d: not smoother than raw touch",
+                          limit->name, level);
+            }
+        }
+    }
+    
+    // Jitter shorter than the string never reaches the canvas before the lift
+    Trace hold;
+    if (loadTrace("hold", &hold)) {
+        for (int level = 1; level < STABILIZER_LEVELS; level++) {
+            CHECK_MSG(runTrace(&hold, level).moves == 0, "hold level %d: brush moved", level);
+        }
+    }
+    
+    return testResult("test_stabilizer");
+}
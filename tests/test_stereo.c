@@ -0,0 +1,217 @@
+/**
+ * Golden tests for renderStereoEye: the warp is compared byte for byte
+ * with a straightforward per-row reference (explicit nearest-wins z test
+ * and hole filling), and checked for the properties the top screen
+ * relies on. Strips warped on their own (renderStereoStrip) must match
+ * the same rows of the whole view.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "stereo.h"
+#include "test.h"
+
+#define EYE_WIDTH 400
+#define COMPOSITE_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+#define EYE_PIXELS (EYE_WIDTH * SCREEN_HEIGHT)
+
+enum { DEPTH_FLAT_NEAR, DEPTH_RAMP, DEPTH_STEPS, DEPTH_BLOCKS, DEPTH_NOISE, DEPTH_MAP_COUNT };
+static const char* depthNames[DEPTH_MAP_COUNT] = {"flat", "ramp", "steps", "blocks", "noise"};
+
+static u8 composite[COMPOSITE_PIXELS * 3];
+static u8 depth[COMPOSITE_PIXELS];
+static u8 eye[EYE_PIXELS * 3];
+static u8 expected[EYE_PIXELS * 3];
+
+static inline int pixelIndex(int x, int y) {
+    return x * SCREEN_HEIGHT + (SCREEN_HEIGHT - 1 - y);
+}
+
+// Composite with no black pixels, so black in an eye view is always a bar
+static void makeComposite(void) {
+    unsigned seed = 1;
+    for (int i = 0; i < COMPOSITE_PIXELS * 3; i++) {
+        composite[i] = 1 + testRandom(&seed) % 255;
+    }
+}
+
+static void makeDepth(int kind) {
+    unsigned seed = 7;
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            int d = 0;
+            switch (kind) {
+                case DEPTH_FLAT_NEAR: d = 255; break;
+                case DEPTH_RAMP: d = x * 255 / (SCREEN_WIDTH - 1); break;
+                case DEPTH_STEPS: d = ((x / 20) & 1) ? 255 : 0; break;
+                case DEPTH_BLOCKS: d = (((x / 16) * 7 + (y / 16) * 13) % 5) * 63; break;
+                case DEPTH_NOISE: d = testRandom(&seed) & 255; break;
+            }
+            depth[pixelIndex(x, y)] = d;
+        }
+    }
+}
+
+// Same disparity rounding as the warp: 1/16 pixel fixed point
+static int referenceShift(int d, float eyeOffset) {
+    int offset16 = (int)(eyeOffset * 16.0f);
+    return ((d * offset16) / 255 + 8) >> 4;
+}
+
+/**
+ * Per row: every target takes the source pixel that moved furthest (the
+ * nearest one), then each gap between written targets is filled from the
+ * farther of its two neighbours (the left one on a tie).
+ */
+static void referenceEye(u8* dest, const u8* src, float eyeOffset, int pixelSize) {
+    memset(dest, 0, EYE_PIXELS * pixelSize);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        int moved[EYE_WIDTH];
+        int from[EYE_WIDTH];
+        for (int t = 0; t < EYE_WIDTH; t++) moved[t] = -1;
+        
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            int s = referenceShift(depth[pixelIndex(x, y)], eyeOffset);
+            int t = x + 40 + s;
+            if (t < 0 || t >= EYE_WIDTH) continue;
+            if (abs(s) > moved[t]) {
+                moved[t] = abs(s);
+                from[t] = x;
+            }
+        }
+        
+        int row = SCREEN_HEIGHT - 1 - y;
+        for (int t = 0; t < EYE_WIDTH; t++) {
+            if (moved[t] >= 0) {
+                memcpy(&dest[(t * SCREEN_HEIGHT + row) * pixelSize], &src[pixelIndex(from[t], y) * pixelSize], pixelSize);
+            }
+        }
+        
+        int first = 0, last = EYE_WIDTH - 1;
+        while (first < EYE_WIDTH && moved[first] < 0) first++;
+        while (last > first && moved[last] < 0) last--;
+        for (int t = first + 1; t < last; t++) {
+            if (moved[t] >= 0) continue;
+            int end = t;
+            while (moved[end + 1] < 0) end++;
+            int leftDepth = depth[pixelIndex(from[t - 1], y)];
+            int rightDepth = depth[pixelIndex(from[end + 1], y)];
+            int source = (leftDepth <= rightDepth) ? t - 1 : end + 1;
+            for (int h = t; h <= end; h++) {
+                memcpy(&dest[(h * SCREEN_HEIGHT + row) * pixelSize], &dest[(source * SCREEN_HEIGHT + row) * pixelSize], pixelSize);
+            }
+            t = end;
+        }
+    }
+}
+
+// 2-byte pixels: the warp only moves bytes, so any 16-bit values will do
+static void packComposite565(u8* out) {
+    for (int i = 0; i < COMPOSITE_PIXELS; i++) {
+        out[i * 2 + 0] = composite[i * 3 + 0];
+        out[i * 2 + 1] = composite[i * 3 + 1];
+    }
+}
+
+static void testMatchesReference(void) {
+    static const float offsets[] = {-10.0f, -3.5f, 0.0f, 3.0f, 7.25f, 15.0f};
+    static u8 composite565[COMPOSITE_PIXELS * 2];
+    packComposite565(composite565);
+    
+    for (int kind = 0; kind < DEPTH_MAP_COUNT; kind++) {
+        makeDepth(kind);
+        for (unsigned i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+            for (int pixelSize = 2; pixelSize <= 3; pixelSize++) {
+                const u8* src = (pixelSize == 3) ? composite : composite565;
+                renderStereoEye(eye, src, depth, offsets[i], pixelSize);
+                referenceEye(expected, src, offsets[i], pixelSize);
+                CHECK_MSG(memcmp(eye, expected, EYE_PIXELS * pixelSize) == 0,
+                          "%s depth, offset %.2f, %d-byte pixels", depthNames[kind], offsets[i], pixelSize);
+            }
+        }
+    }
+}
+
+// Strips of every height at every row match the whole eye view
+static void testStripsMatchEye(void) {
+    static const float offsets[] = {-10.0f, 0.0f, 15.0f};
+    static u8 strip[EYE_WIDTH * STEREO_STRIP * 3];
+    for (int kind = 0; kind < DEPTH_MAP_COUNT; kind++) {
+        makeDepth(kind);
+        for (int i = 0; i < 3; i++) {
+            for (int pixelSize = 2; pixelSize <= 3; pixelSize++) {
+                renderStereoEye(eye, composite, depth, offsets[i], pixelSize);
+                int wrong = 0;
+                for (int y0 = 0; y0 < SCREEN_HEIGHT; y0++) {
+                    for (int rows = 1; rows <= STEREO_STRIP && y0 + rows <= SCREEN_HEIGHT; rows++) {
+                        renderStereoStrip(strip, composite, depth, offsets[i], y0, rows, pixelSize);
+                        int row = SCREEN_HEIGHT - y0 - rows;
+                        for (int x = 0; x < EYE_WIDTH; x++) {
+                            if (memcmp(&strip[x * rows * pixelSize], &eye[(x * SCREEN_HEIGHT + row) * pixelSize],
+                                       rows * pixelSize) != 0) wrong++;
+                        }
+                    }
+                }
+                CHECK_MSG(wrong == 0, "%s depth, offset %.0f, %d-byte pixels: %d strip columns differ",
+                          depthNames[kind], offsets[i], pixelSize, wrong);
+            }
+        }
+    }
+}
+
+// Zero offset is the old flat copy: the composite centered between black bars
+static void testZeroOffsetIsCopy(void) {
+    for (int kind = 0; kind < DEPTH_MAP_COUNT; kind++) {
+        makeDepth(kind);
+        memset(expected, 0, EYE_PIXELS * 3);
+        memcpy(&expected[40 * SCREEN_HEIGHT * 3], composite, COMPOSITE_PIXELS * 3);
+        renderStereoEye(eye, composite, depth, 0.0f, 3);
+        CHECK_MSG(memcmp(eye, expected, EYE_PIXELS * 3) == 0, "%s depth", depthNames[kind]);
+    }
+}
+
+// Between the first and last pixel of a row, nothing may be left black
+static void testNoInteriorHoles(void) {
+    static const float offsets[] = {-10.0f, 15.0f};
+    for (int kind = 0; kind < DEPTH_MAP_COUNT; kind++) {
+        makeDepth(kind);
+        for (int i = 0; i < 2; i++) {
+            renderStereoEye(eye, composite, depth, offsets[i], 3);
+            int holes = 0;
+            for (int row = 0; row < SCREEN_HEIGHT; row++) {
+                int first = -1, last = -1;
+                for (int t = 0; t < EYE_WIDTH; t++) {
+                    const u8* p = &eye[(t * SCREEN_HEIGHT + row) * 3];
+                    if (p[0] | p[1] | p[2]) {
+                        if (first < 0) first = t;
+                        last = t;
+                    }
+                }
+                for (int t = first; t <= last; t++) {
+                    const u8* p = &eye[(t * SCREEN_HEIGHT + row) * 3];
+                    if (!(p[0] | p[1] | p[2])) holes++;
+                }
+            }
+            CHECK_MSG(holes == 0, "%s depth, offset %.0f: %d holes", depthNames[kind], offsets[i], holes);
+        }
+    }
+}
+
+// A flat map moves the whole view by the rounded offset
+static void testFlatDepthShifts(void) {
+    makeDepth(DEPTH_FLAT_NEAR);
+    renderStereoEye(eye, composite, depth, 15.0f, 3);
+    memset(expected, 0, EYE_PIXELS * 3);
+    memcpy(&expected[(40 + 15) * SCREEN_HEIGHT * 3], composite, COMPOSITE_PIXELS * 3);
+    CHECK(memcmp(eye, expected, EYE_PIXELS * 3) == 0);
+}
+
+int main(void) {
+    makeComposite();
+    testMatchesReference();
+    testStripsMatchEye();
+    testZeroOffsetIsCopy();
+    testNoInteriorHoles();
+    testFlatDepthShifts();
+    return testResult("test_stereo");
+}
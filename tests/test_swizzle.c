@@ -0,0 +1,222 @@
+/**
+ * Texture swizzling against a texel-at-a-time reference, and the atlas
+ * slot bookkeeping of the GPU compositing path. Also built with
+ * MASK_TILE_MORTON (test_swizzle_morton) for the other tile layout.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "swizzle.h"
+#include "packed.h"
+#include "test.h"
+
+static u8 atlas[ATLAS_SIZE * ATLAS_SIZE];
+static u8 tileData[4][TILE_PIXELS];
+static u8* tiles[CANVAS_TILE_COUNT];
+static u8 dirty[CANVAS_TILE_COUNT];
+static s16 slotTile[ATLAS_SLOTS * ATLAS_SLOTS];
+
+// Byte offset of texel (x, y) in a swizzled texture `width` texels wide
+static int referenceOffset(int x, int y, int width) {
+    int morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+    return ((y >> 3) * (width >> 3) + (x >> 3)) * 64 + morton;
+}
+
+static void fillRandom(u8* data, int size, unsigned* seed) {
+    for (int i = 0; i < size; i++) data[i] = testRandom(seed);
+}
+
+// Both source layouts the app swizzles: mask tiles and bottom-up layer columns
+static void testBlock() {
+    unsigned seed = 72;
+    u8 source[TILE_PIXELS];
+    u8 block[64];
+    fillRandom(source, sizeof(source), &seed);
+    
+    swizzleBlock(source, TILE_SIZE, 1, block);
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            CHECK_MSG(block[referenceOffset(x, y, 8)] == source[x * TILE_SIZE + y], "column-major (%d, %d)", x, y);
+        }
+    }
+    
+    const u8* bottomUp = &source[7 * 3 + 1];
+    swizzleBlock(bottomUp, 8 * 3, -3, block);
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 8; y++) {
+            CHECK_MSG(block[referenceOffset(x, y, 8)] == bottomUp[x * 8 * 3 - y * 3], "bottom-up (%d, %d)", x, y);
+        }
+    }
+}
+
+// Every pixel of a tile has its own byte, and the box filter steps reach the right neighbours
+static void testLayout() {
+    static bool used[TILE_PIXELS];
+    for (int x = 0; x < TILE_SIZE; x++) {
+        for (int y = 0; y < TILE_SIZE; y++) {
+            int index = TILE_COLUMN(x) + TILE_ROW(y);
+            CHECK_MSG(index >= 0 && index < TILE_PIXELS && !used[index], "pixel (%d, %d) at %d", x, y, index);
+            if (index >= 0 && index < TILE_PIXELS) used[index] = true;
+            
+            if ((x & 1) || (y & 1)) continue;
+            CHECK(index + TILE_NEXT_X == TILE_COLUMN(x + 1) + TILE_ROW(y));
+            CHECK(index + TILE_NEXT_Y == TILE_COLUMN(x) + TILE_ROW(y + 1));
+            CHECK(index + TILE_NEXT_X + TILE_NEXT_Y == TILE_COLUMN(x + 1) + TILE_ROW(y + 1));
+        }
+    }
+    
+    // Column spans read and write the same pixels in either layout, and no others
+    unsigned seed = 73;
+    u8 tile[TILE_PIXELS], before[TILE_PIXELS], span[TILE_SIZE];
+    fillRandom(tile, TILE_PIXELS, &seed);
+    memcpy(before, tile, TILE_PIXELS);
+    readTileColumn(tile, 37, 5, 50, span);
+    for (int i = 0; i < 50; i++) {
+        CHECK(span[i] == tile[TILE_COLUMN(37) + TILE_ROW(5 + i)]);
+        span[i] = ~span[i];
+    }
+    writeTileColumn(tile, 37, 5, 50, span);
+    int changed = 0;
+    for (int i = 0; i < TILE_PIXELS; i++) changed += tile[i] != before[i];
+    CHECK(changed == 50);
+    for (int i = 0; i < 50; i++) CHECK(tile[TILE_COLUMN(37) + TILE_ROW(5 + i)] == span[i]);
+}
+
+// Whole-tile conversion to and from column-major (files and the Morton atlas copy)
+static void testTileConversion() {
+    unsigned seed = 74;
+    u8 columns[TILE_PIXELS], tile[TILE_PIXELS], back[TILE_PIXELS];
+    fillRandom(columns, TILE_PIXELS, &seed);
+    
+    swizzleTile(columns, tile);
+    for (int x = 0; x < TILE_SIZE; x++) {
+        for (int y = 0; y < TILE_SIZE; y++) {
+            CHECK_MSG(tile[referenceOffset(x, y, TILE_SIZE)] == columns[x * TILE_SIZE + y], "(%d, %d)", x, y);
+        }
+    }
+    unswizzleTile(tile, back);
+    CHECK(memcmp(back, columns, TILE_PIXELS) == 0);
+}
+
+// Texel (slotX * TILE_SIZE + x, slotY * TILE_SIZE + y) of the atlas is tile byte (x, y); nothing else changes
+static void checkSlot(const u8* tile, int slotX, int slotY, const char* what) {
+    int wrong = 0;
+    for (int x = 0; x < TILE_SIZE; x++) {
+        for (int y = 0; y < TILE_SIZE; y++) {
+            u8 expected = tile ? tile[TILE_COLUMN(x) + TILE_ROW(y)] : 255;
+            int offset = referenceOffset(slotX * TILE_SIZE + x, slotY * TILE_SIZE + y, ATLAS_SIZE);
+            if (atlas[offset] != expected) wrong++;
+        }
+    }
+    CHECK_MSG(wrong == 0, "%s: %d texels wrong in slot (%d, %d)", what, wrong, slotX, slotY);
+}
+
+static int countBytes(u8 value) {
+    int count = 0;
+    for (int i = 0; i < (int)sizeof(atlas); i++) count += atlas[i] == value;
+    return count;
+}
+
+static void testMaskTile() {
+    static const int slots[][2] = {{0, 0}, {15, 0}, {0, 15}, {7, 9}, {15, 15}};
+    unsigned seed = 7;
+    fillRandom(tileData[0], TILE_PIXELS, &seed);
+    for (int i = 0; i < TILE_PIXELS; i++) tileData[0][i] |= 1;  // Never the sentinel
+    
+    for (int s = 0; s < (int)(sizeof(slots) / sizeof(slots[0])); s++) {
+        memset(atlas, 0, sizeof(atlas));
+        swizzleMaskTile(tileData[0], atlas, slots[s][0], slots[s][1]);
+        checkSlot(tileData[0], slots[s][0], slots[s][1], "tile");
+        CHECK_MSG(countBytes(0) == (int)sizeof(atlas) - TILE_PIXELS, "slot (%d, %d) wrote outside", slots[s][0], slots[s][1]);
+        
+        memset(atlas, 0, sizeof(atlas));
+        swizzleMaskTile(NULL, atlas, slots[s][0], slots[s][1]);
+        checkSlot(NULL, slots[s][0], slots[s][1], "unscratched tile");
+        CHECK(countBytes(255) == TILE_PIXELS);
+    }
+}
+
+static bool wasWritten(const u16* written, int count, int tileX, int tileY) {
+    int slot = (tileY % ATLAS_SLOTS) * ATLAS_SLOTS + tileX % ATLAS_SLOTS;
+    for (int i = 0; i < count; i++) {
+        if (written[i] == slot) return true;
+    }
+    return false;
+}
+
+// Only tiles the atlas doesn't hold, or that changed, are written again
+static void testSlotBookkeeping() {
+    unsigned seed = 16;
+    for (int i = 0; i < 4; i++) fillRandom(tileData[i], TILE_PIXELS, &seed);
+    memset(tiles, 0, sizeof(tiles));
+    for (int i = 0; i < CANVAS_TILE_COUNT; i += 3) tiles[i] = tileData[i % 4];
+    memset(dirty, TILE_DIRTY_TEXTURE | TILE_DIRTY_AUTOSAVE, sizeof(dirty));
+    clearAtlasSlots(slotTile);
+    
+    // A 6x5 tile view, all new
+    u16 written[ATLAS_SLOTS * ATLAS_SLOTS];
+    int count = updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 3, 2, 8, 6, written);
+    CHECK(count == 30);
+    for (int tileY = 2; tileY <= 6; tileY++) {
+        for (int tileX = 3; tileX <= 8; tileX++) {
+            int tileIndex = tileY * CANVAS_TILES_X + tileX;
+            checkSlot(tiles[tileIndex], tileX % ATLAS_SLOTS, tileY % ATLAS_SLOTS, "first view");
+            CHECK(dirty[tileIndex] == TILE_DIRTY_AUTOSAVE);
+        }
+    }
+    
+    // Nothing changed
+    CHECK(updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 3, 2, 8, 6, written) == 0);
+    
+    // One tile scratched again
+    int changed = 4 * CANVAS_TILES_X + 5;
+    tiles[changed] = tileData[3];
+    dirty[changed] |= TILE_DIRTY_TEXTURE;
+    count = updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 3, 2, 8, 6, written);
+    CHECK(count == 1 && wasWritten(written, count, 5, 4));
+    checkSlot(tileData[3], 5, 4, "changed tile");
+    
+    // A packed tile goes in expanded
+    static u32* bitTiles[CANVAS_TILE_COUNT];
+    static u8 binary[TILE_PIXELS];
+    for (int i = 0; i < TILE_PIXELS; i++) binary[i] = (testRandom(&seed) & 64) ? 255 : 0;
+    bitTiles[changed] = packBinaryTile(binary);
+    tiles[changed] = NULL;
+    dirty[changed] |= TILE_DIRTY_TEXTURE;
+    count = updateAtlasSlots(slotTile, atlas, tiles, bitTiles, dirty, 3, 2, 8, 6, written);
+    CHECK(count == 1 && wasWritten(written, count, 5, 4));
+    checkSlot(binary, 5, 4, "packed tile");
+    free(bitTiles[changed]);
+    bitTiles[changed] = NULL;
+    tiles[changed] = tileData[3];
+    
+    // Scroll right by two tiles past the atlas edge: only the new columns come in,
+    // into the slots that wrap around
+    count = updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 13, 2, 18, 6, written);
+    CHECK(count == 30);
+    count = updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 15, 2, 20, 6, written);
+    CHECK(count == 10);
+    for (int tileY = 2; tileY <= 6; tileY++) {
+        for (int tileX = 19; tileX <= 20; tileX++) {
+            CHECK(wasWritten(written, count, tileX, tileY));
+            checkSlot(tiles[tileY * CANVAS_TILES_X + tileX], tileX % ATLAS_SLOTS, tileY % ATLAS_SLOTS, "scrolled");
+        }
+    }
+    
+    // After clearAtlasSlots everything is written again
+    clearAtlasSlots(slotTile);
+    CHECK(updateAtlasSlots(slotTile, atlas, tiles, NULL, dirty, 15, 2, 20, 6, written) == 30);
+}
+
+int main(void) {
+    testLayout();
+    testBlock();
+    testTileConversion();
+    testMaskTile();
+    testSlotBookkeeping();
+#ifdef MASK_TILE_MORTON
+    return testResult("test_swizzle (Morton tiles)");
+#else
+    return testResult("test_swizzle");
+#endif
+}